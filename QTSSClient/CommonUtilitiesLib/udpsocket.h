@@ -43,6 +43,7 @@
 
 #include "Socket.h"
 #include "UDPDemuxer.h"
+#include "StrPtrLen.h"
 
 
 class   UDPSocket : public Socket
@@ -74,6 +75,19 @@ class   UDPSocket : public Socket
         OS_Error        RecvFrom(UInt32* outRemoteAddr, UInt16* outRemotePort,
                                         void* ioBuffer, UInt32 inBufLen, UInt32* outRecvLen);
         
+        //Reads up to inNumPackets datagrams, with one recvmmsg call where the platform has
+        //it and one recvfrom per datagram elsewhere. Each ioPackets[x].Ptr must point at
+        //inBufLen bytes. On return, the first *outNumPackets entries of ioPackets,
+        //outRemoteAddrs and outRemotePorts describe what was read. Fewer than inNumPackets
+        //means the socket is drained. Returns an ERRNO only if nothing could be read.
+        OS_Error        RecvMultipleFrom(UInt32* outRemoteAddrs, UInt16* outRemotePorts,
+                                        StrPtrLen* ioPackets, UInt32 inBufLen, UInt32 inNumPackets, UInt32* outNumPackets);
+        
+        enum
+        {
+            kMaxRecvMultiplePackets = 64 //UInt32
+        };
+        
         //A UDP socket may or may not have a demuxer associated with it. The demuxer
         //is a data structure so the socket can associate incoming data with the proper
         //task to process that data (based on source IP addr & port)
@@ -0,0 +1,444 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1999-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ *
+ */
+/*
+    File:       ClientJitterBuffer.cpp
+
+    Contains:   Implementation of ClientJitterBuffer
+                    
+*/
+
+#include <string.h>
+#include "ClientJitterBuffer.h"
+#include "OSMemory.h"
+#include "MyAssert.h"
+#include "SafeStdLib.h"
+
+#define CLIENT_JITTER_BUFFER_DEBUG 0
+
+static const UInt32 kInitialFrameBufferSize = 65536;
+static const UInt8  sStartCode[] = { 0, 0, 0, 1 };
+
+ClientJitterBuffer::ClientJitterBuffer(UInt32 inClockRate, FrameMode inMode, UInt32 inMinDelayMsec, UInt32 inMaxDelayMsec)
+:   fClockRate(inClockRate),
+    fMode(inMode),
+    fMinDelayMsec(inMinDelayMsec),
+    fMaxDelayMsec(inMaxDelayMsec),
+    fPacketMemory(NULL),
+    fHaveFirstPacket(false),
+    fNextSeqNum(0),
+    fHighestSeqNum(0),
+    fNumBufferedPackets(0),
+    fLastTimeStamp(0),
+    fExtTimeStamp(0),
+    fLastTransitMsec(0),
+    fHaveTransit(false),
+    fMinTransitMsec(0),
+    fWindowMinTransitMsec(0),
+    fWindowStartMsec(0),
+    fJitterMsec(0),
+    fTargetDelayMsec(inMinDelayMsec),
+    fFrameBuffer(NULL),
+    fFrameBufferSize(kInitialFrameBufferSize),
+    fPendingLostPackets(0),
+    fTotalLostPackets(0),
+    fNumLatePackets(0),
+    fNumDuplicates(0),
+    fNumFrames(0)
+{
+    if (fMaxDelayMsec < fMinDelayMsec)
+        fMaxDelayMsec = fMinDelayMsec;
+        
+    fPacketMemory = NEW UInt8[kRingSize * kMaxPacketSize];
+    for (UInt32 x = 0; x < kRingSize; x++)
+    {
+        fSlots[x].fPayload = &fPacketMemory[x * kMaxPacketSize];
+        fSlots[x].fLen = 0;
+        fSlots[x].fTimeStamp = 0;
+        fSlots[x].fTimeMsec = 0;
+        fSlots[x].fSeqNum = 0;
+        fSlots[x].fFull = false;
+        fSlots[x].fMarker = false;
+    }
+    
+    fFrameBuffer = NEW char[fFrameBufferSize];
+    ::memset(&fFrame, 0, sizeof(fFrame));
+}
+
+ClientJitterBuffer::~ClientJitterBuffer()
+{
+    delete [] fPacketMemory;
+    delete [] fFrameBuffer;
+}
+
+void ClientJitterBuffer::AddPacket(char* inPacket, UInt32 inLength, SInt64 inArrivalMsec)
+{
+    UInt8* thePacket = (UInt8*)inPacket;
+    if ((inLength < 12) || ((thePacket[0] & 0xC0) != 0x80))
+        return;
+    
+    //
+    // Find the payload, past any CSRCs and header extension, and less any padding
+    UInt32 theHeaderLen = 12 + ((thePacket[0] & 0x0F) * 4);
+    if (thePacket[0] & 0x10)
+    {
+        if (inLength < theHeaderLen + 4)
+            return;
+        theHeaderLen += 4 + ((((UInt32)thePacket[theHeaderLen + 2] << 8) | thePacket[theHeaderLen + 3]) * 4);
+    }
+    if (theHeaderLen > inLength)
+        return;
+        
+    UInt32 thePayloadLen = inLength - theHeaderLen;
+    if ((thePacket[0] & 0x20) && (thePayloadLen > 0))
+    {
+        UInt32 thePadding = thePacket[inLength - 1];
+        if (thePadding > thePayloadLen)
+            return;
+        thePayloadLen -= thePadding;
+    }
+    if (thePayloadLen > kMaxPacketSize)
+        return;
+        
+    UInt16 theSeqNum = (UInt16)((thePacket[2] << 8) | thePacket[3]);
+    UInt32 theTimeStamp = ((UInt32)thePacket[4] << 24) | ((UInt32)thePacket[5] << 16) | ((UInt32)thePacket[6] << 8) | thePacket[7];
+    
+    if (!fHaveFirstPacket)
+    {
+        fHaveFirstPacket = true;
+        fNextSeqNum = fHighestSeqNum = theSeqNum;
+        fLastTimeStamp = theTimeStamp;
+        fExtTimeStamp = theTimeStamp;
+    }
+    
+    SInt16 theOffset = (SInt16)(theSeqNum - fNextSeqNum);
+    if ((theOffset < 0) && (theOffset > -(SInt16)kRingSize))
+    {
+        //
+        // Already handed out, or given up on. If it was given up on, we aren't
+        // waiting long enough.
+        fNumLatePackets++;
+        fTargetDelayMsec += kLatePacketStepMsec;
+        if (fTargetDelayMsec > fMaxDelayMsec)
+            fTargetDelayMsec = fMaxDelayMsec;
+        return;
+    }
+    if ((theOffset < 0) || (theOffset >= (SInt16)kRingSize))
+    {
+        //
+        // Way out of the window. Either a long burst was lost or the sender
+        // started over. Start over here too.
+#if CLIENT_JITTER_BUFFER_DEBUG
+        qtss_printf("ClientJitterBuffer: seq num jumped from %u to %u\n", fNextSeqNum, theSeqNum);
+#endif
+        this->Flush();
+        fNextSeqNum = fHighestSeqNum = theSeqNum;
+    }
+    
+    Slot* theSlot = this->GetSlot(theSeqNum);
+    if (theSlot->fFull)
+    {
+        Assert(theSlot->fSeqNum == theSeqNum);
+        fNumDuplicates++;
+        return;
+    }
+    
+    ::memcpy(theSlot->fPayload, &thePacket[theHeaderLen], thePayloadLen);
+    theSlot->fLen = thePayloadLen;
+    theSlot->fTimeStamp = theTimeStamp;
+    theSlot->fSeqNum = theSeqNum;
+    theSlot->fMarker = (thePacket[1] & 0x80) != 0;
+    theSlot->fFull = true;
+    fNumBufferedPackets++;
+    
+    if ((SInt16)(theSeqNum - fHighestSeqNum) > 0)
+        fHighestSeqNum = theSeqNum;
+        
+    this->UpdateJitter(theTimeStamp, inArrivalMsec, theSlot);
+}
+
+void ClientJitterBuffer::UpdateJitter(UInt32 inTimeStamp, SInt64 inArrivalMsec, Slot* ioSlot)
+{
+    //
+    // Without a clock rate there is nothing to measure transit against, so
+    // every packet plays out a fixed fMinDelayMsec after it arrives.
+    if (fClockRate == 0)
+    {
+        ioSlot->fTimeMsec = inArrivalMsec;
+        return;
+    }
+    
+    fExtTimeStamp += (SInt32)(inTimeStamp - fLastTimeStamp);
+    fLastTimeStamp = inTimeStamp;
+    ioSlot->fTimeMsec = (fExtTimeStamp * 1000) / fClockRate;
+    
+    SInt64 theTransitMsec = inArrivalMsec - ioSlot->fTimeMsec;
+    if (!fHaveTransit)
+    {
+        fHaveTransit = true;
+        fMinTransitMsec = fWindowMinTransitMsec = theTransitMsec;
+        fWindowStartMsec = inArrivalMsec;
+    }
+    else
+    {
+        SInt64 theDifference = theTransitMsec - fLastTransitMsec;
+        if (theDifference < 0)
+            theDifference = -theDifference;
+        fJitterMsec += ((Float32)theDifference - fJitterMsec) / 16;
+        
+        //
+        // Playout is timed from the quickest a packet got here lately. The minimum is
+        // only remembered for kTransitWindowMsec, so the two clocks can drift apart.
+        if (theTransitMsec < fWindowMinTransitMsec)
+            fWindowMinTransitMsec = theTransitMsec;
+        if (theTransitMsec < fMinTransitMsec)
+            fMinTransitMsec = theTransitMsec;
+        if (inArrivalMsec - fWindowStartMsec >= kTransitWindowMsec)
+        {
+            fMinTransitMsec = fWindowMinTransitMsec;
+            fWindowMinTransitMsec = theTransitMsec;
+            fWindowStartMsec = inArrivalMsec;
+        }
+    }
+    fLastTransitMsec = theTransitMsec;
+    
+    //
+    // Grow the delay right away, shrink it slowly as frames go out (see GetNextFrame)
+    UInt32 theTargetDelayMsec = (UInt32)(fJitterMsec * kJitterMultiplier);
+    if (theTargetDelayMsec > fMaxDelayMsec)
+        theTargetDelayMsec = fMaxDelayMsec;
+    if (theTargetDelayMsec > fTargetDelayMsec)
+        fTargetDelayMsec = theTargetDelayMsec;
+}
+
+ClientJitterBuffer::Frame* ClientJitterBuffer::GetNextFrame(SInt64 inCurrentMsec)
+{
+    while (fNumBufferedPackets > 0)
+    {
+        Slot* theHead = this->GetSlot(fNextSeqNum);
+        if (!theHead->fFull)
+        {
+            //
+            // Give up on a missing packet once whatever follows it is due
+            UInt16 theSeqNum = fNextSeqNum + 1;
+            while (!this->GetSlot(theSeqNum)->fFull)
+                theSeqNum++;
+            if (this->GetPlayoutMsec(this->GetSlot(theSeqNum)) > inCurrentMsec)
+                return NULL;
+            
+            UInt16 theNumLost = theSeqNum - fNextSeqNum;
+            fPendingLostPackets += theNumLost;
+            fTotalLostPackets += theNumLost;
+            fNextSeqNum = theSeqNum;
+            continue;
+        }
+        
+        if (this->GetPlayoutMsec(theHead) > inCurrentMsec)
+            return NULL;
+            
+        UInt32 theNumPackets = this->GetFrameLength();
+        if (theNumPackets == 0)
+        {
+            //
+            // Part of this frame is missing. Wait for it as long as the next frame
+            // isn't due, then drop what we have. The decoder is told about the hole.
+            UInt16 theSeqNum = fNextSeqNum + 1;
+            for ( ; (SInt16)(theSeqNum - fHighestSeqNum) <= 0; theSeqNum++)
+            {
+                Slot* theSlot = this->GetSlot(theSeqNum);
+                if (theSlot->fFull && (theSlot->fTimeStamp != theHead->fTimeStamp))
+                    break;
+            }
+            if (((SInt16)(theSeqNum - fHighestSeqNum) > 0) || (this->GetPlayoutMsec(this->GetSlot(theSeqNum)) > inCurrentMsec))
+                return NULL;
+                
+            for ( ; fNextSeqNum != theSeqNum; fNextSeqNum++)
+            {
+                Slot* theSlot = this->GetSlot(fNextSeqNum);
+                if (theSlot->fFull)
+                {
+                    theSlot->fFull = false;
+                    fNumBufferedPackets--;
+                }
+                fPendingLostPackets++;
+                fTotalLostPackets++;
+            }
+            continue;
+        }
+        
+        this->AssembleFrame(theNumPackets);
+        fFrame.fTimeStamp = theHead->fTimeStamp;
+        for (UInt32 x = 0; x < theNumPackets; x++, fNextSeqNum++)
+            this->GetSlot(fNextSeqNum)->fFull = false;
+        fNumBufferedPackets -= theNumPackets;
+        
+        if (fTargetDelayMsec > fMinDelayMsec)
+        {
+            UInt32 theTargetDelayMsec = (UInt32)(fJitterMsec * kJitterMultiplier);
+            if (theTargetDelayMsec < fTargetDelayMsec)
+                fTargetDelayMsec--;
+        }
+        
+        if (fFrame.fLen == 0)
+            continue; // nothing in it we know how to depacketize
+            
+        fFrame.fNumLostPackets = fPendingLostPackets;
+        fPendingLostPackets = 0;
+        fNumFrames++;
+        return &fFrame;
+    }
+    return NULL;
+}
+
+SInt64 ClientJitterBuffer::GetNextPlayoutMsec()
+{
+    if (fNumBufferedPackets == 0)
+        return -1;
+        
+    UInt16 theSeqNum = fNextSeqNum;
+    while (!this->GetSlot(theSeqNum)->fFull)
+        theSeqNum++;
+    return this->GetPlayoutMsec(this->GetSlot(theSeqNum));
+}
+
+UInt32 ClientJitterBuffer::GetFrameLength()
+{
+    Slot* theHead = this->GetSlot(fNextSeqNum);
+    Assert(theHead->fFull);
+    if (fMode == kOnePacketPerFrame)
+        return 1;
+        
+    for (UInt32 x = 0; x < kRingSize; x++)
+    {
+        Slot* theSlot = this->GetSlot(fNextSeqNum + x);
+        if (!theSlot->fFull)
+            return 0;
+        if (theSlot->fTimeStamp != theHead->fTimeStamp)
+            return x; // the sender doesn't set the marker bit
+        if (theSlot->fMarker)
+            return x + 1;
+    }
+    return 0;
+}
+
+void ClientJitterBuffer::Flush()
+{
+    for (UInt32 x = 0; x < kRingSize; x++)
+    {
+        if (fSlots[x].fFull)
+        {
+            fSlots[x].fFull = false;
+            fPendingLostPackets++;
+            fTotalLostPackets++;
+        }
+    }
+    fNumBufferedPackets = 0;
+}
+
+void ClientJitterBuffer::AssembleFrame(UInt32 inNumPackets)
+{
+    fFrame.fLen = 0;
+    for (UInt32 x = 0; x < inNumPackets; x++)
+    {
+        Slot* theSlot = this->GetSlot(fNextSeqNum + x);
+        UInt8* thePayload = theSlot->fPayload;
+        UInt32 theLen = theSlot->fLen;
+        
+        if (fMode != kH264Frames)
+        {
+            this->AppendNALUnit(NULL, 0, thePayload, theLen, false);
+            continue;
+        }
+        if (theLen == 0)
+            continue;
+            
+        UInt8 theNALType = thePayload[0] & 0x1F;
+        if ((theNALType >= 1) && (theNALType <= 23))
+        {
+            this->AppendNALUnit(NULL, 0, thePayload, theLen, true);
+        }
+        else if (theNALType == 24)
+        {
+            //
+            // STAP-A. 16 bit size, then NAL unit, until the packet runs out.
+            thePayload++;
+            theLen--;
+            while (theLen >= 2)
+            {
+                UInt32 theNALLen = ((UInt32)thePayload[0] << 8) | thePayload[1];
+                thePayload += 2;
+                theLen -= 2;
+                if (theNALLen > theLen)
+                    break;
+                this->AppendNALUnit(NULL, 0, thePayload, theNALLen, true);
+                thePayload += theNALLen;
+                theLen -= theNALLen;
+            }
+        }
+        else if ((theNALType == 28) && (theLen >= 2))
+        {
+            //
+            // FU-A. The NAL header is rebuilt from the FU indicator and FU header
+            // when the start bit is set. The other fragments just carry on from there.
+            if (thePayload[1] & 0x80)
+            {
+                UInt8 theNALHeader = (thePayload[0] & 0xE0) | (thePayload[1] & 0x1F);
+                this->AppendNALUnit(&theNALHeader, 1, &thePayload[2], theLen - 2, true);
+            }
+            else
+                this->AppendNALUnit(NULL, 0, &thePayload[2], theLen - 2, false);
+        }
+        // STAP-B, MTAP and FU-B only occur in interleaved mode, which we never ask for
+    }
+}
+
+void ClientJitterBuffer::AppendNALUnit(UInt8* inHeader, UInt32 inHeaderLen, UInt8* inData, UInt32 inLen, Bool16 inStartCode)
+{
+    UInt32 theNeeded = fFrame.fLen + inHeaderLen + inLen + (inStartCode ? sizeof(sStartCode) : 0);
+    if (theNeeded > fFrameBufferSize)
+    {
+        UInt32 theNewSize = fFrameBufferSize * 2;
+        while (theNewSize < theNeeded)
+            theNewSize *= 2;
+        char* theNewBuffer = NEW char[theNewSize];
+        ::memcpy(theNewBuffer, fFrameBuffer, fFrame.fLen);
+        delete [] fFrameBuffer;
+        fFrameBuffer = theNewBuffer;
+        fFrameBufferSize = theNewSize;
+    }
+    fFrame.fData = fFrameBuffer;
+    
+    if (inStartCode)
+    {
+        ::memcpy(&fFrameBuffer[fFrame.fLen], sStartCode, sizeof(sStartCode));
+        fFrame.fLen += sizeof(sStartCode);
+    }
+    if (inHeaderLen > 0)
+    {
+        ::memcpy(&fFrameBuffer[fFrame.fLen], inHeader, inHeaderLen);
+        fFrame.fLen += inHeaderLen;
+    }
+    ::memcpy(&fFrameBuffer[fFrame.fLen], inData, inLen);
+    fFrame.fLen += inLen;
+}
@@ -0,0 +1,161 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1999-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ *
+ */
+/*
+    File:       ClientJitterBuffer.h
+
+    Contains:   Reorders the RTP packets of one track by sequence number and hands
+                them back as whole access units, each in one contiguous buffer.
+                Packets sit in a fixed ring indexed by sequence number. A frame is
+                released once all its packets are in and its playout time has come.
+                Playout time is the packet's RTP time plus the smallest transit
+                delay seen lately plus a target delay that follows the measured
+                interarrival jitter. Missing packets are given up on when the data
+                after them is due, and the next frame says how many were lost.
+                
+                H.264 payloads (RFC 3984) are depacketized into Annex B byte stream.
+                Single NAL unit, STAP-A and FU-A packets are understood.
+*/
+
+#ifndef __CLIENT_JITTER_BUFFER__
+#define __CLIENT_JITTER_BUFFER__
+
+#include "OSHeaders.h"
+
+class ClientJitterBuffer
+{
+    public:
+    
+        enum
+        {
+            kRingSize               = 512,  //UInt32 packets. Must be a power of 2.
+            kMaxPacketSize          = 2048, //UInt32
+            kDefaultMinDelayMsec    = 20,   //UInt32
+            kDefaultMaxDelayMsec    = 500,  //UInt32
+            kJitterMultiplier       = 4,    //UInt32 target delay is this many times the jitter
+            kLatePacketStepMsec     = 10,   //UInt32 target delay grows this much when a packet comes too late
+            kTransitWindowMsec      = 10000 //UInt32 how long the smallest transit delay is remembered
+        };
+        
+        enum
+        {
+            kOnePacketPerFrame      = 0,    // audio. Every packet is a frame.
+            kMarkerBitFrames        = 1,    // a frame ends at the marker bit, or when the timestamp changes
+            kH264Frames             = 2     // same as above, and the payload is depacketized
+        };
+        typedef UInt32 FrameMode;
+        
+        struct Frame
+        {
+            char*   fData;
+            UInt32  fLen;
+            UInt32  fTimeStamp;         // RTP timestamp
+            UInt32  fNumLostPackets;    // lost since the last frame handed out. Non-zero means
+                                        // there is a hole the decoder should conceal.
+        };
+        
+        // inClockRate may be 0 if it isn't known. Then frames play out
+        // inMinDelayMsec .. inMaxDelayMsec after they arrive instead.
+        ClientJitterBuffer(UInt32 inClockRate, FrameMode inMode,
+                            UInt32 inMinDelayMsec = kDefaultMinDelayMsec, UInt32 inMaxDelayMsec = kDefaultMaxDelayMsec);
+        ~ClientJitterBuffer();
+        
+        // The RTP header is parsed here. Packets that aren't RTP are ignored.
+        void        AddPacket(char* inPacket, UInt32 inLength, SInt64 inArrivalMsec);
+        
+        // Returns the next frame if it is due, otherwise NULL. Call until it returns NULL.
+        // The frame is valid until the next call to GetNextFrame.
+        Frame*      GetNextFrame(SInt64 inCurrentMsec);
+        
+        // Time at which GetNextFrame may have something new, or -1 if the buffer is empty
+        SInt64      GetNextPlayoutMsec();
+        
+        UInt32      GetJitterMsec()         { return (UInt32)fJitterMsec; }
+        UInt32      GetTargetDelayMsec()    { return fTargetDelayMsec; }
+        UInt32      GetNumBufferedPackets() { return fNumBufferedPackets; }
+        UInt32      GetNumLostPackets()     { return fTotalLostPackets; }
+        UInt32      GetNumLatePackets()     { return fNumLatePackets; }
+        UInt32      GetNumDuplicates()      { return fNumDuplicates; }
+        UInt32      GetNumFrames()          { return fNumFrames; }
+    
+    private:
+    
+        struct Slot
+        {
+            UInt8*  fPayload;       // kMaxPacketSize, in fPacketMemory
+            UInt32  fLen;
+            UInt32  fTimeStamp;
+            SInt64  fTimeMsec;      // unwrapped RTP time in msec, or arrival time without a clock rate
+            UInt16  fSeqNum;
+            Bool16  fFull;
+            Bool16  fMarker;
+        };
+        
+        Slot*       GetSlot(UInt16 inSeqNum) { return &fSlots[inSeqNum & (kRingSize - 1)]; }
+        SInt64      GetPlayoutMsec(Slot* inSlot) { return inSlot->fTimeMsec + fMinTransitMsec + fTargetDelayMsec; }
+        
+        void        UpdateJitter(UInt32 inTimeStamp, SInt64 inArrivalMsec, Slot* ioSlot);
+        void        ReleaseSlot(UInt16 inSeqNum, Bool16 isLost);
+        void        Flush();
+        
+        // How many packets from fNextSeqNum make up the next frame, or 0 if it isn't all here yet
+        UInt32      GetFrameLength();
+        void        AssembleFrame(UInt32 inNumPackets);
+        void        AppendNALUnit(UInt8* inHeader, UInt32 inHeaderLen, UInt8* inData, UInt32 inLen, Bool16 inStartCode);
+        
+        UInt32      fClockRate;
+        FrameMode   fMode;
+        UInt32      fMinDelayMsec;
+        UInt32      fMaxDelayMsec;
+        
+        Slot        fSlots[kRingSize];
+        UInt8*      fPacketMemory;
+        
+        Bool16      fHaveFirstPacket;
+        UInt16      fNextSeqNum;        // oldest packet not yet handed out or given up on
+        UInt16      fHighestSeqNum;
+        UInt32      fNumBufferedPackets;
+        
+        UInt32      fLastTimeStamp;
+        SInt64      fExtTimeStamp;      // fLastTimeStamp unwrapped
+        SInt64      fLastTransitMsec;
+        Bool16      fHaveTransit;
+        SInt64      fMinTransitMsec;
+        SInt64      fWindowMinTransitMsec;
+        SInt64      fWindowStartMsec;
+        Float32     fJitterMsec;        // RFC 3550 interarrival jitter
+        UInt32      fTargetDelayMsec;
+        
+        char*       fFrameBuffer;
+        UInt32      fFrameBufferSize;
+        Frame       fFrame;
+        UInt32      fPendingLostPackets;
+        
+        UInt32      fTotalLostPackets;
+        UInt32      fNumLatePackets;
+        UInt32      fNumDuplicates;
+        UInt32      fNumFrames;
+};
+
+#endif //__CLIENT_JITTER_BUFFER__
@@ -33,6 +33,7 @@
 
 #include "ClientSessionEx.h"
 #include "OSMemory.h"
+#include "StringParser.h"
 #include <stdlib.h>
 #include "SafeStdLib.h"
 #define CLIENT_SESSION_DEBUG 0
@@ -99,6 +100,7 @@ ClientSessionEx::ClientSessionEx(   UInt32 inAddr, UInt16 inPort, char* inURL,
     fDeathReason(kDiedNormally),
     fNumSetups(0),
     fUDPSocketArray(NULL),
+    fPacketArena(NULL),
     
     fPlayTime(0),
     fTotalPlayTime(0),
@@ -201,6 +203,7 @@ ClientSessionEx::ClientSessionEx()
 	fDeathReason(kDiedNormally),
 	fNumSetups(0),
 	fUDPSocketArray(NULL),
+	fPacketArena(NULL),
 	fPlayTime(0),
 	fTotalPlayTime(0),
 	fLastRTCPTime(0),
@@ -214,8 +217,13 @@ ClientSessionEx::ClientSessionEx()
 	fOverbufferWindowSizeInK(5120),
 	fCurRTCPTrack(0),
 	fNumPacketsReceived(0),
+	fJitterBuffers(NULL),
+	fJitterTrackMask(0),
+	fJitterMinDelayMsec(ClientJitterBuffer::kDefaultMinDelayMsec),
+	fJitterMaxDelayMsec(ClientJitterBuffer::kDefaultMaxDelayMsec),
 	fDataCallBackFuncEx(NULL),//fym
-	fUserData(0)//fym
+	fUserData(0),//fym
+	fFrameCallBackFuncEx(NULL)
 {
 	this->SetTaskName("RTSPClientLib:ClientSessionEx");
 }
@@ -317,6 +325,14 @@ ClientSessionEx::~ClientSessionEx()
     }
             
     delete [] fUDPSocketArray;
+    delete [] fPacketArena;
+
+    if (fJitterBuffers != NULL)
+    {
+        for (UInt32 y = 0; y < fSDPParser.GetNumStreams(); y++)
+            delete fJitterBuffers[y];
+    }
+    delete [] fJitterBuffers;
 
 	if(NULL != fClient)
 		delete fClient;
@@ -459,6 +475,8 @@ SInt64 ClientSessionEx::Run()
                         // Setup client stats
                         fStats = NEW TrackStats[fSDPParser.GetNumStreams()];
                         ::memset(fStats, 0, sizeof(TrackStats) * fSDPParser.GetNumStreams());
+                        
+                        this->SetupJitterBuffers();
                     }
                     fState = kSendingSetup;
                 }
@@ -550,6 +568,15 @@ SInt64 ClientSessionEx::Run()
                 if(1)//fym  fCurRTCPTrack == fSDPParser.GetNumStreams())
                     theErr = this->ReadMediaData();
 
+                //
+                // Frames that were waiting on their playout time, or on a lost packet
+                if (fJitterBuffers != NULL)
+                {
+                    SInt64 theCurrentMsec = OS::Milliseconds();
+                    for (UInt32 x = 0; x < fSDPParser.GetNumStreams(); x++)
+                        this->DeliverFrames(x, theCurrentMsec);
+                }
+
                 //
                 // If we've encountered some fatal error, bail.
                 if ((theErr != EINPROGRESS) && (theErr != EAGAIN) && (theErr != OS_NoErr))
@@ -557,7 +584,11 @@ SInt64 ClientSessionEx::Run()
                     sPlayingConnections--;
                     break;
                 }
-                theErr = OS_NoErr; // Ignore flow control errors here.
+                //
+                // Everything that was readable has been read. Wait for the event thread
+                // to say there is more, rather than going round and polling again.
+                if (theErr == EINPROGRESS)
+                    theErr = EAGAIN;
                     
 #if 0//fym
 				//
@@ -622,9 +653,13 @@ SInt64 ClientSessionEx::Run()
     if ((theErr == EINPROGRESS) || (theErr == EAGAIN))
     {
         //
-        // Request an async event
-        fSocket->GetSocket()->SetTask(this);
-        fSocket->GetSocket()->RequestEvent(fSocket->GetEventMask());
+        // Request an async event. While playing over UDP, ReadMediaData
+        // has already asked for events on the sockets the media comes in on.
+        if ((fState != kPlaying) || (fTransportType == kTCPTransportType))
+        {
+            fSocket->GetSocket()->SetTask(this);
+            fSocket->GetSocket()->RequestEvent(fSocket->GetEventMask());
+        }
     }
     else if (theErr != OS_NoErr)
     {
@@ -647,6 +682,26 @@ SInt64 ClientSessionEx::Run()
         qtss_printf("Client connection complete. Death reason = %ul\n", fDeathReason);
 #endif              
 
+    //
+    // If frames are waiting to play out, come back when the first one is due
+    // even if no more data arrives before then
+    if ((fState == kPlaying) && (fJitterBuffers != NULL))
+    {
+        SInt64 theNextPlayoutMsec = -1;
+        for (UInt32 x = 0; x < fSDPParser.GetNumStreams(); x++)
+        {
+            if (fJitterBuffers[x] == NULL)
+                continue;
+            SInt64 thePlayoutMsec = fJitterBuffers[x]->GetNextPlayoutMsec();
+            if ((thePlayoutMsec != -1) && ((theNextPlayoutMsec == -1) || (thePlayoutMsec < theNextPlayoutMsec)))
+                theNextPlayoutMsec = thePlayoutMsec;
+        }
+        if (theNextPlayoutMsec != -1)
+        {
+            SInt64 theTimeout = theNextPlayoutMsec - OS::Milliseconds();
+            return (theTimeout > 0) ? theTimeout : 1;
+        }
+    }
     return 0;
 }
 
@@ -661,12 +716,18 @@ void    ClientSessionEx::SetupUDPSockets()
 
     OS_Error theErr = OS_NoErr;
     
+    //
+    // One arena for everything read off the sockets
+    fPacketArena = NEW char[kRecvBatchSize * kMaxUDPPacketSize];
+    for (UInt32 z = 0; z < kRecvBatchSize; z++)
+        fRecvPackets[z].Set(&fPacketArena[z * kMaxUDPPacketSize], 0);
+    
     //
     // Create a UDP socket pair (RTP, RTCP) for each stream
-    fUDPSocketArray = NEW UDPSocket*[fSDPParser.GetNumStreams() * 2];
+    fUDPSocketArray = NEW ClientUDPSocket*[fSDPParser.GetNumStreams() * 2];
     for (UInt32 x = 0; x < fSDPParser.GetNumStreams() * 2; x++)
     {
-        fUDPSocketArray[x] = NEW UDPSocket(this, Socket::kNonBlockingSocketType);
+        fUDPSocketArray[x] = NEW ClientUDPSocket(this);
         theErr = fUDPSocketArray[x]->Open();
         if (theErr != OS_NoErr)
         {
@@ -712,72 +773,79 @@ void    ClientSessionEx::SetupUDPSockets()
 
 OS_Error    ClientSessionEx::ReadMediaData()
 {
-    // For iterating over the array of UDP sockets
-    UInt32 theUDPSockIndex = 0;
     OS_Error theErr = OS_NoErr;
     
-    while (true)
+    //
+    // If the media data is being interleaved, get it from the control connection
+    if (fTransportType == kTCPTransportType)
     {
-        //
-        // If the media data is being interleaved, get it from the control connection
-        UInt32 theTrackID = 0;
-        UInt32 theLength = 0;
-        Bool16 isRTCP = false;
-        char* thePacket = NULL;
-
-        if (fTransportType == kTCPTransportType)
+        while (true)
         {
-            thePacket = NULL;
+            UInt32 theTrackID = 0;
+            UInt32 theLength = 0;
+            Bool16 isRTCP = false;
+            char* thePacket = NULL;
+
             theErr = fClient->GetMediaPacket(&theTrackID, &isRTCP, &thePacket, &theLength);
             if (thePacket == NULL)
                 break;
-        }
-        else
-        {
-            static const UInt32 kMaxPacketSize = 2048;
-            
-            UInt32 theRemoteAddr = 0;
-            UInt16 theRemotePort = 0;
-            char thePacketBuf[kMaxPacketSize];
-            
-            // Get a packet from one of the UDP sockets.
-            theErr = fUDPSocketArray[theUDPSockIndex]->RecvFrom(&theRemoteAddr, &theRemotePort,
-                                                                &thePacketBuf[0], kMaxPacketSize,
-                                                                &theLength);
-            if ((theErr != OS_NoErr) || (theLength == 0))
-            {
-                if ((fTransportType == kReliableUDPTransportType) &&
-                    (!(theUDPSockIndex & 1)))
-                {
-                    for (UInt32 trackCount = 0; trackCount < fSDPParser.GetNumStreams(); trackCount++)
-                    {
-                        if (fSDPParser.GetStreamInfo(trackCount)->fTrackID == fSDPParser.GetStreamInfo(theUDPSockIndex >> 1)->fTrackID)
-                        {
-                            if (fStats[trackCount].fHighestSeqNumValid)
-                                // If we are supposed to be sending acks, and we just finished
-                                // receiving all packets for this track that are available at this time,
-                                // send an ACK packet
-                                this->AckPackets(trackCount, 0, false);
-                        }
-                    }
-                }
                 
-                theUDPSockIndex++;
-                if (theUDPSockIndex == fSDPParser.GetNumStreams() * 2)
-                    break;
-                continue;
-            }
-            
-            theTrackID = fSDPParser.GetStreamInfo(theUDPSockIndex >> 1)->fTrackID;
-            isRTCP = (theUDPSockIndex & 1);
-            thePacket = &thePacketBuf[0];
+            //
+            // We have a valid packet. Invoke the packet handler function
+            this->ProcessMediaPacket(thePacket, theLength, theTrackID, isRTCP);
         }
+        return theErr;
+    }
+    
+    //
+    // Read whole batches from each socket the event thread has said is readable,
+    // until it runs dry. Sockets that haven't had an event aren't touched.
+    for (UInt32 theUDPSockIndex = 0; theUDPSockIndex < fSDPParser.GetNumStreams() * 2; theUDPSockIndex++)
+    {
+        ClientUDPSocket* theSocket = fUDPSocketArray[theUDPSockIndex];
+        if (!theSocket->IsReadable())
+            continue;
+            
+        UInt32 theTrackIndex = theUDPSockIndex >> 1;
+        Bool16 isRTCP = (theUDPSockIndex & 1);
+        UInt32 theNumPackets = 0;
+        do
+        {
+            theErr = theSocket->RecvMultipleFrom(fRecvAddrs, fRecvPorts, fRecvPackets, kMaxUDPPacketSize, kRecvBatchSize, &theNumPackets);
+            if (theNumPackets > 0)
+                this->ProcessMediaPackets(fRecvPackets, theNumPackets, theTrackIndex, isRTCP);
+        } while ((theErr == OS_NoErr) && (theNumPackets == kRecvBatchSize));
         
-        //
-        // We have a valid packet. Invoke the packet handler function
-        this->ProcessMediaPacket(thePacket, theLength, theTrackID, isRTCP);
+        theSocket->WaitForData();
+        
+        // If we are supposed to be sending acks, and we just finished
+        // receiving all packets for this track that are available at this time,
+        // send an ACK packet
+        if ((fTransportType == kReliableUDPTransportType) && !isRTCP && fStats[theTrackIndex].fHighestSeqNumValid)
+            this->AckPackets(theTrackIndex, 0, false);
+    }
+    return EAGAIN;
+}
+
+void    ClientSessionEx::ProcessMediaPackets(StrPtrLen* inPackets, UInt32 inNumPackets, UInt32 inTrackIndex, Bool16 isRTCP)
+{
+    //
+    // A jitter buffer takes the whole batch before any frames are looked for
+    if (!isRTCP && (fJitterBuffers != NULL) && (fJitterBuffers[inTrackIndex] != NULL))
+    {
+        SInt64 theCurrentMsec = OS::Milliseconds();
+        for (UInt32 x = 0; x < inNumPackets; x++)
+            fJitterBuffers[inTrackIndex]->AddPacket(inPackets[x].Ptr, inPackets[x].Len, theCurrentMsec);
+        this->DeliverFrames(inTrackIndex, theCurrentMsec);
+        return;
+    }
+    
+    UInt32 theTrackID = fSDPParser.GetStreamInfo(inTrackIndex)->fTrackID;
+    for (UInt32 y = 0; y < inNumPackets; y++)
+    {
+        if (inPackets[y].Len > 4)
+            this->ProcessMediaPacket(inPackets[y].Ptr, inPackets[y].Len, theTrackID, isRTCP);
     }
-    return theErr;
 }
 
 void    ClientSessionEx::ProcessMediaPacket(  char* inPacket, UInt32 inLength,
@@ -785,6 +853,20 @@ void    ClientSessionEx::ProcessMediaPacket(  char* inPacket, UInt32 inLength,
 {
     Assert(inLength > 4);
 
+    if (!isRTCP && (fJitterBuffers != NULL))
+    {
+        for (UInt32 x = 0; x < fSDPParser.GetNumStreams(); x++)
+        {
+            if ((fSDPParser.GetStreamInfo(x)->fTrackID == inTrackID) && (fJitterBuffers[x] != NULL))
+            {
+                SInt64 theCurrentMsec = OS::Milliseconds();
+                fJitterBuffers[x]->AddPacket(inPacket, inLength, theCurrentMsec);
+                this->DeliverFrames(x, theCurrentMsec);
+                return;
+            }
+        }
+    }
+
 	//fym
 	if(NULL != fDataCallBackFuncEx || 12 >= inLength)
 	{
@@ -931,6 +1013,60 @@ void    ClientSessionEx::ProcessMediaPacket(  char* inPacket, UInt32 inLength,
   //  Assert(theSeqNum == 0); // We should always find a track with this track ID
 }
 
+void ClientSessionEx::SetupJitterBuffers()
+{
+    if (fJitterTrackMask == 0)
+        return;
+        
+    fJitterBuffers = NEW ClientJitterBuffer*[fSDPParser.GetNumStreams()];
+    for (UInt32 x = 0; x < fSDPParser.GetNumStreams(); x++)
+    {
+        fJitterBuffers[x] = NULL;
+        if ((x >= 32) || !(fJitterTrackMask & (1 << x)))
+            continue;
+            
+        SourceInfo::StreamInfo* theInfo = fSDPParser.GetStreamInfo(x);
+        
+        //
+        // The clock rate is the part of the rtpmap after the slash, as in "H264/90000"
+        UInt32 theClockRate = theInfo->fTimeScale;
+        if ((theClockRate == 0) && (theInfo->fPayloadName.Len > 0))
+        {
+            StringParser theParser(&theInfo->fPayloadName);
+            theParser.ConsumeUntil(NULL, '/');
+            if (theParser.Expect('/'))
+                theClockRate = theParser.ConsumeInteger(NULL);
+        }
+        
+        ClientJitterBuffer::FrameMode theMode = ClientJitterBuffer::kOnePacketPerFrame;
+        if (theInfo->fPayloadType == qtssVideoPayloadType)
+        {
+            if (theInfo->fPayloadName.NumEqualIgnoreCase("H264/", 5))
+                theMode = ClientJitterBuffer::kH264Frames;
+            else
+                theMode = ClientJitterBuffer::kMarkerBitFrames;
+        }
+        
+        fJitterBuffers[x] = NEW ClientJitterBuffer(theClockRate, theMode, fJitterMinDelayMsec, fJitterMaxDelayMsec);
+    }
+}
+
+void ClientSessionEx::DeliverFrames(UInt32 inTrackIndex, SInt64 inCurrentMsec)
+{
+    ClientJitterBuffer* theBuffer = fJitterBuffers[inTrackIndex];
+    if (theBuffer == NULL)
+        return;
+        
+    UInt32 theTrackID = fSDPParser.GetStreamInfo(inTrackIndex)->fTrackID;
+    ClientJitterBuffer::Frame* theFrame = NULL;
+    while ((theFrame = theBuffer->GetNextFrame(inCurrentMsec)) != NULL)
+    {
+        if (fFrameCallBackFuncEx != NULL)
+            (*fFrameCallBackFuncEx)((const void*)theFrame->fData, theFrame->fLen, (unsigned short)theTrackID,
+                                    theFrame->fTimeStamp, theFrame->fNumLostPackets, fUserData);
+    }
+}
+
 void ClientSessionEx::AckPackets(UInt32 inTrackIndex, UInt16 inCurSeqNum, Bool16 inCurSeqNumValid)
 {
     char theRRBuffer[256];
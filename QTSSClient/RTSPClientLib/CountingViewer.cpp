@@ -0,0 +1,634 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1999-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ *
+ */
+/*
+    File:       CountingViewer.cpp
+
+    Contains:   Implementation of CountingViewer, CountingReceiver and CountingHistogram
+                    
+*/
+
+#include <string.h>
+#include "CountingViewer.h"
+#include "SDPSourceInfo.h"
+#include "StringParser.h"
+#include "OSMemory.h"
+#include "OS.h"
+#include "MyAssert.h"
+#include "atomic.h"
+#include "SafeStdLib.h"
+
+#define COUNTING_VIEWER_DEBUG 0
+
+static const UInt16 kSanitySeqNumDifference = 3000;
+static const UInt32 kMaxPortChecks = 500;
+static const UInt32 kMaxBatchesPerRun = 16;    // so one busy receiver can't hold on to a task thread
+
+unsigned int    CountingViewer::sConnectingViewers = 0;
+unsigned int    CountingViewer::sPlayingViewers = 0;
+unsigned int    CountingViewer::sFailedViewers = 0;
+
+//
+// CountingHistogram
+
+void CountingHistogram::Clear()
+{
+    ::memset(fBuckets, 0, sizeof(fBuckets));
+    fCount = 0;
+    fMax = 0;
+}
+
+UInt32 CountingHistogram::GetBucket(UInt32 inValue)
+{
+    if (inValue < kLinearBuckets)
+        return inValue;
+        
+    UInt32 theMSB = 6;
+    while ((inValue >> theMSB) > 1)
+        theMSB++;
+    
+    // The 5 bits under the most significant one pick the sub bucket
+    UInt32 theSubBucket = (inValue >> (theMSB - 5)) - kSubBuckets;
+    return kLinearBuckets + ((theMSB - 6) * kSubBuckets) + theSubBucket;
+}
+
+UInt32 CountingHistogram::GetBucketTop(UInt32 inBucket)
+{
+    if (inBucket < kLinearBuckets)
+        return inBucket;
+        
+    UInt32 theMSB = ((inBucket - kLinearBuckets) / kSubBuckets) + 6;
+    UInt32 theSubBucket = (inBucket - kLinearBuckets) % kSubBuckets;
+    UInt32 theShift = theMSB - 5;
+    
+    return ((kSubBuckets + theSubBucket + 1) << theShift) - 1;
+}
+
+void CountingHistogram::Record(UInt32 inValue)
+{
+    fBuckets[GetBucket(inValue)]++;
+    fCount++;
+    if (inValue > fMax)
+        fMax = inValue;
+}
+
+void CountingHistogram::Merge(const CountingHistogram& inHistogram)
+{
+    for (UInt32 x = 0; x < kNumBuckets; x++)
+        fBuckets[x] += inHistogram.fBuckets[x];
+    fCount += inHistogram.fCount;
+    if (inHistogram.fMax > fMax)
+        fMax = inHistogram.fMax;
+}
+
+UInt32 CountingHistogram::GetPercentile(Float32 inPercent)
+{
+    if (fCount == 0)
+        return 0;
+        
+    UInt32 theTarget = (UInt32) (((Float64) fCount * inPercent) / 100);
+    if (theTarget == 0)
+        theTarget = 1;
+        
+    UInt32 theTotal = 0;
+    for (UInt32 x = 0; x < kNumBuckets; x++)
+    {
+        theTotal += fBuckets[x];
+        if (theTotal >= theTarget)
+        {
+            UInt32 theTop = GetBucketTop(x);
+            return (theTop < fMax) ? theTop : fMax;
+        }
+    }
+    return fMax;
+}
+
+void CountingStats::Add(const CountingStats& inStats)
+{
+    fPacketsReceived += inStats.fPacketsReceived;
+    fBytesReceived += inStats.fBytesReceived;
+    fUnknownPackets += inStats.fUnknownPackets;
+    fRTCPPackets += inStats.fRTCPPackets;
+    fStartupMsec.Merge(inStats.fStartupMsec);
+}
+
+UInt32 CountingTrack::GetPacketsLost()
+{
+    UInt32 theExpected = this->GetPacketsExpected();
+    if (theExpected > fPacketsReceived)
+        return theExpected - fPacketsReceived;
+    return 0;
+}
+
+//
+// CountingReceiver
+
+CountingReceiver::CountingReceiver()
+:   fRTPSocket(this, Socket::kNonBlockingSocketType),
+    fRTCPSocket(this, Socket::kNonBlockingSocketType),
+    fPacketArena(NEW char[kRecvBatchSize * kMaxUDPPacketSize])
+{
+    this->SetTaskName("RTSPClientLib:CountingReceiver");
+    ::memset(fTracks, 0, sizeof(fTracks));
+    
+    for (UInt32 x = 0; x < kRecvBatchSize; x++)
+        fPackets[x].Ptr = &fPacketArena[x * kMaxUDPPacketSize];
+}
+
+CountingReceiver::~CountingReceiver()
+{
+    delete [] fPacketArena;
+}
+
+OS_Error CountingReceiver::Bind(UInt16* ioPort, UInt32 inRcvBufSize)
+{
+    OS_Error theErr = fRTPSocket.Open();
+    if (theErr == OS_NoErr)
+        theErr = fRTCPSocket.Open();
+    if (theErr != OS_NoErr)
+        return theErr;
+        
+    for (UInt32 portCheck = 0; portCheck < kMaxPortChecks; portCheck++)
+    {
+        UInt16 thePort = *ioPort;
+        *ioPort += 2;
+        
+        theErr = fRTPSocket.Bind(INADDR_ANY, thePort);
+        if (theErr != OS_NoErr)
+            continue;
+            
+        // The RTP socket can't be unbound again, so if its neighbour is taken
+        // the caller has to start over with a new receiver.
+        theErr = fRTCPSocket.Bind(INADDR_ANY, thePort + 1);
+        if (theErr != OS_NoErr)
+            return theErr;
+        
+        // Every viewer on this receiver lands in this one buffer
+        (void) fRTPSocket.SetSocketRcvBufSize(inRcvBufSize);
+        
+        fRTPSocket.RequestEvent(EV_RE);
+        fRTCPSocket.RequestEvent(EV_RE);
+        return OS_NoErr;
+    }
+    return theErr;
+}
+
+void CountingReceiver::AddTrack(CountingTrack* inTrack)
+{
+    OSMutexLocker locker(&fMutex);
+    
+    UInt32 theBucket = HashSource(inTrack->fServerAddr, inTrack->fServerPort);
+    inTrack->fNext = fTracks[theBucket];
+    fTracks[theBucket] = inTrack;
+}
+
+void CountingReceiver::RemoveTrack(CountingTrack* inTrack)
+{
+    OSMutexLocker locker(&fMutex);
+    
+    CountingTrack** theTrackPtr = &fTracks[HashSource(inTrack->fServerAddr, inTrack->fServerPort)];
+    while (*theTrackPtr != NULL)
+    {
+        if (*theTrackPtr == inTrack)
+        {
+            *theTrackPtr = inTrack->fNext;
+            break;
+        }
+        theTrackPtr = &(*theTrackPtr)->fNext;
+    }
+    inTrack->fNext = NULL;
+}
+
+void CountingReceiver::GetStats(CountingStats* ioStats)
+{
+    OSMutexLocker locker(&fMutex);
+    ioStats->Add(fStats);
+}
+
+SInt64 CountingReceiver::Run()
+{
+    EventFlags theEvents = this->GetEvents();
+    
+    if (theEvents & Task::kKillEvent)
+        return -1;
+        
+    (void) this->DrainSocket(&fRTPSocket, false);
+    (void) this->DrainSocket(&fRTCPSocket, true);
+    
+    // Whichever socket didn't fire is still being watched, asking again is harmless
+    fRTPSocket.RequestEvent(EV_RE);
+    fRTCPSocket.RequestEvent(EV_RE);
+    return 0;
+}
+
+UInt32 CountingReceiver::DrainSocket(UDPSocket* inSocket, Bool16 isRTCP)
+{
+    UInt32 theTotal = 0;
+    
+    for (UInt32 theBatch = 0; theBatch < kMaxBatchesPerRun; theBatch++)
+    {
+        UInt32 theNumPackets = 0;
+        OS_Error theErr = inSocket->RecvMultipleFrom(fAddrs, fPorts, fPackets, kMaxUDPPacketSize, kRecvBatchSize, &theNumPackets);
+        if ((theErr != OS_NoErr) || (theNumPackets == 0))
+            break;
+        theTotal += theNumPackets;
+        
+        {
+            OSMutexLocker locker(&fMutex);
+            
+            if (isRTCP)
+                fStats.fRTCPPackets += theNumPackets;
+            else
+            {
+                // One clock read per batch. Packets in a batch arrived within a
+                // few hundred microseconds of each other.
+                SInt64 theCurTime = OS::Milliseconds();
+                for (UInt32 x = 0; x < theNumPackets; x++)
+                    this->ProcessPacket(&fPackets[x], fAddrs[x], fPorts[x], theCurTime);
+            }
+        }
+        
+        if (theNumPackets < kRecvBatchSize)
+            break;
+    }
+    return theTotal;
+}
+
+void CountingReceiver::ProcessPacket(StrPtrLen* inPacket, UInt32 inAddr, UInt16 inPort, SInt64 inCurTime)
+{
+    UInt8* thePacket = (UInt8*) inPacket->Ptr;
+    
+    CountingTrack* theTrack = fTracks[HashSource(inAddr, inPort)];
+    while ((theTrack != NULL) && ((theTrack->fServerAddr != inAddr) || (theTrack->fServerPort != inPort)))
+        theTrack = theTrack->fNext;
+        
+    if ((theTrack == NULL) || (inPacket->Len < 12) || ((thePacket[0] & 0xC0) != 0x80))
+    {
+        fStats.fUnknownPackets++;
+        return;
+    }
+    
+    fStats.fPacketsReceived++;
+    fStats.fBytesReceived += inPacket->Len;
+    theTrack->fPacketsReceived++;
+    theTrack->fBytesReceived += inPacket->Len;
+    
+    CountingViewer* theViewer = theTrack->fViewer;
+    if (theViewer->GetFirstPacketTime() == 0)
+    {
+        theViewer->SetFirstPacketTime(inCurTime);
+        fStats.fStartupMsec.Record((UInt32) (inCurTime - theViewer->GetStartTime()));
+    }
+    
+    UInt16 theSeqNum = (UInt16) ((thePacket[2] << 8) | thePacket[3]);
+    UInt32 theTimeStamp = ((UInt32) thePacket[4] << 24) | ((UInt32) thePacket[5] << 16) | ((UInt32) thePacket[6] << 8) | thePacket[7];
+    
+    if (!theTrack->fHaveSeqNum)
+    {
+        theTrack->fHaveSeqNum = true;
+        theTrack->fBaseSeqNum = theTrack->fMaxSeqNum = theSeqNum;
+    }
+    else
+    {
+        UInt16 theDelta = (UInt16) (theSeqNum - theTrack->fMaxSeqNum);
+        if (theDelta == 0)
+        {
+            theTrack->fDuplicates++;
+            return;
+        }
+        if (theDelta >= kSanitySeqNumDifference)
+        {
+            // Late, or so far ahead it can't be trusted. It doesn't move the
+            // highest sequence number, and its transit time is no use for jitter.
+            theTrack->fOutOfOrder++;
+            return;
+        }
+        if (theSeqNum < theTrack->fMaxSeqNum)
+            theTrack->fCycles += 65536;
+        theTrack->fMaxSeqNum = theSeqNum;
+    }
+    
+    //
+    // RFC 3550 A.8. Transit times are only compared with each other, so any
+    // wall clock will do as long as it is in timestamp units.
+    UInt32 theArrival = (UInt32) (((UInt64) inCurTime * theTrack->fClockRate) / 1000);
+    UInt32 theTransit = theArrival - theTimeStamp;
+    if (theTrack->fPacketsReceived > 1)
+    {
+        SInt32 theDiff = (SInt32) (theTransit - theTrack->fLastTransit);
+        if (theDiff < 0)
+            theDiff = -theDiff;
+        theTrack->fJitter += (UInt32) theDiff - ((theTrack->fJitter + 8) >> 4);
+    }
+    theTrack->fLastTransit = theTransit;
+}
+
+//
+// CountingViewer
+
+CountingViewer::CountingViewer(UInt32 inAddr, UInt16 inPort, char* inURL, CountingReceiver* inReceiver,
+                                UInt32 inStartDelayMsec, UInt32 inDurationInSec)
+:   fSocket(Socket::kNonBlockingSocketType),
+    fClient(&fSocket, false),
+    fReceiver(inReceiver),
+    fState(kWaitingToStart),
+    fDeathReason(kDiedNormally),
+    fStartDelayMsec(inStartDelayMsec),
+    fDurationInSec(inDurationInSec),
+    fNumTracks(0),
+    fNumSetups(0),
+    fTracksAdded(false),
+    fTeardownImmediately(false),
+    fStartTime(0),
+    fTransactionStartTime(0),
+    fFirstPacketTime(0),
+    fPlayTime(0),
+    fStopTime(0),
+    fLastKeepAliveTime(0)
+{
+    this->SetTaskName("RTSPClientLib:CountingViewer");
+    
+    fSocket.Set(inAddr, inPort);
+    fClient.Set(StrPtrLen(inURL));
+    fClient.SetSetupParams(0, NULL);
+    
+    for (UInt32 x = 0; x < kMaxTracks; x++)
+        fTracks[x].fViewer = this;
+        
+    this->Signal(Task::kStartEvent);
+}
+
+CountingViewer::~CountingViewer()
+{
+    if (fTracksAdded)
+    {
+        for (UInt32 x = 0; x < fNumTracks; x++)
+            fReceiver->RemoveTrack(&fTracks[x]);
+    }
+}
+
+SInt64 CountingViewer::Run()
+{
+    EventFlags theEvents = this->GetEvents();
+    
+    if (theEvents & Task::kKillEvent)
+        return -1;
+        
+    if ((theEvents & Task::kStartEvent) && (fStartDelayMsec > 0))
+        return fStartDelayMsec;
+        
+    if (theEvents & CountingViewer::kTeardownEvent)
+    {
+        if (fState == kWaitingToStart)
+            this->Finish(kDiedNormally);
+        else
+            fTeardownImmediately = true;
+    }
+    
+    SInt64 theCurTime = OS::Milliseconds();
+    OS_Error theErr = OS_NoErr;
+    
+    while ((theErr == OS_NoErr) && (fState != kDone))
+    {
+        switch (fState)
+        {
+            case kWaitingToStart:
+            {
+                fStartTime = theCurTime;
+                (void) atomic_add(&sConnectingViewers, 1);
+                fState = kSendingDescribe;
+                break;
+            }
+            case kSendingDescribe:
+            {
+                theErr = fClient.SendDescribe();
+                if (theErr == OS_NoErr)
+                {
+                    if (fClient.GetStatus() != 200)
+                    {
+                        theErr = ENOTCONN; // Exit the state machine
+                        break;
+                    }
+                    theErr = this->ParseDescribe();
+                    if (theErr == OS_NoErr)
+                        fState = kSendingSetup;
+                }
+                break;
+            }
+            case kSendingSetup:
+            {
+                theErr = fClient.SendUDPSetup(fTrackIDs[fNumSetups], fReceiver->GetRTPPort());
+                if (theErr == OS_NoErr)
+                {
+                    if (fClient.GetStatus() != 200)
+                    {
+                        theErr = ENOTCONN;
+                        break;
+                    }
+                    
+                    // This is how the receiver will know the track's packets
+                    fTracks[fNumSetups].fServerAddr = fSocket.GetHostAddr();
+                    fTracks[fNumSetups].fServerPort = fClient.GetServerPort();
+                    
+                    fNumSetups++;
+                    if (fNumSetups == fNumTracks)
+                        fState = kSendingPlay;
+                }
+                break;
+            }
+            case kSendingPlay:
+            {
+                // Before the PLAY goes out, so the first packets aren't thrown away
+                if (!fTracksAdded)
+                {
+                    for (UInt32 x = 0; x < fNumTracks; x++)
+                        fReceiver->AddTrack(&fTracks[x]);
+                    fTracksAdded = true;
+                }
+                
+                theErr = fClient.SendPlay(0);
+                if (theErr == OS_NoErr)
+                {
+                    if (fClient.GetStatus() != 200)
+                    {
+                        theErr = ENOTCONN;
+                        break;
+                    }
+                    
+                    (void) atomic_sub(&sConnectingViewers, 1);
+                    (void) atomic_add(&sPlayingViewers, 1);
+                    fPlayTime = fLastKeepAliveTime = theCurTime;
+                    fState = kPlaying;
+                }
+                break;
+            }
+            case kPlaying:
+            {
+                theErr = this->DrainControlSocket();
+                if (theErr != OS_NoErr)
+                    break;
+                    
+                if (fTeardownImmediately || ((fDurationInSec > 0) && ((theCurTime - fPlayTime) >= ((SInt64) fDurationInSec * 1000))))
+                {
+                    (void) atomic_sub(&sPlayingViewers, 1);
+                    fState = kSendingTeardown;
+                    break;
+                }
+                
+                if ((theCurTime - fLastKeepAliveTime) >= kKeepAliveIntervalMsec)
+                {
+                    // RTSPClient doesn't wait for the OPTIONS response. It is thrown
+                    // away by DrainControlSocket next time around.
+                    (void) fClient.SendOptions();
+                    fLastKeepAliveTime = theCurTime;
+                }
+                
+                SInt64 theWait = (fLastKeepAliveTime + kKeepAliveIntervalMsec) - theCurTime;
+                if (fDurationInSec > 0)
+                {
+                    SInt64 theTimeLeft = (fPlayTime + ((SInt64) fDurationInSec * 1000)) - theCurTime;
+                    if (theTimeLeft < theWait)
+                        theWait = theTimeLeft;
+                }
+                return (theWait > 0) ? theWait : 1;
+            }
+            case kSendingTeardown:
+            {
+                theErr = fClient.SendTeardown();
+                if (theErr == OS_NoErr)
+                    this->Finish(kDiedNormally);
+                break;
+            }
+        }
+        
+        if (theErr == OS_NoErr)
+            fTransactionStartTime = 0;
+    }
+    
+    if ((theErr == EINPROGRESS) || (theErr == EAGAIN))
+    {
+        if (fTransactionStartTime == 0)
+            fTransactionStartTime = theCurTime;
+        
+        if ((theCurTime - fTransactionStartTime) > kTransactionTimeoutMsec)
+            this->Finish(kSessionTimedout);
+        else
+        {
+            // The RTSP socket is polled rather than handed to the event thread.
+            // There can be far more viewers than select() can watch, and only
+            // the ones in the middle of a request need looking at.
+            return kPollIntervalMsec;
+        }
+    }
+    else if (theErr != OS_NoErr)
+    {
+        if (fState == kSendingTeardown)
+            this->Finish(kTeardownFailed);
+        else if (fState == kPlaying)
+            this->Finish(kDiedWhilePlaying);
+        else if (fDeathReason == kBadSDP)
+            this->Finish(kBadSDP);
+        else if (fClient.GetStatus() != 200)
+            this->Finish(kRequestFailed);
+        else
+            this->Finish(kConnectionFailed);
+    }
+
+#if COUNTING_VIEWER_DEBUG
+    if (fState == kDone)
+        qtss_printf("CountingViewer complete. Death reason = %lu\n", fDeathReason);
+#endif
+    return 0;
+}
+
+void CountingViewer::Finish(UInt32 inDeathReason)
+{
+    if ((fState >= kSendingDescribe) && (fState <= kSendingPlay))
+        (void) atomic_sub(&sConnectingViewers, 1);
+    else if (fState == kPlaying)
+        (void) atomic_sub(&sPlayingViewers, 1);
+        
+    // A viewer that played but couldn't tear down cleanly still counts as a success
+    if ((inDeathReason != kDiedNormally) && (inDeathReason != kTeardownFailed))
+        (void) atomic_add(&sFailedViewers, 1);
+    
+    // Anything still arriving for us is counted as unknown from here on
+    if (fTracksAdded)
+    {
+        for (UInt32 x = 0; x < fNumTracks; x++)
+            fReceiver->RemoveTrack(&fTracks[x]);
+        fTracksAdded = false;
+    }
+    
+    fDeathReason = inDeathReason;
+    fStopTime = OS::Milliseconds();
+    fState = kDone;
+}
+
+OS_Error CountingViewer::ParseDescribe()
+{
+    SDPSourceInfo theSDP(fClient.GetContentBody(), fClient.GetContentLength());
+    
+    fNumTracks = theSDP.GetNumStreams();
+    if (fNumTracks > kMaxTracks)
+        fNumTracks = kMaxTracks;
+    if (fNumTracks == 0)
+    {
+        fDeathReason = kBadSDP;
+        return EINVAL;
+    }
+    
+    for (UInt32 x = 0; x < fNumTracks; x++)
+    {
+        SourceInfo::StreamInfo* theInfo = theSDP.GetStreamInfo(x);
+        fTrackIDs[x] = theInfo->fTrackID;
+        
+        // The clock rate is the part of the rtpmap after the slash, as in "H264/90000"
+        UInt32 theClockRate = theInfo->fTimeScale;
+        if ((theClockRate == 0) && (theInfo->fPayloadName.Len > 0))
+        {
+            StringParser theParser(&theInfo->fPayloadName);
+            theParser.ConsumeUntil(NULL, '/');
+            if (theParser.Expect('/'))
+                theClockRate = theParser.ConsumeInteger(NULL);
+        }
+        if (theClockRate > 0)
+            fTracks[x].fClockRate = theClockRate;
+    }
+    return OS_NoErr;
+}
+
+OS_Error CountingViewer::DrainControlSocket()
+{
+    char theBuffer[512];
+    UInt32 theLen = 0;
+    OS_Error theErr = OS_NoErr;
+    
+    while (theErr == OS_NoErr)
+        theErr = fSocket.Read(theBuffer, sizeof(theBuffer), &theLen);
+        
+    if (theErr == EAGAIN)
+        return OS_NoErr;
+    return (OS_Error)theErr;
+}
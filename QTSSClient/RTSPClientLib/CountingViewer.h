@@ -0,0 +1,290 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1999-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ *
+ */
+/*
+    File:       CountingViewer.h
+
+    Contains:   A stripped down RTSP viewer for load testing with many viewers per
+                process. A CountingViewer only does DESCRIBE, SETUP (UDP), PLAY, an
+                occasional keep-alive and TEARDOWN. It owns no media sockets.
+                
+                Instead, viewers are spread over a few CountingReceivers. Each one has
+                a single RTP / RTCP socket pair that all of its viewers give as their
+                client_port. The server gives every (client address, RTCP port) its own
+                socket pair, so the server's source address and port still tell which
+                viewer and track a packet belongs to. Receivers look only at the 12 byte
+                RTP header and keep sequence number, loss and RFC 3550 jitter per track.
+                
+                Counters and the startup latency histogram are kept per receiver and
+                only touched with the receiver's mutex held, so they are summed up
+                when a report is made rather than shared while packets come in.
+*/
+
+#ifndef __COUNTING_VIEWER__
+#define __COUNTING_VIEWER__
+
+#include "Task.h"
+#include "OSMutex.h"
+#include "UDPSocket.h"
+#include "RTSPClient.h"
+#include "ClientSocket.h"
+
+class CountingViewer;
+
+// Log linear histogram of UInt32 values (milliseconds, kbits / sec...). Values below
+// kLinearBuckets are exact, above that each power of 2 is split in kSubBuckets, so
+// a reported percentile is never more than about 3% above the real one.
+class CountingHistogram
+{
+    public:
+    
+        enum
+        {
+            kLinearBuckets  = 64,   //UInt32
+            kSubBuckets     = 32,   //UInt32
+            kNumBuckets     = kLinearBuckets + (32 - 6) * kSubBuckets   //UInt32 (msb 6 to 31)
+        };
+        
+        CountingHistogram() { this->Clear(); }
+        
+        void    Clear();
+        void    Record(UInt32 inValue);
+        void    Merge(const CountingHistogram& inHistogram);
+        
+        UInt32  GetCount()  { return fCount; }
+        UInt32  GetMax()    { return fMax; }
+        
+        // Smallest value that at least inPercent of the samples are at or below.
+        // 0 if nothing was recorded.
+        UInt32  GetPercentile(Float32 inPercent);
+        
+    private:
+    
+        static UInt32   GetBucket(UInt32 inValue);
+        static UInt32   GetBucketTop(UInt32 inBucket);
+        
+        UInt32  fBuckets[kNumBuckets];
+        UInt32  fCount;
+        UInt32  fMax;
+};
+
+struct CountingStats
+{
+    CountingStats() : fPacketsReceived(0), fBytesReceived(0), fUnknownPackets(0), fRTCPPackets(0) {}
+    
+    void    Add(const CountingStats& inStats);
+    
+    UInt64              fPacketsReceived;
+    UInt64              fBytesReceived;     // UDP payload only
+    UInt64              fUnknownPackets;    // from a source no viewer has set up
+    UInt64              fRTCPPackets;
+    CountingHistogram   fStartupMsec;       // viewer start to its first RTP packet
+};
+
+// What a receiver keeps about one track of one viewer. Only the receiver the
+// track was added to writes to it, with its mutex held.
+struct CountingTrack
+{
+    CountingTrack() :   fNext(NULL), fViewer(NULL), fServerAddr(0), fServerPort(0), fClockRate(90000),
+                        fHaveSeqNum(false), fBaseSeqNum(0), fMaxSeqNum(0), fCycles(0),
+                        fPacketsReceived(0), fBytesReceived(0), fOutOfOrder(0), fDuplicates(0),
+                        fLastTransit(0), fJitter(0) {}
+    
+    UInt32  GetPacketsExpected()    { return fHaveSeqNum ? fCycles + fMaxSeqNum - fBaseSeqNum + 1 : 0; }
+    UInt32  GetPacketsLost();
+    UInt32  GetJitterMsec()         { return (UInt32) (((UInt64) (fJitter >> 4) * 1000) / fClockRate); }
+    
+    CountingTrack*  fNext;          // receiver hash chain
+    CountingViewer* fViewer;
+    UInt32          fServerAddr;
+    UInt16          fServerPort;    // server_port from the SETUP response
+    UInt32          fClockRate;
+    
+    Bool16          fHaveSeqNum;
+    UInt16          fBaseSeqNum;
+    UInt16          fMaxSeqNum;
+    UInt32          fCycles;        // sequence number wraps * 65536
+    UInt32          fPacketsReceived;
+    UInt64          fBytesReceived;
+    UInt32          fOutOfOrder;
+    UInt32          fDuplicates;
+    UInt32          fLastTransit;
+    UInt32          fJitter;        // RFC 3550 interarrival jitter, in 1/16 timestamp units
+};
+
+class CountingReceiver : public Task
+{
+    public:
+    
+        CountingReceiver();
+        virtual ~CountingReceiver();
+        
+        // Opens the RTP / RTCP socket pair on the first free even port at or after
+        // *ioPort, and moves *ioPort past it.
+        OS_Error    Bind(UInt16* ioPort, UInt32 inRcvBufSize);
+        UInt16      GetRTPPort()    { return fRTPSocket.GetLocalPort(); }
+        
+        // Tracks must be added before the PLAY goes out, and removed before they're deleted.
+        void        AddTrack(CountingTrack* inTrack);
+        void        RemoveTrack(CountingTrack* inTrack);
+        
+        // Adds this receiver's counters and histogram to ioStats
+        void        GetStats(CountingStats* ioStats);
+        OSMutex*    GetMutex()      { return &fMutex; }
+        
+        virtual SInt64 Run();
+        
+    private:
+    
+        enum
+        {
+            kHashTableSize      = 4096, //UInt32 must be a power of 2
+            kMaxUDPPacketSize   = 2048, //UInt32
+            kRecvBatchSize      = UDPSocket::kMaxRecvMultiplePackets
+        };
+        
+        static UInt32   HashSource(UInt32 inAddr, UInt16 inPort)
+                            { return ((inAddr ^ ((UInt32) inPort << 16) ^ inPort) * 2654435761UL) & (kHashTableSize - 1); }
+        
+        void            ProcessPacket(StrPtrLen* inPacket, UInt32 inAddr, UInt16 inPort, SInt64 inCurTime);
+        UInt32          DrainSocket(UDPSocket* inSocket, Bool16 isRTCP);
+        
+        UDPSocket       fRTPSocket;
+        UDPSocket       fRTCPSocket;
+        OSMutex         fMutex;
+        CountingTrack*  fTracks[kHashTableSize];
+        CountingStats   fStats;
+        
+        char*           fPacketArena;   // kRecvBatchSize * kMaxUDPPacketSize
+        StrPtrLen       fPackets[kRecvBatchSize];
+        UInt32          fAddrs[kRecvBatchSize];
+        UInt16          fPorts[kRecvBatchSize];
+};
+
+class CountingViewer : public Task
+{
+    public:
+    
+        enum
+        {
+            kMaxTracks = 8  //UInt32
+        };
+    
+        // Nothing happens until inStartDelayMsec has passed. With an inDurationInSec
+        // of 0 the viewer plays until it gets a kTeardownEvent.
+        CountingViewer(UInt32 inAddr, UInt16 inPort, char* inURL, CountingReceiver* inReceiver,
+                        UInt32 inStartDelayMsec, UInt32 inDurationInSec);
+        virtual ~CountingViewer();
+        
+        enum
+        {
+            kTeardownEvent = 0x00000100
+        };
+        
+        virtual SInt64 Run();
+        
+        enum
+        {
+            kWaitingToStart     = 0,
+            kSendingDescribe    = 1,
+            kSendingSetup       = 2,
+            kSendingPlay        = 3,
+            kPlaying            = 4,
+            kSendingTeardown    = 5,
+            kDone               = 6
+        };
+        
+        enum
+        {
+            kDiedNormally       = 0,
+            kTeardownFailed     = 1,
+            kRequestFailed      = 2,
+            kBadSDP             = 3,
+            kSessionTimedout    = 4,
+            kConnectionFailed   = 5,
+            kDiedWhilePlaying   = 6
+        };
+        
+        Bool16          IsDone()            { return fState == kDone; }
+        UInt32          GetState()          { return fState; }
+        UInt32          GetReasonForDying() { return fDeathReason; }
+        CountingReceiver* GetReceiver()     { return fReceiver; }
+        
+        // Read these with the receiver's mutex held
+        UInt32          GetNumTracks()      { return fNumTracks; }
+        CountingTrack*  GetTrack(UInt32 inIndex) { return &fTracks[inIndex]; }
+        SInt64          GetStartTime()      { return fStartTime; }
+        SInt64          GetFirstPacketTime() { return fFirstPacketTime; }
+        SInt64          GetPlayTime()       { return fPlayTime; }
+        SInt64          GetStopTime()       { return fStopTime; }  // 0 until IsDone()
+        
+        // The receiver calls this on the first RTP packet for any of our tracks.
+        void            SetFirstPacketTime(SInt64 inTime) { fFirstPacketTime = inTime; }
+        
+        static UInt32   GetConnectingViewers()  { return sConnectingViewers; }
+        static UInt32   GetPlayingViewers()     { return sPlayingViewers; }
+        static UInt32   GetFailedViewers()      { return sFailedViewers; }
+        
+    private:
+    
+        enum
+        {
+            kPollIntervalMsec       = 10,       //UInt32 while waiting on the RTSP connection
+            kTransactionTimeoutMsec = 20000,    //UInt32
+            kKeepAliveIntervalMsec  = 25000     //UInt32
+        };
+        
+        OS_Error        ParseDescribe();
+        OS_Error        DrainControlSocket();
+        void            Finish(UInt32 inDeathReason);
+        
+        TCPClientSocket fSocket;
+        RTSPClient      fClient;
+        CountingReceiver* fReceiver;
+        
+        UInt32          fState;
+        UInt32          fDeathReason;
+        UInt32          fStartDelayMsec;
+        UInt32          fDurationInSec;
+        
+        UInt32          fNumTracks;
+        UInt32          fNumSetups;
+        UInt32          fTrackIDs[kMaxTracks];
+        CountingTrack   fTracks[kMaxTracks];
+        Bool16          fTracksAdded;
+        Bool16          fTeardownImmediately;
+        
+        SInt64          fStartTime;
+        SInt64          fTransactionStartTime;
+        SInt64          fFirstPacketTime;
+        SInt64          fPlayTime;
+        SInt64          fStopTime;
+        SInt64          fLastKeepAliveTime;
+        
+        static unsigned int sConnectingViewers;
+        static unsigned int sPlayingViewers;
+        static unsigned int sFailedViewers;
+};
+
+#endif //__COUNTING_VIEWER__
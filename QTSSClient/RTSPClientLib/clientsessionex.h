@@ -38,6 +38,7 @@
 #include "ClientSocket.h"
 #include "SDPSourceInfo.h"
 #include "UDPSocket.h"
+#include "ClientJitterBuffer.h"
 
 //fym
 typedef struct tagRTPHeaderParam
@@ -53,6 +54,27 @@ typedef struct tagRTPHeaderParam
 	unsigned long ssrc:32;
 }RTPHeaderParam;
 
+// A UDP socket that remembers when the event thread said it was readable, so
+// ReadMediaData only reads the sockets that have something waiting.
+class ClientUDPSocket : public UDPSocket
+{
+    public:
+    
+        ClientUDPSocket(Task* inTask) : UDPSocket(inTask, Socket::kNonBlockingSocketType), fReadable(true) {}
+        virtual ~ClientUDPSocket() {}
+        
+        Bool16  IsReadable() { return fReadable; }
+        
+        // Call once the socket is drained. Clears the flag, then asks for the next read event.
+        void    WaitForData() { fReadable = false; this->RequestEvent(EV_RE); }
+        
+    private:
+    
+        virtual void ProcessEvent(int eventBits) { fReadable = true; UDPSocket::ProcessEvent(eventBits); }
+        
+        volatile Bool16 fReadable;
+};
+
 class ClientSessionEx : public Task
 {
     public:
@@ -156,6 +178,9 @@ class ClientSessionEx : public Task
                                     { return fStats[inTrackIndex].fNumDuplicates; }
         UInt32                  GetNumAcks(UInt32 inTrackIndex)
                                     { return fStats[inTrackIndex].fNumAcks; }
+        // NULL unless EnableJitterBuffer turned it on for this track
+        ClientJitterBuffer*     GetJitterBuffer(UInt32 inTrackIndex)
+                                    { return (fJitterBuffers != NULL) ? fJitterBuffers[inTrackIndex] : NULL; }
                 
         UInt32   GetSessionPacketsReceived()  { UInt32 result = fNumPacketsReceived; fNumPacketsReceived = 0; return result; }
         //
@@ -205,7 +230,19 @@ class ClientSessionEx : public Task
         UInt32          fState;     // For managing the state machine
         UInt32          fDeathReason;
         UInt32          fNumSetups;
-        UDPSocket**     fUDPSocketArray;
+        ClientUDPSocket**   fUDPSocketArray;
+        
+        //
+        // Every UDP read lands in this one arena, up to kRecvBatchSize packets per recvmmsg
+        enum
+        {
+            kRecvBatchSize      = 32,   //UInt32
+            kMaxUDPPacketSize   = 2048  //UInt32
+        };
+        char*           fPacketArena;
+        StrPtrLen       fRecvPackets[kRecvBatchSize];
+        UInt32          fRecvAddrs[kRecvBatchSize];
+        UInt16          fRecvPorts[kRecvBatchSize];
         
         SInt64          fPlayTime;
         SInt64          fTotalPlayTime;
@@ -253,6 +290,11 @@ class ClientSessionEx : public Task
         UInt32              fOverbufferWindowSizeInK;
         UInt32              fCurRTCPTrack;
         UInt32              fNumPacketsReceived;
+        
+        ClientJitterBuffer**    fJitterBuffers; // one per track, NULL where it is off
+        UInt32              fJitterTrackMask;
+        UInt32              fJitterMinDelayMsec;
+        UInt32              fJitterMaxDelayMsec;
         //
         // Global stats
         static UInt32           sActiveConnections;
@@ -264,15 +306,29 @@ class ClientSessionEx : public Task
         // Helper functions for Run()
         void    SetupUDPSockets();
         void    ProcessMediaPacket(char* inPacket, UInt32 inLength, UInt32 inTrackID, Bool16 isRTCP);
+        void    ProcessMediaPackets(StrPtrLen* inPackets, UInt32 inNumPackets, UInt32 inTrackIndex, Bool16 isRTCP);
         OS_Error    ReadMediaData();
         OS_Error    SendReceiverReport(UInt32 inTrackID);
         void    AckPackets(UInt32 inTrackIndex, UInt16 inCurSeqNum, Bool16 inCurSeqNumValid);
+        void    SetupJitterBuffers();
+        void    DeliverFrames(UInt32 inTrackIndex, SInt64 inCurrentMsec);
 
 	//fym
 	public:
 		void (CALLBACK* fDataCallBackFuncEx)(const void* pData, unsigned long nLen, unsigned short nDataType, DWORD dwUserData);
 		DWORD fUserData;
 
+		// With the jitter buffer on, a track's RTP packets come out here instead of
+		// fDataCallBackFuncEx: one complete frame at a time, in order, H.264 as Annex B.
+		// nLostPackets is non-zero if packets were lost since the track's last frame.
+		void (CALLBACK* fFrameCallBackFuncEx)(const void* pData, unsigned long nLen, unsigned short nDataType,
+												unsigned long nTimeStamp, unsigned long nLostPackets, DWORD dwUserData);
+
+		// Call before OpenSession. Bit x of inTrackMask turns the buffer on for the
+		// track at index x in the SDP. The delay adapts to jitter between the two bounds.
+		void EnableJitterBuffer(UInt32 inMinDelayMsec, UInt32 inMaxDelayMsec, UInt32 inTrackMask = 0xFFFFFFFF)
+			{ fJitterMinDelayMsec = inMinDelayMsec; fJitterMaxDelayMsec = inMaxDelayMsec; fJitterTrackMask = inTrackMask; }
+
 		int OpenSession(UInt32 inAddr, UInt16 inPort, const char* inURL, ClientType inClientType);
 		int CloseSession();
 };
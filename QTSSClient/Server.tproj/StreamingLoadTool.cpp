@@ -49,6 +49,7 @@ Contains:       Tool that simulates streaming movie load
 #endif
 
 #include "ClientSession.h"
+#include "CountingViewer.h"
 //#include "FilePrefsSource.h"
 #include "OSMemory.h"
 #include "OSArrayObjectDeleter.h"
@@ -108,6 +109,9 @@ char*	GetDeathReasonDescription(UInt32 inDeathReason);
 char*	GetPayloadDescription(QTSS_RTPPayloadType inPayload);
 //fym void	CheckForStreamingLoadToolDotMov(SVector<UInt32> &ioIPAddrArray, SVector<char *> &theURLlist, UInt16 inPort, SVector<char *> &userList, SVector<char *> &passwordList, UInt32 verboseLevel);
 UInt32 CalcStartTime(Bool16 inRandomThumb, UInt32 inMovieLength);
+void	RunCountingViewers(SVector<char *> &theURLlist, SVector<UInt32> &theIPAddrArray, UInt16 inPort, UInt32 inNumViewers,
+							UInt32 inViewersPerReceiver, UInt32 inStartsPerSec, UInt32 inDurationInSec, UInt32 inSockRcvBuf);
+void	PrintPercentiles(char* inMetric, CountingHistogram& inHistogram);
 
 extern char* optarg;
 
@@ -800,6 +804,12 @@ int fym_main()//(int argc, char *argv[])
     UInt32 bufferSpace = 100000;
     UInt32 delayTime = 10000;
 	Float32 startDelayFrac = 0.5;
+	Bool16 countingViewers = false;
+	UInt32 numCountingViewers = 50000;
+	UInt32 viewersPerReceiver = 1000;
+	UInt32 viewerStartsPerSec = 500;
+	UInt32 countingSockRcvBuf = 4 * 1024 * 1024;
+	UInt32 numTaskThreads = 1;
 	//
 
 #if 0//fym
@@ -836,6 +846,13 @@ int fym_main()//(int argc, char *argv[])
 	overbufferwindowInK = 5120;//fym
 	randomThumb = false;//fym
 	sendOptions = true;//fym
+	
+	//Counting viewers: numCountingViewers light viewers that only count RTP headers,
+	//viewersPerReceiver of them to each shared receive socket, started at
+	//viewerStartsPerSec. They stream for theMovieLength seconds, or until Ctrl-C if runForever.
+	countingViewers = false;
+	if (countingViewers)
+		numTaskThreads = 4;
 
 	//fym
 	//char* temp = new char[32];
@@ -874,10 +891,17 @@ int fym_main()//(int argc, char *argv[])
 #if !MACOSXEVENTQUEUE
 	::select_startevents();//initialize the select() implementation of the event queue
 #endif
-	TaskThreadPool::AddThreads(1);
+	TaskThreadPool::AddThreads(numTaskThreads);
 	TimeoutTask::Initialize();
 	Socket::StartThread();
 
+	if (countingViewers)
+	{
+		::RunCountingViewers(theURLlist, theIPAddrArray, thePort, numCountingViewers, viewersPerReceiver,
+								viewerStartsPerSec, runForever ? 0 : theMovieLength, countingSockRcvBuf);
+		return 0;
+	}
+
 	if (sGotSigInt)
 	{
 		//
@@ -991,6 +1015,225 @@ UInt32 CalcStartTime(Bool16 inRandomThumb, UInt32 inMovieLength)
 		return 0;
 }
 
+//
+// Runs inNumViewers CountingViewers until they are all done, or until Ctrl-C.
+// Everything goes to stdout as key=value lines so it can be picked up by a script:
+// an "interval" line a second, then a "summary" line and a "percentiles" line per metric.
+void RunCountingViewers(SVector<char *> &theURLlist, SVector<UInt32> &theIPAddrArray, UInt16 inPort, UInt32 inNumViewers,
+						UInt32 inViewersPerReceiver, UInt32 inStartsPerSec, UInt32 inDurationInSec, UInt32 inSockRcvBuf)
+{
+	static const UInt16 kFirstCountingRTPPort = 6970;
+	static const UInt32 kMaxReceiverTries = 10;
+	
+	if ((inNumViewers == 0) || (theURLlist.size() == 0))
+		return;
+	if (inViewersPerReceiver == 0)
+		inViewersPerReceiver = 1;
+	if (inStartsPerSec == 0)
+		inStartsPerSec = 1;
+		
+#ifndef __Win32__
+	//
+	// One RTSP connection per viewer
+	struct rlimit theLimit;
+	if (::getrlimit(RLIMIT_NOFILE, &theLimit) == 0)
+	{
+		rlim_t theNeeded = inNumViewers + 256;
+		if (theLimit.rlim_cur < theNeeded)
+		{
+			theLimit.rlim_cur = (theLimit.rlim_max < theNeeded) ? theLimit.rlim_max : theNeeded;
+			(void)::setrlimit(RLIMIT_NOFILE, &theLimit);
+		}
+	}
+#endif
+
+	//
+	// The receivers go first, so their sockets get low descriptors the event thread can watch
+	UInt32 theNumReceivers = (inNumViewers + inViewersPerReceiver - 1) / inViewersPerReceiver;
+	CountingReceiver** theReceivers = NEW CountingReceiver*[theNumReceivers];
+	UInt16 thePort = kFirstCountingRTPPort;
+	for (UInt32 x = 0; x < theNumReceivers; x++)
+	{
+		theReceivers[x] = NULL;
+		for (UInt32 theTry = 0; (theReceivers[x] == NULL) && (theTry < kMaxReceiverTries); theTry++)
+		{
+			CountingReceiver* theReceiver = NEW CountingReceiver();
+			if (theReceiver->Bind(&thePort, inSockRcvBuf) == OS_NoErr)
+				theReceivers[x] = theReceiver;
+			else
+				theReceiver->Signal(Task::kKillEvent);
+		}
+		if (theReceivers[x] == NULL)
+		{
+			printf("error=bind receivers=%"_U32BITARG_" port=%u\n", x, thePort);
+			theNumReceivers = x;
+			break;
+		}
+	}
+	if (theNumReceivers == 0)
+	{
+		delete [] theReceivers;
+		return;
+	}
+	
+	CountingViewer** theViewers = NEW CountingViewer*[inNumViewers];
+	for (UInt32 y = 0; y < inNumViewers; y++)
+	{
+		UInt32 theURLIndex = y % theURLlist.size();
+		theViewers[y] = NEW CountingViewer(theIPAddrArray[theURLIndex], inPort, theURLlist[theURLIndex], theReceivers[y % theNumReceivers],
+											(y * 1000) / inStartsPerSec, inDurationInSec);
+	}
+	
+	//
+	// Once a second, until everyone is done
+	SInt64 theStartTime = OS::Milliseconds();
+	SInt64 theLastReportTime = theStartTime;
+	UInt64 theLastBytes = 0;
+	UInt64 theLastPackets = 0;
+	CountingHistogram theIntervalKbps;
+	Bool16 sentTeardowns = false;
+	Bool16 isDone = false;
+	
+	while (!isDone && !sQuitNow)
+	{
+		OSThread::Sleep(1000);
+		
+		if (sGotSigInt && !sentTeardowns)
+		{
+			for (UInt32 z = 0; z < inNumViewers; z++)
+				theViewers[z]->Signal(CountingViewer::kTeardownEvent);
+			sentTeardowns = true;
+		}
+		
+		CountingStats theStats;
+		for (UInt32 r = 0; r < theNumReceivers; r++)
+			theReceivers[r]->GetStats(&theStats);
+			
+		SInt64 theCurTime = OS::Milliseconds();
+		SInt64 theElapsed = theCurTime - theLastReportTime;
+		if (theElapsed < 1)
+			theElapsed = 1;
+		Float64 theKbps = ((Float64) (SInt64) (theStats.fBytesReceived - theLastBytes) * 8) / (Float64) theElapsed;
+		Float64 thePps = ((Float64) (SInt64) (theStats.fPacketsReceived - theLastPackets) * 1000) / (Float64) theElapsed;
+		if (CountingViewer::GetPlayingViewers() > 0)
+			theIntervalKbps.Record((UInt32) theKbps);
+			
+		printf("interval time_ms=%"_S64BITARG_" connecting=%"_U32BITARG_" playing=%"_U32BITARG_" failed=%"_U32BITARG_" packets=%"_U64BITARG_" bytes=%"_U64BITARG_" kbps=%.0f pps=%.0f unknown=%"_U64BITARG_"\n",
+				theCurTime - theStartTime,
+				CountingViewer::GetConnectingViewers(),
+				CountingViewer::GetPlayingViewers(),
+				CountingViewer::GetFailedViewers(),
+				theStats.fPacketsReceived,
+				theStats.fBytesReceived,
+				theKbps,
+				thePps,
+				theStats.fUnknownPackets);
+		::fflush(stdout);
+		
+		theLastReportTime = theCurTime;
+		theLastBytes = theStats.fBytesReceived;
+		theLastPackets = theStats.fPacketsReceived;
+		
+		isDone = true;
+		for (UInt32 cc = 0; (cc < inNumViewers) && isDone; cc++)
+			isDone = theViewers[cc]->IsDone();
+	}
+	
+	//
+	// Per viewer results. Tracks are only stable with their receiver's mutex held.
+	SInt64 theEndTime = OS::Milliseconds();
+	CountingStats theStats;
+	for (UInt32 r2 = 0; r2 < theNumReceivers; r2++)
+		theReceivers[r2]->GetStats(&theStats);
+		
+	CountingHistogram theJitterMsec;
+	CountingHistogram theViewerKbps;
+	UInt64 theExpected = 0;
+	UInt64 theLost = 0;
+	UInt64 theOutOfOrder = 0;
+	UInt64 theDuplicates = 0;
+	UInt32 thePlayed = 0;
+	
+	for (UInt32 v = 0; v < inNumViewers; v++)
+	{
+		CountingViewer* theViewer = theViewers[v];
+		OSMutexLocker locker(theViewer->GetReceiver()->GetMutex());
+		
+		if (theViewer->GetPlayTime() != 0)
+			thePlayed++;
+			
+		UInt64 theViewerBytes = 0;
+		for (UInt32 t = 0; t < theViewer->GetNumTracks(); t++)
+		{
+			CountingTrack* theTrack = theViewer->GetTrack(t);
+			if (!theTrack->fHaveSeqNum)
+				continue;
+			theExpected += theTrack->GetPacketsExpected();
+			theLost += theTrack->GetPacketsLost();
+			theOutOfOrder += theTrack->fOutOfOrder;
+			theDuplicates += theTrack->fDuplicates;
+			theViewerBytes += theTrack->fBytesReceived;
+			theJitterMsec.Record(theTrack->GetJitterMsec());
+		}
+		
+		if (theViewer->GetFirstPacketTime() != 0)
+		{
+			SInt64 theStopTime = (theViewer->GetStopTime() != 0) ? theViewer->GetStopTime() : theEndTime;
+			SInt64 thePlayedMsec = theStopTime - theViewer->GetFirstPacketTime();
+			if (thePlayedMsec > 0)
+				theViewerKbps.Record((UInt32) ((theViewerBytes * 8) / (UInt64) thePlayedMsec));
+		}
+	}
+	
+	printf("summary viewers=%"_U32BITARG_" receivers=%"_U32BITARG_" played=%"_U32BITARG_" failed=%"_U32BITARG_" time_ms=%"_S64BITARG_" packets=%"_U64BITARG_" bytes=%"_U64BITARG_
+			" expected=%"_U64BITARG_" lost=%"_U64BITARG_" loss_pct=%.3f out_of_order=%"_U64BITARG_" duplicates=%"_U64BITARG_" unknown=%"_U64BITARG_" rtcp=%"_U64BITARG_"\n",
+			inNumViewers,
+			theNumReceivers,
+			thePlayed,
+			CountingViewer::GetFailedViewers(),
+			theEndTime - theStartTime,
+			theStats.fPacketsReceived,
+			theStats.fBytesReceived,
+			theExpected,
+			theLost,
+			(theExpected > 0) ? ((Float64) (SInt64) theLost * 100) / (Float64) (SInt64) theExpected : 0.0,
+			theOutOfOrder,
+			theDuplicates,
+			theStats.fUnknownPackets,
+			theStats.fRTCPPackets);
+	::PrintPercentiles("startup_ms", theStats.fStartupMsec);
+	::PrintPercentiles("jitter_ms", theJitterMsec);
+	::PrintPercentiles("viewer_kbps", theViewerKbps);
+	::PrintPercentiles("interval_kbps", theIntervalKbps);
+	::fflush(stdout);
+	
+	//
+	// A viewer that's done has let go of its receiver, so both can go. If we're
+	// quitting with viewers still running, leave them to the process exit.
+	if (isDone)
+	{
+		for (UInt32 k = 0; k < inNumViewers; k++)
+			theViewers[k]->Signal(Task::kKillEvent);
+		for (UInt32 k2 = 0; k2 < theNumReceivers; k2++)
+			theReceivers[k2]->Signal(Task::kKillEvent);
+	}
+	delete [] theViewers;
+	delete [] theReceivers;
+}
+
+void PrintPercentiles(char* inMetric, CountingHistogram& inHistogram)
+{
+	printf("percentiles metric=%s count=%"_U32BITARG_" p1=%"_U32BITARG_" p10=%"_U32BITARG_" p50=%"_U32BITARG_" p90=%"_U32BITARG_" p99=%"_U32BITARG_" max=%"_U32BITARG_"\n",
+			inMetric,
+			inHistogram.GetCount(),
+			inHistogram.GetPercentile(1),
+			inHistogram.GetPercentile(10),
+			inHistogram.GetPercentile(50),
+			inHistogram.GetPercentile(90),
+			inHistogram.GetPercentile(99),
+			inHistogram.GetMax());
+}
+
 void CheckForStreamingLoadToolPermission(UInt32* inIPAddrArray, UInt32 inNumURLs, UInt16 inPort)
 {
 	//Eventually check for the existance of a specially formatted sdp file (assuming the server blindly returns sdps)
@@ -43,6 +43,133 @@
 #include "OSHeaders.h"
 #include "QTAccessFile.h"
 #include "OSArrayObjectDeleter.h"
+#include "OSRef.h"
+#include "OS.h"
+
+// One of these per directory a request has been authorized in. It remembers which
+// access file governs the directory and what that file contained, so the directory
+// walk and the file read are only repeated once the entry is older than
+// QTAccessFile::sCacheRevalidateMSecs, and then the file is only reread if its mod
+// date moved. The cache holds at most QTAccessFile::kMaxCacheEntries of these. Once it is
+// full, entries that haven't been revalidated for a couple of intervals are evicted.
+class QTAccessFileCacheEntry
+{
+    public:
+    
+        QTAccessFileCacheEntry(const StrPtrLen& inDir);
+        ~QTAccessFileCacheEntry();
+        
+        OSRef*  GetRef()    { return &fRef; }
+        
+        // True if no request has looked at this directory since inOldest. An entry that
+        // hasn't walked yet never is: its creator uses it without holding a ref.
+        Bool16  IsStale(SInt64 inOldest)    { OSMutexLocker locker(&fMutex); return (fLastChecked != 0) && (fLastChecked < inOldest); }
+        
+        // Returns a copy of the path of the access file governing this directory (or NULL),
+        // and if outAccessFileData is non-NULL a copy of its contents.
+        char*   GetAccessFile_Copy(const char* movieRootDir, const char* dirPath, StrPtrLen* outAccessFileData);
+        
+    private:
+    
+        void    Revalidate(const char* movieRootDir, const char* dirPath, SInt64 inNow);
+    
+        OSRef           fRef;
+        StrPtrLen       fDir;               // key
+        OSMutex         fMutex;             // protects everything below
+        SInt64          fLastChecked;       // 0 until the first walk
+        UInt32          fNameGeneration;    // access file name this entry was resolved with
+        char*           fMovieRootDir;      // the walk stops here
+        char*           fAccessFilePath;    // NULL if no access file governs this directory
+        StrPtrLen       fAccessFileData;
+        QTSS_TimeVal    fModDate;
+};
+
+QTAccessFileCacheEntry::QTAccessFileCacheEntry(const StrPtrLen& inDir)
+:   fLastChecked(0),
+    fNameGeneration(0),
+    fMovieRootDir(NULL),
+    fAccessFilePath(NULL),
+    fModDate(-1)
+{
+    fDir.Set(inDir.GetAsCString(), inDir.Len);
+    fRef.Set(fDir, this);
+}
+
+QTAccessFileCacheEntry::~QTAccessFileCacheEntry()
+{
+    delete [] fDir.Ptr;
+    delete [] fMovieRootDir;
+    delete [] fAccessFilePath;
+    delete [] fAccessFileData.Ptr;
+}
+
+char* QTAccessFileCacheEntry::GetAccessFile_Copy(const char* movieRootDir, const char* dirPath, StrPtrLen* outAccessFileData)
+{
+    OSMutexLocker locker(&fMutex);
+    
+    SInt64 theNow = OS::Milliseconds();
+    if  (   (fLastChecked == 0) 
+        ||  (theNow - fLastChecked >= QTAccessFile::sCacheRevalidateMSecs)
+        ||  (fNameGeneration != QTAccessFile::sAccessFileNameGeneration)
+        ||  (::strcmp(fMovieRootDir, movieRootDir) != 0)
+        )
+        this->Revalidate(movieRootDir, dirPath, theNow);
+    
+    if (outAccessFileData != NULL)
+    {
+        if (fAccessFileData.Ptr != NULL)
+        {
+            StrPtrLen theCopy(fAccessFileData.GetAsCString(), fAccessFileData.Len);
+            *outAccessFileData = theCopy;
+        }
+        else
+            outAccessFileData->Set(NULL, 0);
+    }
+    
+    if (fAccessFilePath == NULL)
+        return NULL;
+        
+    char* theAccessFilePath = NEW char[::strlen(fAccessFilePath) + 1];
+    ::strcpy(theAccessFilePath, fAccessFilePath);
+    return theAccessFilePath;
+}
+
+void QTAccessFileCacheEntry::Revalidate(const char* movieRootDir, const char* dirPath, SInt64 inNow)
+{
+    fLastChecked = inNow;
+    fNameGeneration = QTAccessFile::sAccessFileNameGeneration;
+    
+    if ((fMovieRootDir == NULL) || (::strcmp(fMovieRootDir, movieRootDir) != 0))
+    {
+        delete [] fMovieRootDir;
+        fMovieRootDir = NEW char[::strlen(movieRootDir) + 1];
+        ::strcpy(fMovieRootDir, movieRootDir);
+    }
+    
+    char* theAccessFilePath = QTAccessFile::FindAccessFile_Copy(movieRootDir, dirPath);
+    Bool16 samePath = (theAccessFilePath != NULL) && (fAccessFilePath != NULL) && (::strcmp(theAccessFilePath, fAccessFilePath) == 0);
+    
+    delete [] fAccessFilePath;
+    fAccessFilePath = theAccessFilePath;
+    
+    if (fAccessFilePath == NULL)
+    {
+        fAccessFileData.Delete();
+        fModDate = -1;
+        return;
+    }
+    
+    // Only reread the file if it is a different one or it changed since we last read it.
+    StrPtrLen theData;
+    QTSS_TimeVal theModDate = -1;
+    QTSS_Error theErr = QTSSModuleUtils::ReadEntireFile(fAccessFilePath, &theData, samePath ? fModDate : -1, &theModDate);
+    if ((theErr == QTSS_NoErr) && (theData.Ptr == NULL) && samePath)
+        return; // unchanged
+    
+    fAccessFileData.Delete();
+    fAccessFileData = theData;
+    fModDate = (theErr == QTSS_NoErr) ? theModDate : -1;
+}
 
 
 UInt8 QTAccessFile::sWhitespaceAndGreaterThanMask[] =
@@ -78,6 +205,10 @@ UInt8 QTAccessFile::sWhitespaceAndGreaterThanMask[] =
 char*       QTAccessFile::sQTAccessFileName = "qtaccess";
 Bool16      QTAccessFile::sAllocatedName = false;
 OSMutex*    QTAccessFile::sAccessFileMutex = NULL;//QTAccessFile isn't reentrant
+UInt32      QTAccessFile::sAccessFileNameGeneration = 0;
+OSRefTable* QTAccessFile::sAccessFileCache = NULL;
+SInt64      QTAccessFile::sCacheRevalidateMSecs = 10000;
+SInt64      QTAccessFile::sLastCacheSweep = 0;
 const int kBuffLen = 512;
 
 void QTAccessFile::Initialize() // called by server at initialize never call again
@@ -85,6 +216,10 @@ void QTAccessFile::Initialize() // called by server at initialize never call aga
     if(NULL == sAccessFileMutex)
     {   sAccessFileMutex = NEW OSMutex();
     }
+    
+    if(NULL == sAccessFileCache)
+    {   sAccessFileCache = NEW OSRefTable();
+    }
 }
 
 void QTAccessFile::SetAccessFileName(const char *inQTAccessFileName)
@@ -102,7 +237,7 @@ void QTAccessFile::SetAccessFileName(const char *inQTAccessFileName)
     sAllocatedName = true;
     sQTAccessFileName = NEW char[strlen(inQTAccessFileName)+1];
     ::strcpy(sQTAccessFileName, inQTAccessFileName);
-    
+    sAccessFileNameGeneration++;
 }
 
 
@@ -244,13 +379,103 @@ Bool16 QTAccessFile::AccessAllowed  (   char *userName, char**groupArray, UInt32
 }
 
 char*  QTAccessFile::GetAccessFile_Copy( const char* movieRootDir, const char* dirPath)
+{
+    return QTAccessFile::GetAccessFileData_Copy(movieRootDir, dirPath, NULL);
+}
+
+char*  QTAccessFile::GetAccessFileData_Copy( const char* movieRootDir, const char* dirPath, StrPtrLen* outAccessFileData)
+{
+    if(outAccessFileData != NULL)
+        outAccessFileData->Set(NULL, 0);
+
+    // Requests for every file in a directory share the directory's entry
+    StrPtrLen theDir((char*)dirPath);
+    char* lastSlash = ::strrchr(theDir.Ptr, kPathDelimiterChar);
+    if(lastSlash != NULL)
+        theDir.Len = lastSlash - theDir.Ptr;
+    
+    OSRef* theRef = NULL;
+    if((NULL != sAccessFileCache) && (0 != theDir.Len))
+        theRef = sAccessFileCache->Resolve(&theDir);
+    
+    // Not cacheable, or the cache is full of directories that are in use
+    if((NULL == theRef) && ((NULL == sAccessFileCache) || (0 == theDir.Len) || !QTAccessFile::MakeRoomInCache()))
+    {
+        char* accessFilePath = QTAccessFile::FindAccessFile_Copy(movieRootDir, dirPath);
+        if((accessFilePath != NULL) && (outAccessFileData != NULL))
+            (void)QTSSModuleUtils::ReadEntireFile(accessFilePath, outAccessFileData);
+        return accessFilePath;
+    }
+    
+    Bool16 resolved = true;
+    if(NULL == theRef)
+    {
+        QTAccessFileCacheEntry* theEntry = NEW QTAccessFileCacheEntry(theDir);
+        theRef = sAccessFileCache->RegisterOrResolve(theEntry->GetRef());
+        if(NULL == theRef) // our entry went in
+        {   theRef = theEntry->GetRef();
+            resolved = false;
+        }
+        else // someone else got there first
+            delete theEntry;
+    }
+    
+    QTAccessFileCacheEntry* theEntry = (QTAccessFileCacheEntry*)theRef->GetObject();
+    char* accessFilePath = theEntry->GetAccessFile_Copy(movieRootDir, dirPath, outAccessFileData);
+    
+    if(resolved)
+        sAccessFileCache->Release(theRef);
+        
+    return accessFilePath;
+}
+
+Bool16 QTAccessFile::MakeRoomInCache()
+{
+    if(sAccessFileCache->GetNumRefsInTable() < kMaxCacheEntries)
+        return true;
+    
+    OSMutexLocker locker(sAccessFileCache->GetMutex());
+    SInt64 theNow = OS::Milliseconds();
+    if((sLastCacheSweep != 0) && (theNow - sLastCacheSweep < sCacheRevalidateMSecs))
+        return (sAccessFileCache->GetNumRefsInTable() < kMaxCacheEntries);
+    sLastCacheSweep = theNow;
+    
+    // An entry in use is revalidated every interval, so one that hasn't been for two
+    // intervals hasn't been asked for in at least one. Collect them first: the table
+    // can't be walked while entries are being taken out of it.
+    QTAccessFileCacheEntry* theStaleEntries[kMaxEvictionsPerSweep];
+    UInt32 theNumStale = 0;
+    SInt64 theOldest = theNow - (2 * sCacheRevalidateMSecs);
+    for (OSRefHashTableIter theIter(sAccessFileCache->GetHashTable()); !theIter.IsDone() && (theNumStale < kMaxEvictionsPerSweep); theIter.Next())
+    {
+        QTAccessFileCacheEntry* theEntry = (QTAccessFileCacheEntry*)theIter.GetCurrent()->GetObject();
+        if(theEntry->IsStale(theOldest))
+            theStaleEntries[theNumStale++] = theEntry;
+    }
+    
+    for (UInt32 x = 0; x < theNumStale; x++)
+    {
+        // a request may have just resolved it, in which case it stays
+        if(sAccessFileCache->TryUnRegister(theStaleEntries[x]->GetRef()))
+            delete theStaleEntries[x];
+    }
+    
+    return (sAccessFileCache->GetNumRefsInTable() < kMaxCacheEntries);
+}
+
+char*  QTAccessFile::FindAccessFile_Copy( const char* movieRootDir, const char* dirPath)
 {   
-    OSMutexLocker locker(sAccessFileMutex);
+    char* accessFileName = NULL;
+    {   OSMutexLocker locker(sAccessFileMutex);
+        accessFileName = NEW char[::strlen(sQTAccessFileName) + 1];
+        ::strcpy(accessFileName, sQTAccessFileName);
+    }
+    OSCharArrayDeleter accessFileNameDeleter(accessFileName);
 
     char* currentDir= NULL;
     char* lastSlash = NULL;
     int movieRootDirLen = ::strlen(movieRootDir);
-    int maxLen = strlen(dirPath)+strlen(sQTAccessFileName) + strlen(kPathDelimiterString) + 1;
+    int maxLen = strlen(dirPath)+strlen(accessFileName) + strlen(kPathDelimiterString) + 1;
     currentDir = NEW char[maxLen];
 
     ::strcpy(currentDir, dirPath);
@@ -264,13 +489,13 @@ char*  QTAccessFile::GetAccessFile_Copy( const char* movieRootDir, const char* d
     
     while ( true )  //walk backward up the dir tree.
     {
-        int curLen = strlen(currentDir) + strlen(sQTAccessFileName) + strlen(kPathDelimiterString);
+        int curLen = strlen(currentDir) + strlen(accessFileName) + strlen(kPathDelimiterString);
 
         if( curLen >= maxLen )
             break;
     
         ::strcat(currentDir, kPathDelimiterString);
-        ::strcat(currentDir, sQTAccessFileName);
+        ::strcat(currentDir, accessFileName);
     
         QTSS_Object fileObject = NULL;
         if( QTSS_OpenFileObject(currentDir, qtssOpenFileNoFlags, &fileObject) == QTSS_NoErr) 
@@ -300,7 +525,7 @@ char*  QTAccessFile::GetAccessFile_Copy( const char* movieRootDir, const char* d
 
 // allocates memory for outUsersFilePath and outGroupsFilePath - remember to delete
 // returns the auth scheme
-QTSS_AuthScheme QTAccessFile::FindUsersAndGroupsFilesAndAuthScheme(char* inAccessFilePath, QTSS_ActionFlags inAction, char** outUsersFilePath, char** outGroupsFilePath)
+QTSS_AuthScheme QTAccessFile::FindUsersAndGroupsFilesAndAuthScheme(char* inAccessFilePath, QTSS_ActionFlags inAction, char** outUsersFilePath, char** outGroupsFilePath, StrPtrLen* inAccessFileData)
 {
     QTSS_AuthScheme authScheme = qtssAuthNone;
     QTSS_ActionFlags currentFlags = qtssActionFlagsRead;
@@ -314,8 +539,14 @@ QTSS_AuthScheme QTAccessFile::FindUsersAndGroupsFilesAndAuthScheme(char* inAcces
     //Assert(outGroupsFilePath == NULL);
     
     StrPtrLen accessFileBuf;
-    (void)QTSSModuleUtils::ReadEntireFile(inAccessFilePath, &accessFileBuf);
-    OSCharArrayDeleter accessFileBufDeleter(accessFileBuf.Ptr);
+    char* accessFileBufPtr = NULL; // only set if we read the file ourselves
+    if(inAccessFileData != NULL)
+        accessFileBuf = *inAccessFileData;
+    else
+    {   (void)QTSSModuleUtils::ReadEntireFile(inAccessFilePath, &accessFileBuf);
+        accessFileBufPtr = accessFileBuf.Ptr;
+    }
+    OSCharArrayDeleter accessFileBufDeleter(accessFileBufPtr);
     
     StringParser accessFileParser(&accessFileBuf);
     StrPtrLen line;
@@ -439,8 +670,10 @@ QTSS_Error QTAccessFile::AuthorizeRequest(QTSS_StandardRTSP_Params* inParams, Bo
     if(NULL == theUserProfile)
         return QTSS_RequestFailed;
 
-    char* accessFilePath = QTAccessFile::GetAccessFile_Copy(movieRootDirStr, pathBuffStr);
+    StrPtrLen accessFileBuf;
+    char* accessFilePath = QTAccessFile::GetAccessFileData_Copy(movieRootDirStr, pathBuffStr, &accessFileBuf);
     OSCharArrayDeleter accessFilePathDeleter(accessFilePath);
+    OSCharArrayDeleter accessFileBufDeleter(accessFileBuf.Ptr);
     
     if(NULL == accessFilePath) // we are done nothing to do
     {   if(QTSS_NoErr != QTSS_SetValue(theRTSPRequest,qtssRTSPReqUserAllowed, 0, &allowNoAccessFiles, sizeof(allowNoAccessFiles)))
@@ -454,10 +687,6 @@ QTSS_Error QTAccessFile::AuthorizeRequest(QTSS_StandardRTSP_Params* inParams, Bo
     UInt32 numGroups = 0;
     char** groupCharPtrArray =  QTSSModuleUtils::GetGroupsArray_Copy(theUserProfile, &numGroups);
     OSCharPointerArrayDeleter groupCharPtrArrayDeleter(groupCharPtrArray);
-    
-    StrPtrLen accessFileBuf;
-    (void)QTSSModuleUtils::ReadEntireFile(accessFilePath, &accessFileBuf);
-    OSCharArrayDeleter accessFileBufDeleter(accessFileBuf.Ptr);
         
     char realmName[kBuffLen] = { 0 };
     StrPtrLen   realmNameStr(realmName,kBuffLen -1);
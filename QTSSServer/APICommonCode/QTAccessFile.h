@@ -38,6 +38,8 @@
 #include "StrPtrLen.h"
 #include "OSHeaders.h"
 
+class OSRefTable;
+
 class QTAccessFile
 {
     public:
@@ -51,6 +53,19 @@ class QTAccessFile
         // GetGroupsArrayCopy allocates outGroupCharPtrArray. Caller must "delete [] outGroupCharPtrArray" when done.
         static char*  GetAccessFile_Copy( const char* movieRootDir, const char* dirPath);
 
+        //GetAccessFileData_Copy
+        //
+        // Same as GetAccessFile_Copy, but also returns a copy of the access file's contents
+        // in outAccessFileData. Caller must delete [] both the result and outAccessFileData->Ptr.
+        // Both come out of a per directory cache, so the directory walk and the file read only
+        // happen again once the cached entry is older than the revalidate interval.
+        static char*  GetAccessFileData_Copy( const char* movieRootDir, const char* dirPath, StrPtrLen* outAccessFileData);
+
+        // How long a cached directory -> access file lookup is trusted before the
+        // directories are walked again and the access file's mod date is rechecked.
+        static void SetCacheRevalidateInterval(UInt32 inSeconds) { sCacheRevalidateMSecs = (SInt64)inSeconds * 1000; }
+        static SInt64 GetCacheRevalidateMSecs() { return sCacheRevalidateMSecs; }
+
         //AccessAllowed
         //
         // This routine is used to get the Realm to send back to a user and to check if a user has access
@@ -69,14 +84,35 @@ class QTAccessFile
         
                 // allocates memory for outUsersFilePath and outGroupsFilePath - remember to delete
                 // returns the auth scheme
-                static QTSS_AuthScheme FindUsersAndGroupsFilesAndAuthScheme(char* inAccessFilePath, QTSS_ActionFlags inAction, char** outUsersFilePath, char** outGroupsFilePath);
+                // if inAccessFileData is non-NULL it is parsed instead of reading inAccessFilePath
+                static QTSS_AuthScheme FindUsersAndGroupsFilesAndAuthScheme(char* inAccessFilePath, QTSS_ActionFlags inAction, char** outUsersFilePath, char** outGroupsFilePath, StrPtrLen* inAccessFileData = NULL);
                 
         static QTSS_Error AuthorizeRequest(QTSS_StandardRTSP_Params* inParams, Bool16 allowNoAccessFiles, QTSS_ActionFlags noAction, QTSS_ActionFlags authorizeAction);
 
     private:    
+        // Walks up from dirPath to movieRootDir looking for an access file. Not cached.
+        static char*  FindAccessFile_Copy( const char* movieRootDir, const char* dirPath);
+
+        // Returns true if there is room in the cache for one more directory. If it is full,
+        // at most once per revalidate interval, evicts the entries no request has revalidated
+        // for two intervals.
+        static Bool16 MakeRoomInCache();
+
+        enum
+        {
+            kMaxCacheEntries = 1024,    //UInt32
+            kMaxEvictionsPerSweep = 256 //UInt32
+        };
+
         static char* sQTAccessFileName; // managed by the QTAccess module
         static Bool16 sAllocatedName;
-        static OSMutex* sAccessFileMutex;
+        static OSMutex* sAccessFileMutex; // only guards sQTAccessFileName now, lookups go through the cache
+        static UInt32 sAccessFileNameGeneration; // bumped by SetAccessFileName, invalidates the cache
+        static OSRefTable* sAccessFileCache; // directory -> QTAccessFileCacheEntry
+        static SInt64 sCacheRevalidateMSecs;
+        static SInt64 sLastCacheSweep; // guarded by sAccessFileCache's mutex
+
+        friend class QTAccessFileCacheEntry;
 };
 
 #endif //_QT_ACCESS_FILE_H_
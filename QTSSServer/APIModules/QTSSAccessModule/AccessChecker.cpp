@@ -50,6 +50,7 @@
 #include "AccessChecker.h"
 #include "QTSSModuleUtils.h"
 #include "OSArrayObjectDeleter.h"
+#include "OS.h"
 
 static StrPtrLen sAuthWord("realm", 5);
 
@@ -62,7 +63,9 @@ AccessChecker::AccessChecker() :
     fGroupsFileModDate(-1),
     fProfiles(NULL),
     fNumUsers(0),
-    fCurrentSize(0)
+    fCurrentSize(0),
+    fProfileTable(NULL),
+    fLastUpdateTime(0)
 {
 }
 
@@ -116,6 +119,10 @@ void AccessChecker::DeleteProfilesAndRealm()
         {
             UserProfile* profile = fProfiles[i];
             
+            // the hash table deletes whatever is still in it, so take the profile out first
+            if(fProfileTable != NULL)
+                fProfileTable->Remove(profile);
+            
             // delete the username
             if((profile->username).Len != 0) 
             {
@@ -157,6 +164,9 @@ void AccessChecker::DeleteProfilesAndRealm()
         fProfiles = NULL;
     }
     
+    delete fProfileTable;
+    fProfileTable = NULL;
+    
     // delete the fAuthRealm field
     if(fAuthRealm.Len != 0) {
         delete fAuthRealm.Ptr;
@@ -181,6 +191,8 @@ UInt32 AccessChecker::UpdateUserProfiles() {
         
     StrPtrLen line;
     
+        fLastUpdateTime = OS::Milliseconds();
+        
         QTSS_TimeVal oldUsersFileModDate = fUsersFileModDate;
         QTSS_TimeVal oldGroupsFileModDate = fGroupsFileModDate;
         
@@ -345,6 +357,7 @@ UInt32 AccessChecker::UpdateUserProfiles() {
         index ++;
     }
     fNumUsers = index;
+    BuildProfileTable();
     
         if(!groupFileErrors)    
     {
@@ -373,26 +386,24 @@ UInt32 AccessChecker::UpdateUserProfiles() {
                             {
                                     groupLineParser.ConsumeWhitespace();
                                     groupLineParser.ConsumeUntilWhitespace(&groupUser);
-                                    for(i = 0; i < fNumUsers; i++) {
-                                            if(fProfiles[i]->username.Equal(groupUser))
-                                            {
-                                                    UInt32 grpSize = fProfiles[i]->groupsSize;
-                                                    if(fProfiles[i]->numGroups >= grpSize) {
-                                                            char** oldGroups = fProfiles[i]->groups;
-                                                            fProfiles[i]->groups = NEW char*[grpSize * 2];
-                                                            for(j = 0; j < grpSize; j++) {
-                                                                    fProfiles[i]->groups[j] = oldGroups[j];
-                                                            }
-                                                            fProfiles[i]->groupsSize *= 2;
-                                                            delete [] oldGroups;
+                                    UserProfile* profile = MapUserProfile(&groupUser);
+                                    if(profile != NULL)
+                                    {
+                                            UInt32 grpSize = profile->groupsSize;
+                                            if(profile->numGroups >= grpSize) {
+                                                    char** oldGroups = profile->groups;
+                                                    profile->groups = NEW char*[grpSize * 2];
+                                                    for(j = 0; j < grpSize; j++) {
+                                                            profile->groups[j] = oldGroups[j];
                                                     }
-                                                    
-                                                    fProfiles[i]->groups[fProfiles[i]->numGroups] = groupName.GetAsCString();
-                                                    if(nameLen > fProfiles[i]->maxGroupNameLen) 
-                                                            fProfiles[i]->maxGroupNameLen = nameLen;
-                                                    fProfiles[i]->numGroups++;
-                                                    break;
+                                                    profile->groupsSize *= 2;
+                                                    delete [] oldGroups;
                                             }
+                                            
+                                            profile->groups[profile->numGroups] = groupName.GetAsCString();
+                                            if(nameLen > profile->maxGroupNameLen) 
+                                                    profile->maxGroupNameLen = nameLen;
+                                            profile->numGroups++;
                                     }
                             }
                     }
@@ -416,11 +427,38 @@ Bool16  AccessChecker::HaveFilePathsChanged(const char* inUsersFilePath, const c
 // No memory is allocated
 AccessChecker::UserProfile* AccessChecker::RetrieveUserProfile(const StrPtrLen* inUserName)
 {
-    UInt32 index = 0;
-    for(index = 0; index < fNumUsers; index++) {
-        if(fProfiles[index]->username.Equal(*inUserName)) 
-            return fProfiles[index];
+    return MapUserProfile(inUserName);
+}
+
+// Allocates the fProfileTable, sized for fNumUsers
+void AccessChecker::BuildProfileTable()
+{
+    // keep the chains short, and a power of 2 so the table can mask instead of mod
+    UInt32 tableSize = 64;
+    while(tableSize < fNumUsers * 2)
+        tableSize <<= 1;
+        
+    fProfileTable = NEW OSHashTable<UserProfile, AccessCheckerProfileKey>(tableSize);
+    for(UInt32 index = 0; index < fNumUsers; index++)
+    {
+        UserProfile* profile = fProfiles[index];
+        profile->fHashValue = AccessCheckerProfileKey::HashUserName(&profile->username);
+        profile->fNextHashEntry = NULL;
+        
+        // If a username is in the file twice, the first one wins, as it did
+        // when the profiles were searched in order
+        if(MapUserProfile(&profile->username) == NULL)
+            fProfileTable->Add(profile);
     }
-    return NULL;
+}
+
+// No memory is allocated
+AccessChecker::UserProfile* AccessChecker::MapUserProfile(const StrPtrLen* inUserName)
+{
+    if(fProfileTable == NULL)
+        return NULL;
+        
+    AccessCheckerProfileKey key(inUserName);
+    return fProfileTable->Map(&key);
 }
 
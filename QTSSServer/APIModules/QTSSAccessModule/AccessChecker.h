@@ -35,6 +35,9 @@
 #include "QTSS.h"
 #include "StrPtrLen.h"
 #include "OSHeaders.h"
+#include "OSHashTable.h"
+
+class AccessCheckerProfileKey;
 
 class AccessChecker
 {
@@ -55,9 +58,8 @@ class AccessChecker
             If not found, 
                 deny access
                 
-    ToDo:
-        would probably be a good idea to do some caching of ".qtaccess" data to avoid
-        multiple directory walks
+    The ".qtaccess" lookup is cached per directory by QTAccessFile, and the profiles
+    are indexed by username, so neither costs more than a hash lookup per request.
 */
 
 public:
@@ -70,6 +72,9 @@ public:
         UInt32      maxGroupNameLen;
         UInt32      numGroups;
         UInt32      groupsSize;
+        
+        UInt32      fHashValue;     // of username
+        UserProfile* fNextHashEntry;
     };
     
     AccessChecker();
@@ -77,6 +82,11 @@ public:
     
     void UpdateFilePaths(const char* inUsersFilePath, const char* inGroupsFilePath);
     UInt32 UpdateUserProfiles();
+    
+    // True if the users and groups files haven't been checked for changes
+    // in the last inIntervalMSecs. UpdateUserProfiles resets the clock.
+    Bool16  NeedsUpdate(SInt64 inNow, SInt64 inIntervalMSecs)
+        { return (fLastUpdateTime == 0) || (inNow - fLastUpdateTime >= inIntervalMSecs); }
 
     Bool16  HaveFilePathsChanged(const char* inUsersFilePath, const char* inGroupsFilePath);
     UserProfile* RetrieveUserProfile(const StrPtrLen* inUserName);
@@ -104,12 +114,53 @@ protected:
     UserProfile**       fProfiles;
     UInt32              fNumUsers;
     UInt32              fCurrentSize;
+    
+    // Indexes fProfiles by username. Rebuilt whenever the profiles are.
+    OSHashTable<UserProfile, AccessCheckerProfileKey>* fProfileTable;
+    SInt64              fLastUpdateTime;
         
     static const char*  kDefaultUsersFilePath;
     static const char*  kDefaultGroupsFilePath;
     
 private:
     void DeleteProfilesAndRealm();
+    void BuildProfileTable();
+    UserProfile* MapUserProfile(const StrPtrLen* inUserName);
+};
+
+class AccessCheckerProfileKey
+{
+public:
+
+    AccessCheckerProfileKey(const StrPtrLen* inUserName)
+        :   fUserName(inUserName), fHashValue(HashUserName(inUserName)) {}
+    ~AccessCheckerProfileKey() {}
+    
+    // usernames often differ by a digit or two, so hash every byte (FNV-1a)
+    static UInt32 HashUserName(const StrPtrLen* inUserName)
+    {
+        UInt32 theHash = 2166136261U;
+        for (UInt32 x = 0; x < inUserName->Len; x++)
+            theHash = ((theHash ^ (UInt8)inUserName->Ptr[x]) * 16777619U) & 0xFFFFFFFF;
+        return theHash;
+    }
+    
+private:
+
+    AccessCheckerProfileKey(AccessChecker::UserProfile* inProfile)
+        :   fUserName(&inProfile->username), fHashValue(inProfile->fHashValue) {}
+        
+    UInt32  GetHashKey()    { return fHashValue; }
+    
+    friend int operator ==(const AccessCheckerProfileKey &key1, const AccessCheckerProfileKey &key2)
+    {
+        return (key1.fHashValue == key2.fHashValue) && key1.fUserName->Equal(*key2.fUserName);
+    }
+    
+    const StrPtrLen*    fUserName;
+    UInt32              fHashValue;
+    
+    friend class OSHashTable<AccessChecker::UserProfile, AccessCheckerProfileKey>;
 };
 
 #endif //_QTSSACCESSCHECKER_H_
@@ -49,6 +49,7 @@
 #include "AccessChecker.h"
 #include "QTAccessFile.h"
 #include "QTSSModuleUtils.h"
+#include "OSMutexRW.h"
 
 #ifndef __Win32__
 #include <unistd.h>
@@ -67,7 +68,7 @@
 #define MODPREFIX_ "modAccess_"
 
 static StrPtrLen    sSDPSuffix(".sdp");
-static OSMutex*     sUserMutex              = NULL;
+static OSMutexRW*   sUserMutex              = NULL;
 
 //static Bool16         sDefaultAuthenticationEnabled   = true;
 //static Bool16         sAuthenticationEnabled          = true;
@@ -80,6 +81,9 @@ static char* sGroupsFilePath = NULL;
 
 static char* sDefaultAccessFileName = "qtaccess";
 
+static UInt32 sCacheRevalidateInterval = 10;
+static UInt32 sDefaultCacheRevalidateInterval = 10;
+
 static QTSS_AttributeID sBadNameMessageAttrID               = qtssIllegalAttrID;
 static QTSS_AttributeID sUsersFileNotFoundMessageAttrID     = qtssIllegalAttrID;
 static QTSS_AttributeID sGroupsFileNotFoundMessageAttrID    = qtssIllegalAttrID;
@@ -106,6 +110,7 @@ static QTSS_Error RereadPrefs();
 static QTSS_Error AuthenticateRTSPRequest(QTSS_RTSPAuth_Params* inParams);
 static QTSS_Error AccessAuthorizeRTSPRequest(QTSS_StandardRTSP_Params* inParams);
 static char*      GetCheckedFileName();
+static AccessChecker* GetAccessChecker(char* inUsersFilePath, char* inGroupsFilePath, Bool16 inWriteLocked);
 
 // FUNCTION IMPLEMENTATIONS
 
@@ -198,9 +203,9 @@ QTSS_Error Initialize(QTSS_Initialize_Params* inParams)
     sMessages = inParams->inMessages;
     sPrefs = QTSSModuleUtils::GetModulePrefsObject(inParams->inModule);
     sServerPrefs = inParams->inPrefs;
-    sUserMutex = NEW OSMutex();
-    RereadPrefs();
+    sUserMutex = NEW OSMutexRW();
     QTAccessFile::Initialize();
+    RereadPrefs();
     
     return QTSS_NoErr;
 }
@@ -257,7 +262,7 @@ char* GetCheckedFileName()
 
 QTSS_Error RereadPrefs()
 {
-    OSMutexLocker locker(sUserMutex);
+    OSMutexWriteLocker locker(sUserMutex);
     
     //
     // Use the standard GetAttribute routine to retrieve the correct values for our preferences
@@ -287,6 +292,10 @@ QTSS_Error RereadPrefs()
     QTAccessFile::SetAccessFileName(accessFile);
     delete [] accessFile;
     
+    QTSSModuleUtils::GetAttribute(sPrefs, MODPREFIX_"cache_revalidate_interval", qtssAttrDataTypeUInt32,
+                            &sCacheRevalidateInterval, &sDefaultCacheRevalidateInterval, sizeof(sCacheRevalidateInterval));
+    QTAccessFile::SetCacheRevalidateInterval(sCacheRevalidateInterval);
+    
     if(sAccessCheckers[0]->HaveFilePathsChanged(sUsersFilePath, sGroupsFilePath))
     {
         sAccessCheckers[0]->UpdateFilePaths(sUsersFilePath, sGroupsFilePath);
@@ -305,76 +314,30 @@ QTSS_Error RereadPrefs()
     return QTSS_NoErr;
 }
 
-QTSS_Error AuthenticateRTSPRequest(QTSS_RTSPAuth_Params* inParams)
+// Returns the AccessChecker for the given users and groups files, NULL meaning the
+// ones in the prefs. sUserMutex must be held. Without the write lock, returns NULL
+// if the checker would have to be created or its files reread first.
+AccessChecker* GetAccessChecker(char* inUsersFilePath, char* inGroupsFilePath, Bool16 inWriteLocked)
 {
-    QTSS_RTSPRequestObject  theRTSPRequest = inParams->inRTSPRequest;
-    UInt32 fileErr;
-    
-    OSMutexLocker locker(sUserMutex);
-
-    if  ( (NULL == inParams) || (NULL == inParams->inRTSPRequest) )
-        return QTSS_RequestFailed;
-
-    // Get the user profile object from the request object
-    QTSS_UserProfileObject theUserProfile = NULL;
-    UInt32 len = sizeof(QTSS_UserProfileObject);
-    QTSS_Error theErr = QTSS_GetValue(theRTSPRequest, qtssRTSPReqUserProfile, 0, (void*)&theUserProfile, &len);
-    Assert(len == sizeof(QTSS_UserProfileObject));
-    if(theErr != QTSS_NoErr)
-        return theErr;
-        
-    Bool16 defaultPaths = true;
-    // Check for a users and groups file in the access file
-    // For this, first get local file path and root movie directory
-    //get the local file path
-    char*   pathBuffStr = QTSSModuleUtils::GetLocalPath_Copy(theRTSPRequest);
-    OSCharArrayDeleter pathBuffDeleter(pathBuffStr);
-    if(NULL == pathBuffStr)
-        return QTSS_RequestFailed;
-    //get the root movie directory
-    char*   movieRootDirStr = QTSSModuleUtils::GetMoviesRootDir_Copy(theRTSPRequest);
-    OSCharArrayDeleter movieRootDeleter(movieRootDirStr);
-    if(NULL == movieRootDirStr)
-        return QTSS_RequestFailed;
-    // Now get the access file path
-    char* accessFilePath = QTAccessFile::GetAccessFile_Copy(movieRootDirStr, pathBuffStr);
-    OSCharArrayDeleter accessFilePathDeleter(accessFilePath);
-    // Parse the access file for the AuthUserFile and AuthGroupFile keywords
-    char* usersFilePath = NULL;
-    char* groupsFilePath = NULL;
-        
-        // Get the request action from the request object
-        QTSS_ActionFlags action = qtssActionFlagsNoFlags;
-        len = sizeof(action);
-        theErr = QTSS_GetValue(theRTSPRequest, qtssRTSPReqAction, 0, (void*)&action, &len);
-        Assert(len == sizeof(action));
-        if(theErr != QTSS_NoErr)
-            return theErr;
-        
-    // Allocates memory for usersFilePath and groupsFilePath
-    QTSS_AuthScheme authScheme = QTAccessFile::FindUsersAndGroupsFilesAndAuthScheme(accessFilePath, action, &usersFilePath, &groupsFilePath);
-    
-    if((usersFilePath != NULL) || (groupsFilePath != NULL)) 
-        defaultPaths = false;
-        
-    if(usersFilePath == NULL)
-        usersFilePath = sUsersFilePath;
-        
-    if(groupsFilePath == NULL)
-        groupsFilePath = sGroupsFilePath;
-        
     AccessChecker* currentChecker = NULL;
+    UInt32 fileErr;
     UInt32 index;
     
     // If the default users and groups file are not the ones we need
-    if(!defaultPaths) 
+    if((inUsersFilePath != NULL) || (inGroupsFilePath != NULL))
     {
+        if(inUsersFilePath == NULL)
+            inUsersFilePath = sUsersFilePath;
+            
+        if(inGroupsFilePath == NULL)
+            inGroupsFilePath = sGroupsFilePath;
+            
         // check if there is one AccessChecker that matches the needed paths
         // Don't have to check for the first one (or element zero) because it has the default paths
         for(index = 1; index < sNumAccessCheckers; index++)
         {
             // If an access checker that matches the users and groups file paths is found
-            if(!sAccessCheckers[index]->HaveFilePathsChanged(usersFilePath, groupsFilePath))
+            if(!sAccessCheckers[index]->HaveFilePathsChanged(inUsersFilePath, inGroupsFilePath))
             {
                 currentChecker = sAccessCheckers[index];
                 break;
@@ -383,6 +346,9 @@ QTSS_Error AuthenticateRTSPRequest(QTSS_RTSPAuth_Params* inParams)
         // If an existing AccessChecker for the needed paths isn't found
         if(currentChecker == NULL)
         {
+            if(!inWriteLocked)
+                return NULL;
+                
             // Grow the AccessChecker array if needed
             if(sNumAccessCheckers == sAccessCheckerArraySize)
             {
@@ -398,33 +364,22 @@ QTSS_Error AuthenticateRTSPRequest(QTSS_RTSPAuth_Params* inParams)
         
             // And create a new AccessChecker for the paths
             sAccessCheckers[sNumAccessCheckers] = NEW AccessChecker();
-            sAccessCheckers[sNumAccessCheckers]->UpdateFilePaths(usersFilePath, groupsFilePath);
+            sAccessCheckers[sNumAccessCheckers]->UpdateFilePaths(inUsersFilePath, inGroupsFilePath);
             fileErr = sAccessCheckers[sNumAccessCheckers]->UpdateUserProfiles();
             
             if(fileErr & AccessChecker::kUsersFileNotFoundErr)
-                QTSSModuleUtils::LogError(qtssWarningVerbosity,sUsersFileNotFoundMessageAttrID, 0, usersFilePath, NULL);
+                QTSSModuleUtils::LogError(qtssWarningVerbosity,sUsersFileNotFoundMessageAttrID, 0, inUsersFilePath, NULL);
             else if(fileErr & AccessChecker::kBadUsersFileErr)
-                QTSSModuleUtils::LogError(qtssWarningVerbosity,sBadUsersFileMessageAttrID, 0, usersFilePath, NULL);
+                QTSSModuleUtils::LogError(qtssWarningVerbosity,sBadUsersFileMessageAttrID, 0, inUsersFilePath, NULL);
             if(fileErr & AccessChecker::kGroupsFileNotFoundErr)
-                QTSSModuleUtils::LogError(qtssWarningVerbosity,sGroupsFileNotFoundMessageAttrID, 0, groupsFilePath, NULL);
+                QTSSModuleUtils::LogError(qtssWarningVerbosity,sGroupsFileNotFoundMessageAttrID, 0, inGroupsFilePath, NULL);
             else if(fileErr & AccessChecker::kBadGroupsFileErr)
-                QTSSModuleUtils::LogError(qtssWarningVerbosity,sBadGroupsFileMessageAttrID, 0, groupsFilePath, NULL);
+                QTSSModuleUtils::LogError(qtssWarningVerbosity,sBadGroupsFileMessageAttrID, 0, inGroupsFilePath, NULL);
                 
             currentChecker = sAccessCheckers[sNumAccessCheckers];
             sNumAccessCheckers++;
+            return currentChecker;
         }
-        
-        // If the usersFilePath is the same as the main users file path, no new memory is allocated
-        // because QTAccessFile::FindUsersAndGroupsFilesAndAuthScheme returned NULL, and we just copied the pointer
-        // Otherwise, delete the memory allocated
-        if(strcmp(usersFilePath, sUsersFilePath) != 0)  
-            delete usersFilePath;
-        
-        // If the groupsFilePath is the same as the main groups file path, no new memory is allocated
-        // because QTAccessFile::FindUsersAndGroupsFilesAndAuthScheme returned NULL, and we just copied the pointer
-        // Otherwise, delete the memory allocated
-        if(strcmp(groupsFilePath, sGroupsFilePath) != 0)    
-            delete groupsFilePath;
     }
     else
     {
@@ -433,23 +388,81 @@ QTSS_Error AuthenticateRTSPRequest(QTSS_RTSPAuth_Params* inParams)
     
     // Before retrieving the user profile information
     // check if the groups/users files have been modified and update them otherwise
-    fileErr = currentChecker->UpdateUserProfiles();
-    
-    /*
-    // This is for logging the errors if users file and/or the groups file is not found or corrupted
-    char* usersFile = currentChecker->GetUsersFilePathPtr();
-    char* groupsFile = currentChecker->GetGroupsFilePathPtr();
-    
-    if(fileErr & AccessChecker::kUsersFileNotFoundErr)
-        QTSSModuleUtils::LogError(qtssWarningVerbosity,sUsersFileNotFoundMessageAttrID, 0, usersFile, NULL);
-    else if(fileErr & AccessChecker::kBadUsersFileErr)
-        QTSSModuleUtils::LogError(qtssWarningVerbosity,sBadUsersFileMessageAttrID, 0, usersFile, NULL);
-    if(fileErr & AccessChecker::kGroupsFileNotFoundErr)
-        QTSSModuleUtils::LogError(qtssWarningVerbosity,sGroupsFileNotFoundMessageAttrID, 0, groupsFile, NULL);
-    else if(fileErr & AccessChecker::kBadGroupsFileErr)
-        QTSSModuleUtils::LogError(qtssWarningVerbosity,sBadGroupsFileMessageAttrID, 0, groupsFile, NULL);
-      */
+    if(currentChecker->NeedsUpdate(OS::Milliseconds(), QTAccessFile::GetCacheRevalidateMSecs()))
+    {
+        if(!inWriteLocked)
+            return NULL;
+        (void)currentChecker->UpdateUserProfiles();
+    }
+    
+    return currentChecker;
+}
+
+QTSS_Error AuthenticateRTSPRequest(QTSS_RTSPAuth_Params* inParams)
+{
+    QTSS_RTSPRequestObject  theRTSPRequest = inParams->inRTSPRequest;
+    
+    if  ( (NULL == inParams) || (NULL == inParams->inRTSPRequest) )
+        return QTSS_RequestFailed;
 
+    // Get the user profile object from the request object
+    QTSS_UserProfileObject theUserProfile = NULL;
+    UInt32 len = sizeof(QTSS_UserProfileObject);
+    QTSS_Error theErr = QTSS_GetValue(theRTSPRequest, qtssRTSPReqUserProfile, 0, (void*)&theUserProfile, &len);
+    Assert(len == sizeof(QTSS_UserProfileObject));
+    if(theErr != QTSS_NoErr)
+        return theErr;
+        
+    // Check for a users and groups file in the access file
+    // For this, first get local file path and root movie directory
+    //get the local file path
+    char*   pathBuffStr = QTSSModuleUtils::GetLocalPath_Copy(theRTSPRequest);
+    OSCharArrayDeleter pathBuffDeleter(pathBuffStr);
+    if(NULL == pathBuffStr)
+        return QTSS_RequestFailed;
+    //get the root movie directory
+    char*   movieRootDirStr = QTSSModuleUtils::GetMoviesRootDir_Copy(theRTSPRequest);
+    OSCharArrayDeleter movieRootDeleter(movieRootDirStr);
+    if(NULL == movieRootDirStr)
+        return QTSS_RequestFailed;
+    // Now get the access file path and contents. These come out of QTAccessFile's
+    // per directory cache, so they don't need sUserMutex.
+    StrPtrLen accessFileBuf;
+    char* accessFilePath = QTAccessFile::GetAccessFileData_Copy(movieRootDirStr, pathBuffStr, &accessFileBuf);
+    OSCharArrayDeleter accessFilePathDeleter(accessFilePath);
+    OSCharArrayDeleter accessFileBufDeleter(accessFileBuf.Ptr);
+    // Parse the access file for the AuthUserFile and AuthGroupFile keywords
+    char* usersFilePath = NULL;
+    char* groupsFilePath = NULL;
+        
+        // Get the request action from the request object
+        QTSS_ActionFlags action = qtssActionFlagsNoFlags;
+        len = sizeof(action);
+        theErr = QTSS_GetValue(theRTSPRequest, qtssRTSPReqAction, 0, (void*)&action, &len);
+        Assert(len == sizeof(action));
+        if(theErr != QTSS_NoErr)
+            return theErr;
+        
+    // Allocates memory for usersFilePath and groupsFilePath
+    QTSS_AuthScheme authScheme = QTAccessFile::FindUsersAndGroupsFilesAndAuthScheme(accessFilePath, action, &usersFilePath, &groupsFilePath, &accessFileBuf);
+    OSCharArrayDeleter usersFilePathDeleter(usersFilePath);
+    OSCharArrayDeleter groupsFilePathDeleter(groupsFilePath);
+    
+    // Looking the user up only needs the read lock. Creating an AccessChecker or
+    // rereading the users and groups files takes the write lock, and that only
+    // happens once per cache_revalidate_interval.
+    OSMutexReadLocker readLocker(sUserMutex);
+    OSMutexWriteLocker writeLocker(NULL);
+    AccessChecker* currentChecker = GetAccessChecker(usersFilePath, groupsFilePath, false);
+    if(currentChecker == NULL)
+    {
+        readLocker.UnLock();
+        readLocker.SetMutex(NULL);
+        writeLocker.SetMutex(sUserMutex);
+        writeLocker.Lock();
+        currentChecker = GetAccessChecker(usersFilePath, groupsFilePath, true);
+    }
+    
     // Retrieve the password data and group information for the user and set them
     // in the qtssRTSPReqUserProfile attr
     // The password data is crypt of the real password for Basic authentication
@@ -506,7 +519,7 @@ QTSS_Error AuthenticateRTSPRequest(QTSS_RTSPAuth_Params* inParams)
     
     // Set the multivalued qtssUserGroups attr to the groups the user belongs to, if any
     UInt32 maxLen = profile->maxGroupNameLen;
-    for(index = 0; index < profile->numGroups; index++) 
+    for(UInt32 index = 0; index < profile->numGroups; index++) 
     {
         UInt32 curLen = ::strlen(profile->groups[index]);
         if(curLen < maxLen) 
@@ -70,8 +70,9 @@ static UInt32   sLossesToThick          = 6;
 static UInt32   sWorsesToThin           = 2;
 static Bool16   sModuleEnabled      = true;
 
-// Server preference we respect
+// Server preferences we respect
 static Bool16   sDisableThinning       = false;
+static Bool16   sRTCPRateControlEnabled = true;
 
 
 // FUNCTION PROTOTYPES
@@ -164,6 +165,9 @@ QTSS_Error RereadPrefs()
 
     UInt32 len = sizeof(sDisableThinning);
     (void) QTSS_GetValue(sServerPrefs, qtssPrefsDisableThinning, 0, (void*)&sDisableThinning, &len);
+    
+    len = sizeof(sRTCPRateControlEnabled);
+    (void) QTSS_GetValue(sServerPrefs, qtssPrefsRTCPRateControlEnabled, 0, (void*)&sRTCPRateControlEnabled, &len);
                                 
     return QTSS_NoErr;
 }
@@ -171,7 +175,10 @@ QTSS_Error RereadPrefs()
 
 QTSS_Error ProcessRTCPPacket(QTSS_RTCPProcess_Params* inParams)
 {
-    if(!sModuleEnabled || sDisableThinning)
+    //
+    // When the server's own RTCP rate controller is on, it thins UDP streams itself
+    // from the receiver reports, so this algorithm must stay out of its way.
+    if(!sModuleEnabled || sDisableThinning || sRTCPRateControlEnabled)
         return QTSS_NoErr;
         
 
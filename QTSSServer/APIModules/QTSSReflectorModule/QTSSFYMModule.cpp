@@ -197,6 +197,7 @@ static StrPtrLen    sBroadcastNotActive("Broadcast is not active.");
 static StrPtrLen    sTheNowRangeHeader("npt=now-");
 
 const int kBuffLen = 512;
+const SInt64 kDescribeCacheCheckIntervalMS = 1000; // how stale a running session's idea of its SDP file may get
 
 // FUNCTION PROTOTYPES
 
@@ -213,10 +214,14 @@ static QTSS_Error DoPlay(QTSS_StandardRTSP_Params* inParams, ReflectorSession* i
 static QTSS_Error DestroySession(QTSS_ClientSessionClosing_Params* inParams);
 static void RemoveOutput(ReflectorOutput* inOutput, ReflectorSession* inSession, Bool16 killClients);
 static ReflectorSession* DoSessionSetup(QTSS_StandardRTSP_Params* inParams, QTSS_AttributeID inPathType,Bool16 isPush=false,Bool16 *foundSessionPtr= NULL, char** resultFilePath = NULL);
+static void DoDescribeFormatCacheKey(QTSS_StandardRTSP_Params* inParams, UInt32 inBandwidthPercent, ResizeableStringFormatter* outKey);
+static Bool16 DoDescribeIsResponseCurrent(ReflectorSession* inSession, ReflectorDescribeResponse* inResponse);
+static void DoDescribeSendResponse(QTSS_StandardRTSP_Params* inParams, ReflectorDescribeResponse* inResponse);
 static QTSS_Error RereadPrefs();
 static QTSS_Error ProcessRTPData(QTSS_IncomingData_Params* inParams);
 static QTSS_Error ReflectorAuthorizeRTSPRequest(QTSS_StandardRTSP_Params* inParams);
 static Bool16 InfoPortsOK(QTSS_StandardRTSP_Params* inParams, SDPSourceInfo* theInfo, StrPtrLen* inPath);
+static Bool16 CheckSessionSDPFile(QTSS_StandardRTSP_Params* inParams, ReflectorSession* inSession, StrPtrLen* inPath);
 void KillCommandPathInList();
 Bool16 KillSession(StrPtrLen *sdpPath, Bool16 killClients);
 QTSS_Error IntervalRole();
@@ -1139,6 +1144,45 @@ void DoDescribeAddRequiredSDPLines(QTSS_StandardRTSP_Params* inParams, Reflector
 
 }
 
+void DoDescribeFormatCacheKey(QTSS_StandardRTSP_Params* inParams, UInt32 inBandwidthPercent, ResizeableStringFormatter* outKey)
+{
+    // Everything the DESCRIBE body depends on besides the session and its SDP file:
+    // the s= and o= lines that may be filled in, and the player's bandwidth
+    StrPtrLen theFilePath;
+    (void)QTSS_GetValuePtr(inParams->inRTSPRequest, qtssRTSPReqFilePath, 0, (void**)&theFilePath.Ptr, &theFilePath.Len);
+    outKey->Put(theFilePath);
+    outKey->PutEOL();
+    
+    char tempBuff[256] = "";
+    UInt32 buffLen = sizeof(tempBuff) - 1;
+    (void)QTSS_GetValue(inParams->inClientSession, qtssCliSesHostName, 0, &tempBuff, &buffLen);
+    outKey->Put(tempBuff, buffLen);
+    outKey->PutEOL();
+    
+    qtss_snprintf(tempBuff, sizeof(tempBuff) - 1, "%lu", inBandwidthPercent);
+    outKey->Put(tempBuff);
+}
+
+Bool16 DoDescribeIsResponseCurrent(ReflectorSession* inSession, ReflectorDescribeResponse* inResponse)
+{
+    // DoSessionSetup has just brought the session's idea of its SDP file up to date,
+    // looking at the file no more than once a second, so it doesn't need to be read here
+    return (inResponse->GetModDate() == inSession->GetSDPFileModDate());
+}
+
+void DoDescribeSendResponse(QTSS_StandardRTSP_Params* inParams, ReflectorDescribeResponse* inResponse)
+{
+    // [0] is for the response headers, so they and the body go out in one writev
+    iovec theDescribeVec[2] = { {0 }};
+    theDescribeVec[1].iov_base = inResponse->GetBody()->Ptr;
+    theDescribeVec[1].iov_len = inResponse->GetBody()->Len;
+
+    (void)QTSS_AppendRTSPHeader(inParams->inRTSPRequest, qtssCacheControlHeader,
+                                kCacheControlHeader.Ptr, kCacheControlHeader.Len);
+    QTSSModuleUtils::SendDescribeResponse(inParams->inRTSPRequest, inParams->inClientSession,
+                                            &theDescribeVec[0], 2, inResponse->GetBody()->Len);
+}
+
 QTSS_Error DoDescribe(QTSS_StandardRTSP_Params* inParams)
 {
     char *theFilepath = NULL;
@@ -1170,10 +1214,37 @@ QTSS_Error DoDescribe(QTSS_StandardRTSP_Params* inParams)
     // send the DESCRIBE response
     
     //above function has signalled that this request belongs to us, so let's respond
-    iovec theDescribeVec[3] = { {0 }};
     
     Assert(theSession->GetLocalSDP()->Ptr != NULL);
     
+    Float32 adjustMediaBandwidthPercent = 1.0;
+    Bool16 adjustMediaBandwidth = false;
+
+    if (sPlayerCompatibility )
+        adjustMediaBandwidth = QTSSModuleUtils::HavePlayerProfile(sServerPrefs,inParams,QTSSModuleUtils::kAdjustBandwidth);
+
+    if (adjustMediaBandwidth)
+        adjustMediaBandwidthPercent = (Float32) sAdjustMediaBandwidthPercent / 100.0;
+
+// ------------ Use the response built for an earlier DESCRIBE if nothing it came from has changed
+
+    char theKeyBuf[512];
+    ResizeableStringFormatter theKey(theKeyBuf, sizeof(theKeyBuf));
+    DoDescribeFormatCacheKey(inParams, adjustMediaBandwidth ? sAdjustMediaBandwidthPercent : 100, &theKey);
+    StrPtrLen theKeySPL(theKey.GetBufPtr(), theKey.GetBytesWritten());
+    
+    ReflectorDescribeResponse* theResponse = theSession->FindDescribeResponse(&theKeySPL);
+    if (theResponse != NULL)
+    {
+        if (DoDescribeIsResponseCurrent(theSession, theResponse))
+        {
+            DoDescribeSendResponse(inParams, theResponse);
+            theResponse->Release();
+            return QTSS_NoErr;
+        }
+        theSession->RemoveDescribeResponse(theResponse);
+        theResponse->Release();
+    }
 
     StrPtrLen theFileData;
     QTSS_TimeVal outModDate = 0;
@@ -1212,31 +1283,16 @@ QTSS_Error DoDescribe(QTSS_StandardRTSP_Params* inParams)
             
  
 // ------------ Put SDP header lines in correct order
-    Float32 adjustMediaBandwidthPercent = 1.0;
-    Bool16 adjustMediaBandwidth = false;
-
-    if (sPlayerCompatibility )
-        adjustMediaBandwidth = QTSSModuleUtils::HavePlayerProfile(sServerPrefs,inParams,QTSSModuleUtils::kAdjustBandwidth);
-
-    if (adjustMediaBandwidth)
-        adjustMediaBandwidthPercent = (Float32) sAdjustMediaBandwidthPercent / 100.0;
 
     SDPLineSorter sortedSDP(&checkedSDPContainer,adjustMediaBandwidthPercent);
 
-// ------------ Write the SDP 
-
-    UInt32 sessLen = sortedSDP.GetSessionHeaders()->Len;
-    UInt32 mediaLen = sortedSDP.GetMediaHeaders()->Len;
-    theDescribeVec[1].iov_base = sortedSDP.GetSessionHeaders()->Ptr;
-    theDescribeVec[1].iov_len = sortedSDP.GetSessionHeaders()->Len;
-
-    theDescribeVec[2].iov_base = sortedSDP.GetMediaHeaders()->Ptr;
-    theDescribeVec[2].iov_len = sortedSDP.GetMediaHeaders()->Len;
+// ------------ Write the SDP, and keep it for the next viewer
 
-    (void)QTSS_AppendRTSPHeader(inParams->inRTSPRequest, qtssCacheControlHeader,
-                                kCacheControlHeader.Ptr, kCacheControlHeader.Len);
-    QTSSModuleUtils::SendDescribeResponse(inParams->inRTSPRequest, inParams->inClientSession,
-                                            &theDescribeVec[0], 3, sessLen + mediaLen ); 
+    theResponse = NEW ReflectorDescribeResponse(&theKeySPL, sortedSDP.GetSessionHeaders(),
+                                                sortedSDP.GetMediaHeaders(), outModDate);
+    theSession->CacheDescribeResponse(theResponse);
+    DoDescribeSendResponse(inParams, theResponse);
+    theResponse->Release();
     return QTSS_NoErr;
 }
 
@@ -1282,6 +1338,44 @@ Bool16 InfoPortsOK(QTSS_StandardRTSP_Params* inParams, SDPSourceInfo* theInfo, S
     return isOK;
 }
 
+// Checks the SDP file of a session that is already running. The file is only read and
+// parsed again if it changed, and not looked at at all if it was found unchanged less than
+// kDescribeCacheCheckIntervalMS ago. Returns false if it is gone or its ports aren't allowed.
+Bool16 CheckSessionSDPFile(QTSS_StandardRTSP_Params* inParams, ReflectorSession* inSession, StrPtrLen* inPath)
+{
+    SInt64 theNow = OS::Milliseconds();
+    QTSS_TimeVal theLastModDate = inSession->GetSDPFileModDate();
+    if (theLastModDate != -1 && theNow - inSession->GetSDPFileCheckedTimeMS() < kDescribeCacheCheckIntervalMS)
+        return true;
+        
+    StrPtrLen theFileData;
+    QTSS_TimeVal theModDate = -1;
+    (void)QTSSModuleUtils::ReadEntireFile(inPath->Ptr, &theFileData, theLastModDate, &theModDate);
+    if (theFileData.Ptr == NULL && theModDate != -1 && theModDate != theLastModDate)
+        (void)QTSSModuleUtils::ReadEntireFile(inPath->Ptr, &theFileData); // replaced by an older file
+    OSCharArrayDeleter charArrayDeleter(theFileData.Ptr);
+    
+    // Its ports were checked when it was last read
+    if (theFileData.Ptr == NULL && theModDate != -1 && theModDate == theLastModDate)
+    {   inSession->SetSDPFileChecked(theModDate, theNow);
+        return true;
+    }
+        
+    if (theFileData.Len <= 0)
+        return false;
+    
+    SDPSourceInfo* theInfo = NEW SDPSourceInfo(theFileData.Ptr, theFileData.Len);
+    if (theInfo == NULL) 
+        return false;
+    
+    Bool16 isOK = InfoPortsOK(inParams, theInfo, inPath);
+    delete theInfo;
+    
+    if (isOK)
+        inSession->SetSDPFileChecked(theModDate, theNow);
+    return isOK;
+}
+
 //sSessionMapһ̬ȫֱResolveĲsdpļ·, Ҳ˵ͬʱڲͬһsdpļʱʹͬһReflectorSession
 //FindOrCreateSessionҲSetupReflectorSessionReflectorStreamReflectorSocketȶҲᱻٴδ
 //߼ҲȷʵˣΪֻҪһ׶Mp4liveϵͳ򽻵
@@ -1306,8 +1400,9 @@ ReflectorSession* FindOrCreateSession(StrPtrLen* inPath, QTSS_StandardRTSP_Param
         //
         // If no file data is provided by the caller, read the file data out of the file.
         // If file data is provided, use that as our SDP data
+        QTSS_TimeVal theModDate = -1;
         if (inData == NULL)
-        {   (void)QTSSModuleUtils::ReadEntireFile(inPath->Ptr, &theFileDeleteData);
+        {   (void)QTSSModuleUtils::ReadEntireFile(inPath->Ptr, &theFileDeleteData, -1, &theModDate);
             theFileData = theFileDeleteData;
         }
         else
@@ -1368,6 +1463,9 @@ ReflectorSession* FindOrCreateSession(StrPtrLen* inPath, QTSS_StandardRTSP_Param
         //put the session's ID into the session map.
         theErr = sSessionMap->Register(theSession->GetRef());
         Assert(theErr == QTSS_NoErr);
+        
+        if (inData == NULL)
+            theSession->SetSDPFileChecked(theModDate, OS::Milliseconds());
 
         //unless we do this, the refcount won't increment (and we'll delete the session prematurely
         if (!isPush)
@@ -1394,28 +1492,11 @@ ReflectorSession* FindOrCreateSession(StrPtrLen* inPath, QTSS_StandardRTSP_Param
         if (foundSessionPtr)
             *foundSessionPtr = true;
             
-        StrPtrLen theFileData;
-        SDPSourceInfo* theInfo = NULL;
-        
-        if (inData == NULL)
-            (void)QTSSModuleUtils::ReadEntireFile(inPath->Ptr, &theFileData);
-        OSCharArrayDeleter charArrayDeleter(theFileData.Ptr);
-            
-        if (theFileData.Len <= 0)
-            return NULL;
-        
-        theInfo = NEW SDPSourceInfo(theFileData.Ptr, theFileData.Len);
-        if (theInfo == NULL) 
-            return NULL;
-      
-        if (!InfoPortsOK(inParams, theInfo, inPath))
-        {   delete theInfo;
+        // There is no file to check if the caller has the SDP data
+        theSession = (ReflectorSession*)theSessionRef->GetObject(); 
+        if ((inData != NULL) || !CheckSessionSDPFile(inParams, theSession, inPath))
             return NULL;
-        }
         
-        delete theInfo;
-        
-        theSession = (ReflectorSession*)theSessionRef->GetObject(); 
         if (isPush && theSession)
         {
             UInt32 theSetupFlag = ReflectorSession::kMarkSetup | ReflectorSession::kIsPushSession;
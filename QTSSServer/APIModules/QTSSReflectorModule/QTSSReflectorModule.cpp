@@ -181,6 +181,25 @@ static char*	sDefaultsBroadcasterGroup = "broadcaster";
 static StrPtrLen sBroadcasterGroup;
 
 static QTSS_AttributeID sBroadcastDirListID = qtssIllegalAttrID;
+
+// Multicast egress. Viewers whose address falls in the subnet may be moved onto a
+// per session multicast group. An empty subnet turns this off.
+static char*    sMulticastEgressSubnet = NULL;
+static char*    sDefaultMulticastEgressSubnet = "";
+static UInt32   sMulticastEgressSubnetAddr = 0;
+static UInt32   sMulticastEgressSubnetMask = 0;
+static Bool16   sMulticastEgressEnabled = false;
+static char*    sMulticastEgressGroup = NULL;
+static char*    sDefaultMulticastEgressGroup = "239.255.42.1";
+static UInt16   sMulticastEgressPort = 22000;
+static UInt16   sDefaultMulticastEgressPort = 22000;
+static UInt16   sMulticastEgressTTL = 1;
+static UInt16   sDefaultMulticastEgressTTL = 1;
+static UInt32   sMulticastEgressMinViewers = 2;
+static UInt32   sDefaultMulticastEgressMinViewers = 2;
+
+// RFC 4585 generic NACK. How many packets each UDP viewer may have resent a second, 0 is off.
+static UInt32   sDefaultNACKMaxRetransmitsPerSec = 50;
                                 
 static SInt32   sWaitTimeLoopCount = 10;  
 
@@ -197,6 +216,7 @@ static StrPtrLen    sBroadcastNotActive("Broadcast is not active.");
 static StrPtrLen    sTheNowRangeHeader("npt=now-");
 
 const int kBuffLen = 512;
+const SInt64 kDescribeCacheCheckIntervalMS = 1000; // how stale a running session's idea of its SDP file may get
 
 //static OSQueue*     sReflectorSessionQueue = NULL;//fym ʱãReflecorSessionάsSessionMap
 
@@ -220,9 +240,19 @@ static QTSS_Error DestroySession(QTSS_ClientSessionClosing_Params* inParams);
 static void RemoveOutput(ReflectorOutput* inOutput, ReflectorSession* inSession, Bool16 killClients);
 static ReflectorSession* DoSessionSetup(QTSS_StandardRTSP_Params* inParams, QTSS_AttributeID inPathType,Bool16 isPush=false,Bool16 *foundSessionPtr= NULL, char** resultFilePath = NULL);
 static QTSS_Error RereadPrefs();
+static void SetMulticastEgress();
+static Bool16 IsMulticastEgressClient(QTSS_StandardRTSP_Params* inParams);
+static void DoDescribeRewriteMulticastLines(ReflectorSession* theSession, StrPtrLen* inSDP, ResizeableStringFormatter* outSDP);
+static Bool16 DoDescribeAddFECLines(ReflectorSession* theSession, StrPtrLen* inSDP, ResizeableStringFormatter* outSDP);
+static void DoDescribeFormatCacheKey(QTSS_StandardRTSP_Params* inParams, ReflectorSession* theSession, Bool16 isMulticastEgress,
+                                        UInt32 inBandwidthPercent, ResizeableStringFormatter* outKey);
+static Bool16 DoDescribeIsResponseCurrent(ReflectorSession* inSession, ReflectorDescribeResponse* inResponse);
+static void DoDescribeSendResponse(QTSS_StandardRTSP_Params* inParams, ReflectorDescribeResponse* inResponse);
 static QTSS_Error ProcessRTPData(QTSS_IncomingData_Params* inParams);
+static QTSS_Error ProcessRTCPPacket(QTSS_RTCPProcess_Params* inParams);
 static QTSS_Error ReflectorAuthorizeRTSPRequest(QTSS_StandardRTSP_Params* inParams);
 static Bool16 InfoPortsOK(QTSS_StandardRTSP_Params* inParams, SDPSourceInfo* theInfo, StrPtrLen* inPath);
+static Bool16 CheckSessionSDPFile(QTSS_StandardRTSP_Params* inParams, ReflectorSession* inSession, StrPtrLen* inPath);
 void KillCommandPathInList();
 Bool16 KillSession(StrPtrLen *sdpPath, Bool16 killClients);
 QTSS_Error IntervalRole();
@@ -269,6 +299,8 @@ QTSS_Error  QTSSReflectorModuleDispatch(QTSS_Role inRole, QTSS_RoleParamPtr inPa
             return ProcessRTSPRequest(&inParams->rtspRequestParams);
         case QTSS_RTSPIncomingData_Role:
             return ProcessRTPData(&inParams->rtspIncomingDataParams);
+        case QTSS_RTCPProcess_Role:
+            return ProcessRTCPPacket(&inParams->rtcpProcessParams);
         case QTSS_ClientSessionClosing_Role:
             return DestroySession(&inParams->clientSessionClosingParams);
         case QTSS_Shutdown_Role:
@@ -294,6 +326,7 @@ QTSS_Error Register(QTSS_Register_Params* inParams)
     (void)QTSS_AddRole(QTSS_RTSPPreProcessor_Role);
     (void)QTSS_AddRole(QTSS_ClientSessionClosing_Role);
     (void)QTSS_AddRole(QTSS_RTSPIncomingData_Role); // call me with interleaved RTP streams on the RTSP session
+    (void)QTSS_AddRole(QTSS_RTCPProcess_Role); // NACKs and PLIs from viewers
     //fym (void)QTSS_AddRole(QTSS_RTSPAuthorize_Role);
     (void)QTSS_AddRole(QTSS_RereadPrefs_Role);
     //fym (void)QTSS_AddRole(QTSS_RTSPRoute_Role);  
@@ -572,6 +605,24 @@ QTSS_Error RereadPrefs()
 
     sBroadcasterSessionTimeoutMilliSecs = sBroadcasterSessionTimeoutSecs * 1000;
     
+    QTSSModuleUtils::GetAttribute(sPrefs, "reflector_multicast_egress_port",    qtssAttrDataTypeUInt16,
+                                &sMulticastEgressPort, &sDefaultMulticastEgressPort, sizeof(sDefaultMulticastEgressPort));
+    QTSSModuleUtils::GetAttribute(sPrefs, "reflector_multicast_egress_ttl",     qtssAttrDataTypeUInt16,
+                                &sMulticastEgressTTL, &sDefaultMulticastEgressTTL, sizeof(sDefaultMulticastEgressTTL));
+    QTSSModuleUtils::GetAttribute(sPrefs, "reflector_multicast_egress_min_viewers", qtssAttrDataTypeUInt32,
+                                &sMulticastEgressMinViewers, &sDefaultMulticastEgressMinViewers, sizeof(sDefaultMulticastEgressMinViewers));
+    
+    delete [] sMulticastEgressGroup;
+    sMulticastEgressGroup = QTSSModuleUtils::GetStringAttribute(sPrefs, "reflector_multicast_egress_group", sDefaultMulticastEgressGroup);
+    delete [] sMulticastEgressSubnet;
+    sMulticastEgressSubnet = QTSSModuleUtils::GetStringAttribute(sPrefs, "reflector_multicast_egress_subnet", sDefaultMulticastEgressSubnet);
+    SetMulticastEgress();
+    
+    UInt32 theMaxRetransmitsPerSec = sDefaultNACKMaxRetransmitsPerSec;
+    QTSSModuleUtils::GetAttribute(sPrefs, "nack_max_retransmits_per_second", qtssAttrDataTypeUInt32,
+                                &theMaxRetransmitsPerSec, &sDefaultNACKMaxRetransmitsPerSec, sizeof(sDefaultNACKMaxRetransmitsPerSec));
+    RTPSessionOutput::sMaxRetransmitsPerSec = theMaxRetransmitsPerSec;
+    
 
 
     if(sEnforceStaticSDPPortRange)
@@ -729,6 +780,19 @@ QTSS_Error ProcessRTPData(QTSS_IncomingData_Params* inParams)
     return theErr;
 }
 
+QTSS_Error ProcessRTCPPacket(QTSS_RTCPProcess_Params* inParams)
+{
+    //this gets called for every stream the server plays, only our viewers have an output
+    RTPSessionOutput** theOutput = NULL;
+    UInt32 theLen = 0;
+    QTSS_Error theErr = QTSS_GetValuePtr(inParams->inClientSession, sOutputAttr, 0, (void**)&theOutput, &theLen);
+    if((theErr != QTSS_NoErr) || (theLen != sizeof(RTPSessionOutput*)) || (theOutput == NULL) || (*theOutput == NULL))
+        return QTSS_NoErr;
+        
+    (*theOutput)->ProcessRTCPFeedback(inParams->inRTPStream, inParams->inRTCPPacketData, inParams->inRTCPPacketDataLen);
+    return QTSS_NoErr;
+}
+
 QTSS_Error ProcessRTSPRequest(QTSS_StandardRTSP_Params* inParams)
 {
     QTSS_RTSPMethod* theMethod = NULL;
@@ -1298,6 +1362,175 @@ void DoDescribeAddRequiredSDPLines(QTSS_StandardRTSP_Params* inParams, Reflector
 
 }
 
+void DoDescribeRewriteMulticastLines(ReflectorSession* theSession, StrPtrLen* inSDP, ResizeableStringFormatter* outSDP)
+{
+    char theGroupBuf[20];
+    StrPtrLen theGroupStr(theGroupBuf, sizeof(theGroupBuf));
+    struct in_addr theGroupAddr;
+    theGroupAddr.s_addr = htonl(theSession->GetMulticastGroupAddr());
+    SocketUtils::ConvertAddrToString(theGroupAddr, &theGroupStr);
+    
+    char tempBuff[64] = "";
+    UInt32 theStreamIndex = 0;
+    StrPtrLen theLine;
+    StringParser sdpParser(inSDP);
+    while (sdpParser.GetDataRemaining() > 0)
+    {
+        sdpParser.GetThruEOL(&theLine);
+        if(theLine.Len < 2 || theLine.Ptr[1] != '=')
+            continue;
+        
+        if(theLine.Ptr[0] == 'c')
+        {   // every connection line, session or media, is the group
+            qtss_snprintf(tempBuff, sizeof(tempBuff) - 1, "c=IN IP4 %s/%u", theGroupBuf, theSession->GetMulticastTTL());
+            outSDP->Put(tempBuff);
+            outSDP->PutEOL();
+        }
+        else if(theLine.Ptr[0] == 'm')
+        {   // m=<media> <port> <the rest>
+            StringParser mediaParser(&theLine);
+            StrPtrLen theMediaType;
+            mediaParser.ConsumeUntil(&theMediaType, ' ');
+            mediaParser.ConsumeWhitespace();
+            mediaParser.ConsumeInteger(NULL);
+            
+            outSDP->Put(theMediaType);
+            qtss_snprintf(tempBuff, sizeof(tempBuff) - 1, " %u", theSession->GetMulticastPort(theStreamIndex++));
+            outSDP->Put(tempBuff);
+            outSDP->Put(theLine.Ptr + mediaParser.GetDataParsedLen(), mediaParser.GetDataRemaining());
+            outSDP->PutEOL();
+        }
+        else
+        {
+            outSDP->Put(theLine);
+            outSDP->PutEOL();
+        }
+    }
+}
+
+Bool16 DoDescribeAddFECLines(ReflectorSession* theSession, StrPtrLen* inSDP, ResizeableStringFormatter* outSDP)
+{
+    // Returns false, having written nothing, if no stream of the session sends parity
+    UInt32 theNumStreams = theSession->GetNumStreams();
+    UInt32 theIndex = 0;
+    for ( ; theIndex < theNumStreams; theIndex++)
+    {
+        if(theSession->GetStreamByIndex(theIndex)->IsFECEnabled())
+            break;
+    }
+    if(theIndex == theNumStreams)
+        return false;
+        
+    char tempBuff[64] = "";
+    ReflectorStream* theFECStream = NULL;   // stream whose a=rtpmap is still to be written
+    UInt32 theStreamIndex = 0;
+    StrPtrLen theLine;
+    StringParser sdpParser(inSDP);
+    while (sdpParser.GetDataRemaining() > 0)
+    {
+        sdpParser.GetThruEOL(&theLine);
+        if(theLine.Len < 2 || theLine.Ptr[1] != '=')
+            continue;
+        
+        if((theLine.Ptr[0] == 'm') && (theFECStream != NULL))
+        {   // the attributes of the last media end here
+            UInt32 theTimeScale = theFECStream->GetTimeScale();
+            qtss_snprintf(tempBuff, sizeof(tempBuff) - 1, "a=rtpmap:%u ulpfec/%lu", theFECStream->GetFECPayloadType(), (theTimeScale != 0) ? theTimeScale : 90000);
+            outSDP->Put(tempBuff);
+            outSDP->PutEOL();
+            theFECStream = NULL;
+        }
+        
+        outSDP->Put(theLine);
+        
+        if((theLine.Ptr[0] == 'm') && (theStreamIndex < theNumStreams))
+        {   // m=<media> <port> <proto> <fmt> ... gets the parity payload type on the end
+            ReflectorStream* theStream = theSession->GetStreamByIndex(theStreamIndex++);
+            if((theStream != NULL) && theStream->IsFECEnabled())
+            {
+                StringParser mediaParser(&theLine);
+                mediaParser.ConsumeUntil(NULL, ' ');
+                mediaParser.ConsumeWhitespace();
+                mediaParser.ConsumeUntil(NULL, ' ');
+                mediaParser.ConsumeWhitespace();
+                mediaParser.ConsumeUntil(NULL, ' ');
+                Bool16 isListed = false;
+                while (mediaParser.GetDataRemaining() > 0)
+                {
+                    mediaParser.ConsumeWhitespace();
+                    StrPtrLen theFormat;
+                    UInt32 thePayloadType = mediaParser.ConsumeInteger(&theFormat);
+                    if((theFormat.Len > 0) && (thePayloadType == theStream->GetFECPayloadType()))
+                        isListed = true;
+                    mediaParser.ConsumeUntil(NULL, ' ');
+                }
+                
+                if(!isListed)
+                {
+                    qtss_snprintf(tempBuff, sizeof(tempBuff) - 1, " %u", theStream->GetFECPayloadType());
+                    outSDP->Put(tempBuff);
+                    theFECStream = theStream;
+                }
+            }
+        }
+        outSDP->PutEOL();
+    }
+    
+    if(theFECStream != NULL)
+    {
+        UInt32 theTimeScale = theFECStream->GetTimeScale();
+        qtss_snprintf(tempBuff, sizeof(tempBuff) - 1, "a=rtpmap:%u ulpfec/%lu", theFECStream->GetFECPayloadType(), (theTimeScale != 0) ? theTimeScale : 90000);
+        outSDP->Put(tempBuff);
+        outSDP->PutEOL();
+    }
+    
+    return true;
+}
+
+void DoDescribeFormatCacheKey(QTSS_StandardRTSP_Params* inParams, ReflectorSession* theSession, Bool16 isMulticastEgress,
+                                UInt32 inBandwidthPercent, ResizeableStringFormatter* outKey)
+{
+    // Everything the DESCRIBE body depends on besides the session and its SDP file:
+    // the s= and o= lines that may be filled in, the multicast rewrite and the player's bandwidth
+    StrPtrLen theFilePath;
+    (void)QTSS_GetValuePtr(inParams->inRTSPRequest, qtssRTSPReqFilePath, 0, (void**)&theFilePath.Ptr, &theFilePath.Len);
+    outKey->Put(theFilePath);
+    outKey->PutEOL();
+    
+    char tempBuff[256] = "";
+    UInt32 buffLen = sizeof(tempBuff) - 1;
+    (void)QTSS_GetValue(inParams->inClientSession, qtssCliSesHostName, 0, &tempBuff, &buffLen);
+    outKey->Put(tempBuff, buffLen);
+    outKey->PutEOL();
+    
+    if(isMulticastEgress)
+        qtss_snprintf(tempBuff, sizeof(tempBuff) - 1, "%lu:%u/%u %lu", theSession->GetMulticastGroupAddr(),
+                        theSession->GetMulticastPort(0), theSession->GetMulticastTTL(), inBandwidthPercent);
+    else
+        qtss_snprintf(tempBuff, sizeof(tempBuff) - 1, "unicast %lu", inBandwidthPercent);
+    outKey->Put(tempBuff);
+}
+
+Bool16 DoDescribeIsResponseCurrent(ReflectorSession* inSession, ReflectorDescribeResponse* inResponse)
+{
+    // DoSessionSetup has just brought the session's idea of its SDP file up to date,
+    // looking at the file no more than once a second, so it doesn't need to be read here
+    return (inResponse->GetModDate() == inSession->GetSDPFileModDate());
+}
+
+void DoDescribeSendResponse(QTSS_StandardRTSP_Params* inParams, ReflectorDescribeResponse* inResponse)
+{
+    // [0] is for the response headers, so they and the body go out in one writev
+    iovec theDescribeVec[2] = { {0 }};
+    theDescribeVec[1].iov_base = inResponse->GetBody()->Ptr;
+    theDescribeVec[1].iov_len = inResponse->GetBody()->Len;
+
+    (void)QTSS_AppendRTSPHeader(inParams->inRTSPRequest, qtssCacheControlHeader,
+                                kCacheControlHeader.Ptr, kCacheControlHeader.Len);
+    QTSSModuleUtils::SendDescribeResponse(inParams->inRTSPRequest, inParams->inClientSession,
+                                            &theDescribeVec[0], 2, inResponse->GetBody()->Len);
+}
+
 QTSS_Error DoDescribe(QTSS_StandardRTSP_Params* inParams)
 {
 	//qtss_printf("\nQTSSReflectorModule::DoDescribe");//fym
@@ -1332,12 +1565,41 @@ QTSS_Error DoDescribe(QTSS_StandardRTSP_Params* inParams)
     // send the DESCRIBE response
     
     //above function has signalled that this request belongs to us, so let's respond
-    iovec theDescribeVec[3] = { {0 }};
     
     //fym Assert(theSession->GetLocalSDP()->Ptr != NULL);
 	if(NULL == theSession->GetLocalSDP()->Ptr)//fym
 		return QTSS_RequestFailed;
     
+    Float32 adjustMediaBandwidthPercent = 1.0;
+    Bool16 adjustMediaBandwidth = false;
+
+    if(sPlayerCompatibility )
+        adjustMediaBandwidth = QTSSModuleUtils::HavePlayerProfile(sServerPrefs,inParams,QTSSModuleUtils::kAdjustBandwidth);
+
+    if(adjustMediaBandwidth)
+        adjustMediaBandwidthPercent = (Float32) sAdjustMediaBandwidthPercent / 100.0;
+        
+    Bool16 isMulticastEgress = theSession->IsMulticastActive() && IsMulticastEgressClient(inParams);
+
+// ------------ Use the response built for an earlier DESCRIBE if nothing it came from has changed
+
+    char theKeyBuf[512];
+    ResizeableStringFormatter theKey(theKeyBuf, sizeof(theKeyBuf));
+    DoDescribeFormatCacheKey(inParams, theSession, isMulticastEgress, adjustMediaBandwidth ? sAdjustMediaBandwidthPercent : 100, &theKey);
+    StrPtrLen theKeySPL(theKey.GetBufPtr(), theKey.GetBytesWritten());
+    
+    ReflectorDescribeResponse* theResponse = theSession->FindDescribeResponse(&theKeySPL);
+    if(theResponse != NULL)
+    {
+        if(DoDescribeIsResponseCurrent(theSession, theResponse))
+        {
+            DoDescribeSendResponse(inParams, theResponse);
+            theResponse->Release();
+            return QTSS_NoErr;
+        }
+        theSession->RemoveDescribeResponse(theResponse);
+        theResponse->Release();
+    }
 
     StrPtrLen theFileData;
     QTSS_TimeVal outModDate = 0;
@@ -1365,6 +1627,21 @@ QTSS_Error DoDescribe(QTSS_StandardRTSP_Params* inParams)
     DoDescribeAddRequiredSDPLines(inParams, theSession, outModDate, &editedSDP, &theSDPData);
     StrPtrLen editedSDPSPL(editedSDP.GetBufPtr(),editedSDP.GetBytesWritten());
 
+// ------------ Point viewers on the egress subnet at the group, if there is one
+
+    ResizeableStringFormatter multicastSDP(NULL,0);
+    if(isMulticastEgress)
+    {
+        DoDescribeRewriteMulticastLines(theSession, &editedSDPSPL, &multicastSDP);
+        editedSDPSPL.Set(multicastSDP.GetBufPtr(), multicastSDP.GetBytesWritten());
+    }
+
+// ------------ Announce the parity payload type of streams that send FEC
+
+    ResizeableStringFormatter fecSDP(NULL,0);
+    if(DoDescribeAddFECLines(theSession, &editedSDPSPL, &fecSDP))
+        editedSDPSPL.Set(fecSDP.GetBufPtr(), fecSDP.GetBytesWritten());
+
 // ------------ Check the headers
 
     SDPContainer checkedSDPContainer;
@@ -1376,31 +1653,16 @@ QTSS_Error DoDescribe(QTSS_StandardRTSP_Params* inParams)
             
  
 // ------------ Put SDP header lines in correct order
-    Float32 adjustMediaBandwidthPercent = 1.0;
-    Bool16 adjustMediaBandwidth = false;
-
-    if(sPlayerCompatibility )
-        adjustMediaBandwidth = QTSSModuleUtils::HavePlayerProfile(sServerPrefs,inParams,QTSSModuleUtils::kAdjustBandwidth);
-
-    if(adjustMediaBandwidth)
-        adjustMediaBandwidthPercent = (Float32) sAdjustMediaBandwidthPercent / 100.0;
 
     SDPLineSorter sortedSDP(&checkedSDPContainer,adjustMediaBandwidthPercent);
 
-// ------------ Write the SDP 
-
-    UInt32 sessLen = sortedSDP.GetSessionHeaders()->Len;
-    UInt32 mediaLen = sortedSDP.GetMediaHeaders()->Len;
-    theDescribeVec[1].iov_base = sortedSDP.GetSessionHeaders()->Ptr;
-    theDescribeVec[1].iov_len = sortedSDP.GetSessionHeaders()->Len;
-
-    theDescribeVec[2].iov_base = sortedSDP.GetMediaHeaders()->Ptr;
-    theDescribeVec[2].iov_len = sortedSDP.GetMediaHeaders()->Len;
+// ------------ Write the SDP, and keep it for the next viewer
 
-    (void)QTSS_AppendRTSPHeader(inParams->inRTSPRequest, qtssCacheControlHeader,
-                                kCacheControlHeader.Ptr, kCacheControlHeader.Len);
-    QTSSModuleUtils::SendDescribeResponse(inParams->inRTSPRequest, inParams->inClientSession,
-                                            &theDescribeVec[0], 3, sessLen + mediaLen ); 
+    theResponse = NEW ReflectorDescribeResponse(&theKeySPL, sortedSDP.GetSessionHeaders(),
+                                                sortedSDP.GetMediaHeaders(), outModDate);
+    theSession->CacheDescribeResponse(theResponse);
+    DoDescribeSendResponse(inParams, theResponse);
+    theResponse->Release();
     return QTSS_NoErr;
 }
 
@@ -1446,6 +1708,44 @@ Bool16 InfoPortsOK(QTSS_StandardRTSP_Params* inParams, SDPSourceInfo* theInfo, S
     return isOK;
 }
 
+// Checks the SDP file of a session that is already running. The file is only read and
+// parsed again if it changed, and not looked at at all if it was found unchanged less than
+// kDescribeCacheCheckIntervalMS ago. Returns false if it is gone or its ports aren't allowed.
+Bool16 CheckSessionSDPFile(QTSS_StandardRTSP_Params* inParams, ReflectorSession* inSession, StrPtrLen* inPath)
+{
+    SInt64 theNow = OS::Milliseconds();
+    QTSS_TimeVal theLastModDate = inSession->GetSDPFileModDate();
+    if(theLastModDate != -1 && theNow - inSession->GetSDPFileCheckedTimeMS() < kDescribeCacheCheckIntervalMS)
+        return true;
+        
+    StrPtrLen theFileData;
+    QTSS_TimeVal theModDate = -1;
+    (void)QTSSModuleUtils::ReadEntireFile(inPath->Ptr, &theFileData, theLastModDate, &theModDate);
+    if(theFileData.Ptr == NULL && theModDate != -1 && theModDate != theLastModDate)
+        (void)QTSSModuleUtils::ReadEntireFile(inPath->Ptr, &theFileData); // replaced by an older file
+    OSCharArrayDeleter charArrayDeleter(theFileData.Ptr);
+    
+    // Its ports were checked when it was last read
+    if(theFileData.Ptr == NULL && theModDate != -1 && theModDate == theLastModDate)
+    {   inSession->SetSDPFileChecked(theModDate, theNow);
+        return true;
+    }
+        
+    if(theFileData.Len <= 0)
+        return false;
+    
+    SDPSourceInfo* theInfo = NEW SDPSourceInfo(theFileData.Ptr, theFileData.Len);
+    if(theInfo == NULL) 
+        return false;
+    
+    Bool16 isOK = InfoPortsOK(inParams, theInfo, inPath);
+    delete theInfo;
+    
+    if(isOK)
+        inSession->SetSDPFileChecked(theModDate, theNow);
+    return isOK;
+}
+
 //sSessionMapһ̬ȫֱResolveĲsdpļ·, Ҳ˵ͬʱڲͬһsdpļʱʹͬһReflectorSession
 //FindOrCreateSessionҲSetupReflectorSessionReflectorStreamReflectorSocketȶҲᱻٴδ
 //߼ҲȷʵˣΪֻҪһ׶Mp4liveϵͳ򽻵
@@ -1470,8 +1770,9 @@ ReflectorSession* FindOrCreateSession(StrPtrLen* inPath, QTSS_StandardRTSP_Param
         //
         // If no file data is provided by the caller, read the file data out of the file.
         // If file data is provided, use that as our SDP data
+        QTSS_TimeVal theModDate = -1;
         if(inData == NULL)
-        {   (void)QTSSModuleUtils::ReadEntireFile(inPath->Ptr, &theFileDeleteData);
+        {   (void)QTSSModuleUtils::ReadEntireFile(inPath->Ptr, &theFileDeleteData, -1, &theModDate);
             theFileData = theFileDeleteData;
         }
         else
@@ -1580,6 +1881,9 @@ ReflectorSession* FindOrCreateSession(StrPtrLen* inPath, QTSS_StandardRTSP_Param
         //fym Assert(theErr == QTSS_NoErr);
 		if(QTSS_NoErr != theErr)//fym
 			return NULL;
+        
+        if(inData == NULL)
+            theSession->SetSDPFileChecked(theModDate, OS::Milliseconds());
 
         //unless we do this, the refcount won't increment (and we'll delete the session prematurely
         /*fym if(!isPush)
@@ -1612,30 +1916,11 @@ ReflectorSession* FindOrCreateSession(StrPtrLen* inPath, QTSS_StandardRTSP_Param
         if(foundSessionPtr)
             *foundSessionPtr = true;
             
-        StrPtrLen theFileData;
-        SDPSourceInfo* theInfo = NULL;
-        
-        if(inData == NULL)
-            (void)QTSSModuleUtils::ReadEntireFile(inPath->Ptr, &theFileData);
-        OSCharArrayDeleter charArrayDeleter(theFileData.Ptr);
-            
-        if(theFileData.Len <= 0)
-            return NULL;
-        
-        theInfo = NEW SDPSourceInfo(theFileData.Ptr, theFileData.Len);
-        if(theInfo == NULL) 
-            return NULL;
-      
-        if(!InfoPortsOK(inParams, theInfo, inPath))
-        {   delete theInfo;
-			theInfo = NULL;//fym
+        // There is no file to check if the caller has the SDP data
+        theSession = (ReflectorSession*)theSessionRef->GetObject(); 
+        if((inData != NULL) || !CheckSessionSDPFile(inParams, theSession, inPath))
             return NULL;
-        }
         
-        delete theInfo;
-		theInfo = NULL;//fym
-        
-        theSession = (ReflectorSession*)theSessionRef->GetObject(); 
         if(isPush && theSession)
         {
             UInt32 theSetupFlag = ReflectorSession::kMarkSetup | ReflectorSession::kIsPushSession;
@@ -1735,6 +2020,69 @@ QTSS_Error AddRTPStream(ReflectorSession* theSession,QTSS_StandardRTSP_Params* i
     return theErr;
 }
 
+void SetMulticastEgress()
+{
+    sMulticastEgressEnabled = false;
+    UInt32 theGroupAddr = 0;
+    UInt32 theInterfaceAddr = INADDR_ANY;
+    
+    // "a.b.c.d/bits", or just an address for a single host
+    if(sMulticastEgressSubnet != NULL && sMulticastEgressSubnet[0] != 0)
+    {
+        StrPtrLen theSubnetStr(sMulticastEgressSubnet);
+        StringParser theSubnetParser(&theSubnetStr);
+        StrPtrLen theAddrStr;
+        theSubnetParser.ConsumeUntil(&theAddrStr, '/');
+        UInt32 theMaskBits = 32;
+        if(theSubnetParser.Expect('/'))
+            theMaskBits = theSubnetParser.ConsumeInteger(NULL);
+        
+        char* theAddrCStr = theAddrStr.GetAsCString();
+        OSCharArrayDeleter theAddrCStrDeleter(theAddrCStr);
+        theGroupAddr = SocketUtils::ConvertStringToAddr(sMulticastEgressGroup);
+        
+        if(theMaskBits <= 32 && SocketUtils::IsMulticastIPAddr(theGroupAddr))
+        {
+            sMulticastEgressSubnetMask = (theMaskBits == 0) ? 0 : (0xFFFFFFFF << (32 - theMaskBits));
+            sMulticastEgressSubnetAddr = SocketUtils::ConvertStringToAddr(theAddrCStr) & sMulticastEgressSubnetMask;
+            sMulticastEgressEnabled = true;
+            
+            // Send out of the interface that is on the subnet, if we have one
+            for (UInt32 x = 0; x < SocketUtils::GetNumIPAddrs(); x++)
+            {
+                if((SocketUtils::GetIPAddr(x) & sMulticastEgressSubnetMask) == sMulticastEgressSubnetAddr)
+                {
+                    theInterfaceAddr = SocketUtils::GetIPAddr(x);
+                    break;
+                }
+            }
+        }
+    }
+    
+    ReflectorSession::SetMulticastEgress(sMulticastEgressEnabled ? theGroupAddr : 0, sMulticastEgressPort, 
+                                            sMulticastEgressTTL, sMulticastEgressMinViewers, theInterfaceAddr);
+}
+
+Bool16 IsMulticastEgressClient(QTSS_StandardRTSP_Params* inParams)
+{
+    if(!sMulticastEgressEnabled)
+        return false;
+    
+    // Clients that asked for TCP or reliable UDP stay on unicast
+    QTSS_RTPTransportType theTransportType = qtssRTPTransportTypeUDP;
+    UInt32 theLen = sizeof(theTransportType);
+    (void)QTSS_GetValue(inParams->inRTSPRequest, qtssRTSPReqTransportType, 0, &theTransportType, &theLen);
+    if(theTransportType != qtssRTPTransportTypeUDP)
+        return false;
+    
+    UInt32 theClientAddr = 0;
+    theLen = sizeof(theClientAddr);
+    if(QTSS_GetValue(inParams->inRTSPSession, qtssRTSPSesRemoteAddr, 0, &theClientAddr, &theLen) != QTSS_NoErr)
+        return false;
+        
+    return (theClientAddr & sMulticastEgressSubnetMask) == sMulticastEgressSubnetAddr;
+}
+
 QTSS_Error DoSetup(QTSS_StandardRTSP_Params* inParams)
 {
 	//qtss_printf("\nQTSSReflectorModule::DoSetup");//fym
@@ -1771,6 +2119,10 @@ QTSS_Error DoSetup(QTSS_StandardRTSP_Params* inParams)
             RTPSessionOutput* theNewOutput = NEW RTPSessionOutput(inParams->inClientSession, theSession, sServerPrefs, sStreamCookieAttr );
             theSession->AddOutput(theNewOutput,true);
             (void)QTSS_SetValue(inParams->inClientSession, sOutputAttr, 0, &theNewOutput, sizeof(theNewOutput));
+            
+            // Viewers on the multicast egress subnet may share the session's group
+            if(IsMulticastEgressClient(inParams))
+                theNewOutput->SetSubnetViewer(theSession->JoinMulticastGroup());
         }
         else 
         {           
@@ -1845,6 +2197,19 @@ QTSS_Error DoSetup(QTSS_StandardRTSP_Params* inParams)
             DeleteReflectorPushSession(inParams,theSession, foundSession);
             return QTSSModuleUtils::SendErrorResponse(inParams->inRTSPRequest, qtssClientBadRequest, 0);
         }
+        
+        // If the broadcaster is pushing over its RTSP connection, remember which
+        // channel this track comes in on so its packets can go straight to the stream
+        Bool16 isTCP = false;
+        theLen = sizeof(isTCP);
+        (void)QTSS_GetValue(newStream, qtssRTPStrIsTCP, 0, &isTCP, &theLen);
+        if(isTCP)
+        {
+            UInt16 theRTPChannel = 0;
+            theLen = sizeof(theRTPChannel);
+            if(QTSS_GetValue(newStream, qtssRTPStrRTPChannel, 0, &theRTPChannel, &theLen) == QTSS_NoErr)
+                theSession->SetInterleavedChannel(theTrackID, theRTPChannel);
+        }
             
         //send the setup response
 
@@ -1884,6 +2249,24 @@ QTSS_Error DoSetup(QTSS_StandardRTSP_Params* inParams)
     if(theStreamInfo->fTimeScale == 0)
         theStreamInfo->fTimeScale = 90000;
     
+    // A viewer that got the multicast group is told to join it, on the ports of this track
+    RTPSessionOutput** theClientOutput = NULL;
+    theLen = 0;
+    theErr = QTSS_GetValuePtr(inParams->inClientSession, sOutputAttr, 0, (void**)&theClientOutput, &theLen);
+    if((theErr == QTSS_NoErr) && (theLen == sizeof(RTPSessionOutput*)) && (*theClientOutput)->IsMulticastViewer() && theSession->IsMulticastActive())
+    {
+        UInt32 theStreamIndex = 0;
+        while ((theStreamIndex < theSession->GetNumStreams()) && (theSession->GetSourceInfo()->GetStreamInfo(theStreamIndex) != theStreamInfo))
+            theStreamIndex++;
+            
+        UInt32 theGroupAddr = theSession->GetMulticastGroupAddr();
+        UInt16 theGroupPort = theSession->GetMulticastPort(theStreamIndex);
+        UInt16 theGroupTTL = theSession->GetMulticastTTL();
+        (void)QTSS_SetValue(inParams->inRTSPRequest, qtssRTSPReqMulticastDestAddr, 0, &theGroupAddr, sizeof(theGroupAddr));
+        (void)QTSS_SetValue(inParams->inRTSPRequest, qtssRTSPReqMulticastPort, 0, &theGroupPort, sizeof(theGroupPort));
+        (void)QTSS_SetValue(inParams->inRTSPRequest, qtssRTSPReqMulticastTTL, 0, &theGroupTTL, sizeof(theGroupTTL));
+    }
+    
     QTSS_RTPStreamObject newStream = NULL;
     {
         // Ok, this is completely crazy but I can't think of a better way to do this that's
@@ -2108,6 +2491,8 @@ QTSS_Error DoPlay(QTSS_StandardRTSP_Params* inParams, ReflectorSession* inSessio
 		qtss_printf("R3 ");//fym
         if(debug != inSession->GetRef())
         {   
+             if(debug != NULL)
+                 sSessionMap->Release(debug); // or RemoveOutput waits on it forever
              return QTSSModuleUtils::SendErrorResponse(inParams->inRTSPRequest, qtssClientBadRequest, 0);
         }
 
@@ -2150,6 +2535,14 @@ QTSS_Error DoPlay(QTSS_StandardRTSP_Params* inParams, ReflectorSession* inSessio
         if(sRTPInfoDisabled )
             rtpInfoEnabled = false; 
 
+        // The group sends the broadcaster's packets as they are, not through this viewer's
+        // RTPSessionOutput, so the seq and rtptime it would be told wouldn't match them.
+        RTPSessionOutput** theClientOutput = NULL;
+        theLen = 0;
+        theErr = QTSS_GetValuePtr(inParams->inClientSession, sOutputAttr, 0, (void**)&theClientOutput, &theLen);
+        if((theErr == QTSS_NoErr) && (theLen == sizeof(RTPSessionOutput*)) && (*theClientOutput)->IsMulticastViewer())
+            rtpInfoEnabled = false;
+
         if(rtpInfoEnabled)
         {
             flags = qtssPlayRespWriteTrackInfo; //write first timestampe and seq num to rtpinfo
@@ -2209,8 +2602,17 @@ Bool16 KillSession(StrPtrLen *sdpPathStr, Bool16 killClients)
     if(theSessionRef != NULL)
     {
         ReflectorSession*   theSession = (ReflectorSession*)theSessionRef->GetObject();
+        
+        //fym RemoveOutput waits for every ref on the session to be released before
+        //deleting it, so let ours go first. Sessions are only deleted under their
+        //uuid's mutex, so holding it keeps this one around until we're done.
+        UInt16 uuid  = ResolveUUIDFromPath(theSession->GetSourcePath()->Ptr);
+        OSMutexLocker locker(sSessionMutexArray[uuid]);
+        QTSS_ClientSessionObject theBroadcasterSession = theSession->GetBroadcasterSession();
+        sSessionMap->Release(theSessionRef);
+        
         RemoveOutput(NULL, theSession, killClients);
-        (void)QTSS_Teardown(theSession->GetBroadcasterSession());
+        (void)QTSS_Teardown(theBroadcasterSession);
         return true;
     }
     return false;
@@ -2319,6 +2721,11 @@ void RemoveOutput(ReflectorOutput* inOutput, ReflectorSession* inSession, Bool16
     {
         if(inOutput != NULL)
         {
+            // Leave the multicast group first, the group output counts as one of the session's outputs
+            RTPSessionOutput* theClientOutput = (RTPSessionOutput*)inOutput;
+            if(theClientOutput->IsSubnetViewer())
+                inSession->LeaveMulticastGroup(theClientOutput->IsMulticastViewer());
+                
 			inSession->RemoveOutput(inOutput,true);
             //qtss_printf("QTSSReflectorModule.cpp:RemoveOutput it is a client session\n");
         }
@@ -2643,13 +3050,22 @@ SInt32 InputStreamData(QTSS_RelayStreamData_Params* inParams)
 	if(2 == sSessionStatus[inParams->in_relay_source_uuid])//fym
 		return 0;
 
-	OSMutexLocker locker(sSessionMutexArray[inParams->in_relay_source_uuid]);//fym OSMutexLocker locker(theSession->GetMutex());//fym
-
-	ReflectorSession* theSession = FindExistingReflectorSession(inParams->in_relay_source_uuid);
+	// Don't take sSessionMutexArray here: setup and teardown hold it for a long time, and
+	// the ingest thread must never wait on them. The ref keeps the session alive instead.
+	// RemoveOutput takes the session out of the map, so no new Resolve finds it, and then
+	// UnRegister waits for this ref to be released before the session is deleted.
+	char temp[24];
+	::ZeroMemory(temp, sizeof(temp));
+	qtss_sprintf(temp, "\\%d.sdp", inParams->in_relay_source_uuid);
+	StrPtrLen src_url(temp);
 
-	if(NULL  == theSession)
+	OSRef* theSessionRef = sSessionMap->Resolve(&src_url);
+	if(NULL == theSessionRef)
 		return 0;//fym QTSS_RequestFailed;
 
+	OSRefReleaser releaser(sSessionMap, theSessionRef);
+	ReflectorSession* theSession = (ReflectorSession*)theSessionRef->GetObject();
+
 	//fym ûпͻ
 	if(!(theSession->GetNumOutputs()))
 		return 0;
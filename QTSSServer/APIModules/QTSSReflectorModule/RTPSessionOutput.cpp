@@ -33,6 +33,7 @@
 
 #include "RTPSessionOutput.h"
 #include "ReflectorStream.h"
+#include "RTCPCompoundPacket.h"
 
 #include <errno.h>
 
@@ -45,9 +46,9 @@
 
 // ATTRIBUTES
 
-static QTSS_AttributeID     sNextSeqNumAttr             = qtssIllegalAttrID;
 static QTSS_AttributeID     sSeqNumOffsetAttr           = qtssIllegalAttrID;
-static QTSS_AttributeID     sLastQualityChangeAttr      = qtssIllegalAttrID;
+static QTSS_AttributeID     sDropToNextIDRAttr          = qtssIllegalAttrID;
+static QTSS_AttributeID     sThinResumeSeqNumAttr       = qtssIllegalAttrID;
 static QTSS_AttributeID     sLastRTPPacketIDAttr        = qtssIllegalAttrID;
 static QTSS_AttributeID     sLastRTCPPacketIDAttr       = qtssIllegalAttrID;
 
@@ -71,6 +72,8 @@ static QTSS_AttributeID     sLastRTPTimeStampAttr           = qtssIllegalAttrID;
 
 static QTSS_AttributeID     sLastRTCPTransmitAttr           = qtssIllegalAttrID;
 
+UInt32 RTPSessionOutput::sMaxRetransmitsPerSec = 50;
+
 RTPSessionOutput::RTPSessionOutput(QTSS_ClientSessionObject inClientSession, ReflectorSession* inReflectorSession,
                                     QTSS_Object serverPrefs, QTSS_AttributeID inCookieAddrID)
 :   fClientSession(inClientSession),
@@ -81,7 +84,12 @@ RTPSessionOutput::RTPSessionOutput(QTSS_ClientSessionObject inClientSession, Ref
     fIsUDP(false),
     fTransportInitialized(false),
     fMustSynch(true),
-    fPreFilter(true)
+    fPreFilter(true),
+    fIsSubnetViewer(false),
+    fIsMulticastViewer(false),
+    fNumRetransmitRequests(0),
+    fRetransmitIntervalStart(0),
+    fRetransmitsInInterval(0)
 {
     // create a bookmark for each stream we'll reflect
     this->InititializeBookmarks( inReflectorSession->GetNumStreams() );
@@ -91,9 +99,9 @@ RTPSessionOutput::RTPSessionOutput(QTSS_ClientSessionObject inClientSession, Ref
 void RTPSessionOutput::Register()
 {
     // Add some attributes to QTSS_RTPStream dictionary 
-    static char*        sNextSeqNum             = "qtssNextSeqNum";
     static char*        sSeqNumOffset           = "qtssSeqNumOffset";
-    static char*        sLastQualityChange      = "qtssLastQualityChange";
+    static char*        sDropToNextIDR          = "qtssReflectorStreamDropToNextIDR";
+    static char*        sThinResumeSeqNum       = "qtssReflectorStreamThinResumeSeqNum";
     
     static char*        sLastRTPPacketID        = "qtssReflectorStreamLastRTPPacketID";
     static char*        sLastRTCPPacketID       = "qtssReflectorStreamLastRTCPPacketID";
@@ -122,14 +130,14 @@ void RTPSessionOutput::Register()
     (void)QTSS_AddStaticAttribute(qtssRTPStreamObjectType, sLastRTCPTransmit, NULL, qtssAttrDataTypeUInt16);
     (void)QTSS_IDForAttr(qtssRTPStreamObjectType, sLastRTCPTransmit, &sLastRTCPTransmitAttr);
 
-    (void)QTSS_AddStaticAttribute(qtssRTPStreamObjectType, sNextSeqNum, NULL, qtssAttrDataTypeUInt16);
-    (void)QTSS_IDForAttr(qtssRTPStreamObjectType, sNextSeqNum, &sNextSeqNumAttr);
-
     (void)QTSS_AddStaticAttribute(qtssRTPStreamObjectType, sSeqNumOffset, NULL, qtssAttrDataTypeUInt16);
     (void)QTSS_IDForAttr(qtssRTPStreamObjectType, sSeqNumOffset, &sSeqNumOffsetAttr);
 
-    (void)QTSS_AddStaticAttribute(qtssRTPStreamObjectType, sLastQualityChange, NULL, qtssAttrDataTypeSInt64);
-    (void)QTSS_IDForAttr(qtssRTPStreamObjectType, sLastQualityChange, &sLastQualityChangeAttr);
+    (void)QTSS_AddStaticAttribute(qtssRTPStreamObjectType, sDropToNextIDR, NULL, qtssAttrDataTypeBool16);
+    (void)QTSS_IDForAttr(qtssRTPStreamObjectType, sDropToNextIDR, &sDropToNextIDRAttr);
+    
+    (void)QTSS_AddStaticAttribute(qtssRTPStreamObjectType, sThinResumeSeqNum, NULL, qtssAttrDataTypeUInt16);
+    (void)QTSS_IDForAttr(qtssRTPStreamObjectType, sThinResumeSeqNum, &sThinResumeSeqNumAttr);
     
     
     (void)QTSS_AddStaticAttribute(qtssRTPStreamObjectType, sLastRTPPacketID, NULL, qtssAttrDataTypeUInt64);
@@ -567,11 +575,15 @@ QTSS_Error  RTPSessionOutput::WritePacket(StrPtrLen* inPacket, void* inStreamCoo
     QTSS_RTPSessionState*   theState = NULL;
     UInt32                  theLen = 0;
     QTSS_Error              writeErr = QTSS_NoErr;
-    SInt64                  currentTime = OS::Milliseconds();
+    SInt64                  currentTime = OSThread::GetRunStartMilliseconds();
     
  	if(inPacket == NULL || inPacket->Len == 0)
 		return QTSS_NoErr;
 
+    // The session's multicast output already sent this one to the group
+    if(fIsMulticastViewer)
+        return QTSS_NoErr;
+
  
 	(void)QTSS_GetValuePtr(fClientSession, qtssCliSesState, 0, (void**)&theState, &theLen);
     if(theLen == 0 || theState == NULL || *theState != qtssPlayingState)
@@ -592,15 +604,49 @@ QTSS_Error  RTPSessionOutput::WritePacket(StrPtrLen* inPacket, void* inStreamCoo
                 
             if(!this->PacketReadyToSend(theStreamPtr,&currentTime, inFlags, packetIDPtr, timeToSendThisPacketAgain)) 
                 return QTSS_WouldBlock; // stop not ready to send packets now
+            
+            //
+            // A thinned stream skips whole frames. Packets that do go out are renumbered
+            // so the client sees no gaps, which means copying them, as the packet we are
+            // given is shared by every output of this stream.
+            StrPtrLen thePacketStr(*inPacket);
+            char thePacketCopy[ReflectorPacket::kMaxReflectorPacketSize];
+            if((inFlags & qtssWriteFlagsIsRTP) && ((ReflectorStream*)inStreamCookie)->IsFECPacket(*inPacket))
+            {
+                //
+                // Parity only helps plain UDP viewers, and only while the sequence
+                // numbers it names are still the ones the viewer sees.
+                if(!this->IsUDP() || (this->GetSeqNumOffset(*theStreamPtr) != 0))
+                {
+                    (void) QTSS_SetValue (*theStreamPtr, sLastRTPPacketIDAttr, 0, packetIDPtr, sizeof(UInt64));
+                    return QTSS_NoErr;
+                }
+            }
+            else if(inFlags & qtssWriteFlagsIsRTP)
+            {
+                UInt16 theSeqNumOffset = 0;
+                if(this->PacketShouldBeThinned(*theStreamPtr, inPacket, &theSeqNumOffset))
+                {
+                    (void) QTSS_SetValue (*theStreamPtr, sLastRTPPacketIDAttr, 0, packetIDPtr, sizeof(UInt64));
+                    return QTSS_NoErr;
+                }
+                
+                if((theSeqNumOffset != 0) && (inPacket->Len <= sizeof(thePacketCopy)))
+                {
+                    ::memcpy(thePacketCopy, inPacket->Ptr, inPacket->Len);
+                    thePacketStr.Set(thePacketCopy, inPacket->Len);
+                    this->SetPacketSeqNumber(&thePacketStr, (UInt16)(this->GetPacketSeqNumber(inPacket) - theSeqNumOffset));
+                }
+            }
                                           
     
        // TrackPackets below is for re-writing the rtcps we don't use it right now-- shouldn't need to    
        // (void) this->TrackPackets(theStreamPtr, inPacket, &currentTime,inFlags,  &packetLatenessInMSec, timeToSendThisPacketAgain, packetIDPtr,arrivalTimeMSecPtr);
 
             QTSS_PacketStruct thePacket;
-            thePacket.packetData = inPacket->Ptr;
+            thePacket.packetData = thePacketStr.Ptr;
             thePacket.packetTransmitTime = (currentTime - packetLatenessInMSec) + (fBufferDelayMSecs - (currentTime - *arrivalTimeMSecPtr)); // add buffer time where oldest buffered packet as now == 0 and newest is entire buffer time in the future.
-            writeErr = QTSS_Write(*theStreamPtr, &thePacket, inPacket->Len, NULL, inFlags | qtssWriteFlagsWriteBurstBegin); 
+            writeErr = QTSS_Write(*theStreamPtr, &thePacket, thePacketStr.Len, NULL, inFlags | qtssWriteFlagsWriteBurstBegin); 
             if(writeErr == QTSS_WouldBlock)
             {  
                 //
@@ -617,6 +663,9 @@ QTSS_Error  RTPSessionOutput::WritePacket(StrPtrLen* inPacket, void* inStreamCoo
                 if(inFlags & qtssWriteFlagsIsRTP)
                 {
                     (void) QTSS_SetValue (*theStreamPtr, sLastRTPPacketIDAttr, 0, packetIDPtr, sizeof(UInt64));
+                    
+                    if(fNumRetransmitRequests > 0)
+                        this->SendRetransmits(*theStreamPtr, inStreamCookie, currentTime, *packetIDPtr);
                 }
                 else if(inFlags & qtssWriteFlagsIsRTCP)
                 {
@@ -654,93 +703,278 @@ void RTPSessionOutput::SetPacketSeqNumber(StrPtrLen* inPacket, UInt16 inSeqNumbe
     seqNumPtr[1] = htons(inSeqNumber);
 }
 
-// this routine is not used
-Bool16 RTPSessionOutput::PacketShouldBeThinned(QTSS_RTPStreamObject inStream, StrPtrLen* inPacket)
+UInt32 RTPSessionOutput::GetH264NALType(UInt8 inNALHeader)
 {
-    return false; // function is disabled.
-    
-    static UInt16 sZero = 0;
-    //This function determines whether the packet should be dropped.
-    //It also adjusts the sequence number if necessary
+    UInt8 theType = inNALHeader & 0x1F;
+    if(theType == 5)
+        return kH264IDR;
+    if((theType < 1) || (theType > 5))
+        return kH264NonVCL;
+        
+    // nal_ref_idc is the same for every slice of a picture, so one packet speaks for the frame
+    if((inNALHeader & 0x60) == 0)
+        return kH264Disposable;
+    return kH264Reference;
+}
 
-    if(inPacket->Len < 4)
-        return false;
+UInt32 RTPSessionOutput::GetH264PacketType(StrPtrLen* inPacket)
+{
+    UInt8* thePacket = (UInt8*)inPacket->Ptr;
+    UInt32 theLen = inPacket->Len;
+    if(theLen <= 12)
+        return kH264NonVCL;
     
-    UInt16 curSeqNum = this->GetPacketSeqNumber(inPacket);
-    UInt32* curQualityLevel = NULL;
-    UInt16* nextSeqNum = NULL;
-    UInt16* theSeqNumOffset = NULL;
-    SInt64* lastChangeTime = NULL;
+    //Skip the RTP header, its CSRCs, and its header extension if there is one
+    UInt32 theOffset = 12 + (4 * (thePacket[0] & 0x0F));
+    if(thePacket[0] & 0x10)
+    {
+        if(theOffset + 4 > theLen)
+            return kH264NonVCL;
+        theOffset += 4 + (4 * (((UInt32)thePacket[theOffset + 2] << 8) | thePacket[theOffset + 3]));
+    }
+    if(theOffset >= theLen)
+        return kH264NonVCL;
     
+    UInt8 theNALHeader = thePacket[theOffset];
+    switch (theNALHeader & 0x1F)
+    {
+        case 24: // STAP-A: the most important NAL unit inside decides
+        {
+            UInt32 theType = kH264NonVCL;
+            theOffset++;
+            while (theOffset + 2 < theLen)
+            {
+                UInt32 theNALSize = ((UInt32)thePacket[theOffset] << 8) | thePacket[theOffset + 1];
+                theOffset += 2;
+                if((theNALSize == 0) || (theOffset + theNALSize > theLen))
+                    break;
+                UInt32 theNALType = this->GetH264NALType(thePacket[theOffset]);
+                if(theNALType > theType)
+                    theType = theNALType;
+                theOffset += theNALSize;
+            }
+            return theType;
+        }
+        
+        case 28: // FU-A: nal_ref_idc is in the FU indicator, the NAL type in the FU header
+            if(theOffset + 1 >= theLen)
+                return kH264NonVCL;
+            return this->GetH264NALType((theNALHeader & 0xE0) | (thePacket[theOffset + 1] & 0x1F));
+            
+        default:
+            return this->GetH264NALType(theNALHeader);
+    }
+}
+
+UInt16 RTPSessionOutput::GetSeqNumOffset(QTSS_RTPStreamObject inStream)
+{
     UInt32 theLen = 0;
-    (void)QTSS_GetValuePtr(inStream, qtssRTPStrQualityLevel, 0, (void**)&curQualityLevel, &theLen);
-    if((curQualityLevel == NULL) || (theLen != sizeof(UInt32)))
+    UInt16* theSeqNumOffset = NULL;
+    (void)QTSS_GetValuePtr(inStream, sSeqNumOffsetAttr, 0, (void**)&theSeqNumOffset, &theLen);
+    if((theSeqNumOffset != NULL) && (theLen == sizeof(UInt16)))
+        return *theSeqNumOffset;
+        
+    return 0;
+}
+
+Bool16 RTPSessionOutput::PacketShouldBeThinned(QTSS_RTPStreamObject inStream, StrPtrLen* inPacket, UInt16* outSeqNumOffset)
+{
+    //This function determines whether the packet should be dropped, and if
+    //not, how much its sequence number should be adjusted by.
+    *outSeqNumOffset = this->GetSeqNumOffset(inStream);
+    UInt32 theLen = 0;
+    
+    //
+    // Only H.264 can be thinned a frame at a time. Everything else goes out whole,
+    // and a viewer that can't keep up with it is left to RTPStream's own dropping.
+    char* thePayloadName = NULL;
+    (void)QTSS_GetValuePtr(inStream, qtssRTPStrPayloadName, 0, (void**)&thePayloadName, &theLen);
+    if((thePayloadName == NULL) || !StrPtrLen(thePayloadName, theLen).EqualIgnoreCase("H264", 4))
         return false;
-    (void)QTSS_GetValuePtr(inStream, sNextSeqNumAttr, 0, (void**)&nextSeqNum, &theLen);
-    if((nextSeqNum == NULL) || (theLen != sizeof(UInt16)))
+        
+    UInt32 theQualityLevel = ReflectorSession::kNormalQuality;
+    UInt32* theQualityLevelPtr = NULL;
+    (void)QTSS_GetValuePtr(inStream, qtssRTPStrQualityLevel, 0, (void**)&theQualityLevelPtr, &theLen);
+    if((theQualityLevelPtr != NULL) && (theLen == sizeof(UInt32)))
+        theQualityLevel = *theQualityLevelPtr;
+    
+    Bool16 isDroppingToNextIDR = false;
+    Bool16* theDropToNextIDRPtr = NULL;
+    (void)QTSS_GetValuePtr(inStream, sDropToNextIDRAttr, 0, (void**)&theDropToNextIDRPtr, &theLen);
+    if((theDropToNextIDRPtr != NULL) && (theLen == sizeof(Bool16)))
+        isDroppingToNextIDR = *theDropToNextIDRPtr;
+    
+    Bool16 shouldDrop = false;
+    UInt32 thePacketType = this->GetH264PacketType(inPacket);
+    if(thePacketType == kH264IDR)
     {
-        nextSeqNum = &sZero;
-        (void)QTSS_SetValue(inStream, sNextSeqNumAttr, 0, nextSeqNum, sizeof(UInt16));
+        //Nothing before an IDR is needed to decode what follows it
+        if(isDroppingToNextIDR)
+        {
+            isDroppingToNextIDR = false;
+            (void)QTSS_SetValue(inStream, sDropToNextIDRAttr, 0, &isDroppingToNextIDR, sizeof(isDroppingToNextIDR));
+        }
     }
-    (void)QTSS_GetValuePtr(inStream, sSeqNumOffsetAttr, 0, (void**)&theSeqNumOffset, &theLen);
-    if((theSeqNumOffset == NULL) || (theLen != sizeof(UInt16)))
+    else if(thePacketType != kH264NonVCL)
     {
-        theSeqNumOffset = &sZero;
-        (void)QTSS_SetValue(inStream, sSeqNumOffsetAttr, 0, theSeqNumOffset, sizeof(UInt16));
+        if(isDroppingToNextIDR)
+            shouldDrop = true;
+        else if((theQualityLevel >= ReflectorSession::kKeyFramesOnlyQuality) && (thePacketType == kH264Reference))
+        {
+            //
+            // Once a reference frame is gone, so is everything that refers to it,
+            // which is the rest of this GOP. Even if the quality level goes back up
+            // we keep dropping until the next IDR.
+            isDroppingToNextIDR = true;
+            (void)QTSS_SetValue(inStream, sDropToNextIDRAttr, 0, &isDroppingToNextIDR, sizeof(isDroppingToNextIDR));
+            shouldDrop = true;
+#if RTP_SESSION_DEBUGGING
+            qtss_printf("RTPSessionOutput dropping to next IDR at seq %u\n", this->GetPacketSeqNumber(inPacket));
+#endif
+        }
+        else if((theQualityLevel >= ReflectorSession::kNoDisposableFramesQuality) && (thePacketType == kH264Disposable))
+            shouldDrop = true;
     }
-    UInt16 newSeqNumOffset = *theSeqNumOffset;
     
-    (void)QTSS_GetValuePtr(inStream, sLastQualityChangeAttr, 0, (void**)&lastChangeTime, &theLen);
-    if((lastChangeTime == NULL) || (theLen != sizeof(SInt64)))
-    {   static SInt64 startTime = 0;
-        lastChangeTime = &startTime;
-        (void)QTSS_SetValue(inStream, sLastQualityChangeAttr, 0, lastChangeTime, sizeof(SInt64));
+    if(shouldDrop)
+    {
+        UInt16 theNewSeqNumOffset = *outSeqNumOffset + 1;
+        (void)QTSS_SetValue(inStream, sSeqNumOffsetAttr, 0, &theNewSeqNumOffset, sizeof(theNewSeqNumOffset));
+        
+        //the client number of the next packet we send. NACKs for anything before it can't be mapped back.
+        UInt16 theResumeSeqNum = (UInt16)(this->GetPacketSeqNumber(inPacket) + 1 - theNewSeqNumOffset);
+        (void)QTSS_SetValue(inStream, sThinResumeSeqNumAttr, 0, &theResumeSeqNum, sizeof(theResumeSeqNum));
     }
     
-    SInt64 timeNow = OS::Milliseconds();
-    if(*lastChangeTime == 0 || *curQualityLevel == 0) 
-        *lastChangeTime =timeNow;
-    
-    if(*curQualityLevel > 0 && ((*lastChangeTime + 30000) < timeNow) ) // 30 seconds between reductions
-    {   *curQualityLevel -= 1; // reduce quality value.  If we quality doesn't change then we may have hit some steady state which we can't get out of without thinning or increasing the quality
-        *lastChangeTime =timeNow; 
-        //qtss_printf("RTPSessionOutput set quality to %lu\n",*curQualityLevel);
+    return shouldDrop;
+}
+
+void RTPSessionOutput::ProcessRTCPFeedback(QTSS_RTPStreamObject inStream, void* inRTCPPacketData, UInt32 inRTCPPacketDataLen)
+{
+    //TCP doesn't lose packets, reliable UDP has its own resender, and multicast viewers aren't ours to repair
+    if(!this->IsUDP() || fIsMulticastViewer)
+        return;
+        
+    void** theStreamCookie = NULL;
+    UInt32 theLen = 0;
+    (void)QTSS_GetValuePtr(inStream, fCookieAttrID, 0, (void**)&theStreamCookie, &theLen);
+    if((theStreamCookie == NULL) || (*theStreamCookie == NULL))
+        return;
+        
+    RTCPCompoundPacket theCompoundPacket;
+    if(!theCompoundPacket.Parse((UInt8*)inRTCPPacketData, inRTCPPacketDataLen))
+        return;
+        
+    for (UInt32 x = 0; x < theCompoundPacket.GetNumPackets(); x++)
+    {
+        RTCPPacketView* thePacket = theCompoundPacket.GetPacket(x);
+        
+        if((thePacket->GetPacketType() == RTCPPacketView::kRTPFBPacketType) && (thePacket->GetCount() == RTCPPacketView::kGenericNACKFormat))
+        {
+            if(sMaxRetransmitsPerSec == 0)
+                continue;
+                
+            for (UInt32 theField = 0; theField < thePacket->GetNumNACKFields(); theField++)
+            {
+                UInt16 theSeqNum = thePacket->GetNACKPacketID(theField);
+                UInt16 theMask = thePacket->GetNACKBitmask(theField);
+                
+                this->QueueRetransmitRequest(inStream, *theStreamCookie, theSeqNum);
+                for (UInt16 theBit = 0; theBit < 16; theBit++)
+                {
+                    if(theMask & (1 << theBit))
+                        this->QueueRetransmitRequest(inStream, *theStreamCookie, (UInt16)(theSeqNum + theBit + 1));
+                }
+            }
+        }
+        else if((thePacket->GetPacketType() == RTCPPacketView::kPSFBPacketType) && (thePacket->GetCount() == RTCPPacketView::kPLIFormat))
+        {
+            //we don't make key frames, but the source can
+            ((ReflectorStream*)*theStreamCookie)->SendPictureLossIndication(thePacket->GetMediaSSRC());
+        }
     }
+}
 
-    //Check to see if we need to drop to audio only
-    if((*curQualityLevel >= ReflectorSession::kAudioOnlyQuality) &&
-        (*nextSeqNum == 0))
+void RTPSessionOutput::QueueRetransmitRequest(QTSS_RTPStreamObject inStream, void* inStreamCookie, UInt16 inClientSeqNum)
+{
+    //
+    // Undo the renumbering thinning did. The current offset only holds for packets
+    // sent since the last one was dropped, anything older we can't find any more.
+    UInt16 theSeqNumOffset = this->GetSeqNumOffset(inStream);
+    if(theSeqNumOffset != 0)
     {
-//#if REFLECTOR_THINNING_DEBUGGING || RTP_SESSION_DEBUGGING
-        qtss_printf(" *** Reflector Dropping to audio only *** \n");
-//#endif
-        //All we need to do in this case is mark the sequence number of the first dropped packet
-        (void)QTSS_SetValue(inStream, sNextSeqNumAttr, 0, &curSeqNum, sizeof(UInt16));  
-         *lastChangeTime =timeNow;  
+        UInt32 theLen = 0;
+        UInt16* theResumeSeqNum = NULL;
+        (void)QTSS_GetValuePtr(inStream, sThinResumeSeqNumAttr, 0, (void**)&theResumeSeqNum, &theLen);
+        if((theResumeSeqNum != NULL) && (theLen == sizeof(UInt16)) && ((SInt16)(inClientSeqNum - *theResumeSeqNum) < 0))
+            return;
+            
+        inClientSeqNum += theSeqNumOffset;
     }
     
+    OSMutexLocker locker(&fRetransmitMutex);
+    if(fNumRetransmitRequests == kMaxRetransmitRequests)
+        return;
+        
+    fRetransmitRequests[fNumRetransmitRequests].fStreamCookie = inStreamCookie;
+    fRetransmitRequests[fNumRetransmitRequests].fSeqNum = inClientSeqNum;
+    fNumRetransmitRequests++;
+}
+
+void RTPSessionOutput::SendRetransmits(QTSS_RTPStreamObject inStream, void* inStreamCookie, SInt64 inCurrentTime, UInt64 inLastPacketID)
+{
+    OSMutexLocker locker(&fRetransmitMutex);
     
-    //Check to see if we can reinstate video
-    if((*curQualityLevel == ReflectorSession::kNormalQuality) && (*nextSeqNum != 0))
+    if(inCurrentTime >= fRetransmitIntervalStart + kRetransmitIntervalInMsec)
     {
-        //Compute the offset amount for each subsequent sequence number. This offset will
-        //alter the sequence numbers so that they increment normally (providing the illusion to the
-        //client that there are no missing packets)
-        newSeqNumOffset = (*theSeqNumOffset) + (curSeqNum - (*nextSeqNum));
-        (void)QTSS_SetValue(inStream, sSeqNumOffsetAttr, 0, &newSeqNumOffset, sizeof(UInt16));
-        (void)QTSS_SetValue(inStream, sNextSeqNumAttr, 0, &sZero, sizeof(UInt16));
+        fRetransmitIntervalStart = inCurrentTime;
+        fRetransmitsInInterval = 0;
     }
     
-    //tell the caller whether to drop this packet or not.
-    if(*curQualityLevel >= ReflectorSession::kAudioOnlyQuality)
-        return true;
-    else
+    UInt16 theSeqNumOffset = this->GetSeqNumOffset(inStream);
+    ReflectorSender* theSender = ((ReflectorStream*)inStreamCookie)->GetRTPSender();
+    Bool16 isFlowControlled = false;
+    UInt32 theNumKept = 0;
+    for (UInt32 x = 0; x < fNumRetransmitRequests; x++)
     {
-        //Adjust the sequence number of the current packet based on the offset, if any
-        curSeqNum -= newSeqNumOffset;
-        this->SetPacketSeqNumber(inPacket, curSeqNum);
-        return false;
+        RetransmitRequest* theRequest = &fRetransmitRequests[x];
+        if(theRequest->fStreamCookie != inStreamCookie)
+        {
+            //another stream's, it gets looked at when that stream writes
+            fRetransmitRequests[theNumKept++] = *theRequest;
+            continue;
+        }
+        
+        //requests over the limit are dropped, by the time we could send them they would be too late
+        if(isFlowControlled || (fRetransmitsInInterval >= sMaxRetransmitsPerSec))
+            continue;
+            
+        //gone from the queue already, or not sent to this viewer yet, in which case it's still coming
+        ReflectorPacket* thePacket = theSender->GetPacketWithSeqNum(theRequest->fSeqNum);
+        if((thePacket == NULL) || (thePacket->fStreamCountID > inLastPacketID))
+            continue;
+            
+        StrPtrLen thePacketStr(thePacket->fPacketPtr);
+        char thePacketCopy[ReflectorPacket::kMaxReflectorPacketSize];
+        if(theSeqNumOffset != 0)
+        {
+            ::memcpy(thePacketCopy, thePacketStr.Ptr, thePacketStr.Len);
+            thePacketStr.Set(thePacketCopy, thePacketStr.Len);
+            this->SetPacketSeqNumber(&thePacketStr, (UInt16)(theRequest->fSeqNum - theSeqNumOffset));
+        }
+        
+#if RTP_SESSION_DEBUGGING
+        qtss_printf("RTPSessionOutput resending seq %u\n", this->GetPacketSeqNumber(&thePacketStr));
+#endif
+        QTSS_PacketStruct theRetransmit;
+        theRetransmit.packetData = thePacketStr.Ptr;
+        theRetransmit.packetTransmitTime = inCurrentTime;
+        if(QTSS_Write(inStream, &theRetransmit, thePacketStr.Len, NULL, qtssWriteFlagsIsRTP) == QTSS_NoErr)
+            fRetransmitsInInterval++;
+        else
+            isFlowControlled = true;
     }
+    fNumRetransmitRequests = theNumKept;
 }
 
 void RTPSessionOutput::TearDown()
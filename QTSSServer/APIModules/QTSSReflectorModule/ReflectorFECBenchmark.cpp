@@ -0,0 +1,290 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1999-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ *
+ */
+/*
+    File:       ReflectorFECBenchmark.cpp
+
+    Contains:   Checks ReflectorFECEncoder's FEC packets by rebuilding every packet they
+                protect, then times AddPacket for the row and matrix layouts the reflector
+                offers. Runs the way CommonUtilitiesBenchmark does, with the same options.
+                
+                This is a program of its own, not part of the module.
+
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SafeStdLib.h"
+
+#ifdef __Win32__
+#include "getopt.h"
+#else
+#include <unistd.h>
+#endif
+
+#include "OS.h"
+#include "OSThread.h"
+#include "OSMemory.h"
+#include "StrPtrLen.h"
+#include "Benchmark.h"
+#include "ReflectorFECEncoder.h"
+
+// Whatever a benchmark computes goes here, so the compiler can't throw the work away
+static volatile UInt32 sSink = 0;
+
+static void PrintUsage();
+
+//
+// ReflectorFECEncoder: 1400 byte packets, protected by a row of 10, or by the 10 x 4
+// matrix with a column under every packet of the row as well. The check rebuilds
+// every packet an FEC packet protects from the others, the way a receiver would
+// (RFC 5109), so a wrong header fails it as surely as wrong parity does.
+static const UInt32 kFECPacketSize = 1400;
+static const UInt32 kFECMatrixSize = 100;
+static const UInt8  kFECPayloadType = 127;
+static const UInt16 kFECFirstSeqNum = 65500;    // so the check's sequence numbers wrap
+static UInt8*   sFECPackets = NULL;             // kFECMatrixSize of them, kFECPacketSize apart
+static UInt32   sFECPacketLens[kFECMatrixSize]; // for the check. The benchmark sends them whole.
+static ReflectorFECEncoder* sFECEncoder = NULL;
+static UInt16   sFECSeqNum = 0;
+
+static UInt32 GetUInt32(const UInt8* inBytes)  { return ((UInt32)inBytes[0] << 24) | ((UInt32)inBytes[1] << 16) | ((UInt32)inBytes[2] << 8) | (UInt32)inBytes[3]; }
+static UInt16 GetUInt16(const UInt8* inBytes)  { return (UInt16)(((UInt16)inBytes[0] << 8) | inBytes[1]); }
+
+static void SetFECSeqNum(UInt8* ioPacket, UInt16 inSeqNum)
+{
+    ioPacket[2] = (UInt8)(inSeqNum >> 8);
+    ioPacket[3] = (UInt8)inSeqNum;
+}
+
+static void MakeFECPackets()
+{
+    if (sFECPackets != NULL)
+        return;
+        
+    sFECPackets = NEW UInt8[kFECMatrixSize * kFECPacketSize];
+    UInt32 theSeed = 6;
+    for (UInt32 x = 0; x < kFECMatrixSize; x++)
+    {
+        UInt8* thePacket = sFECPackets + (x * kFECPacketSize);
+        for (UInt32 y = 0; y < kFECPacketSize; y++)
+            thePacket[y] = (UInt8)NextRandom(&theSeed);
+            
+        // Ten packets to a frame, with the marker on the last one
+        UInt32 theTimeStamp = (x / 10) * 3000;
+        thePacket[0] = 0x80;
+        thePacket[1] = (UInt8)(((x % 10) == 9) ? 0x80 | 96 : 96);
+        thePacket[4] = (UInt8)(theTimeStamp >> 24);
+        thePacket[5] = (UInt8)(theTimeStamp >> 16);
+        thePacket[6] = (UInt8)(theTimeStamp >> 8);
+        thePacket[7] = (UInt8)theTimeStamp;
+        
+        // Odd lengths, so the parity has to be padded out and the SSE2 tail gets used
+        sFECPacketLens[x] = ReflectorFECEncoder::kRTPHeaderSize + 1 + (NextRandom(&theSeed) % (kFECPacketSize - ReflectorFECEncoder::kRTPHeaderSize));
+    }
+}
+
+static Bool16 RecoverFromFECPacket(StrPtrLen* inFECPacket, UInt32 inNumSent)
+{
+    const UInt8* theFEC = (const UInt8*)inFECPacket->Ptr;
+    const UInt8* theFECHeader = theFEC + ReflectorFECEncoder::kRTPHeaderSize;
+    const UInt8* theLevelHeader = theFECHeader + ReflectorFECEncoder::kFECHeaderSize;
+    Bool16 isLongMask = (theFECHeader[0] & 0x40) != 0;
+    UInt32 theMaskBytes = (isLongMask ? ReflectorFECEncoder::kLongMaskBits : ReflectorFECEncoder::kShortMaskBits) / 8;
+    UInt32 theParityOffset = (UInt32)(theLevelHeader + 2 + theMaskBytes - theFEC);
+    UInt32 theProtectionLen = GetUInt16(theLevelHeader);
+    if (((theFEC[1] & 0x7F) != kFECPayloadType) || ((theFECHeader[0] & 0x80) != 0) || (inFECPacket->Len != theParityOffset + theProtectionLen))
+    {
+        qtss_printf("ReflectorFECEncoder: FEC packet headers are wrong\n");
+        return false;
+    }
+    
+    UInt64 theMask = 0;
+    for (UInt32 x = 0; x < theMaskBytes; x++)
+        theMask |= (UInt64)theLevelHeader[2 + x] << (ReflectorFECEncoder::kLongMaskBits - 8 - (x * 8));
+        
+    UInt32 theProtected[ReflectorFECEncoder::kLongMaskBits];
+    UInt32 theNumProtected = 0;
+    for (UInt32 x = 0; x < ReflectorFECEncoder::kLongMaskBits; x++)
+    {
+        if ((theMask & ((UInt64)1 << (ReflectorFECEncoder::kLongMaskBits - 1 - x))) == 0)
+            continue;
+        UInt32 theIndex = (UInt16)(GetUInt16(theFECHeader + 2) + x - kFECFirstSeqNum);
+        if (theIndex >= inNumSent)
+        {
+            qtss_printf("ReflectorFECEncoder: FEC packet protects a packet that wasn't sent\n");
+            return false;
+        }
+        theProtected[theNumProtected++] = theIndex;
+    }
+    
+    // Lose each one in turn
+    UInt8 theRecovered[kFECPacketSize];
+    for (UInt32 theLost = 0; theLost < theNumProtected; theLost++)
+    {
+        UInt8 theHeader0 = theFECHeader[0];
+        UInt8 theHeader1 = theFECHeader[1];
+        UInt32 theTimeStamp = GetUInt32(theFECHeader + 4);
+        UInt16 theLen = GetUInt16(theFECHeader + 8);
+        ::memcpy(theRecovered, theFEC + theParityOffset, theProtectionLen);
+        for (UInt32 x = 0; x < theNumProtected; x++)
+        {
+            if (x == theLost)
+                continue;
+            const UInt8* thePacket = sFECPackets + (theProtected[x] * kFECPacketSize);
+            UInt32 thePacketLen = sFECPacketLens[theProtected[x]] - ReflectorFECEncoder::kRTPHeaderSize;
+            theHeader0 ^= thePacket[0];
+            theHeader1 ^= thePacket[1];
+            theTimeStamp ^= GetUInt32(thePacket + 4);
+            theLen ^= (UInt16)thePacketLen;
+            ReflectorFECEncoder::XORBytes(theRecovered, thePacket + ReflectorFECEncoder::kRTPHeaderSize, thePacketLen);
+        }
+        
+        const UInt8* theLostPacket = sFECPackets + (theProtected[theLost] * kFECPacketSize);
+        UInt32 theLostLen = sFECPacketLens[theProtected[theLost]] - ReflectorFECEncoder::kRTPHeaderSize;
+        if (((theHeader0 & 0x3F) != (theLostPacket[0] & 0x3F)) || (theHeader1 != theLostPacket[1]) ||
+            (theTimeStamp != GetUInt32(theLostPacket + 4)) || (theLen != theLostLen) ||
+            (::memcmp(theRecovered, theLostPacket + ReflectorFECEncoder::kRTPHeaderSize, theLostLen) != 0))
+        {
+            qtss_printf("ReflectorFECEncoder: packet %lu didn't come back from parity\n", theProtected[theLost]);
+            return false;
+        }
+    }
+    return true;
+}
+
+static Bool16 CheckFECMatrix(UInt32 inColumns, UInt32 inRows)
+{
+    ReflectorFECEncoder theEncoder;
+    if (!theEncoder.Configure(inColumns, inRows, kFECPayloadType))
+    {
+        qtss_printf("ReflectorFECEncoder: won't do %lu x %lu\n", inColumns, inRows);
+        return false;
+    }
+    
+    UInt32 theNumRows = (inRows > 0) ? inRows : kFECMatrixSize / inColumns;
+    UInt32 theNumFECPackets = 0;
+    for (UInt32 x = 0; x < inColumns * theNumRows; x++)
+    {
+        UInt8* thePacket = sFECPackets + (x * kFECPacketSize);
+        SetFECSeqNum(thePacket, (UInt16)(kFECFirstSeqNum + x));
+        UInt32 theNumOut = theEncoder.AddPacket(StrPtrLen((char*)thePacket, sFECPacketLens[x]));
+        for (UInt32 y = 0; y < theNumOut; y++)
+        {
+            if (!RecoverFromFECPacket(theEncoder.GetFECPacket(y), x + 1))
+                return false;
+        }
+        theNumFECPackets += theNumOut;
+    }
+    
+    // One per row, and one per column if there are columns
+    UInt32 theExpected = theNumRows + ((inRows > 0) ? inColumns : 0);
+    if (theNumFECPackets != theExpected)
+    {
+        qtss_printf("ReflectorFECEncoder: %lu x %lu sent %lu FEC packets, not %lu\n", inColumns, inRows, theNumFECPackets, theExpected);
+        return false;
+    }
+    return true;
+}
+
+static Bool16 CheckReflectorFECEncoder()
+{
+    MakeFECPackets();
+    
+    // A column of 10 x 10 spans 91 packets, more than a mask covers
+    ReflectorFECEncoder theEncoder;
+    if (theEncoder.Configure(10, 10, kFECPayloadType) || theEncoder.IsEnabled())
+    {
+        qtss_printf("ReflectorFECEncoder: took a 10 x 10 matrix\n");
+        return false;
+    }
+    
+    // Row parity only, with a short mask and a long one, then a matrix
+    return CheckFECMatrix(10, 0) && CheckFECMatrix(20, 0) && CheckFECMatrix(10, 4);
+}
+
+static Bool16 FECSetup(UInt32 inColumns, UInt32 inRows)
+{
+    MakeFECPackets();
+    if (sFECEncoder == NULL)
+        sFECEncoder = NEW ReflectorFECEncoder();
+    return sFECEncoder->Configure(inColumns, inRows, kFECPayloadType);
+}
+
+static Bool16 FECRowSetup(UInt32 /*inNumThreads*/)      { return FECSetup(10, 0); }
+static Bool16 FECMatrixSetup(UInt32 /*inNumThreads*/)   { return FECSetup(10, 4); }
+
+static void FECAddPacket(UInt32 /*inThreadIndex*/, UInt32 inIterations)
+{
+    UInt32 theNumFECPackets = 0;
+    for (UInt32 x = 0; x < inIterations; x++)
+    {
+        UInt8* thePacket = sFECPackets + ((x % kFECMatrixSize) * kFECPacketSize);
+        SetFECSeqNum(thePacket, sFECSeqNum++);
+        theNumFECPackets += sFECEncoder->AddPacket(StrPtrLen((char*)thePacket, kFECPacketSize));
+    }
+    sSink += theNumFECPackets;
+}
+
+static Check sChecks[] =
+{
+    { "ReflectorFECEncoder",                    CheckReflectorFECEncoder }
+};
+static const UInt32 kNumChecks = sizeof(sChecks) / sizeof(Check);
+
+static Benchmark sBenchmarks[] =
+{
+    { "ReflectorFECEncoder/AddPacket/1400/row10",   false,  kFECPacketSize - ReflectorFECEncoder::kRTPHeaderSize,   FECRowSetup,    FECAddPacket,   NULL },
+    { "ReflectorFECEncoder/AddPacket/1400/10x4",    false,  kFECPacketSize - ReflectorFECEncoder::kRTPHeaderSize,   FECMatrixSetup, FECAddPacket,   NULL }
+};
+static const UInt32 kNumBenchmarks = sizeof(sBenchmarks) / sizeof(Benchmark);
+
+int main(int argc, char* argv[])
+{
+    extern char* optarg;
+    int ch;
+    
+    BenchmarkOptions theOptions;
+    while ((ch = getopt(argc, argv, kBenchmarkOptionLetters "h")) != EOF)
+    {
+        if (!ParseBenchmarkOption(ch, optarg, &theOptions))
+        {
+            PrintUsage();
+            ::exit(0);
+        }
+    }
+        
+    OS::Initialize();
+    OSThread::Initialize();
+    
+    return RunChecksAndBenchmarks("QTSSReflectorModule", sChecks, kNumChecks, sBenchmarks, kNumBenchmarks, &theOptions);
+}
+
+void PrintUsage()
+{
+    qtss_printf("usage: ReflectorFECBenchmark [-f filter] [-t msec] [-j threads] [-o results.json] [-c]\n");
+    PrintBenchmarkOptions();
+}
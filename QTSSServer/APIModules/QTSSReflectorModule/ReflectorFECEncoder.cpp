@@ -0,0 +1,288 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1999-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ *
+ */
+/*
+    File:       ReflectorFECEncoder.cpp
+
+    Contains:   Implementation of object described in .h file
+
+
+
+*/
+
+#include "ReflectorFECEncoder.h"
+#include "OSMemory.h"
+#include "SafeStdLib.h"
+#include <string.h>
+#include <stdlib.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define REFLECTOR_FEC_SSE2 1
+#else
+#define REFLECTOR_FEC_SSE2 0
+#endif
+
+ReflectorFECEncoder::ReflectorFECEncoder()
+:   fColumns(0),
+    fRows(0),
+    fPayloadType(0),
+    fLongMask(false),
+    fParityOffset(0),
+    fSSRC(0),
+    fSeqNum(0),
+    fHaveMatrix(false),
+    fMatrixBase(0),
+    fNextSeqNum(0),
+    fGroups(NULL),
+    fBuffer(NULL)
+{
+}
+
+Bool16 ReflectorFECEncoder::Configure(UInt32 inColumns, UInt32 inRows, UInt8 inPayloadType)
+{
+    delete [] fGroups;
+    delete [] fBuffer;
+    fGroups = NULL;
+    fBuffer = NULL;
+    fColumns = 0;
+    fHaveMatrix = false;
+
+    if(inColumns == 0)
+        return true;
+
+    //a column spans from its top packet to its bottom one, which is more than its packet count
+    UInt32 theSpan = inColumns;
+    if((inRows > 0) && (((inRows - 1) * inColumns) + 1 > theSpan))
+        theSpan = ((inRows - 1) * inColumns) + 1;
+    if(theSpan > kLongMaskBits)
+        return false;
+
+    fRows = inRows;
+    fPayloadType = (UInt8)(inPayloadType & 0x7F);
+    fLongMask = (theSpan > kShortMaskBits);
+    fParityOffset = kRTPHeaderSize + kFECHeaderSize + (fLongMask ? kLongLevelHeaderSize : kShortLevelHeaderSize);
+    fSSRC = (UInt32)::rand();
+    fSeqNum = (UInt16)::rand();
+
+    UInt32 theNumGroups = 1 + inColumns;
+    fGroups = NEW ParityGroup[theNumGroups];
+    fBuffer = NEW UInt8[theNumGroups * kMaxFECPacketSize];
+    for (UInt32 x = 0; x < theNumGroups; x++)
+    {
+        fGroups[x].fNumPackets = 0;
+        fGroups[x].fPacket = fBuffer + (x * kMaxFECPacketSize);
+    }
+
+    fColumns = inColumns;
+    return true;
+}
+
+Bool16 ReflectorFECEncoder::IsFECPacket(const StrPtrLen& inPacket)
+{
+    if((fColumns == 0) || (inPacket.Len < kRTPHeaderSize))
+        return false;
+
+    UInt8* thePacket = (UInt8*)inPacket.Ptr;
+    UInt32 theSSRC = ((UInt32)thePacket[8] << 24) | ((UInt32)thePacket[9] << 16) | ((UInt32)thePacket[10] << 8) | (UInt32)thePacket[11];
+    return ((thePacket[1] & 0x7F) == fPayloadType) && (theSSRC == fSSRC);
+}
+
+UInt32 ReflectorFECEncoder::AddPacket(const StrPtrLen& inPacket)
+{
+    if(fColumns == 0)
+        return 0;
+
+    UInt8* thePacket = (UInt8*)inPacket.Ptr;
+    if((inPacket.Len <= kRTPHeaderSize) || (inPacket.Len - kRTPHeaderSize > kMaxProtectedSize) ||
+        ((thePacket[0] & 0xC0) != 0x80) || ((thePacket[1] & 0x7F) == fPayloadType))
+    {
+        //can't protect this one, so nothing it would have been grouped with is complete either
+        fHaveMatrix = false;
+        return 0;
+    }
+
+    //
+    // A gap or reordering from the source leaves every open group short a packet.
+    // Start a new matrix here instead of sending parity nobody can use.
+    UInt16 theSeqNum = (UInt16)(((UInt16)thePacket[2] << 8) | thePacket[3]);
+    UInt32 theMatrixSize = fColumns * ((fRows > 0) ? fRows : 1);
+    if(!fHaveMatrix || (theSeqNum != fNextSeqNum) || ((UInt16)(theSeqNum - fMatrixBase) >= theMatrixSize))
+    {
+        fHaveMatrix = true;
+        fMatrixBase = theSeqNum;
+    }
+    fNextSeqNum = (UInt16)(theSeqNum + 1);
+
+    UInt32 theIndex = (UInt16)(theSeqNum - fMatrixBase);
+    UInt32 theRow = theIndex / fColumns;
+    UInt32 theColumn = theIndex % fColumns;
+    UInt32 theNumFECPackets = 0;
+
+    ParityGroup* theRowGroup = &fGroups[0];
+    if(theColumn == 0)
+        this->StartGroup(theRowGroup, theSeqNum);
+    this->AddToGroup(theRowGroup, thePacket, inPacket.Len, theColumn);
+    if(theColumn == fColumns - 1)
+        fOutput[theNumFECPackets++] = this->FinishGroup(theRowGroup);
+
+    if(fRows > 0)
+    {
+        ParityGroup* theColumnGroup = &fGroups[1 + theColumn];
+        if(theRow == 0)
+            this->StartGroup(theColumnGroup, theSeqNum);
+        this->AddToGroup(theColumnGroup, thePacket, inPacket.Len, theRow * fColumns);
+        if(theRow == fRows - 1)
+            fOutput[theNumFECPackets++] = this->FinishGroup(theColumnGroup);
+    }
+
+    return theNumFECPackets;
+}
+
+void ReflectorFECEncoder::StartGroup(ParityGroup* ioGroup, UInt16 inSeqNumBase)
+{
+    ioGroup->fSeqNumBase = inSeqNumBase;
+    ioGroup->fNumPackets = 0;
+    ioGroup->fMask = 0;
+    ioGroup->fProtectionLength = 0;
+    ioGroup->fHeaderRecovery[0] = 0;
+    ioGroup->fHeaderRecovery[1] = 0;
+    ioGroup->fTimeStampRecovery = 0;
+    ioGroup->fLengthRecovery = 0;
+    ioGroup->fLastTimeStamp = 0;
+}
+
+void ReflectorFECEncoder::AddToGroup(ParityGroup* ioGroup, UInt8* inPacket, UInt32 inLen, UInt32 inOffsetFromBase)
+{
+    UInt32 theTimeStamp = ((UInt32)inPacket[4] << 24) | ((UInt32)inPacket[5] << 16) | ((UInt32)inPacket[6] << 8) | (UInt32)inPacket[7];
+    UInt32 theProtectedLen = inLen - kRTPHeaderSize;
+    UInt8* theParity = ioGroup->fPacket + fParityOffset;
+
+    //the CSRC list, header extension, payload and padding are all protected
+    if(ioGroup->fNumPackets == 0)
+        ::memcpy(theParity, inPacket + kRTPHeaderSize, theProtectedLen);
+    else
+    {
+        //shorter packets count as if padded with zeros
+        if(theProtectedLen > ioGroup->fProtectionLength)
+            ::memset(theParity + ioGroup->fProtectionLength, 0, theProtectedLen - ioGroup->fProtectionLength);
+        XORBytes(theParity, inPacket + kRTPHeaderSize, theProtectedLen);
+    }
+
+    if(theProtectedLen > ioGroup->fProtectionLength)
+        ioGroup->fProtectionLength = theProtectedLen;
+
+    ioGroup->fHeaderRecovery[0] ^= inPacket[0];
+    ioGroup->fHeaderRecovery[1] ^= inPacket[1];
+    ioGroup->fTimeStampRecovery ^= theTimeStamp;
+    ioGroup->fLengthRecovery ^= (UInt16)theProtectedLen;
+    ioGroup->fMask |= ((UInt64)1 << (kLongMaskBits - 1 - inOffsetFromBase));
+    ioGroup->fLastTimeStamp = theTimeStamp;
+    ioGroup->fNumPackets++;
+}
+
+StrPtrLen ReflectorFECEncoder::FinishGroup(ParityGroup* ioGroup)
+{
+    UInt8* theWriter = ioGroup->fPacket;
+
+    // RTP header. The timestamp is that of the last packet protected.
+    theWriter[0] = 0x80;
+    theWriter[1] = fPayloadType;
+    theWriter[2] = (UInt8)(fSeqNum >> 8);
+    theWriter[3] = (UInt8)fSeqNum;
+    theWriter[4] = (UInt8)(ioGroup->fLastTimeStamp >> 24);
+    theWriter[5] = (UInt8)(ioGroup->fLastTimeStamp >> 16);
+    theWriter[6] = (UInt8)(ioGroup->fLastTimeStamp >> 8);
+    theWriter[7] = (UInt8)ioGroup->fLastTimeStamp;
+    theWriter[8] = (UInt8)(fSSRC >> 24);
+    theWriter[9] = (UInt8)(fSSRC >> 16);
+    theWriter[10] = (UInt8)(fSSRC >> 8);
+    theWriter[11] = (UInt8)fSSRC;
+    fSeqNum++;
+
+    // FEC header: E, L, P/X/CC recovery, M/PT recovery, SN base, TS recovery, length recovery
+    theWriter += kRTPHeaderSize;
+    theWriter[0] = (UInt8)((fLongMask ? 0x40 : 0) | (ioGroup->fHeaderRecovery[0] & 0x3F));
+    theWriter[1] = ioGroup->fHeaderRecovery[1];
+    theWriter[2] = (UInt8)(ioGroup->fSeqNumBase >> 8);
+    theWriter[3] = (UInt8)ioGroup->fSeqNumBase;
+    theWriter[4] = (UInt8)(ioGroup->fTimeStampRecovery >> 24);
+    theWriter[5] = (UInt8)(ioGroup->fTimeStampRecovery >> 16);
+    theWriter[6] = (UInt8)(ioGroup->fTimeStampRecovery >> 8);
+    theWriter[7] = (UInt8)ioGroup->fTimeStampRecovery;
+    theWriter[8] = (UInt8)(ioGroup->fLengthRecovery >> 8);
+    theWriter[9] = (UInt8)ioGroup->fLengthRecovery;
+
+    // Level 0 header: protection length and mask
+    theWriter += kFECHeaderSize;
+    theWriter[0] = (UInt8)(ioGroup->fProtectionLength >> 8);
+    theWriter[1] = (UInt8)ioGroup->fProtectionLength;
+    UInt32 theMaskBytes = (fLongMask ? kLongMaskBits : kShortMaskBits) / 8;
+    for (UInt32 x = 0; x < theMaskBytes; x++)
+        theWriter[2 + x] = (UInt8)(ioGroup->fMask >> (kLongMaskBits - 8 - (x * 8)));
+
+    return StrPtrLen((char*)ioGroup->fPacket, fParityOffset + ioGroup->fProtectionLength);
+}
+
+void ReflectorFECEncoder::XORBytes(UInt8* ioDest, const UInt8* inSrc, UInt32 inLen)
+{
+    UInt32 x = 0;
+
+#if REFLECTOR_FEC_SSE2
+    for (; x + 64 <= inLen; x += 64)
+    {
+        __m128i theDest0 = _mm_loadu_si128((__m128i*)(ioDest + x));
+        __m128i theDest1 = _mm_loadu_si128((__m128i*)(ioDest + x + 16));
+        __m128i theDest2 = _mm_loadu_si128((__m128i*)(ioDest + x + 32));
+        __m128i theDest3 = _mm_loadu_si128((__m128i*)(ioDest + x + 48));
+        theDest0 = _mm_xor_si128(theDest0, _mm_loadu_si128((const __m128i*)(inSrc + x)));
+        theDest1 = _mm_xor_si128(theDest1, _mm_loadu_si128((const __m128i*)(inSrc + x + 16)));
+        theDest2 = _mm_xor_si128(theDest2, _mm_loadu_si128((const __m128i*)(inSrc + x + 32)));
+        theDest3 = _mm_xor_si128(theDest3, _mm_loadu_si128((const __m128i*)(inSrc + x + 48)));
+        _mm_storeu_si128((__m128i*)(ioDest + x), theDest0);
+        _mm_storeu_si128((__m128i*)(ioDest + x + 16), theDest1);
+        _mm_storeu_si128((__m128i*)(ioDest + x + 32), theDest2);
+        _mm_storeu_si128((__m128i*)(ioDest + x + 48), theDest3);
+    }
+    for (; x + 16 <= inLen; x += 16)
+    {
+        __m128i theDest = _mm_loadu_si128((__m128i*)(ioDest + x));
+        theDest = _mm_xor_si128(theDest, _mm_loadu_si128((const __m128i*)(inSrc + x)));
+        _mm_storeu_si128((__m128i*)(ioDest + x), theDest);
+    }
+#else
+    //word at a time. memcpy keeps this safe on platforms that fault on unaligned loads.
+    for (; x + sizeof(UInt64) <= inLen; x += sizeof(UInt64))
+    {
+        UInt64 theDest, theSrc;
+        ::memcpy(&theDest, ioDest + x, sizeof(UInt64));
+        ::memcpy(&theSrc, inSrc + x, sizeof(UInt64));
+        theDest ^= theSrc;
+        ::memcpy(ioDest + x, &theDest, sizeof(UInt64));
+    }
+#endif
+
+    for (; x < inLen; x++)
+        ioDest[x] ^= inSrc[x];
+}
@@ -0,0 +1,122 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1999-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ *
+ */
+/*
+    File:       ReflectorFECEncoder.h
+
+    Contains:   Generates RFC 5109 ULPFEC packets (XOR parity, level 0 only) for one
+                RTP stream. Packets are laid out in a matrix of fColumns packets per
+                row. Each row gets a parity packet, and if there are rows, each column
+                of fRows packets gets one too, so a viewer can rebuild any single lost
+                packet in a row and, with column parity, short bursts as well.
+
+                FEC packets use their own SSRC and sequence numbers and the payload
+                type they were configured with, so they can share the media's port.
+                
+                ReflectorFECBenchmark checks lost packets can be rebuilt from what
+                this sends, and times it.
+
+
+*/
+
+#ifndef __REFLECTOR_FEC_ENCODER_H__
+#define __REFLECTOR_FEC_ENCODER_H__
+
+#include "OSHeaders.h"
+#include "StrPtrLen.h"
+
+class ReflectorFECEncoder
+{
+    public:
+
+        enum
+        {
+            kRTPHeaderSize          = 12,   //UInt32
+            kFECHeaderSize          = 10,   //UInt32
+            kShortLevelHeaderSize   = 4,    //UInt32 protection length, 16 bit mask
+            kLongLevelHeaderSize    = 8,    //UInt32 protection length, 48 bit mask
+            kMaxFECPacketSize       = 2048, //UInt32 must fit in a ReflectorPacket
+            kMaxProtectedSize       = kMaxFECPacketSize - kRTPHeaderSize - kFECHeaderSize - kLongLevelHeaderSize,
+            kShortMaskBits          = 16,   //UInt32
+            kLongMaskBits           = 48,   //UInt32
+            kMaxFECPacketsPerCall   = 2     //UInt32 a row and a column can end on the same packet
+        };
+
+        ReflectorFECEncoder();
+        ~ReflectorFECEncoder() { delete [] fGroups; delete [] fBuffer; }
+
+        // inColumns packets to a row. With inRows 0 there is only row parity, otherwise
+        // every column of inRows packets is protected too. A group can't span more
+        // packets than the long mask covers. Returns false, and stays off, if it would.
+        Bool16      Configure(UInt32 inColumns, UInt32 inRows, UInt8 inPayloadType);
+
+        Bool16      IsEnabled()         { return fColumns > 0; }
+        UInt8       GetPayloadType()    { return fPayloadType; }
+        Bool16      IsFECPacket(const StrPtrLen& inPacket);
+
+        // Adds the next RTP packet of the stream. Returns how many FEC packets it
+        // completed. They are at GetFECPacket(0 .. n-1) until the next call.
+        UInt32      AddPacket(const StrPtrLen& inPacket);
+        StrPtrLen*  GetFECPacket(UInt32 inIndex) { return &fOutput[inIndex]; }
+
+        // ioDest ^= inSrc, 16 bytes at a time where SSE2 is available
+        static void XORBytes(UInt8* ioDest, const UInt8* inSrc, UInt32 inLen);
+
+    private:
+
+        struct ParityGroup
+        {
+            UInt16  fSeqNumBase;
+            UInt32  fNumPackets;
+            UInt64  fMask;              // bit kLongMaskBits - 1 is fSeqNumBase
+            UInt32  fProtectionLength;  // longest packet so far, less its RTP header
+            UInt8   fHeaderRecovery[2]; // first two RTP header bytes, XORed
+            UInt32  fTimeStampRecovery;
+            UInt16  fLengthRecovery;
+            UInt32  fLastTimeStamp;
+            UInt8*  fPacket;            // kMaxFECPacketSize. Parity is built in place after the headers.
+        };
+
+        void        StartGroup(ParityGroup* ioGroup, UInt16 inSeqNumBase);
+        void        AddToGroup(ParityGroup* ioGroup, UInt8* inPacket, UInt32 inLen, UInt32 inOffsetFromBase);
+        StrPtrLen   FinishGroup(ParityGroup* ioGroup);
+
+        UInt32          fColumns;
+        UInt32          fRows;
+        UInt8           fPayloadType;
+        Bool16          fLongMask;
+        UInt32          fParityOffset;  // where the protected bytes start in an FEC packet
+        UInt32          fSSRC;
+        UInt16          fSeqNum;
+
+        Bool16          fHaveMatrix;
+        UInt16          fMatrixBase;    // sequence number of the top left packet
+        UInt16          fNextSeqNum;
+
+        ParityGroup*    fGroups;        // the row, then one per column
+        UInt8*          fBuffer;
+        StrPtrLen       fOutput[kMaxFECPacketsPerCall];
+};
+
+#endif //__REFLECTOR_FEC_ENCODER_H__
@@ -0,0 +1,118 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1999-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ *
+ */
+/*
+    File:       ReflectorMulticastOutput.cpp
+
+    Contains:   Implementation of object described in .h file
+                    
+    
+
+*/
+
+#include "ReflectorMulticastOutput.h"
+#include "ReflectorSession.h"
+
+#include "OSMemory.h"
+
+ReflectorMulticastOutput::ReflectorMulticastOutput(ReflectorSession* inSession, UInt32 inGroupAddr, UInt16 inBasePort, UInt16 inTTL)
+:   fOutputSocket(NULL, Socket::kNonBlockingSocketType),
+    fNumStreams(inSession->GetNumStreams()),
+    fStreamCookieArray(NULL),
+    fGroupAddr(inGroupAddr),
+    fBasePort(inBasePort),
+    fTTL(inTTL),
+    fValid(false),
+    fTotalPacketsSent(0),
+    fTotalBytesSent(0)
+{
+	if(0 >= fNumStreams)
+		return;
+
+    fStreamCookieArray = NEW void*[fNumStreams];
+    
+    // create a bookmark for each stream we'll reflect
+    this->InititializeBookmarks( fNumStreams );
+    
+    // The stream cookie is what identifies the stream in WritePacket
+    for (UInt32 x = 0; x < fNumStreams; x++)
+        fStreamCookieArray[x] = inSession->GetStreamCookie(inSession->GetSourceInfo()->GetStreamInfo(x)->fTrackID);
+}
+
+ReflectorMulticastOutput::~ReflectorMulticastOutput()
+{
+    delete [] fStreamCookieArray;
+	fStreamCookieArray = NULL;
+}
+
+OS_Error ReflectorMulticastOutput::BindSocket(UInt32 inInterfaceAddr)
+{
+    OS_Error theErr = fOutputSocket.Open();
+    if(theErr != OS_NoErr)
+        return theErr;
+    
+    // We don't care what local port we bind to
+    theErr = fOutputSocket.Bind(inInterfaceAddr, 0);
+    if(theErr != OS_NoErr)
+        return theErr;
+        
+    theErr = fOutputSocket.SetTtl(fTTL);
+    if(theErr != OS_NoErr)
+        return theErr;
+    
+    if(inInterfaceAddr != INADDR_ANY)
+    {
+        theErr = fOutputSocket.SetMulticastInterface(inInterfaceAddr);
+        if(theErr != OS_NoErr)
+            return theErr;
+    }
+    
+    fValid = (fStreamCookieArray != NULL);
+    return OS_NoErr;
+}
+
+QTSS_Error  ReflectorMulticastOutput::WritePacket(StrPtrLen* inPacket, void* inStreamCookie, UInt32 inFlags, SInt64 /*packetLatenessInMSec*/, SInt64* /*timeToSendThisPacketAgain*/, UInt64* /*packetIDPtr*/, SInt64* /*arrivalTimeMSec*/ )
+{
+    if(!fValid || inPacket == NULL || inPacket->Len == 0)
+        return QTSS_NoErr;    // Not done setting up or we had an error setting up
+    
+    // Look for the matching stream
+    for (UInt32 x = 0; x < fNumStreams; x++)
+    {
+        if(inStreamCookie == fStreamCookieArray[x])
+        {
+            UInt16 theDestPort = (UInt16)(fBasePort + (x * 2));
+            if(inFlags & qtssWriteFlagsIsRTCP)
+                theDestPort++;
+            
+            (void)fOutputSocket.SendTo(fGroupAddr, theDestPort, inPacket->Ptr, inPacket->Len);
+
+            fTotalPacketsSent++;
+            fTotalBytesSent += inPacket->Len;
+            break;
+        }
+    }
+    
+    return QTSS_NoErr;
+}
@@ -0,0 +1,88 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1999-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ *
+ */
+/*
+    File:       ReflectorMulticastOutput.h
+
+    Contains:   An implementation of the ReflectorOutput abstract base class
+                that sends each stream of a ReflectorSession once to a multicast
+                group. Viewers that were handed a multicast Transport at SETUP
+                all receive their packets through one of these.
+                    
+    
+
+*/
+
+#ifndef __REFLECTOR_MULTICAST_OUTPUT_H__
+#define __REFLECTOR_MULTICAST_OUTPUT_H__
+
+#include "ReflectorOutput.h"
+#include "UDPSocket.h"
+
+class ReflectorSession;
+
+class ReflectorMulticastOutput : public ReflectorOutput
+{
+    public:
+    
+        // Stream x is sent to inGroupAddr on port inBasePort + 2x (RTP) and
+        // inBasePort + 2x + 1 (RTCP).
+        ReflectorMulticastOutput(ReflectorSession* inSession, UInt32 inGroupAddr, UInt16 inBasePort, UInt16 inTTL);
+        virtual ~ReflectorMulticastOutput();
+        
+        // Call this to setup this object's output socket. inInterfaceAddr may be
+        // INADDR_ANY to let the routing table pick the interface.
+        OS_Error BindSocket(UInt32 inInterfaceAddr);
+        
+        // Writes the packet directly to the group
+        virtual QTSS_Error  WritePacket(StrPtrLen* inPacket, void* inStreamCookie, UInt32 inFlags, SInt64 packetLatenessInMSec, SInt64* timeToSendThisPacketAgain, UInt64* packetIDPtr, SInt64* arrivalTime);
+        
+        virtual void        TearDown() {}
+        virtual Bool16      IsUDP()     { return true; }
+        virtual Bool16      IsPlaying() { return fValid; }
+        
+        // ACCESSORS
+        
+        UInt32              GetGroupAddr()  { return fGroupAddr; }
+        UInt16              GetBasePort()   { return fBasePort; }
+        UInt16              GetTTL()        { return fTTL; }
+        UInt64&             GetTotalPacketsSent()    { return fTotalPacketsSent; }
+        UInt64&             GetTotalBytesSent()      { return fTotalBytesSent; }
+        
+    private:
+    
+        // All streams share this one socket for writing.
+        UDPSocket   fOutputSocket;
+        UInt32      fNumStreams;
+        void**      fStreamCookieArray;//Each stream has a cookie
+        UInt32      fGroupAddr;
+        UInt16      fBasePort;
+        UInt16      fTTL;
+        Bool16      fValid;
+        
+        UInt64      fTotalPacketsSent;
+        UInt64      fTotalBytesSent;
+};
+
+#endif //__REFLECTOR_MULTICAST_OUTPUT_H__
@@ -33,6 +33,7 @@
 
 
 #include "ReflectorSession.h"
+#include "ReflectorMulticastOutput.h"
 #include "RTCPPacket.h"
 #include "SocketUtils.h"
 #include "EventContext.h"
@@ -81,6 +82,15 @@ FileDeleter::~FileDeleter()
 
 static OSRefTable*      sStreamMap = NULL;
 
+UInt32          ReflectorSession::sMulticastGroupAddr = 0;
+UInt16          ReflectorSession::sMulticastBasePort = 0;
+UInt16          ReflectorSession::sMulticastTTL = 1;
+UInt32          ReflectorSession::sMulticastMinViewers = 2;
+UInt32          ReflectorSession::sMulticastInterfaceAddr = INADDR_ANY;
+OSMutex         ReflectorSession::sMulticastGroupMutex;
+Bool16          ReflectorSession::sMulticastGroupInUse[kMaxMulticastGroups];
+UInt32          ReflectorSession::sNextMulticastGroup = 0;
+
 //fym for leak
 void ReflectorSession::RemoveStreamMap()
 {
@@ -107,10 +117,19 @@ ReflectorSession::ReflectorSession(StrPtrLen* inSourceID, SourceInfo* inInfo)
     fSocketStream(NULL),
     fBroadcasterSession(NULL),
     fInitTimeMS(OS::Milliseconds()),
-    fHasBufferedStreams(false)
+    fHasBufferedStreams(false),
+    fMulticastOutput(NULL),
+    fMulticastGroupAddr(0),
+    fMulticastGroupOffset(kMaxMulticastGroups),
+    fNumSubnetViewers(0),
+    fNumMulticastViewers(0),
+    fNextDescribeResponse(0),
+    fSDPFileModDate(-1),
+    fSDPFileCheckedTimeMS(0)
 	//fym fMutex(NULL)//fym
 {
 	fQueueElem.SetEnclosingObject(this);
+    ::memset(fDescribeResponses, 0, sizeof(fDescribeResponses));
 
 	fSourceID.Delete();//fym
 
@@ -139,6 +158,27 @@ ReflectorSession::~ReflectorSession()
 	if(fQueueElem.IsMemberOfAnyQueue())
 		fQueueElem.Remove();
 
+    this->FlushDescribeResponses();
+
+    // The broadcaster's RTSP session pushes interleaved packets straight to us. Once this
+    // returns it has stopped, and won't start again.
+    if(fBroadcasterSession != NULL)
+    {
+        RTSPInterleavedDataHandler* theHandler = NULL;
+        (void)QTSS_SetValue(fBroadcasterSession, qtssCliSesInterleavedDataHandler, 0, &theHandler, sizeof(theHandler));
+        fBroadcasterSession = NULL;
+    }
+
+    // The group output has to go before the streams it is attached to
+    if(fMulticastOutput != NULL)
+    {
+        this->RemoveOutput(fMulticastOutput, false);
+        delete fMulticastOutput;
+        fMulticastOutput = NULL;
+        ReleaseMulticastGroup(fMulticastGroupOffset);
+        fMulticastGroupOffset = kMaxMulticastGroups;
+    }
+
     // For each stream, check to see if the ReflectorStream should be deleted
     OSMutexLocker locker(sStreamMap->GetMutex());
     for (UInt32 x = 0; x < fSourceInfo->GetNumStreams(); x++)
@@ -193,6 +233,8 @@ QTSS_Error ReflectorSession::SetupReflectorSession(SourceInfo* inInfo, QTSS_Stan
     
     fLocalSDP.Delete();// this must be set to the new SDP.
     fLocalSDP.Ptr = inInfo->GetLocalSDP(&fLocalSDP.Len);
+    this->FlushDescribeResponses();
+    this->SetSDPFileChecked(-1, 0);
 
     // Allocate all our ReflectorStreams, using the SourceInfo
     
@@ -308,6 +350,51 @@ void ReflectorSession::AddBroadcasterClientSession(QTSS_StandardRTSP_Params* inP
         }
     }
     fBroadcasterSession = inParams->inClientSession;
+    
+    // Take interleaved packets straight from the broadcaster's RTSP connection
+    RTSPInterleavedDataHandler* theHandler = this;
+    (void)QTSS_SetValue(inParams->inClientSession, qtssCliSesInterleavedDataHandler, 0, &theHandler, sizeof(theHandler));
+}
+
+void ReflectorSession::SetInterleavedChannel(UInt32 inTrackID, UInt16 inRTPChannel)
+{
+    if(NULL == fStreamArray) 
+        return;
+        
+    for (UInt32 x = 0; x < fSourceInfo->GetNumStreams(); x++)
+    {
+        if((fStreamArray[x] != NULL) && (fSourceInfo->GetStreamInfo(x)->fTrackID == inTrackID))
+        {
+            fStreamArray[x]->SetRTPChannelNum((SInt16)inRTPChannel);
+            fStreamArray[x]->SetRTCPChannelNum((SInt16)(inRTPChannel + 1));
+        }
+    }
+}
+
+void ReflectorSession::ProcessInterleavedData(UInt8* inChannels, StrPtrLen* inPackets, UInt32 inNumPackets)
+{
+    if(NULL == fStreamArray) 
+        return;
+        
+    // Sort the packets by stream and give each stream all of its packets at once.
+    // RTCP from the broadcaster isn't reflected, same as PushPacket.
+    StrPtrLen thePackets[kMaxPacketsPerCall];
+    for (UInt32 x = 0; x < fSourceInfo->GetNumStreams(); x++)
+    {
+        ReflectorStream* theStream = fStreamArray[x];
+        if((theStream == NULL) || (theStream->GetRTPChannel() < 0))
+            continue;
+            
+        UInt32 theNumPackets = 0;
+        for (UInt32 y = 0; (y < inNumPackets) && (theNumPackets < kMaxPacketsPerCall); y++)
+        {
+            if(inChannels[y] == theStream->GetRTPChannel())
+                thePackets[theNumPackets++] = inPackets[y];
+        }
+        
+        if(theNumPackets > 0)
+            theStream->PushPackets(thePackets, theNumPackets);
+    }
 }
 
 void    ReflectorSession::FormatHTML(StrPtrLen* inURL)
@@ -358,6 +445,8 @@ void    ReflectorSession::AddOutput(ReflectorOutput* inOutput, Bool16 isClient)
 	if(!(fSourceInfo->GetNumStreams()))//fym
 		return;
     
+    OSMutexLocker locker(&fBucketLayoutMutex);
+    
     // We need to make sure that this output goes into the same bucket for each ReflectorStream.
     SInt32 bucket = -1;
     SInt32 lastBucket = -1;
@@ -397,6 +486,7 @@ void    ReflectorSession::AddOutput(ReflectorOutput* inOutput, Bool16 isClient)
             break;
     }
     (void)atomic_add(&fNumOutputs, 1);
+    this->RebalanceBuckets();
 }
 
 void    ReflectorSession::RemoveOutput(ReflectorOutput* inOutput, Bool16 isClient)
@@ -407,12 +497,30 @@ void    ReflectorSession::RemoveOutput(ReflectorOutput* inOutput, Bool16 isClien
 	if(NULL == fSourceInfo)
 		return;
 
+    OSMutexLocker locker(&fBucketLayoutMutex);
     for (UInt32 y = 0; y < fSourceInfo->GetNumStreams(); y++)
     {
         fStreamArray[y]->RemoveOutput(inOutput);
         if(isClient)
             fStreamArray[y]->DecEyeCount();  
     }
+    this->RebalanceBuckets();
+}
+
+void    ReflectorSession::RebalanceBuckets()
+{
+    // Size for the stream with the biggest packets, it takes the longest to get through a bucket
+    UInt32 thePacketSize = 0;
+    for (UInt32 x = 0; x < fSourceInfo->GetNumStreams(); x++)
+    {
+        if(fStreamArray[x]->GetAvgPacketSize() > thePacketSize)
+            thePacketSize = fStreamArray[x]->GetAvgPacketSize();
+    }
+    
+    UInt32 theBucketSize = ReflectorStream::ComputeBucketSize(fNumOutputs, thePacketSize);
+    UInt32 theDelay = ReflectorStream::ComputeBucketDelay(theBucketSize, thePacketSize);
+    for (UInt32 y = 0; y < fSourceInfo->GetNumStreams(); y++)
+        fStreamArray[y]->SetBucketLayout(theBucketSize, theDelay);
 }
 
 //fym
@@ -425,6 +533,10 @@ void    ReflectorSession::StreamStatistic()
 	{
 		//fym
 		qtss_printf("\nStream%d's packet: %d %d", y, fStreamArray[y]->GetRTPSender()->fPacketQueue.GetLength(), fStreamArray[y]->GetRTCPSender()->fPacketQueue.GetLength());
+		qtss_printf("\nStream%d's buckets: %lu in use, %lu outputs each, %lu msec apart", y, fStreamArray[y]->GetNumBucketsInUse(), fStreamArray[y]->GetBucketSize(), fStreamArray[y]->GetBucketDelayInMsec());
+
+		ReflectorIngestQueue* theQueue = fStreamArray[y]->GetIngestQueue();
+		qtss_printf("\nStream%d's ingest: pushed %lu, dropped oldest %lu, dropped new %lu", y, theQueue->GetNumPushed(), theQueue->GetNumDroppedOldest(), theQueue->GetNumDroppedNew());
 	}
 }
 
@@ -478,8 +590,194 @@ void    ReflectorSession::RemoveSessionFromOutput(QTSS_ClientSessionObject inSes
         ((ReflectorSocket*)fStreamArray[x]->GetSocketPair()->GetSocketB())->RemoveBroadcasterSession(inSession);
     }
     fBroadcasterSession = NULL;
+    
+    RTSPInterleavedDataHandler* theHandler = NULL;
+    (void)QTSS_SetValue(inSession, qtssCliSesInterleavedDataHandler, 0, &theHandler, sizeof(theHandler));
+}
+
+
+ReflectorDescribeResponse::ReflectorDescribeResponse(StrPtrLen* inKey, StrPtrLen* inSessionHeaders,
+                                                        StrPtrLen* inMediaHeaders, QTSS_TimeVal inModDate)
+:   fRefCount(1),
+    fModDate(inModDate)
+{
+    fKey.Ptr = NEW char[inKey->Len + 1];
+    ::memcpy(fKey.Ptr, inKey->Ptr, inKey->Len);
+    fKey.Len = inKey->Len;
+    
+    fBody.Len = inSessionHeaders->Len + inMediaHeaders->Len;
+    fBody.Ptr = NEW char[fBody.Len + 1];
+    ::memcpy(fBody.Ptr, inSessionHeaders->Ptr, inSessionHeaders->Len);
+    ::memcpy(fBody.Ptr + inSessionHeaders->Len, inMediaHeaders->Ptr, inMediaHeaders->Len);
 }
 
+ReflectorDescribeResponse* ReflectorSession::FindDescribeResponse(StrPtrLen* inKey)
+{
+    OSMutexLocker locker(&fDescribeMutex);
+    for (UInt32 x = 0; x < kMaxDescribeResponses; x++)
+    {
+        ReflectorDescribeResponse* theResponse = fDescribeResponses[x];
+        if((theResponse != NULL) && theResponse->GetKey()->Equal(*inKey))
+        {
+            theResponse->Retain();
+            return theResponse;
+        }
+    }
+    return NULL;
+}
+
+void ReflectorSession::CacheDescribeResponse(ReflectorDescribeResponse* inResponse)
+{
+    OSMutexLocker locker(&fDescribeMutex);
+    
+    UInt32 theSlot = 0;
+    for ( ; theSlot < kMaxDescribeResponses; theSlot++)
+    {
+        if((fDescribeResponses[theSlot] != NULL) && fDescribeResponses[theSlot]->GetKey()->Equal(*inResponse->GetKey()))
+            break;
+    }
+    if(theSlot == kMaxDescribeResponses)
+    {   // Take an empty slot, or the oldest one
+        for (theSlot = 0; theSlot < kMaxDescribeResponses; theSlot++)
+        {
+            if(fDescribeResponses[theSlot] == NULL)
+                break;
+        }
+        if(theSlot == kMaxDescribeResponses)
+        {
+            theSlot = fNextDescribeResponse;
+            fNextDescribeResponse = (fNextDescribeResponse + 1) % kMaxDescribeResponses;
+        }
+    }
+    
+    inResponse->Retain();
+    if(fDescribeResponses[theSlot] != NULL)
+        fDescribeResponses[theSlot]->Release();
+    fDescribeResponses[theSlot] = inResponse;
+}
+
+void ReflectorSession::RemoveDescribeResponse(ReflectorDescribeResponse* inResponse)
+{
+    OSMutexLocker locker(&fDescribeMutex);
+    for (UInt32 x = 0; x < kMaxDescribeResponses; x++)
+    {
+        if(fDescribeResponses[x] == inResponse)
+        {
+            fDescribeResponses[x] = NULL;
+            inResponse->Release();
+        }
+    }
+}
+
+void ReflectorSession::FlushDescribeResponses()
+{
+    OSMutexLocker locker(&fDescribeMutex);
+    for (UInt32 x = 0; x < kMaxDescribeResponses; x++)
+    {
+        if(fDescribeResponses[x] != NULL)
+            fDescribeResponses[x]->Release();
+        fDescribeResponses[x] = NULL;
+    }
+}
+
+void ReflectorSession::SetMulticastEgress(UInt32 inGroupAddr, UInt16 inBasePort, UInt16 inTTL,
+                                            UInt32 inMinViewers, UInt32 inInterfaceAddr)
+{
+    sMulticastGroupAddr = inGroupAddr;
+    sMulticastBasePort = inBasePort;
+    sMulticastTTL = inTTL;
+    sMulticastMinViewers = inMinViewers;
+    sMulticastInterfaceAddr = inInterfaceAddr;
+}
+
+Bool16  ReflectorSession::JoinMulticastGroup()
+{
+    OSMutexLocker locker(&fMulticastMutex);
+
+    fNumSubnetViewers++;
+    
+    if(sMulticastGroupAddr == 0 || fSourceInfo == NULL || fStreamArray == NULL)
+        return false;
+    
+    if(fMulticastOutput == NULL)
+    {
+        if(fNumSubnetViewers < sMulticastMinViewers)
+            return false;
+            
+        // Each session gets its own group, so every session can use the same ports
+        UInt32 theOffset = AcquireMulticastGroup();
+        if(theOffset == kMaxMulticastGroups)
+            return false; // every group is taken, so everyone stays on unicast
+            
+        ReflectorMulticastOutput* theOutput = NEW ReflectorMulticastOutput(this, sMulticastGroupAddr + theOffset, sMulticastBasePort, sMulticastTTL);
+        if(theOutput->BindSocket(sMulticastInterfaceAddr) != OS_NoErr)
+        {
+            // No group for this session. Everyone stays on unicast.
+            delete theOutput;
+            ReleaseMulticastGroup(theOffset);
+            return false;
+        }
+        
+        fMulticastGroupAddr = sMulticastGroupAddr + theOffset;
+        fMulticastGroupOffset = theOffset;
+        fMulticastOutput = theOutput;
+        this->AddOutput(fMulticastOutput, false);
+    }
+    
+    fNumMulticastViewers++;
+    return true;
+}
+
+void    ReflectorSession::LeaveMulticastGroup(Bool16 inWasMulticast)
+{
+    OSMutexLocker locker(&fMulticastMutex);
+
+    if(fNumSubnetViewers > 0)
+        fNumSubnetViewers--;
+        
+    if(!inWasMulticast || fNumMulticastViewers == 0)
+        return;
+        
+    fNumMulticastViewers--;
+    if(fNumMulticastViewers == 0 && fMulticastOutput != NULL)
+    {
+        this->RemoveOutput(fMulticastOutput, false);
+        delete fMulticastOutput;
+        fMulticastOutput = NULL;
+        fMulticastGroupAddr = 0;
+        ReleaseMulticastGroup(fMulticastGroupOffset);
+        fMulticastGroupOffset = kMaxMulticastGroups;
+    }
+}
+
+UInt32  ReflectorSession::AcquireMulticastGroup()
+{
+    OSMutexLocker locker(&sMulticastGroupMutex);
+    
+    // Start after the last one handed out, so a group that was just given back
+    // isn't reused while its old viewers may still be listening.
+    for (UInt32 x = 0; x < kMaxMulticastGroups; x++)
+    {
+        UInt32 theOffset = (sNextMulticastGroup + x) % kMaxMulticastGroups;
+        if(!sMulticastGroupInUse[theOffset])
+        {
+            sMulticastGroupInUse[theOffset] = true;
+            sNextMulticastGroup = (theOffset + 1) % kMaxMulticastGroups;
+            return theOffset;
+        }
+    }
+    return kMaxMulticastGroups;
+}
+
+void    ReflectorSession::ReleaseMulticastGroup(UInt32 inOffset)
+{
+    if(inOffset >= kMaxMulticastGroups)
+        return;
+        
+    OSMutexLocker locker(&sMulticastGroupMutex);
+    Assert(sMulticastGroupInUse[inOffset]);
+    sMulticastGroupInUse[inOffset] = false;
+}
 
 UInt32  ReflectorSession::GetBitRate()
 {
@@ -35,6 +35,7 @@
 #include "QTSSModuleUtils.h"
 #include "OSMemory.h"
 #include "SocketUtils.h"
+#include "StartCodeScanner.h"
 #include "atomic.h"
 #include "RTCPPacket.h"
 #include "ReflectorSession.h"
@@ -58,9 +59,16 @@ static QTSS_AttributeID         sCantJoinMulticastGroupErr  = qtssIllegalAttrID;
 
 static UInt32                   sDefaultOverBufferInSec             = 10; 
 static UInt32                   sDefaultBucketDelayInMsec           = 73;
+static UInt32                   sDefaultMaxBucketDelayInMsec        = 1000;
+static UInt32                   sDefaultBucketNICBudgetMbps         = 100;
 static Bool16                   sDefaultUsePacketReceiveTime        = false; 
 static UInt32                   sDefaultMaxFuturePacketTimeSec      = 60;
 static UInt32                   sDefaultFirstPacketOffsetMsec       = 500;
+static UInt32                   sDefaultIngestQueuePackets          = 256;
+static Bool16                   sDefaultIngestDropNewPackets        = false;
+static UInt32                   sDefaultFECColumns                  = 0;
+static UInt32                   sDefaultFECRows                     = 0;
+static UInt32                   sDefaultFECPayloadType              = 127;
 
 UInt32                          ReflectorStream::sBucketSize  = 16;
 UInt32                          ReflectorStream::sOverBufferInMsec = 10000; // more or less what the client over buffer will be
@@ -70,8 +78,13 @@ UInt32                          ReflectorStream::sMaxPacketAgeMSec = 10000;
 UInt32                          ReflectorStream::sMaxFuturePacketSec = 60; // max packet future time
 UInt32                          ReflectorStream::sOverBufferInSec = 10;
 UInt32                          ReflectorStream::sBucketDelayInMsec = 73;
+UInt32                          ReflectorStream::sMaxBucketDelayInMsec = 1000;
+UInt32                          ReflectorStream::sBucketNICBudgetBytesPerMsec = 12500;
 Bool16                          ReflectorStream::sUsePacketReceiveTime = false;
 UInt32                          ReflectorStream::sFirstPacketOffsetMsec = 500;
+UInt32                          ReflectorStream::sFECColumns = 0;
+UInt32                          ReflectorStream::sFECRows = 0;
+UInt32                          ReflectorStream::sFECPayloadType = 127;
 
 UInt16                          ReflectorStream::fRTPPayloadSize = 1400;//fym ܳsizeof(fRTPPacket) - 12!!!
 
@@ -93,6 +106,16 @@ void ReflectorStream::Initialize(QTSS_ModulePrefsObject inPrefs)
 
     QTSSModuleUtils::GetAttribute(inPrefs, "reflector_bucket_offset_delay_msec", qtssAttrDataTypeUInt32,
                               &ReflectorStream::sBucketDelayInMsec, &sDefaultBucketDelayInMsec, sizeof(sBucketDelayInMsec));
+
+    QTSSModuleUtils::GetAttribute(inPrefs, "reflector_max_bucket_delay_msec", qtssAttrDataTypeUInt32,
+                              &ReflectorStream::sMaxBucketDelayInMsec, &sDefaultMaxBucketDelayInMsec, sizeof(sMaxBucketDelayInMsec));
+
+    UInt32 theNICBudgetMbps = sDefaultBucketNICBudgetMbps;
+    QTSSModuleUtils::GetAttribute(inPrefs, "reflector_bucket_nic_budget_mbps", qtssAttrDataTypeUInt32,
+                              &theNICBudgetMbps, &sDefaultBucketNICBudgetMbps, sizeof(theNICBudgetMbps));
+    if (theNICBudgetMbps == 0)
+        theNICBudgetMbps = sDefaultBucketNICBudgetMbps;
+    ReflectorStream::sBucketNICBudgetBytesPerMsec = theNICBudgetMbps * 125; // 1 Mbit/sec is 125 bytes/msec
                                  
     QTSSModuleUtils::GetAttribute(inPrefs, "reflector_buffer_size_sec", qtssAttrDataTypeUInt32,
                               &ReflectorStream::sOverBufferInSec, &sDefaultOverBufferInSec,  sizeof(sDefaultOverBufferInSec));
@@ -106,6 +129,25 @@ void ReflectorStream::Initialize(QTSS_ModulePrefsObject inPrefs)
     QTSSModuleUtils::GetAttribute(inPrefs, "reflector_rtp_info_offset_msec", qtssAttrDataTypeUInt32,
                               &ReflectorStream::sFirstPacketOffsetMsec, &sDefaultFirstPacketOffsetMsec, sizeof(sDefaultFirstPacketOffsetMsec));
 
+    UInt32 theIngestQueuePackets = sDefaultIngestQueuePackets;
+    QTSSModuleUtils::GetAttribute(inPrefs, "reflector_ingest_queue_packets", qtssAttrDataTypeUInt32,
+                              &theIngestQueuePackets, &sDefaultIngestQueuePackets, sizeof(theIngestQueuePackets));
+    ReflectorIngestQueue::SetSize(theIngestQueuePackets);
+
+    Bool16 theIngestDropNewPackets = sDefaultIngestDropNewPackets;
+    QTSSModuleUtils::GetAttribute(inPrefs, "reflector_ingest_drop_new_packets", qtssAttrDataTypeBool16,
+                              &theIngestDropNewPackets, &sDefaultIngestDropNewPackets, sizeof(theIngestDropNewPackets));
+    ReflectorIngestQueue::SetOverflowPolicy(theIngestDropNewPackets ? ReflectorIngestQueue::kDropNew : ReflectorIngestQueue::kDropOldest);
+
+    QTSSModuleUtils::GetAttribute(inPrefs, "reflector_fec_columns", qtssAttrDataTypeUInt32,
+                              &ReflectorStream::sFECColumns, &sDefaultFECColumns, sizeof(sDefaultFECColumns));
+    QTSSModuleUtils::GetAttribute(inPrefs, "reflector_fec_rows", qtssAttrDataTypeUInt32,
+                              &ReflectorStream::sFECRows, &sDefaultFECRows, sizeof(sDefaultFECRows));
+    QTSSModuleUtils::GetAttribute(inPrefs, "reflector_fec_payload_type", qtssAttrDataTypeUInt32,
+                              &ReflectorStream::sFECPayloadType, &sDefaultFECPayloadType, sizeof(sDefaultFECPayloadType));
+    if((sFECPayloadType < 96) || (sFECPayloadType > 127))
+        sFECPayloadType = sDefaultFECPayloadType;
+
     ReflectorStream::sOverBufferInMsec = sOverBufferInSec * 1000;
     ReflectorStream::sMaxFuturePacketMSec = sMaxFuturePacketSec * 1000;
     ReflectorStream::sMaxPacketAgeMSec = sOverBufferInMsec;
@@ -127,14 +169,20 @@ ReflectorStream::ReflectorStream(SourceInfo::StreamInfo* inInfo)
     fOutputArray(NULL),
     fNumBuckets(kMinNumBuckets),
     fNumElements(0),
+    fBucketSize(sBucketSize),
+    fBucketDelayInMsec(sBucketDelayInMsec),
+    fNumBucketsInUse(0),
     fBucketMutex(),
     
     fDestRTCPAddr(0),
     fDestRTCPPort(0),
+    fLastPLITime(0),
     
     fCurrentBitRate(0),
     fLastBitRateSample(OS::Milliseconds()), // don't calculate our first bit rate until kBitRateAvgIntervalInMilSecs has passed!
     fBytesSentInThisInterval(0),
+    fPacketCountAtLastSample(0),
+    fAvgPacketSize(0),
     
     fRTPChannel(-1),
     fRTCPChannel(-1),
@@ -152,6 +200,9 @@ ReflectorStream::ReflectorStream(SourceInfo::StreamInfo* inInfo)
 
     fStreamInfo.Copy(*inInfo);
     
+    // A matrix the mask can't describe just leaves FEC off for this stream
+    (void)fFECEncoder.Configure(sFECColumns, sFECRows, (UInt8)sFECPayloadType);
+    
     // ALLOCATE BUCKET ARRAY
     this->AllocateBucketArray(fNumBuckets);
 
@@ -249,8 +300,8 @@ void ReflectorStream::AllocateBucketArray(UInt32 inNumBuckets)
     fOutputArray = NEW Bucket[inNumBuckets];
     for (UInt32 x = 0; x < inNumBuckets; x++)
     {
-        fOutputArray[x] = NEW ReflectorOutput*[sBucketSize];
-        ::memset(fOutputArray[x], 0, sizeof(ReflectorOutput*) * sBucketSize);
+        fOutputArray[x] = NEW ReflectorOutput*[fBucketSize];
+        ::memset(fOutputArray[x], 0, sizeof(ReflectorOutput*) * fBucketSize);
     }
     
     //copy over the old information if there was an old array
@@ -262,7 +313,7 @@ void ReflectorStream::AllocateBucketArray(UInt32 inNumBuckets)
 
         for (UInt32 y = 0; y < fNumBuckets; y++)
         {
-            ::memcpy(fOutputArray[y],oldArray[y], sBucketSize * sizeof(ReflectorOutput*));
+            ::memcpy(fOutputArray[y],oldArray[y], fBucketSize * sizeof(ReflectorOutput*));
             delete [] oldArray[y];
         }
         delete [] oldArray;
@@ -279,7 +330,7 @@ SInt32 ReflectorStream::AddOutput(ReflectorOutput* inOutput, SInt32 putInThisBuc
 #if DEBUG
     // We should never be adding an output twice to a stream
     for (UInt32 dOne = 0; dOne < fNumBuckets; dOne++)
-        for (UInt32 dTwo = 0; dTwo < sBucketSize; dTwo++)
+        for (UInt32 dTwo = 0; dTwo < fBucketSize; dTwo++)
             Assert(fOutputArray[dOne][dTwo] != inOutput);
 #endif
 
@@ -294,13 +345,13 @@ SInt32 ReflectorStream::AddOutput(ReflectorOutput* inOutput, SInt32 putInThisBuc
     if(fNumBuckets <= (UInt32)putInThisBucket)
         this->AllocateBucketArray(putInThisBucket * 2);
 
-    for(UInt32 y = 0; y < sBucketSize; y++)
+    for(UInt32 y = 0; y < fBucketSize; y++)
     {
         if(fOutputArray[putInThisBucket][y] == NULL)
         {
             fOutputArray[putInThisBucket][y] = inOutput;
 #if REFLECTOR_STREAM_DEBUGGING 
-            qtss_printf("Adding new output (0x%lx) to bucket %ld, index %ld,\nnum buckets %li bucketSize: %li \n",(long)inOutput, putInThisBucket, y, (long)fNumBuckets, (long)sBucketSize);
+            qtss_printf("Adding new output (0x%lx) to bucket %ld, index %ld,\nnum buckets %li bucketSize: %li \n",(long)inOutput, putInThisBucket, y, (long)fNumBuckets, (long)fBucketSize);
 #endif
             fNumElements++;
             return putInThisBucket;
@@ -313,13 +364,13 @@ SInt32 ReflectorStream::AddOutput(ReflectorOutput* inOutput, SInt32 putInThisBuc
 SInt32 ReflectorStream::FindBucket()
 {
     // If we need more buckets, allocate them.
-    if(fNumElements == (sBucketSize * fNumBuckets))
+    if(fNumElements == (fBucketSize * fNumBuckets))
         this->AllocateBucketArray(fNumBuckets * 2);
     
     //find the first open spot in the array
     for (SInt32 putInThisBucket = 0; (UInt32)putInThisBucket < fNumBuckets; putInThisBucket++)
     {
-        for(UInt32 y = 0; y < sBucketSize; y++)
+        for(UInt32 y = 0; y < fBucketSize; y++)
             if(fOutputArray[putInThisBucket][y] == NULL)
                 return putInThisBucket;
     }
@@ -337,7 +388,7 @@ void  ReflectorStream::RemoveOutput(ReflectorOutput* inOutput)
     //look at all the indexes in the array
     for (UInt32 x = 0; x < fNumBuckets; x++)
     {
-        for (UInt32 y = 0; y < sBucketSize; y++)
+        for (UInt32 y = 0; y < fBucketSize; y++)
         {
             //The array may have blank spaces!
             if(fOutputArray[x][y] == inOutput)
@@ -363,7 +414,7 @@ void  ReflectorStream::TearDownAllOutputs()
     //look at all the indexes in the array
     for (UInt32 x = 0; x < fNumBuckets; x++)
     {
-        for (UInt32 y = 0; y < sBucketSize; y++)
+        for (UInt32 y = 0; y < fBucketSize; y++)
         {   ReflectorOutput* theOutputPtr= fOutputArray[x][y];
             //The array may have blank spaces!
             if(theOutputPtr != NULL)
@@ -376,6 +427,124 @@ void  ReflectorStream::TearDownAllOutputs()
     }
 }
 
+UInt32 ReflectorStream::ComputeBucketDelay(UInt32 inBucketSize, UInt32 inPacketSize)
+{
+    if (sMaxBucketDelayInMsec == 0)
+        return sBucketDelayInMsec;
+        
+    // Wait long enough for one packet to go out to a whole bucket before starting the next
+    UInt32 thePacketSize = (inPacketSize > 0) ? inPacketSize : (UInt32)kDefaultAvgPacketSize;
+    UInt32 theDelay = (UInt32)(((UInt64)inBucketSize * thePacketSize) / sBucketNICBudgetBytesPerMsec);
+    if (theDelay > sBucketDelayInMsec)
+        theDelay = sBucketDelayInMsec;
+    if (theDelay < kMinBucketDelayInMsec)
+        theDelay = kMinBucketDelayInMsec;
+    return theDelay;
+}
+
+UInt32 ReflectorStream::ComputeBucketSize(UInt32 inNumOutputs, UInt32 inPacketSize)
+{
+    // A max delay of 0 turns this off and gives the old fixed buckets
+    if ((sMaxBucketDelayInMsec == 0) || (inNumOutputs == 0))
+        return sBucketSize;
+    
+    // Start from the old fixed size, so a handful of viewers is still spread out over a
+    // few buckets, but never bigger than the NIC can drain in the shortest delay
+    UInt32 thePacketSize = (inPacketSize > 0) ? inPacketSize : (UInt32)kDefaultAvgPacketSize;
+    UInt32 theBucketSize = (sBucketNICBudgetBytesPerMsec * kMinBucketDelayInMsec) / thePacketSize;
+    if (theBucketSize > sBucketSize)
+        theBucketSize = sBucketSize;
+    if (theBucketSize == 0)
+        theBucketSize = 1;
+    
+    while (theBucketSize < inNumOutputs)
+    {
+        // Count one bucket more than needed, so outputs leaving don't force a repack right away
+        UInt32 theDelay = ComputeBucketDelay(theBucketSize, inPacketSize);
+        UInt32 theNumBuckets = ((inNumOutputs + theBucketSize - 1) / theBucketSize) + 1;
+        if (((theNumBuckets - 1) * theDelay) <= sMaxBucketDelayInMsec)
+            break;
+        
+        // Jump to the smallest size that would fit at this delay, spare bucket included
+        UInt32 theBucketsAllowed = sMaxBucketDelayInMsec / theDelay;
+        UInt32 theNextSize = (theBucketsAllowed == 0) ? inNumOutputs : (inNumOutputs + theBucketsAllowed - 1) / theBucketsAllowed;
+        theBucketSize = (theNextSize > theBucketSize) ? theNextSize : theBucketSize + 1;
+    }
+    return theBucketSize;
+}
+
+void ReflectorStream::SetBucketLayout(UInt32 inBucketSize, UInt32 inDelayInMsec)
+{
+    OSMutexLocker locker(&fBucketMutex);
+    if (sMaxBucketDelayInMsec == 0)
+    {
+        fBucketDelayInMsec = inDelayInMsec;
+        return;
+    }
+    
+    // Don't shuffle everyone around for small changes. Grow when we must, and shrink
+    // only once buckets are less than half full.
+    if ((inBucketSize > fBucketSize) || ((inBucketSize * 2) <= fBucketSize))
+        this->RepackBuckets(inBucketSize);
+    
+    UInt32 theNumBucketsInUse = 0;
+    for (UInt32 x = 0; x < fNumBuckets; x++)
+        for (UInt32 y = 0; y < fBucketSize; y++)
+            if (fOutputArray[x][y] != NULL)
+                theNumBucketsInUse = x + 1;
+    
+    // Outputs leave holes behind. Close them up once they've pushed anyone past the
+    // spare bucket ComputeBucketSize allowed for.
+    UInt32 theNumBucketsNeeded = (fNumElements + fBucketSize - 1) / fBucketSize;
+    if (theNumBucketsInUse > theNumBucketsNeeded + 1)
+    {
+        this->RepackBuckets(fBucketSize);
+        theNumBucketsInUse = theNumBucketsNeeded;
+    }
+    fNumBucketsInUse = theNumBucketsInUse;
+
+    // Whatever happens, the last bucket can't be later than sMaxBucketDelayInMsec
+    UInt32 theDelay = inDelayInMsec;
+    if ((theNumBucketsInUse > 1) && (((theNumBucketsInUse - 1) * theDelay) > sMaxBucketDelayInMsec))
+        theDelay = sMaxBucketDelayInMsec / (theNumBucketsInUse - 1);
+    fBucketDelayInMsec = theDelay;
+}
+
+void ReflectorStream::RepackBuckets(UInt32 inBucketSize)
+{
+    Bucket* oldArray = fOutputArray;
+    UInt32 oldNumBuckets = fNumBuckets;
+    UInt32 oldBucketSize = fBucketSize;
+    
+    UInt32 theNumBuckets = kMinNumBuckets;
+    while (theNumBuckets * inBucketSize <= fNumElements)
+        theNumBuckets *= 2;
+    
+    fOutputArray = NULL;
+    fBucketSize = inBucketSize;
+    this->AllocateBucketArray(theNumBuckets);
+    
+    // Keep everyone in the same order, so nobody jumps ahead of outputs that were waiting longer
+    UInt32 theIndex = 0;
+    for (UInt32 x = 0; x < oldNumBuckets; x++)
+    {
+        for (UInt32 y = 0; y < oldBucketSize; y++)
+        {
+            if (oldArray[x][y] != NULL)
+            {
+                fOutputArray[theIndex / fBucketSize][theIndex % fBucketSize] = oldArray[x][y];
+                theIndex++;
+            }
+        }
+        delete [] oldArray[x];
+    }
+    delete [] oldArray;
+    
+#if REFLECTOR_STREAM_DEBUGGING  
+    qtss_printf("Repacked %ld outputs into buckets of %ld\n", (long)theIndex, (long)fBucketSize);
+#endif
+}
+
 //fym socketstream
 QTSS_Error ReflectorStream::BindSockets(QTSS_StandardRTSP_Params* inParams, UInt32 inReflectorSessionFlags, Bool16 filterState, UInt32 timeout)
 {
@@ -508,30 +677,68 @@ void ReflectorStream::SendReceiverReport()
     (void)fSockets->GetSocketB()->SendTo(fDestRTCPAddr, fDestRTCPPort, fReceiverReportBuffer, fReceiverReportSize);
 }
 
+void ReflectorStream::SendPictureLossIndication(UInt32 inMediaSSRC)
+{
+    if(fDestRTCPAddr == 0)
+        return;
+        
+    //every viewer that lost the same packet asks, the source only needs to hear it once
+    SInt64 theCurrentTime = OS::Milliseconds();
+    if(theCurrentTime < fLastPLITime + kPLIIntervalInMsec)
+        return;
+    fLastPLITime = theCurrentTime;
+    
+    //PSFB header with FMT 1, our SSRC (the same one our receiver reports use), the source's SSRC
+    UInt32 thePLI[kPLISize / 4];
+    thePLI[0] = htonl(0x81CE0002);
+    thePLI[1] = ((UInt32*)fReceiverReportBuffer)[1];
+    thePLI[2] = htonl(inMediaSSRC);
+    
+    (void)fSockets->GetSocketB()->SendTo(fDestRTCPAddr, fDestRTCPPort, (char*)thePLI, kPLISize);
+}
+
 void ReflectorStream::PushPacket(char *packet, UInt32 packetLen, Bool16 isRTCP)
 {
 	//qtss_printf("recv packet len: %d, ", packetLen);//fym
 
     if(packetLen > 0)
     {   
-        ReflectorPacket* thePacket = NULL;
         if(isRTCP)
         {
         }
         else
         {   //qtss_printf("ReflectorStream::PushPacket RTP packetlen = %lu\n",packetLen);
-            thePacket =  ((ReflectorSocket*)fSockets->GetSocketA())->GetPacket();
-            if(thePacket == NULL)
-            {   //qtss_printf("ReflectorStream::PushPacket GetPacket() is NULL\n");
-                return;
-            }
+            StrPtrLen thePacket(packet, packetLen);
+            this->PushPackets(&thePacket, 1);
+        }
+    }
+}
+
+void ReflectorStream::PushPackets(StrPtrLen* inPackets, UInt32 inNumPackets)
+{
+    if(NULL == fSockets || 0 == inNumPackets)
+        return;
+        
+    ReflectorSocket* theSocket = (ReflectorSocket*)fSockets->GetSocketA();
     
-            OSMutexLocker locker(((ReflectorSocket*)(fSockets->GetSocketA()))->GetDemuxer()->GetMutex());
-            thePacket->SetPacketData(packet, packetLen);
-             ((ReflectorSocket*)fSockets->GetSocketA())->ProcessPacket(OS::Milliseconds(),thePacket,0,0);
-             ((ReflectorSocket*)fSockets->GetSocketA())->Signal(Task::kIdleEvent);
+    OSMutexLocker locker(theSocket->GetDemuxer()->GetMutex());
+    SInt64 theMilliseconds = OS::Milliseconds();
+    for (UInt32 x = 0; x < inNumPackets; x++)
+    {
+        // ProcessPacket treats an empty packet as the end of a UDP read, so skip those
+        if((0 == inPackets[x].Len) || (inPackets[x].Len >= ReflectorPacket::kMaxReflectorPacketSize))
+            continue;
+            
+        ReflectorPacket* thePacket = theSocket->GetPacket();
+        if(thePacket == NULL)
+        {   //qtss_printf("ReflectorStream::PushPackets GetPacket() is NULL\n");
+            break;
         }
+        
+        thePacket->SetPacketData(inPackets[x].Ptr, inPackets[x].Len);
+        theSocket->ProcessPacket(theMilliseconds, thePacket, 0, 0);
     }
+    theSocket->Signal(Task::kIdleEvent);
 }
 
 //
@@ -543,21 +750,15 @@ void ReflectorStream::PushRelayPacket(char *packet, UInt32 packetLen, UInt32 src
 		UInt32 cur_packet_len = 0;//fym δֽ
 		UInt16 packet_mark = 0;
 
-		ReflectorPacket* thePacket = NULL;
-		
 		//fym fScoketsδǰͷµ
 		if(NULL == fSockets)
 			return;
 
+		// Every RTP packet cut from a key frame is marked, so an overflowing queue keeps them
+		Bool16 isKeyFrame = ReflectorStream::IsKeyFrame(packet, packetLen);
+
 		while(sended_len < packetLen)
 		{
-			thePacket =  ((ReflectorSocket*)fSockets->GetSocketA())->GetPacket();
-
-			if(thePacket == NULL)
-			{   //qtss_printf("ReflectorStream::PushPacket GetPacket() is NULL\n");
-				return;
-			}
-
 			UInt32 cur_packet_len = ((packetLen - sended_len) > fRTPPayloadSize) ? fRTPPayloadSize : packetLen - sended_len;
 
 			packet_mark = (packetLen == sended_len + cur_packet_len) ? 1 : 0;
@@ -580,10 +781,8 @@ void ReflectorStream::PushRelayPacket(char *packet, UInt32 packetLen, UInt32 src
 				hdr->TIME_STAMP = htonl(clock());
 				hdr->SSRC = htonl(fSequence);
 
-				OSMutexLocker locker(((ReflectorSocket*)(fSockets->GetSocketA()))->GetDemuxer()->GetMutex());
-				thePacket->SetPacketData(fRTPPacket, cur_packet_len + sizeof(RTPHeaderParam));
-				((ReflectorSocket*)fSockets->GetSocketA())->ProcessPacket(OS::Milliseconds(),thePacket, src_addr, src_port);
-				((ReflectorSocket*)fSockets->GetSocketA())->Signal(Task::kIdleEvent);
+				// The socket task takes it from here; we never wait on the locks it holds
+				(void)fIngestQueue.Push(fRTPPacket, cur_packet_len + sizeof(RTPHeaderParam), isKeyFrame, src_addr, src_port);
 			}
 
 			sended_len += cur_packet_len;
@@ -591,6 +790,8 @@ void ReflectorStream::PushRelayPacket(char *packet, UInt32 packetLen, UInt32 src
 
 		++fSequence;
 
+		((ReflectorSocket*)fSockets->GetSocketA())->Signal(Task::kIdleEvent);
+
 		//fym OSMutexLocker locker(((ReflectorSocket*)(fSockets->GetSocketA()))->GetDemuxer()->GetMutex());
 		//fym thePacket->SetPacketData(packet, packetLen);
 		//fym ((ReflectorSocket*)fSockets->GetSocketA())->ProcessPacket(OS::Milliseconds(),thePacket, src_addr, src_port);
@@ -598,6 +799,156 @@ void ReflectorStream::PushRelayPacket(char *packet, UInt32 packetLen, UInt32 src
 	}
 }
 
+Bool16 ReflectorStream::IsKeyFrame(char* inFrame, UInt32 inLen)
+{
+    // Video frames come in as Annex B H.264. A frame with an IDR slice, or with the
+    // SPS/PPS sent ahead of one, is a key frame. An AUD or SEI may come first, so look
+    // through the NAL units up to the first slice. Anything that doesn't start with a
+    // start code (audio included) isn't one.
+    UInt8* theFrame = (UInt8*)inFrame;
+    if((inLen < 4) || (theFrame[0] != 0) || (theFrame[1] != 0))
+        return false;
+        
+    UInt32 theOffset = 0;
+    StrPtrLen theNALUnit;
+    while (StartCodeScanner::GetNextNALUnit(theFrame, inLen, &theOffset, &theNALUnit))
+    {
+        if(theNALUnit.Len == 0)
+            continue;
+            
+        UInt8 theNALType = theNALUnit.Ptr[0] & 0x1F;
+        if((theNALType == 5) || (theNALType == 7) || (theNALType == 8))
+            return true;
+        if((theNALType >= 1) && (theNALType <= 4))
+            return false;
+    }
+    return false;
+}
+
+UInt32 ReflectorIngestQueue::sNumSlots = 256;
+UInt32 ReflectorIngestQueue::sOverflowPolicy = ReflectorIngestQueue::kDropOldest;
+
+ReflectorIngestQueue::ReflectorIngestQueue()
+:   fSlots(NULL),
+    fMask(0),
+    fHead(0),
+    fTail(0),
+    fNumPushed(0),
+    fNumDroppedOldest(0),
+    fNumDroppedNew(0)
+{}
+
+void ReflectorIngestQueue::SetSize(UInt32 inNumPackets)
+{
+    // Round up to a power of 2 so positions can just keep counting and wrap
+    UInt32 theNumSlots = 2;
+    while ((theNumSlots < inNumPackets) && (theNumSlots < 0x10000))
+        theNumSlots <<= 1;
+    sNumSlots = theNumSlots;
+}
+
+void ReflectorIngestQueue::Fence()
+{
+#if __Win32__
+    ::MemoryBarrier();
+#elif defined(__GNUC__)
+    __sync_synchronize();
+#endif
+}
+
+Bool16 ReflectorIngestQueue::Push(char* inPacket, UInt32 inLen, Bool16 isKeyFrame, UInt32 inSrcAddr, UInt16 inSrcPort)
+{
+    if((inLen == 0) || (inLen >= kMaxPacketSize))
+        return false;
+        
+    if(fSlots == NULL)
+    {
+        // Most streams never get data this way, so only pay for the slots once one does
+        Slot* theSlots = NEW Slot[sNumSlots];
+        for (UInt32 x = 0; x < sNumSlots; x++)
+        {
+            theSlots[x].fSeq = 0;
+            theSlots[x].fPos = 0;
+            theSlots[x].fIsKeyFrame = false;
+        }
+        fMask = sNumSlots - 1;
+        Fence();
+        fSlots = theSlots;
+    }
+    
+    UInt32 theHead = fHead;
+    Slot* theSlot = &fSlots[theHead & fMask];
+    if(theHead - fTail > fMask)
+    {
+        // We've caught up with the consumer, and theSlot holds the oldest packet it hasn't read
+        if((sOverflowPolicy == kDropNew) || theSlot->fIsKeyFrame)
+        {
+            fNumDroppedNew++;
+            return false;
+        }
+        fNumDroppedOldest++;
+    }
+    
+    // An odd sequence number tells the consumer the slot is being written
+    theSlot->fSeq++;
+    Fence();
+    theSlot->fPos = theHead;
+    theSlot->fLen = inLen;
+    theSlot->fSrcAddr = inSrcAddr;
+    theSlot->fSrcPort = inSrcPort;
+    theSlot->fIsKeyFrame = isKeyFrame;
+    ::memcpy(theSlot->fData, inPacket, inLen);
+    Fence();
+    theSlot->fSeq++;
+    Fence();
+    
+    fHead = theHead + 1;
+    fNumPushed++;
+    return true;
+}
+
+Bool16 ReflectorIngestQueue::Pop(ReflectorPacket* ioPacket, UInt32* outSrcAddr, UInt16* outSrcPort)
+{
+    Slot* theSlots = fSlots;
+    if(theSlots == NULL)
+        return false;
+    Fence();
+    
+    while (true)
+    {
+        UInt32 theHead = fHead;
+        Fence();
+        UInt32 theTail = fTail;
+        if(theTail == theHead)
+            return false;
+            
+        // If the producer lapped us, whatever we hadn't read yet is gone
+        if(theHead - theTail > fMask + 1)
+            theTail = theHead - (fMask + 1);
+            
+        Slot* theSlot = &theSlots[theTail & fMask];
+        UInt32 theSeq = theSlot->fSeq;
+        Fence();
+        
+        Bool16 isValid = ((theSeq & 1) == 0) && (theSlot->fPos == theTail) && (theSlot->fLen < kMaxPacketSize);
+        if(isValid)
+        {
+            ::memcpy(ioPacket->fPacketData, theSlot->fData, theSlot->fLen);
+            ioPacket->fPacketPtr.Set(ioPacket->fPacketData, theSlot->fLen);
+            *outSrcAddr = theSlot->fSrcAddr;
+            *outSrcPort = theSlot->fSrcPort;
+            
+            // If the producer got to the slot while we were copying, what we have is garbage
+            Fence();
+            isValid = (theSlot->fSeq == theSeq);
+        }
+        
+        fTail = theTail + 1;
+        if(isValid)
+            return true;
+    }
+}
+
 ReflectorSender::ReflectorSender(ReflectorStream* inStream, UInt32 inWriteFlag)
 :   fStream(inStream),
     fWriteFlag(inWriteFlag),
@@ -691,6 +1042,22 @@ UInt16 ReflectorSender::GetFirstPacketRTPSeqNum(Bool16 *foundPtr)
    return resultSeqNum;
 }
 
+ReflectorPacket* ReflectorSender::GetPacketWithSeqNum(UInt16 inSeqNum)
+{
+    //newest packets are at the tail, and those are the ones that get asked for
+    for (OSQueueElem* packetElem = fPacketQueue.GetTail(); packetElem != NULL; packetElem = packetElem->Next())
+    {
+        ReflectorPacket* thePacket = (ReflectorPacket*)packetElem->GetEnclosingObject();
+        if((thePacket != NULL) && !thePacket->IsRTCP() && !thePacket->IsFEC() && (thePacket->fPacketPtr.Len >= 4) && (thePacket->GetPacketRTPSeqNum() == inSeqNum))
+            return thePacket;
+            
+        if(packetElem == fPacketQueue.GetHead())
+            break;
+    }
+    
+    return NULL;
+}
+
 OSQueueElem*    ReflectorSender::GetClientBufferNextPacketTime(UInt32 inRTPTime)
 {
         
@@ -713,7 +1080,7 @@ OSQueueElem*    ReflectorSender::GetClientBufferNextPacketTime(UInt32 inRTPTime)
 		if(NULL == thePacket)//fym
 			continue;
                  
-        if(thePacket->GetPacketRTPTime() > inRTPTime)
+        if(!thePacket->IsFEC() && (thePacket->GetPacketRTPTime() > inRTPTime))
         {
             requestedPacket = elem; // return the first packet we have that has a later time
             break; // found the packet we need: done processing
@@ -814,7 +1181,7 @@ void ReflectorSender::ReflectRelayPackets(SInt64* ioWakeupTime, OSQueue* inFreeQ
 	Bool16	printQueueLenOnExit = false;
 	#endif	
 
-	SInt64 currentTime = OS::Milliseconds();
+	SInt64 currentTime = OSThread::GetRunStartMilliseconds();
 
 	//make sure to reset these state variables
 	fHasNewPackets = false;	
@@ -836,23 +1203,11 @@ void ReflectorSender::ReflectRelayPackets(SInt64* ioWakeupTime, OSQueue* inFreeQ
 	OSMutexLocker locker(&fStream->fBucketMutex);
 	
 	// Check to see if we should update the session's bitrate average
-	if((fStream->fLastBitRateSample + ReflectorStream::kBitRateAvgIntervalInMilSecs) < currentTime)
-	{
-		unsigned int intervalBytes = fStream->fBytesSentInThisInterval;
-		(void)atomic_sub(&fStream->fBytesSentInThisInterval, intervalBytes);
-		
-		// Multiply by 1000 to convert from milliseconds to seconds, and by 8 to convert from bytes to bits
-		Float32 bps = (Float32)(intervalBytes * 8) / (Float32)(currentTime - fStream->fLastBitRateSample);
-		bps *= 1000;
-		fStream->fCurrentBitRate = (UInt32)bps;
-		
-		// Don't check again for awhile!
-		fStream->fLastBitRateSample = currentTime;
-	}
+	fStream->UpdateBitRate(currentTime);
 
 	for (UInt32 bucketIndex = 0; bucketIndex < fStream->fNumBuckets; bucketIndex++)
 	{	
-		for (UInt32 bucketMemberIndex = 0; bucketMemberIndex < fStream->sBucketSize; bucketMemberIndex++)
+		for (UInt32 bucketMemberIndex = 0; bucketMemberIndex < fStream->fBucketSize; bucketMemberIndex++)
 		{	 
 			ReflectorOutput* theOutput = fStream->fOutputArray[bucketIndex][bucketMemberIndex];
 		
@@ -948,7 +1303,7 @@ void ReflectorSender::ReflectRelayPackets(SInt64* ioWakeupTime, OSQueue* inFreeQ
 					// during this pass mark remaining as still needed
 					if( !dodBookmarkPacket )
 					{
-						SInt64  packetLateness =  currentTime - thePacket->fTimeArrived - (ReflectorStream::sBucketDelayInMsec * (SInt64)bucketIndex);
+						SInt64  packetLateness =  currentTime - thePacket->fTimeArrived - (fStream->fBucketDelayInMsec * (SInt64)bucketIndex);
 					    // packetLateness measures how late this packet it after being corrected for the bucket delay
 						
 						#if REFLECTOR_STREAM_DEBUGGING > 2
@@ -1085,7 +1440,7 @@ void ReflectorSender::ReflectPackets(SInt64* ioWakeupTime, OSQueue* inFreeQueue)
         return;
     }
 
-    SInt64 currentTime = OS::Milliseconds();
+    SInt64 currentTime = OSThread::GetRunStartMilliseconds();
 
     //make sure to reset these state variables
     fHasNewPackets = false; 
@@ -1130,7 +1485,7 @@ if(thePacket == NULL)
 		//qtss_printf("C ");//fym
 		//qtss_printf("BK %d", fStream->fNumBuckets);//fym
 		//qtss_printf("%d ", fStream->sBucketSize);//fym
-        for (UInt32 bucketMemberIndex = 0; bucketMemberIndex < fStream->sBucketSize/*fym 16*/; bucketMemberIndex++)
+        for (UInt32 bucketMemberIndex = 0; bucketMemberIndex < fStream->fBucketSize/*fym 16*/; bucketMemberIndex++)
         {    
             ReflectorOutput* theOutput = fStream->fOutputArray[bucketIndex][bucketMemberIndex];
 
@@ -1153,7 +1508,7 @@ if(thePacket == NULL)
 					theOutput->fNewOutput = false;
 				}
 
-                SInt64  bucketDelay = ReflectorStream::sBucketDelayInMsec * (SInt64)bucketIndex;
+                SInt64  bucketDelay = fStream->fBucketDelayInMsec * (SInt64)bucketIndex;
                 packetElem = this->SendPacketsToOutput(theOutput, packetElem,currentTime, bucketDelay);
                 if(packetElem)
                 {
@@ -1250,7 +1605,7 @@ OSQueueElem*    ReflectorSender::GetClientBufferStartPacketOffset(SInt64 offsetM
 {
         
     OSQueueIter qIter(&fPacketQueue);// start at oldest packet in q
-    SInt64 theCurrentTime = OS::Milliseconds();
+    SInt64 theCurrentTime = OSThread::GetRunStartMilliseconds();
     SInt64 packetDelay = 0;
     OSQueueElem* oldestPacketInClientBufferTime = NULL;
     
@@ -1272,7 +1627,8 @@ OSQueueElem*    ReflectorSender::GetClientBufferStartPacketOffset(SInt64 offsetM
         if(offsetMsec > ReflectorStream::sOverBufferInMsec)
             offsetMsec = ReflectorStream::sOverBufferInMsec;
             
-        if( packetDelay <= (ReflectorStream::sOverBufferInMsec - offsetMsec) ) 
+        //RTP-Info is taken from this packet, so it has to be media
+        if( !thePacket->IsFEC() && (packetDelay <= (ReflectorStream::sOverBufferInMsec - offsetMsec)) ) 
         {   
             oldestPacketInClientBufferTime = &thePacket->fQueueElem;
             break; // found the packet we need: done processing
@@ -1290,7 +1646,7 @@ void    ReflectorSender::RemoveOldPackets(OSQueue* inFreeQueue)
 // Start at the oldest packet and walk forward to the newest packet
 // 
     OSQueueIter removeIter(&fPacketQueue);
-    SInt64 theCurrentTime = OS::Milliseconds();
+    SInt64 theCurrentTime = OSThread::GetRunStartMilliseconds();
     SInt64 packetDelay = 0;
     SInt64 currentMaxPacketDelay = 500;//fym ݰıʱ䲻˹ ReflectorStream::sMaxPacketAgeMSec;
     
@@ -1462,7 +1818,10 @@ SInt64 ReflectorSocket::Run()
 	//qtss_printf("^%d ", theEvents);//fym
 
 	OSMutexLocker locker(this->GetDemuxer()->GetMutex());
-	SInt64 theMilliseconds = OS::Milliseconds();
+	SInt64 theMilliseconds = OSThread::GetRunStartMilliseconds();
+
+	//Pick up everything input_stream_data has pushed since we last ran
+	this->DrainIngestQueues(theMilliseconds);
 
 	//Only check for data on the socket if we've actually been notified to that effect
 	//fym ÿյkReadEventrecvfromݰ
@@ -1541,7 +1900,7 @@ void ReflectorSocket::FilterInvalidSSRCs(ReflectorPacket* thePacket,Bool16 isRTC
 
     if( thePacket->fPacketPtr.Len > 0) do 
     {
-        SInt64 currentTime = OS::Milliseconds() / 1000;
+        SInt64 currentTime = OSThread::GetRunStartMilliseconds() / 1000;
         if(0 == fValidSSRC)
         {   fValidSSRC = thePacket->GetSSRC(isRTCP); // SSRC of 0 is allowed
             fLastValidSSRCTime = currentTime;
@@ -1584,6 +1943,7 @@ Bool16 ReflectorSocket::ProcessPacket(const SInt64& inMilliseconds,ReflectorPack
 		*/
 
 		thePacket->fIsRTCP = false;
+		thePacket->fIsFEC = false;
        
         /*fym if(fBroadcasterClientSession != NULL) // alway refresh timeout even if we are filtering.
         {   if( (inMilliseconds - fLastBroadcasterTimeOutRefresh) > kRefreshBroadcastSessionIntervalMilliSecs)
@@ -1701,6 +2061,9 @@ Bool16 ReflectorSocket::ProcessPacket(const SInt64& inMilliseconds,ReflectorPack
 		if( theSender->fFirstNewPacketInQueue == NULL )
 			theSender->fFirstNewPacketInQueue = &thePacket->fQueueElem;                 
 		theSender->fHasNewPackets = true;
+		
+		if((theSender->fWriteFlag == qtssWriteFlagsIsRTP) && theSender->fStream->IsFECEnabled())
+			this->QueueFECPackets(theSender, thePacket);
      
 #if 0//fym   
 		if(!(thePacket->IsRTCP()))
@@ -1774,6 +2137,29 @@ Bool16 ReflectorSocket::ProcessPacket(const SInt64& inMilliseconds,ReflectorPack
 }
 
 
+void ReflectorSocket::QueueFECPackets(ReflectorSender* inSender, ReflectorPacket* inPacket)
+{
+    ReflectorFECEncoder* theEncoder = &inSender->fStream->fFECEncoder;
+    UInt32 theNumFECPackets = theEncoder->AddPacket(inPacket->fPacketPtr);
+    for (UInt32 x = 0; x < theNumFECPackets; x++)
+    {
+        ReflectorPacket* theFECPacket = this->GetPacket();
+        if(theFECPacket == NULL)
+            break;
+            
+        //arrives with the packet that completed it, so every output sends it right after that one
+        StrPtrLen* theFECData = theEncoder->GetFECPacket(x);
+        theFECPacket->SetPacketData(theFECData->Ptr, theFECData->Len);
+        theFECPacket->fIsRTCP = false;
+        theFECPacket->fIsFEC = true;
+        theFECPacket->fNeededByOutput = false;
+        theFECPacket->fStreamCountID = ++(inSender->fStream->fPacketCount);
+        theFECPacket->fBucketsSeenThisPacket = 0;
+        theFECPacket->fTimeArrived = inPacket->fTimeArrived;
+        inSender->fPacketQueue.EnQueue(&theFECPacket->fQueueElem);
+    }
+}
+
 void ReflectorSocket::GetIncomingData(const SInt64& inMilliseconds)
 {
     OSMutexLocker locker(this->GetDemuxer()->GetMutex());
@@ -1804,6 +2190,36 @@ void ReflectorSocket::GetIncomingData(const SInt64& inMilliseconds)
     
 }
 
+void ReflectorSocket::DrainIngestQueues(const SInt64& inMilliseconds)
+{
+    OSMutexLocker locker(this->GetDemuxer()->GetMutex());
+    for (OSQueueIter iter(&fSenderQueue); !iter.IsDone(); iter.Next())
+    {
+        ReflectorSender* theSender = (ReflectorSender*)iter.GetCurrent()->GetEnclosingObject();
+        if((theSender == NULL) || (theSender != theSender->fStream->GetRTPSender()))
+            continue;
+            
+        // Take no more than one ring's worth per stream, so a busy producer can't keep us here
+        ReflectorIngestQueue* theQueue = theSender->fStream->GetIngestQueue();
+        UInt32 theMaxPackets = theQueue->GetSize();
+        for (UInt32 x = 0; x < theMaxPackets; x++)
+        {
+            ReflectorPacket* thePacket = this->GetPacket();
+            if(NULL == thePacket)
+                break;
+                
+            UInt32 theRemoteAddr = 0;
+            UInt16 theRemotePort = 0;
+            if(!theQueue->Pop(thePacket, &theRemoteAddr, &theRemotePort))
+            {
+                fFreeQueue.EnQueue(&thePacket->fQueueElem);
+                break;
+            }
+            this->ProcessPacket(inMilliseconds, thePacket, theRemoteAddr, theRemotePort);
+        }
+    }
+}
+
 ReflectorPacket* ReflectorSocket::GetPacket()
 {
     OSMutexLocker locker(this->GetDemuxer()->GetMutex());
@@ -380,6 +380,10 @@ QTSS_Error  RelayOutput::WritePacket(StrPtrLen* inPacket, void* inStreamCookie,
     {
         if(inStreamCookie == fStreamCookieArray[x])
         {
+            // The server we relay to makes its own parity
+            if((inFlags & qtssWriteFlagsIsRTP) && ((ReflectorStream*)inStreamCookie)->IsFECPacket(*inPacket))
+                return OS_NoErr;
+                
             UInt16 theDestPort = fOutputInfo.fPortArray[x];
             //fym Assert((theDestPort & 1) == 0); //this should always be an RTP port (even)
 			if(0 != (theDestPort & 1))//fym
@@ -43,8 +43,11 @@
 #include "MyAssert.h"
 
 #include "ReflectorStream.h"
+#include "RTSPRequestStream.h"
 #include "SourceInfo.h"
 #include "OSArrayObjectDeleter.h"
+#include "OSMutex.h"
+#include "atomic.h"
 
 
 #ifndef _FILE_DELETER_
@@ -64,7 +67,38 @@ class FileDeleter
 
 #ifndef __REFLECTOR_SESSION__
 #define __REFLECTOR_SESSION__
-class ReflectorSession
+class ReflectorMulticastOutput;
+
+// A fully formatted DESCRIBE body, kept in one buffer so it goes out with a single
+// writev behind the response headers. It is reference counted: whoever is writing
+// it holds a reference, so the session can drop or replace it at any time.
+class ReflectorDescribeResponse
+{
+    public:
+    
+        // Starts with one reference, owned by the caller. inKey identifies everything
+        // besides the session and its SDP file that went into the body.
+        ReflectorDescribeResponse(StrPtrLen* inKey, StrPtrLen* inSessionHeaders,
+                                    StrPtrLen* inMediaHeaders, QTSS_TimeVal inModDate);
+        
+        void            Retain()            { (void)atomic_add(&fRefCount, 1); }
+        void            Release()           { if (atomic_sub(&fRefCount, 1) == 0) delete this; }
+        
+        StrPtrLen*      GetKey()            { return &fKey; }
+        StrPtrLen*      GetBody()           { return &fBody; }
+        QTSS_TimeVal    GetModDate()        { return fModDate; }    // of the SDP file the body came from
+        
+    private:
+    
+        ~ReflectorDescribeResponse() { fKey.Delete(); fBody.Delete(); }
+        
+        unsigned int    fRefCount;
+        StrPtrLen       fKey;
+        StrPtrLen       fBody;
+        QTSS_TimeVal    fModDate;
+};
+
+class ReflectorSession : public RTSPInterleavedDataHandler
 {
     public:
     
@@ -118,6 +152,56 @@ class ReflectorSession
         
         void    FormatHTML(StrPtrLen* inURL);
 
+        //
+        // MULTICAST EGRESS
+        //
+        // Viewers on the LAN segment the module was configured for may be answered with a
+        // multicast Transport. Once inMinViewers of them have joined, every stream of this
+        // session is sent once to a group of its own, inGroupAddr plus an offset per session,
+        // instead of once per viewer.
+        static void SetMulticastEgress(UInt32 inGroupAddr, UInt16 inBasePort, UInt16 inTTL,
+                                        UInt32 inMinViewers, UInt32 inInterfaceAddr);
+
+        // Call once per eligible viewer. Returns true if the viewer should be given the
+        // group, false if it should get unicast as usual (too few viewers so far, or the
+        // group could not be set up).
+        Bool16  JoinMulticastGroup();
+        
+        // Call once for each JoinMulticastGroup, passing what it returned. The group is
+        // torn down when its last viewer leaves.
+        void    LeaveMulticastGroup(Bool16 inWasMulticast);
+        
+        Bool16  IsMulticastActive()                 { return fMulticastOutput != NULL; }
+        UInt32  GetMulticastGroupAddr()             { return fMulticastGroupAddr; }
+        UInt16  GetMulticastPort(UInt32 inIndex)    { return (UInt16)(sMulticastBasePort + (inIndex * 2)); }
+        UInt16  GetMulticastTTL()                   { return sMulticastTTL; }
+
+        //
+        // DESCRIBE CACHE
+        //
+        // The DESCRIBE bodies built for this session, one per key. They are dropped
+        // whenever the session is set up again, and go away with the session.
+        
+        // Returns the response cached under inKey with a reference the caller must
+        // Release, or NULL if there isn't one.
+        ReflectorDescribeResponse*  FindDescribeResponse(StrPtrLen* inKey);
+        
+        // Takes a reference of its own. Replaces any response with the same key,
+        // otherwise the oldest one if the cache is full.
+        void                        CacheDescribeResponse(ReflectorDescribeResponse* inResponse);
+        
+        // Drops inResponse if it is still cached
+        void                        RemoveDescribeResponse(ReflectorDescribeResponse* inResponse);
+        void                        FlushDescribeResponses();
+        
+        // The mod date of the SDP file when it was last found unchanged, and when that was,
+        // so requests for a running session need not look at the file every time. The mod
+        // date is -1 until the file has been checked, and again after every setup.
+        QTSS_TimeVal                GetSDPFileModDate()         { OSMutexLocker locker(&fDescribeMutex); return fSDPFileModDate; }
+        SInt64                      GetSDPFileCheckedTimeMS()   { OSMutexLocker locker(&fDescribeMutex); return fSDPFileCheckedTimeMS; }
+        void                        SetSDPFileChecked(QTSS_TimeVal inModDate, SInt64 inTimeMS)
+                                        { OSMutexLocker locker(&fDescribeMutex); fSDPFileModDate = inModDate; fSDPFileCheckedTimeMS = inTimeMS; }
+
         //
         // ACCESSORS
         
@@ -141,6 +225,14 @@ class ReflectorSession
         void AddBroadcasterClientSession(QTSS_StandardRTSP_Params* inParams);
         QTSS_ClientSessionObject GetBroadcasterSession() { return fBroadcasterSession;}
 
+        // A broadcaster pushing over its RTSP connection sends each track on the
+        // interleaved channel the server gave it at SETUP. Record that here.
+        void    SetInterleavedChannel(UInt32 inTrackID, UInt16 inRTPChannel);
+
+        // The broadcaster's client session hands us its interleaved packets directly,
+        // one call per read off the RTSP connection.
+        virtual void ProcessInterleavedData(UInt8* inChannels, StrPtrLen* inPackets, UInt32 inNumPackets);
+
         // For the QTSSSplitterModule, this object can cache a QTSS_StreamRef
         void            SetSocketStream(QTSS_StreamRef inStream)    { fSocketStream = inStream; }
         QTSS_StreamRef  GetSocketStream()                           { return fSocketStream; }
@@ -164,11 +256,22 @@ class ReflectorSession
         enum
         {
             kMaxHTMLSize = 128,
-            kAudioOnlyQuality = 1,      //UInt32
             kNormalQuality = 0,         //UInt32
+            kNoDisposableFramesQuality = 1, //UInt32 H.264 frames nothing refers to are dropped
+            kKeyFramesOnlyQuality = 2,  //UInt32 H.264 GOPs are cut off after the IDR
             kNumQualityLevels = 2       //UInt32
         };
         
+        enum
+        {
+            kMaxMulticastGroups = 256   //UInt32 sessions get groups from the base address up to this offset
+        };
+        
+        enum
+        {
+            kMaxDescribeResponses = 4   //UInt32 variants of the SDP kept per session
+        };
+        
         SInt64  GetInitTimeMS()   { return fInitTimeMS; }
 
        void SetHasBufferedStreams(Bool16 enableBuffer) { fHasBufferedStreams = enableBuffer; }
@@ -191,6 +294,14 @@ class ReflectorSession
         
         ReflectorStream**   fStreamArray;
         
+        // Works out one bucket layout for all the streams and hands it to each of them.
+        // Call with fBucketLayoutMutex held.
+        void        RebalanceBuckets();
+        
+        // Held while outputs are added to or removed from the streams, so that every stream
+        // sees them in the same order and ends up with the same bucket layout
+        OSMutex     fBucketLayoutMutex;
+        
         char        fHTMLBuf[kMaxHTMLSize];
         StrPtrLen   fSourceInfoHTML;
         ResizeableStringFormatter fFormatter;
@@ -207,6 +318,36 @@ class ReflectorSession
 
         Bool16      fHasBufferedStreams;
 
+        // Multicast egress, guarded by fMulticastMutex
+        OSMutex                     fMulticastMutex;
+        ReflectorMulticastOutput*   fMulticastOutput;
+        UInt32                      fMulticastGroupAddr;
+        UInt32                      fMulticastGroupOffset;  // kMaxMulticastGroups when there is no group
+        UInt32                      fNumSubnetViewers;
+        UInt32                      fNumMulticastViewers;
+
+        static UInt32   sMulticastGroupAddr;
+        static UInt16   sMulticastBasePort;
+        static UInt16   sMulticastTTL;
+        static UInt32   sMulticastMinViewers;
+        static UInt32   sMulticastInterfaceAddr;
+        
+        // Returns a group offset no other session is using, or kMaxMulticastGroups if
+        // they are all taken. Give it back with ReleaseMulticastGroup.
+        static UInt32   AcquireMulticastGroup();
+        static void     ReleaseMulticastGroup(UInt32 inOffset);
+        
+        static OSMutex  sMulticastGroupMutex;
+        static Bool16   sMulticastGroupInUse[kMaxMulticastGroups];  // guarded by sMulticastGroupMutex
+        static UInt32   sNextMulticastGroup;                        // where the search for a free one starts
+
+        // DESCRIBE cache, guarded by fDescribeMutex
+        OSMutex                     fDescribeMutex;
+        ReflectorDescribeResponse*  fDescribeResponses[kMaxDescribeResponses];
+        UInt32                      fNextDescribeResponse;  // slot to reuse when all are taken
+        QTSS_TimeVal                fSDPFileModDate;
+        SInt64                      fSDPFileCheckedTimeMS;
+
 		//fym OSMutex*	fMutex;//fym
          
 };
@@ -54,6 +54,7 @@
 
 #include "RTCPSRPacket.h"
 #include "ReflectorOutput.h"
+#include "ReflectorFECEncoder.h"
 #include "atomic.h"
 
 //This will add some printfs that are useful for checking the thinning
@@ -83,6 +84,7 @@ class ReflectorPacket
                             //fQueueElem -- should be set to this
                             fPacketPtr.Set(fPacketData, 0); 
                             fIsRTCP = false;
+                            fIsFEC = false;
                             fStreamCountID = 0;
                             fNeededByOutput = false; 
                         }
@@ -96,6 +98,7 @@ class ReflectorPacket
 				memcpy(this->fPacketPtr.Ptr,data,len); this->fPacketPtr.Len = len;
 		}
         Bool16  IsRTCP() { return fIsRTCP; }
+        Bool16  IsFEC() { return fIsFEC; }
 inline  UInt32  GetPacketRTPTime();
 inline  UInt16  GetPacketRTPSeqNum();
 inline  UInt32  GetSSRC(Bool16 isRTCP);
@@ -115,12 +118,15 @@ inline  SInt64  GetPacketNTPTime();
         char        fPacketData[kMaxReflectorPacketSize];
         StrPtrLen   fPacketPtr;
         Bool16      fIsRTCP;
+        Bool16      fIsFEC;         // parity made by our FEC encoder, not from the source
         Bool16      fNeededByOutput; // is this packet still needed for output?
         UInt64      fStreamCountID;
                 
         friend class ReflectorSender;
         friend class ReflectorSocket;
         friend class RTPSessionOutput;
+        friend class ReflectorStream;
+        friend class ReflectorIngestQueue;
         
    
 };
@@ -210,7 +216,12 @@ class ReflectorSocket : public IdleTask, public UDPSocket
         
         //virtual SInt64        Run();
         void    GetIncomingData(const SInt64& inMilliseconds);//Ӹö˿ڽݰ
+        void    DrainIngestQueues(const SInt64& inMilliseconds);//takes packets queued by PushRelayPacket
         void    FilterInvalidSSRCs(ReflectorPacket* thePacket,Bool16 isRTCP);
+        
+        // Runs an RTP packet just queued on inSender through its stream's FEC encoder,
+        // and queues any parity packets that completes right behind it.
+        void    QueueFECPackets(ReflectorSender* inSender, ReflectorPacket* inPacket);
 
         //Number of packets to allocate when the socket is first created
         enum
@@ -283,6 +294,10 @@ class ReflectorSender : public UDPDemuxerTask
 
     UInt32      GetOldestPacketRTPTime(Bool16 *foundPtr);          
     UInt16      GetFirstPacketRTPSeqNum(Bool16 *foundPtr);             
+    
+    // The RTP packet with this sequence number, if it is still queued.
+    // Caller must hold the stream's bucket mutex.
+    ReflectorPacket* GetPacketWithSeqNum(UInt16 inSeqNum);
     Bool16      GetFirstPacketInfo(UInt16* outSeqNumPtr, UInt32* outRTPTimePtr, SInt64* outArrivalTimePtr);
 
     OSQueueElem*GetClientBufferNextPacketTime(UInt32 inRTPTime);
@@ -374,6 +389,78 @@ typedef struct tagRTPHeaderParam
 	unsigned long SSRC:32;//SSRC
 }RTPHeaderParam;
 
+// Carries packets from a thread calling input_stream_data to the ReflectorSocket
+// task without either side taking a lock the other holds. There must be only one
+// producer (pushing) and one consumer (popping) per queue.
+//
+// Each slot owns its packet buffer, so the producer never allocates after the first
+// push. Positions only ever increase. A slot records the position it was written for
+// and bumps its sequence number around every write, so if the producer overwrites a
+// slot while the consumer is copying it out, the consumer notices and skips it.
+class ReflectorIngestQueue
+{
+    public:
+
+        // What to do when the producer laps the consumer
+        enum
+        {
+            kDropOldest = 0,    // overwrite the oldest unread packet, unless it is part of a key frame
+            kDropNew    = 1     // throw away the new packet
+        };
+
+        ReflectorIngestQueue();
+        ~ReflectorIngestQueue() { delete [] fSlots; }
+
+        // Called from Initialize with the module prefs
+        static void SetSize(UInt32 inNumPackets);
+        static void SetOverflowPolicy(UInt32 inPolicy) { sOverflowPolicy = inPolicy; }
+
+        // Producer side. Never blocks. Returns false if the packet was dropped.
+        Bool16  Push(char* inPacket, UInt32 inLen, Bool16 isKeyFrame, UInt32 inSrcAddr, UInt16 inSrcPort);
+
+        // Consumer side. Copies the oldest unread packet into ioPacket. Returns false if
+        // there is nothing left to read.
+        Bool16  Pop(ReflectorPacket* ioPacket, UInt32* outSrcAddr, UInt16* outSrcPort);
+
+        // 0 until the first push allocates the slots
+        UInt32  GetSize()               { return (fSlots == NULL) ? 0 : fMask + 1; }
+        UInt32  GetNumPushed()          { return fNumPushed; }
+        UInt32  GetNumDroppedOldest()   { return fNumDroppedOldest; }
+        UInt32  GetNumDroppedNew()      { return fNumDroppedNew; }
+
+    private:
+
+        enum
+        {
+            kMaxPacketSize = ReflectorPacket::kMaxReflectorPacketSize
+        };
+
+        struct Slot
+        {
+            volatile UInt32 fSeq;   // odd while the producer is writing the slot
+            UInt32          fPos;   // position of the packet in here
+            UInt32          fLen;
+            UInt32          fSrcAddr;
+            UInt16          fSrcPort;
+            Bool16          fIsKeyFrame;
+            char            fData[kMaxPacketSize];
+        };
+
+        static void Fence();
+
+        Slot* volatile      fSlots;     // allocated by the producer on its first push
+        UInt32              fMask;      // number of slots - 1
+        volatile UInt32     fHead;      // next position to write, only the producer changes it
+        volatile UInt32     fTail;      // next position to read, only the consumer changes it
+
+        UInt32              fNumPushed;
+        UInt32              fNumDroppedOldest;
+        UInt32              fNumDroppedNew;
+
+        static UInt32       sNumSlots;  // a power of 2
+        static UInt32       sOverflowPolicy;
+};
+
 //fym һתԴַͶ˿ڶӦһReflectorStreamReflectorStreamReflectorSenderʵ
 class ReflectorStream
 {
@@ -393,6 +480,9 @@ class ReflectorStream
         
         // Uses a StreamInfo to generate a unique ID
         static void GenerateSourceID(SourceInfo::StreamInfo* inInfo, char* ioBuffer);
+        
+        // True if this frame from input_stream_data starts an H.264 key frame
+        static Bool16 IsKeyFrame(char* inFrame, UInt32 inLen);
     
         ReflectorStream(SourceInfo::StreamInfo* inInfo);
         ~ReflectorStream();
@@ -424,6 +514,23 @@ class ReflectorStream
         // Removes the specified output from this ReflectorStream.
         void    RemoveOutput(ReflectorOutput* inOutput); // Removes this output from all tracks
         
+        // An output has to be in the same bucket on every stream of a session, or it gets
+        // audio and video at different times. So the ReflectorSession works out one layout
+        // for all of its streams and hands it to each of them after every add or remove.
+        // Repacks the outputs into buckets of inBucketSize if the old ones no longer fit,
+        // in order, so streams holding the same outputs end up with the same layout.
+        void    SetBucketLayout(UInt32 inBucketSize, UInt32 inDelayInMsec);
+        
+        // Picks the bucket size for inNumOutputs outputs that get inPacketSize byte packets
+        // (0 if not measured yet). Buckets start at sBucketSize, or less if the NIC budget
+        // can't send a packet to that many in kMinBucketDelayInMsec, and grow until the last
+        // bucket, plus one spare, is no more than sMaxBucketDelayInMsec late.
+        static UInt32   ComputeBucketSize(UInt32 inNumOutputs, UInt32 inPacketSize);
+        
+        // How long a bucket of this size needs before the next one starts, given the NIC
+        // budget and the packet size.
+        static UInt32   ComputeBucketDelay(UInt32 inBucketSize, UInt32 inPacketSize);
+        
         void  TearDownAllOutputs(); // causes a tear down and then a remove
 
         // If the incoming data is RTSP interleaved, packets for this stream are identified
@@ -431,6 +538,14 @@ class ReflectorStream
         void                    SetRTPChannelNum(SInt16 inChannel) { fRTPChannel = inChannel; }
         void                    SetRTCPChannelNum(SInt16 inChannel) { fRTCPChannel = inChannel; }
         void                    PushPacket(char *packet, UInt32 packetLen, Bool16 isRTCP);
+        
+        // Queues a batch of RTP packets that arrived together (interleaved on a broadcaster's
+        // RTSP connection) taking the socket's demuxer lock, the arrival time and the wakeup
+        // once for the whole batch.
+        void                    PushPackets(StrPtrLen* inPackets, UInt32 inNumPackets);
+        
+        // Packetizes a frame from input_stream_data and queues it on fIngestQueue for the
+        // ReflectorSocket to pick up. Only one thread may call this for a given stream.
 		void                    PushRelayPacket(char *packet, UInt32 packetLen, UInt32 src_addr, UInt16 src_port, UInt16 stream_index);//fym
 		UInt32					fSequence;//fym תݰ(һݰܱΪRTP
 		UInt16					fRTPPacketSeqNum;//fym RTP
@@ -440,6 +555,12 @@ class ReflectorStream
         
         OSRef*                  GetRef()            { return &fRef; }
         UInt32                  GetBitRate()        { return fCurrentBitRate; }
+        UInt32                  GetAvgPacketSize()  { return fAvgPacketSize; }
+        
+        // Outputs in bucket N get each packet N * GetBucketDelayInMsec() after it arrives
+        UInt32                  GetBucketDelayInMsec()  { OSMutexLocker locker(&fBucketMutex); return fBucketDelayInMsec; }
+        UInt32                  GetBucketSize()         { OSMutexLocker locker(&fBucketMutex); return fBucketSize; }
+        UInt32                  GetNumBucketsInUse()    { OSMutexLocker locker(&fBucketMutex); return fNumBucketsInUse; }
         SourceInfo::StreamInfo* GetStreamInfo()     { return &fStreamInfo; }
         OSMutex*                GetMutex()          { return &fBucketMutex; }
         void*                   GetStreamCookie()   { return this; }
@@ -448,6 +569,7 @@ class ReflectorStream
         UDPSocketPair*          GetSocketPair()     { return fSockets;}
         ReflectorSender*        GetRTPSender()      { return &fRTPSender; }
         ReflectorSender*        GetRTCPSender()     { return &fRTCPSender; }
+        ReflectorIngestQueue*   GetIngestQueue()    { return &fIngestQueue; }
                 
         void                    SetHasFirstRTCP(Bool16 hasPacket)       { fHasFirstRTCPPacket = hasPacket; }
         Bool16                  HasFirstRTCP()                          { return fHasFirstRTCPPacket; }
@@ -474,6 +596,16 @@ inline  void                    UpdateBitRate(SInt64 currentTime);
         void                    IncEyeCount()                           { OSMutexLocker locker(&fBucketMutex); fEyeCount ++; }
         void                    DecEyeCount()                           { OSMutexLocker locker(&fBucketMutex); fEyeCount --; }
         UInt32                  GetEyeCount()                           { OSMutexLocker locker(&fBucketMutex); return fEyeCount; }
+        
+        // FEC is generated once here for every output of the stream. Outputs tell
+        // parity from media with IsFECPacket.
+        Bool16                  IsFECEnabled()                          { return fFECEncoder.IsEnabled(); }
+        UInt8                   GetFECPayloadType()                     { return fFECEncoder.GetPayloadType(); }
+        Bool16                  IsFECPacket(const StrPtrLen& inPacket)  { return fFECEncoder.IsFECPacket(inPacket); }
+        
+        // Asks the broadcast source for a new key frame on behalf of a viewer.
+        // Requests are passed on at most once every kPLIIntervalInMsec.
+        void                    SendPictureLossIndication(UInt32 inMediaSSRC);
 
 	public:
 		static UInt16 fRTPPayloadSize;//fym ݶ1400
@@ -484,6 +616,7 @@ inline  void                    UpdateBitRate(SInt64 currentTime);
         void    SendReceiverReport();
         void    AllocateBucketArray(UInt32 inNumBuckets);
         SInt32  FindBucket();
+        void    RepackBuckets(UInt32 inBucketSize);
         // Unique ID & OSRef. ReflectorStreams can be mapped & shared
         OSRef               fRef;
         char                fSourceIDBuf[kStreamIDSize];
@@ -494,6 +627,8 @@ inline  void                    UpdateBitRate(SInt64 currentTime);
         ReflectorSender     fRTPSender;
         ReflectorSender     fRTCPSender;
         SequenceNumberMap   fSequenceNumberMap; //for removing duplicate packets
+        ReflectorIngestQueue fIngestQueue;      //packets from input_stream_data waiting for the socket
+        ReflectorFECEncoder fFECEncoder;        //only touched by the socket task, with the demuxer mutex held
 
 		char fRTPPacket[1600];//fym зֺڴ,ȷߴfRTPPayloadSize + (8 * sizeof(RTPHeaderParam)))
         
@@ -503,9 +638,13 @@ inline  void                    UpdateBitRate(SInt64 currentTime);
         enum
         {
             kReceiverReportSize = 16,               //UInt32
+            kPLISize = 12,                          //UInt32
+            kPLIIntervalInMsec = 1000,              //SInt64
             kAppSize = 36,                          //UInt32
             kMinNumBuckets = 16,                    //UInt32
-            kBitRateAvgIntervalInMilSecs = 30000 // time between bitrate averages
+            kBitRateAvgIntervalInMilSecs = 30000, // time between bitrate averages
+            kMinBucketDelayInMsec = 10,             //UInt32 no point waking up more often than this
+            kDefaultAvgPacketSize = 1400            //UInt32 until we've measured one
         };
     
         // BUCKET ARRAY
@@ -516,6 +655,9 @@ inline  void                    UpdateBitRate(SInt64 currentTime);
 
         UInt32      fNumBuckets;        //Number of buckets currently
         UInt32      fNumElements;       //Number of reflector outputs in the array
+        UInt32      fBucketSize;        //Number of outputs each bucket holds
+        UInt32      fBucketDelayInMsec; //Delay between one bucket and the next
+        UInt32      fNumBucketsInUse;   //Last non-empty bucket + 1, as of the last rebalance
         
         //Bucket array can't be modified while we are sending packets.
         OSMutex     fBucketMutex;
@@ -531,11 +673,14 @@ inline  void                    UpdateBitRate(SInt64 currentTime);
         // receiver reports.
         UInt32      fDestRTCPAddr;
         UInt16      fDestRTCPPort;
+        SInt64      fLastPLITime;
     
         // Used for calculating average bit rate
         UInt32              fCurrentBitRate;
         SInt64              fLastBitRateSample;
         unsigned int        fBytesSentInThisInterval;// unsigned long because we need to atomic_add it
+        UInt64              fPacketCountAtLastSample;
+        UInt32              fAvgPacketSize;     // 0 until the first bitrate sample. Bucket layouts pick it up on the next add or remove.
 
         // If incoming data is RTSP interleaved
         SInt16              fRTPChannel; //These will be -1 if not set to anything
@@ -557,9 +702,16 @@ inline  void                    UpdateBitRate(SInt64 currentTime);
         static UInt32       sMaxFuturePacketMSec;
         static UInt32       sOverBufferInSec;
         static UInt32       sBucketDelayInMsec;
+        static UInt32       sMaxBucketDelayInMsec;
+        static UInt32       sBucketNICBudgetBytesPerMsec;
         static Bool16       sUsePacketReceiveTime;
         static UInt32       sFirstPacketOffsetMsec;
         
+        // FEC matrix for new streams. 0 columns is off, 0 rows is row parity only.
+        static UInt32       sFECColumns;
+        static UInt32       sFECRows;
+        static UInt32       sFECPayloadType;
+        
         friend class ReflectorSocket;
         friend class ReflectorSender;
 };
@@ -577,6 +729,11 @@ void    ReflectorStream::UpdateBitRate(SInt64 currentTime)
         bps *= 1000;
         fCurrentBitRate = (UInt32)bps;
         
+        UInt64 intervalPackets = fPacketCount - fPacketCountAtLastSample;
+        fPacketCountAtLastSample = fPacketCount;
+        if (intervalPackets > 0)
+            fAvgPacketSize = (UInt32)(intervalBytes / intervalPackets);
+        
         // Don't check again for awhile!
         fLastBitRateSample = currentTime;
     }
@@ -39,6 +39,7 @@
 #include "ReflectorOutput.h"
 #include "ReflectorSession.h"
 #include "QTSS.h"
+#include "OSMutex.h"
 
 class RTPSessionOutput : public ReflectorOutput
 {
@@ -65,6 +66,20 @@ class RTPSessionOutput : public ReflectorOutput
         
         virtual Bool16  IsPlaying();
         
+        // A viewer on the multicast egress subnet. If it was also given the session's
+        // multicast group, its packets are sent by the group output and not from here.
+        void    SetSubnetViewer(Bool16 isMulticast) { fIsSubnetViewer = true; fIsMulticastViewer = isMulticast; }
+        Bool16  IsSubnetViewer()                    { return fIsSubnetViewer; }
+        Bool16  IsMulticastViewer()                 { return fIsMulticastViewer; }
+        
+        // Handles RFC 4585 feedback from a UDP viewer of inStream. Generic NACKs are
+        // queued and the packets they name are resent from the sender's packet queue
+        // the next time WritePacket runs for that stream. PLIs go to the broadcast source.
+        void    ProcessRTCPFeedback(QTSS_RTPStreamObject inStream, void* inRTCPPacketData, UInt32 inRTCPPacketDataLen);
+        
+        // How many packets each viewer may have resent per second. 0 turns NACK handling off.
+        static UInt32   sMaxRetransmitsPerSec;
+        
     private:
     
         QTSS_ClientSessionObject fClientSession;//ĿĵϢ
@@ -76,10 +91,56 @@ class RTPSessionOutput : public ReflectorOutput
         Bool16                  fTransportInitialized;
         Bool16                  fMustSynch;
         Bool16                  fPreFilter;
+        Bool16                  fIsSubnetViewer;
+        Bool16                  fIsMulticastViewer;
+        
+        enum
+        {
+            kMaxRetransmitRequests = 64,    //UInt32
+            kRetransmitIntervalInMsec = 1000 //SInt64
+        };
+        
+        // NACKed packets not yet looked for. The RTCP thread adds to this while holding
+        // the client session mutex, so it must not take the stream's bucket mutex as
+        // well. WritePacket, which already has the bucket mutex, does the sending.
+        struct RetransmitRequest
+        {
+            void*   fStreamCookie;
+            UInt16  fSeqNum;        // as the source numbered it, before thinning
+        };
+        OSMutex                 fRetransmitMutex;
+        RetransmitRequest       fRetransmitRequests[kMaxRetransmitRequests];
+        UInt32                  fNumRetransmitRequests;
+        SInt64                  fRetransmitIntervalStart;
+        UInt32                  fRetransmitsInInterval;
+        
+        // What an H.264 RTP packet carries, least important first
+        enum
+        {
+            kH264NonVCL         = 0,    // parameter sets, SEI, anything we don't understand. Never dropped.
+            kH264Disposable     = 1,    // slice of a frame with nal_ref_idc 0
+            kH264Reference      = 2,    // slice of a frame later frames refer to
+            kH264IDR            = 3     // slice of an IDR frame
+        };
         
         UInt16 GetPacketSeqNumber(StrPtrLen* inPacket);
         void SetPacketSeqNumber(StrPtrLen* inPacket, UInt16 inSeqNumber);
-        Bool16 PacketShouldBeThinned(QTSS_RTPStreamObject inStream, StrPtrLen* inPacket);
+        UInt32 GetH264PacketType(StrPtrLen* inPacket);
+        
+        // How many packets thinning has dropped from this stream so far
+        UInt16 GetSeqNumOffset(QTSS_RTPStreamObject inStream);
+        static UInt32 GetH264NALType(UInt8 inNALHeader);
+        
+        // Decides whether a thinned stream should skip this RTP packet. If not,
+        // outSeqNumOffset is how far to move its sequence number back to cover
+        // the packets dropped so far.
+        Bool16 PacketShouldBeThinned(QTSS_RTPStreamObject inStream, StrPtrLen* inPacket, UInt16* outSeqNumOffset);
+        
+        void QueueRetransmitRequest(QTSS_RTPStreamObject inStream, void* inStreamCookie, UInt16 inClientSeqNum);
+        
+        // Resends queued packets of inStreamCookie's stream that this viewer has
+        // already been sent. Caller must hold the stream's bucket mutex.
+        void SendRetransmits(QTSS_RTPStreamObject inStream, void* inStreamCookie, SInt64 inCurrentTime, UInt64 inLastPacketID);
         Bool16  FilterPacket(QTSS_RTPStreamObject *theStreamPtr, StrPtrLen* inPacket);
         
         UInt32 GetPacketRTPTime(StrPtrLen* packetStrPtr);
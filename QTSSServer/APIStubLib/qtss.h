@@ -429,8 +429,9 @@ enum
     qtssRTPStrSvrRTPPort            = 36,   //read      //UInt16            // Port the server is sending RTP packets from for this stream
     qtssRTPStrClientRTPPort         = 37,   //read      //UInt16            // Port the server is sending RTP packets to for this stream
     qtssRTPStrNetworkMode           = 38,   //read      //QTSS_RTPNetworkMode // unicast or multicast
+    qtssRTPStrRTPChannel            = 39,   //read      //UInt16            // If qtssRTPStrIsTCP, the interleaved channel RTP uses on the RTSP connection. RTCP uses the next one.
 
-    qtssRTPStrNumParams             = 39
+    qtssRTPStrNumParams             = 40
 
 };
 typedef UInt32 QTSS_RTPStreamAttributes;
@@ -482,7 +483,8 @@ enum
     qtssCliSesRTCPPacketsRecv       = 34,   //read      //UInt32    //Number of RTCP packets received so far on this session.
     qtssCliSesRTCPBytesRecv         = 35,   //read      //UInt32    //Number of RTCP bytes received so far on this session.
     qtssCliSesStartedThinning       = 36,   //read      //Bool16    // At least one of the streams in the session is thinned
-    qtssCliSesNumParams             = 37
+    qtssCliSesInterleavedDataHandler = 37,  //r/w       //void*     // RTSPInterleavedDataHandler* that takes the media a client pushes over its RTSP connection. If NULL, QTSServer::fDataCallBackFunc gets it.
+    qtssCliSesNumParams             = 38
     
 };
 typedef UInt32 QTSS_ClientSessionAttributes;
@@ -571,7 +573,10 @@ enum
                                                                             // allowed by all authorization modules
     qtssRTSPReqNetworkMode          = 36,   //read      //QTSS_RTPNetworkMode // unicast or multicast
 	qtssRTSPReqDynamicRateState     = 37,   //read      //SInt32            // -1 not in request, 0 off, 1 on
-	qtssRTSPReqNumParams 			= 38
+    qtssRTSPReqMulticastDestAddr    = 38,   //r/w       //UInt32            // Set by a module before QTSS_AddRTPStream to answer this SETUP with a multicast Transport to this group, whatever the client asked for. 0 means unicast.
+    qtssRTSPReqMulticastPort        = 39,   //r/w       //UInt16            // RTP port of the multicast group above. RTCP is the port after it.
+    qtssRTSPReqMulticastTTL         = 40,   //r/w       //UInt16            // TTL to advertise for the multicast group above.
+	qtssRTSPReqNumParams 			= 41
     
 };
 typedef UInt32 QTSS_RTSPRequestAttributes;
@@ -634,7 +639,8 @@ enum
     qtssSvrServerPlatform           = 39,   //read      //char array //Platform (OS) of the server
     qtssSvrRTSPServerComment        = 40,   //read      //char array //RTSP comment for the server header    
     qtssSvrNumThinned               = 41,    //r/w      //SInt32    //Number of thinned sessions
-    qtssSvrNumParams                = 42
+    qtssSvrMemorySlabStats          = 42,   //read      //char array //One line per slab allocator size class: block size, allocations, frees, free blocks cached, slab bytes. Empty unless the server is built with MEMORY_SLAB_ALLOCATOR.
+    qtssSvrNumParams                = 43
 };
 typedef UInt32 QTSS_ServerAttributes;
 
@@ -734,7 +740,8 @@ enum
     qtssPrefsPlayersReqRTPHeader            = 70,   // "player_requires_rtp_header_info" //Char array //name of player to match against the player's user agent header
     qtssPrefsPlayersReqBandAdjust           = 71,   // "player_requires_bandwidth_adjustment //Char array //name of player to match against the player's user agent header
     qtssPrefsPlayersReqNoPauseTimeAdjust    = 72,   // "player_requires_no_pause_time_adjustment //Char array //name of player to match against the player's user agent header
-    qtssPrefsNumParams                      = 73
+    qtssPrefsRTCPRateControlEnabled         = 73,   // "rtcp_rate_control_enabled" //Bool16 // Thin UDP streams from a target bitrate computed from RTCP receiver reports, instead of leaving it to QTSSFlowControlModule.
+    qtssPrefsNumParams                      = 74
 };
 
 typedef UInt32 QTSS_PrefsAttributes;
@@ -0,0 +1,260 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1999-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ *
+ */
+/*
+    File:       Benchmark.cpp
+
+    Contains:   Implements what Benchmark.h declares
+
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SafeStdLib.h"
+
+#include "Benchmark.h"
+#include "OS.h"
+#include "OSThread.h"
+#include "OSMemory.h"
+#include "atomic.h"
+
+struct BenchmarkResult
+{
+    const char* fName;
+    UInt32      fNumThreads;
+    UInt32      fIterations;    // per thread
+    Float64     fNsecPerOp;     // wall time over operations done by one thread
+    Float64     fOpsPerSec;     // all threads together
+    Float64     fMBytesPerSec;
+};
+
+class BenchmarkThread : public OSThread
+{
+    public:
+    
+        BenchmarkThread() : fRun(NULL), fThreadIndex(0), fIterations(0) {}
+        virtual ~BenchmarkThread() {}
+        
+        void            Set(BenchmarkFunc inRun, UInt32 inThreadIndex, UInt32 inIterations)
+                            { fRun = inRun; fThreadIndex = inThreadIndex; fIterations = inIterations; }
+        virtual void    Entry();
+        
+        // The threads of a run all wait for this before they start, so the
+        // cost of creating them isn't timed.
+        static volatile Bool16 sGo;
+        static unsigned int    sNumReady;
+        
+    private:
+    
+        BenchmarkFunc   fRun;
+        UInt32          fThreadIndex;
+        UInt32          fIterations;
+};
+
+volatile Bool16 BenchmarkThread::sGo = false;
+unsigned int    BenchmarkThread::sNumReady = 0;
+
+static Bool16   RunOnce(Benchmark* inBenchmark, UInt32 inNumThreads, UInt32 inIterations, SInt64* outElapsedUsec);
+static Bool16   RunBenchmark(Benchmark* inBenchmark, UInt32 inNumThreads, SInt64 inMinUsec, BenchmarkResult* outResult);
+
+void BenchmarkThread::Entry()
+{
+    (void)atomic_add(&sNumReady, 1);
+    while (!sGo)
+        ;
+    (*fRun)(fThreadIndex, fIterations);
+}
+
+Bool16 ParseBenchmarkOption(int inOption, char* inArg, BenchmarkOptions* ioOptions)
+{
+    switch (inOption)
+    {
+        case 'f': ioOptions->fFilter = inArg; break;
+        case 'c': ioOptions->fChecksOnly = true; break;
+        case 't': ioOptions->fMinMsec = ::atoi(inArg); break;
+        case 'j': ioOptions->fMaxThreads = ::atoi(inArg); break;
+        case 'o': ioOptions->fOutputPath = inArg; break;
+        default: return false;
+    }
+    if (ioOptions->fMaxThreads == 0)
+        ioOptions->fMaxThreads = 1;
+    return true;
+}
+
+void PrintBenchmarkOptions()
+{
+    qtss_printf("  -f: only run checks and benchmarks with this in their name\n");
+    qtss_printf("  -t: run each benchmark for at least this long (default 500)\n");
+    qtss_printf("  -j: most threads to run the shared benchmarks on, in powers of 2 (default 8)\n");
+    qtss_printf("  -o: also write the results here as JSON\n");
+    qtss_printf("  -c: only run the checks\n");
+}
+
+int RunChecksAndBenchmarks( const char* inName, Check* inChecks, UInt32 inNumChecks,
+                            Benchmark* inBenchmarks, UInt32 inNumBenchmarks, BenchmarkOptions* inOptions)
+{
+    UInt32 theNumFailed = 0;
+    for (UInt32 x = 0; x < inNumChecks; x++)
+    {
+        if ((inOptions->fFilter != NULL) && (::strstr(inChecks[x].fName, inOptions->fFilter) == NULL))
+            continue;
+        Bool16 isOK = (*inChecks[x].fRun)();
+        qtss_printf("%-44s %s\n", inChecks[x].fName, isOK ? "ok" : "FAILED");
+        if (!isOK)
+            theNumFailed++;
+    }
+    if (inOptions->fChecksOnly || (theNumFailed > 0))
+        return (theNumFailed > 0) ? 1 : 0;
+    
+    UInt32 theMaxResults = 0;
+    for (UInt32 x = 0; x < inNumBenchmarks; x++)
+    {
+        for (UInt32 theNumThreads = 1; theNumThreads <= inOptions->fMaxThreads; theNumThreads *= 2)
+        {
+            theMaxResults++;
+            if (!inBenchmarks[x].fIsShared)
+                break;
+        }
+    }
+    BenchmarkResult* theResults = NEW BenchmarkResult[theMaxResults];
+    UInt32 theNumResults = 0;
+    
+    qtss_printf("%-44s %7s %12s %12s %14s %10s\n", "benchmark", "threads", "iterations", "nsec/op", "ops/sec", "MB/sec");
+    for (UInt32 x = 0; x < inNumBenchmarks; x++)
+    {
+        if ((inOptions->fFilter != NULL) && (::strstr(inBenchmarks[x].fName, inOptions->fFilter) == NULL))
+            continue;
+            
+        for (UInt32 theNumThreads = 1; theNumThreads <= inOptions->fMaxThreads; theNumThreads *= 2)
+        {
+            BenchmarkResult* theResult = &theResults[theNumResults];
+            if (!RunBenchmark(&inBenchmarks[x], theNumThreads, (SInt64)inOptions->fMinMsec * 1000, theResult))
+            {
+                qtss_printf("%-44s not available here\n", inBenchmarks[x].fName);
+                break;
+            }
+            theNumResults++;
+            qtss_printf("%-44s %7lu %12lu %12.1f %14.0f %10.1f\n", theResult->fName, theResult->fNumThreads,
+                        theResult->fIterations, theResult->fNsecPerOp, theResult->fOpsPerSec, theResult->fMBytesPerSec);
+            if (!inBenchmarks[x].fIsShared)
+                break;
+        }
+    }
+    
+    if (inOptions->fOutputPath != NULL)
+    {
+        FILE* theOutput = ::fopen(inOptions->fOutputPath, "w");
+        if (theOutput == NULL)
+        {
+            qtss_printf("%s: couldn't write %s\n", inName, inOptions->fOutputPath);
+            ::exit(-1);
+        }
+        qtss_fprintf(theOutput, "{\n  \"benchmark\": \"%s\",\n", inName);
+        qtss_fprintf(theOutput, "  \"compiled\": \"%s %s\",\n", __DATE__, __TIME__);
+        qtss_fprintf(theOutput, "  \"min_msec\": %lu,\n", inOptions->fMinMsec);
+        qtss_fprintf(theOutput, "  \"results\": [\n");
+        for (UInt32 x = 0; x < theNumResults; x++)
+        {
+            BenchmarkResult* theResult = &theResults[x];
+            qtss_fprintf(theOutput, "    { \"name\": \"%s\", \"threads\": %lu, \"iterations\": %lu, \"nsec_per_op\": %.2f, \"ops_per_sec\": %.0f, \"mbytes_per_sec\": %.1f }%s\n",
+                            theResult->fName, theResult->fNumThreads, theResult->fIterations, theResult->fNsecPerOp,
+                            theResult->fOpsPerSec, theResult->fMBytesPerSec, (x + 1 < theNumResults) ? "," : "");
+        }
+        qtss_fprintf(theOutput, "  ]\n}\n");
+        ::fclose(theOutput);
+    }
+    
+    delete [] theResults;
+    return 0;
+}
+
+//
+// Returns false if the benchmark's Setup says it can't run here
+Bool16 RunOnce(Benchmark* inBenchmark, UInt32 inNumThreads, UInt32 inIterations, SInt64* outElapsedUsec)
+{
+    if ((inBenchmark->fSetup != NULL) && !(*inBenchmark->fSetup)(inNumThreads))
+        return false;
+        
+    BenchmarkThread* theThreads = NEW BenchmarkThread[inNumThreads];
+    BenchmarkThread::sGo = false;
+    BenchmarkThread::sNumReady = 0;
+    for (UInt32 x = 0; x < inNumThreads; x++)
+    {
+        theThreads[x].Set(inBenchmark->fRun, x, inIterations);
+        theThreads[x].Start();
+    }
+    while (BenchmarkThread::sNumReady < inNumThreads)
+        OSThread::Sleep(1);
+        
+    SInt64 theStartTime = OS::Microseconds();
+    BenchmarkThread::sGo = true;
+    for (UInt32 x = 0; x < inNumThreads; x++)
+        theThreads[x].Join();
+    *outElapsedUsec = OS::Microseconds() - theStartTime;
+    
+    // The threads have been joined, so deleting them won't wait again
+    delete [] theThreads;
+    
+    if (inBenchmark->fTeardown != NULL)
+        (*inBenchmark->fTeardown)(inNumThreads);
+    return true;
+}
+
+Bool16 RunBenchmark(Benchmark* inBenchmark, UInt32 inNumThreads, SInt64 inMinUsec, BenchmarkResult* outResult)
+{
+    //
+    // Keep growing the run until it takes long enough to measure, aiming straight
+    // for the minimum time once a run has taken a measurable fraction of it.
+    UInt32 theIterations = 1;
+    SInt64 theElapsedUsec = 0;
+    while (true)
+    {
+        if (!RunOnce(inBenchmark, inNumThreads, theIterations, &theElapsedUsec))
+            return false;
+        if ((theElapsedUsec >= inMinUsec) || (theIterations >= 1000000000))
+            break;
+            
+        Float64 theMultiplier = 10;
+        if (theElapsedUsec > inMinUsec / 100)
+            theMultiplier = ((Float64)inMinUsec * 1.2) / (Float64)theElapsedUsec;
+        if (theMultiplier < 2)
+            theMultiplier = 2;
+            
+        Float64 theNextIterations = (Float64)theIterations * theMultiplier;
+        theIterations = (theNextIterations > 1000000000) ? 1000000000 : (UInt32)theNextIterations;
+    }
+    
+    if (theElapsedUsec == 0)
+        theElapsedUsec = 1;
+    outResult->fName = inBenchmark->fName;
+    outResult->fNumThreads = inNumThreads;
+    outResult->fIterations = theIterations;
+    outResult->fNsecPerOp = ((Float64)theElapsedUsec * 1000) / (Float64)theIterations;
+    outResult->fOpsPerSec = ((Float64)theIterations * inNumThreads * 1000000) / (Float64)theElapsedUsec;
+    outResult->fMBytesPerSec = (outResult->fOpsPerSec * inBenchmark->fBytesPerOp) / (1024 * 1024);
+    return true;
+}
+
@@ -0,0 +1,100 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1999-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ *
+ */
+/*
+    File:       Benchmark.h
+
+    Contains:   What the microbenchmark programs share: tables of checks and benchmarks,
+                the -f -t -j -o -c options, and the loop that runs the checks, times the
+                benchmarks on 1 to -j threads and writes the results as JSON.
+
+                Each library with a benchmark of its own builds this file into it.
+                It isn't part of CommonUtilitiesLib.
+
+
+*/
+
+#ifndef __BENCHMARK_H__
+#define __BENCHMARK_H__
+
+#include "OSHeaders.h"
+
+//
+// A benchmark does inIterations operations from each of inNumThreads threads, at once.
+// Setup and Teardown run on the main thread around every run, and aren't timed.
+// A Setup that returns false skips the benchmark, when this machine can't run it.
+typedef void (*BenchmarkFunc)(UInt32 inThreadIndex, UInt32 inIterations);
+typedef Bool16 (*BenchmarkSetupFunc)(UInt32 inNumThreads);
+typedef void (*BenchmarkTeardownFunc)(UInt32 inNumThreads);
+
+struct Benchmark
+{
+    const char*         fName;
+    Bool16              fIsShared;      // run at 1, 2, 4 ... threads, all on the same object
+    UInt32              fBytesPerOp;    // for a throughput figure, 0 if there isn't one
+    BenchmarkSetupFunc      fSetup;
+    BenchmarkFunc           fRun;
+    BenchmarkTeardownFunc   fTeardown;
+};
+
+//
+// A check does some work with a known answer, and prints what it got wrong
+typedef Bool16 (*CheckFunc)();
+
+struct Check
+{
+    const char*         fName;
+    CheckFunc           fRun;
+};
+
+struct BenchmarkOptions
+{
+    BenchmarkOptions() : fFilter(NULL), fOutputPath(NULL), fMinMsec(500), fMaxThreads(8), fChecksOnly(false) {}
+
+    char*       fFilter;        // -f
+    char*       fOutputPath;    // -o
+    UInt32      fMinMsec;       // -t
+    UInt32      fMaxThreads;    // -j
+    Bool16      fChecksOnly;    // -c
+};
+
+// The getopt letters the options below take. A program adds its own after them.
+#define kBenchmarkOptionLetters "f:t:j:o:c"
+
+// Takes one of the options above from getopt. Returns false if inOption isn't one of them.
+Bool16  ParseBenchmarkOption(int inOption, char* inArg, BenchmarkOptions* ioOptions);
+
+// Prints a line for each of the options above, for a program's usage
+void    PrintBenchmarkOptions();
+
+//
+// Runs the checks, then unless one failed or -c was given, the benchmarks, printing
+// every result and writing them to -o as inName's. Returns what main should.
+int     RunChecksAndBenchmarks( const char* inName, Check* inChecks, UInt32 inNumChecks,
+                                Benchmark* inBenchmarks, UInt32 inNumBenchmarks, BenchmarkOptions* inOptions);
+
+// A quick LCG, for benchmarks that want the same random sequence on every run
+inline UInt32 NextRandom(UInt32* ioSeed) { *ioSeed = (*ioSeed * 1103515245) + 12345; return *ioSeed >> 8; }
+
+#endif //__BENCHMARK_H__
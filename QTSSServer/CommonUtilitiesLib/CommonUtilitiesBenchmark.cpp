@@ -0,0 +1,986 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1999-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ *
+ */
+/*
+    File:       CommonUtilitiesBenchmark.cpp
+
+    Contains:   Microbenchmarks for the CommonUtilitiesLib primitives the server leans on
+                per packet and per request: StrPtrLen, StringParser, OSQueue, OSHeap,
+                OSRefTable, OSBufferPool, OSMutex, the atomic routines, base64, md5 and
+                the StartCodeScanner kernels. Each one runs at sizes the server actually
+                sees, and the shared ones at 1 to -j threads, for at least -t msec, and
+                prints the time per operation. -o also writes the results as JSON, to
+                compare builds with. Benchmark.cpp does the running; the libraries built
+                on this one have benchmarks of their own that use it too.
+                
+                Checks run first, so a kernel that's fast but wrong fails instead of
+                looking good. The program exits with 1 if any of them fail. One more check
+                sends streams to a multicast group over loopback, from a UDPSocket set up
+                the way ReflectorMulticastOutput does it.
+                
+                This is a program of its own, not part of the library.
+
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SafeStdLib.h"
+
+#ifdef __Win32__
+#include "getopt.h"
+#else
+#include <unistd.h>
+#endif
+
+#include "OS.h"
+#include "OSThread.h"
+#include "OSMutex.h"
+#include "OSMemory.h"
+#include "OSQueue.h"
+#include "OSHeap.h"
+#include "OSRef.h"
+#include "OSBufferPool.h"
+#include "StrPtrLen.h"
+#include "StringParser.h"
+#include "atomic.h"
+#include "base64.h"
+#include "md5.h"
+#include "StartCodeScanner.h"
+#include "Benchmark.h"
+#include "UDPSocket.h"
+
+// Whatever a benchmark computes goes here, so the compiler can't throw the work away
+static volatile UInt32 sSink = 0;
+
+static void PrintUsage();
+
+//
+// StrPtrLen: what the RTSP header lookup does, a header name against the known ones
+// StrPtrLen only takes a char*, so the names live in writable arrays rather than string constants.
+static char sHeaderNames[][16] = { "Accept", "Bandwidth", "CSeq", "Connection", "Content-Base", "Content-Length",
+                                   "Content-Type", "Range", "Session", "Transport", "User-Agent", "x-Retransmit" };
+static const UInt32 kNumHeaderNames = sizeof(sHeaderNames) / sizeof(sHeaderNames[0]);
+static char sTransportHeader[] = "transport";
+
+static void StrPtrLenEqualIgnoreCase(UInt32 /*inThreadIndex*/, UInt32 inIterations)
+{
+    StrPtrLen theHeader(sTransportHeader);
+    UInt32 theMatches = 0;
+    for (UInt32 x = 0; x < inIterations; x++)
+    {
+        StrPtrLen theName(sHeaderNames[x % kNumHeaderNames]);
+        if (theHeader.EqualIgnoreCase(theName))
+            theMatches++;
+    }
+    sSink += theMatches;
+}
+
+//
+// A SETUP as a player sends it. StringParser goes over the whole thing the way RTSPRequest does.
+static char sRTSPRequest[] =    "SETUP rtsp://192.168.1.10:554/1.sdp/trackID=1 RTSP/1.0\r\n"
+                                "CSeq: 3\r\n"
+                                "Transport: RTP/AVP;unicast;client_port=6970-6971\r\n"
+                                "x-Retransmit: our-retransmit\r\n"
+                                "x-Dynamic-Rate: 1\r\n"
+                                "x-Transport-Options: late-tolerance=2.384000\r\n"
+                                "User-Agent: QTS (qtver=7.7.1;os=Windows NT 6.1Service Pack 1)\r\n"
+                                "Accept-Language: en-US\r\n"
+                                "Session: 1863414529436102354\r\n"
+                                "\r\n";
+
+static char sSessionHeader[] = "session:";
+
+static void StrPtrLenFindStringIgnoreCase(UInt32 /*inThreadIndex*/, UInt32 inIterations)
+{
+    StrPtrLen theRequest(sRTSPRequest);
+    UInt32 theFound = 0;
+    for (UInt32 x = 0; x < inIterations; x++)
+    {
+        if (theRequest.FindStringIgnoreCase(sSessionHeader) != NULL)
+            theFound++;
+    }
+    sSink += theFound;
+}
+
+static void StringParserRTSPRequest(UInt32 /*inThreadIndex*/, UInt32 inIterations)
+{
+    UInt32 theTotal = 0;
+    for (UInt32 x = 0; x < inIterations; x++)
+    {
+        StrPtrLen theRequest(sRTSPRequest);
+        StringParser theParser(&theRequest);
+        StrPtrLen theMethod, theURI, theVersion;
+        
+        theParser.ConsumeWord(&theMethod);
+        theParser.ConsumeWhitespace();
+        theParser.ConsumeUntilWhitespace(&theURI);
+        theParser.ConsumeWhitespace();
+        theParser.ConsumeUntil(&theVersion, StringParser::sEOLMask);
+        (void)theParser.ExpectEOL();
+        
+        while (theParser.GetDataRemaining() > 0)
+        {
+            StrPtrLen theName, theValue;
+            theParser.ConsumeUntil(&theName, ':');
+            if (theName.Len == 0)
+                break;
+            (void)theParser.Expect(':');
+            theParser.ConsumeWhitespace();
+            (void)theParser.GetThruEOL(&theValue);
+            theTotal += theValue.Len;
+        }
+    }
+    sSink += theTotal;
+}
+
+//
+// OSQueue: a task thread's event queue, say, filling up and draining
+static const UInt32 kQueueDepth = 64;
+static OSQueueElem* sQueueElems = NULL;
+
+static Bool16 OSQueueSetup(UInt32 /*inNumThreads*/) { sQueueElems = NEW OSQueueElem[kQueueDepth]; return true; }
+static void OSQueueTeardown(UInt32 /*inNumThreads*/){ delete [] sQueueElems; sQueueElems = NULL; }
+
+static void OSQueueEnQueueDeQueue(UInt32 /*inThreadIndex*/, UInt32 inIterations)
+{
+    OSQueue theQueue;
+    UInt32 theDone = 0;
+    while (theDone < inIterations)
+    {
+        UInt32 theCount = inIterations - theDone;
+        if (theCount > kQueueDepth)
+            theCount = kQueueDepth;
+        for (UInt32 x = 0; x < theCount; x++)
+            theQueue.EnQueue(&sQueueElems[x]);
+        for (UInt32 x = 0; x < theCount; x++)
+            (void)theQueue.DeQueue();
+        theDone += theCount;
+    }
+}
+
+//
+// OSHeap: the timer heap of a busy server, 100k timers. Each op takes the
+// soonest one off and puts it back later, or pulls one out of the middle and puts it
+// back, as a refreshed timeout does.
+static const UInt32 kNumTimers = 100000;
+static OSHeap* sHeap = NULL;
+static OSHeapElem* sHeapElems = NULL;
+
+static Bool16 OSHeapSetup(UInt32 /*inNumThreads*/)
+{
+    sHeap = NEW OSHeap(kNumTimers);
+    sHeapElems = NEW OSHeapElem[kNumTimers];
+    UInt32 theSeed = 1;
+    for (UInt32 x = 0; x < kNumTimers; x++)
+    {
+        sHeapElems[x].SetValue(NextRandom(&theSeed) % 1000000);
+        sHeap->Insert(&sHeapElems[x]);
+    }
+    return true;
+}
+
+static void OSHeapTeardown(UInt32 /*inNumThreads*/)
+{
+    while (sHeap->ExtractMin() != NULL)
+        ;
+    delete [] sHeapElems;
+    sHeapElems = NULL;
+    delete sHeap;
+    sHeap = NULL;
+}
+
+static void OSHeapExtractMinInsert(UInt32 /*inThreadIndex*/, UInt32 inIterations)
+{
+    UInt32 theSeed = 2;
+    for (UInt32 x = 0; x < inIterations; x++)
+    {
+        OSHeapElem* theElem = sHeap->ExtractMin();
+        theElem->SetValue(theElem->GetValue() + (NextRandom(&theSeed) % 1000000));
+        sHeap->Insert(theElem);
+    }
+}
+
+static void OSHeapRemoveInsert(UInt32 /*inThreadIndex*/, UInt32 inIterations)
+{
+    UInt32 theSeed = 3;
+    for (UInt32 x = 0; x < inIterations; x++)
+    {
+        OSHeapElem* theElem = &sHeapElems[NextRandom(&theSeed) % kNumTimers];
+        (void)sHeap->Remove(theElem);
+        theElem->SetValue(theElem->GetValue() + (NextRandom(&theSeed) % 1000000));
+        sHeap->Insert(theElem);
+    }
+}
+
+//
+// OSRefTable: the reflector's session map with 10k sessions, looked up from every thread
+static const UInt32 kNumRefs = 10000;
+static OSRefTable* sRefTable = NULL;
+static OSRef* sRefs = NULL;
+static char* sRefNames = NULL;
+
+static Bool16 OSRefTableSetup(UInt32 /*inNumThreads*/)
+{
+    sRefTable = NEW OSRefTable();
+    sRefs = NEW OSRef[kNumRefs];
+    sRefNames = NEW char[kNumRefs * 16];
+    for (UInt32 x = 0; x < kNumRefs; x++)
+    {
+        char* theName = &sRefNames[x * 16];
+        qtss_sprintf(theName, "\\%lu.sdp", x);
+        sRefs[x].Set(StrPtrLen(theName), &sRefs[x]);
+        (void)sRefTable->Register(&sRefs[x]);
+    }
+    return true;
+}
+
+static void OSRefTableTeardown(UInt32 /*inNumThreads*/)
+{
+    for (UInt32 x = 0; x < kNumRefs; x++)
+        sRefTable->UnRegister(&sRefs[x]);
+    delete [] sRefs;
+    sRefs = NULL;
+    delete [] sRefNames;
+    sRefNames = NULL;
+    delete sRefTable;
+    sRefTable = NULL;
+}
+
+static void OSRefTableResolveRelease(UInt32 inThreadIndex, UInt32 inIterations)
+{
+    UInt32 theSeed = inThreadIndex + 1;
+    for (UInt32 x = 0; x < inIterations; x++)
+    {
+        StrPtrLen theKey(&sRefNames[(NextRandom(&theSeed) % kNumRefs) * 16]);
+        OSRef* theRef = sRefTable->Resolve(&theKey);
+        if (theRef != NULL)
+            sRefTable->Release(theRef);
+    }
+}
+
+static void OSRefTableRegisterUnRegister(UInt32 /*inThreadIndex*/, UInt32 inIterations)
+{
+    char theKey[] = "\\benchmark.sdp";
+    OSRef theRef;
+    theRef.Set(StrPtrLen(theKey), NULL);
+    for (UInt32 x = 0; x < inIterations; x++)
+    {
+        (void)sRefTable->Register(&theRef);
+        sRefTable->UnRegister(&theRef);
+    }
+}
+
+//
+// The check: lookup threads resolve a few keys and hold on to each ref for a msec, as a
+// task might, while the main thread unregisters, swaps and registers the refs under them.
+// Each key has two refs that take turns in the table. A ref is marked dead as soon as the
+// table hands it back, so a lookup still holding it then, or one that finds it afterwards,
+// sees it dead.
+static const UInt32 kRefStressKeys = 8;
+static const UInt32 kRefStressThreads = 4;
+static const UInt32 kRefStressMsec = 2000;
+
+struct RefStressEntry
+{
+    OSRef           fRef;
+    volatile Bool16 fIsAlive;
+};
+
+class RefStressThread : public OSThread
+{
+    public:
+    
+        RefStressThread() : fSeed(0), fNumResolved(0), fNumDead(0) {}
+        virtual ~RefStressThread() {}
+        
+        virtual void    Entry();
+        
+        UInt32          fSeed;
+        UInt32          fNumResolved;
+        UInt32          fNumDead;
+};
+
+static OSRefTable*  sRefStressTable = NULL;
+static char         sRefStressNames[kRefStressKeys][16];
+
+void RefStressThread::Entry()
+{
+    while (!this->IsStopRequested())
+    {
+        StrPtrLen theKey(sRefStressNames[NextRandom(&fSeed) % kRefStressKeys]);
+        OSRef* theRef = sRefStressTable->Resolve(&theKey);
+        if (theRef == NULL)
+            continue;
+        fNumResolved++;
+        
+        RefStressEntry* theEntry = (RefStressEntry*)theRef->GetObject();
+        Bool16 wasAlive = theEntry->fIsAlive;
+        OSThread::Sleep(1);
+        if (!wasAlive || !theEntry->fIsAlive)
+            fNumDead++;
+        sRefStressTable->Release(theRef);
+    }
+}
+
+static void RegisterRefStressEntry(RefStressEntry* inEntry)
+{
+    inEntry->fIsAlive = true;
+    (void)sRefStressTable->Register(&inEntry->fRef);
+}
+
+static void UnRegisterRefStressEntry(RefStressEntry* inEntry)
+{
+    sRefStressTable->UnRegister(&inEntry->fRef);
+    inEntry->fIsAlive = false;
+}
+
+static Bool16 CheckOSRefTable()
+{
+    // A table of 1 bucket, so the keys share a chain, and it grows under the first few
+    sRefStressTable = NEW OSRefTable(1);
+    RefStressEntry* theEntries = NEW RefStressEntry[kRefStressKeys * 2];
+    UInt32 theCurrent[kRefStressKeys];
+    for (UInt32 x = 0; x < kRefStressKeys; x++)
+    {
+        qtss_sprintf(sRefStressNames[x], "\\%lu.sdp", x);
+        for (UInt32 y = 0; y < 2; y++)
+        {
+            theEntries[(x * 2) + y].fRef.Set(StrPtrLen(sRefStressNames[x]), &theEntries[(x * 2) + y]);
+            theEntries[(x * 2) + y].fIsAlive = false;
+        }
+        theCurrent[x] = 0;
+        RegisterRefStressEntry(&theEntries[x * 2]);
+    }
+    
+    RefStressThread* theThreads = NEW RefStressThread[kRefStressThreads];
+    for (UInt32 x = 0; x < kRefStressThreads; x++)
+    {
+        theThreads[x].fSeed = x + 1;
+        theThreads[x].Start();
+    }
+    
+    // Every way a ref leaves the table
+    UInt32 theSeed = 1;
+    UInt32 theNumOps = 0;
+    SInt64 theDeadline = OS::Milliseconds() + kRefStressMsec;
+    while (OS::Milliseconds() < theDeadline)
+    {
+        UInt32 theKey = NextRandom(&theSeed) % kRefStressKeys;
+        RefStressEntry* theOld = &theEntries[(theKey * 2) + theCurrent[theKey]];
+        RefStressEntry* theNew = &theEntries[(theKey * 2) + (1 - theCurrent[theKey])];
+        switch (NextRandom(&theSeed) % 4)
+        {
+            case 0:
+                UnRegisterRefStressEntry(theOld);
+                RegisterRefStressEntry(theNew);
+                break;
+            case 1:
+                theNew->fIsAlive = true;
+                sRefStressTable->Swap(&theNew->fRef);
+                UnRegisterRefStressEntry(theOld);
+                break;
+            case 2:
+                sRefStressTable->Remove(&theOld->fRef);
+                UnRegisterRefStressEntry(theOld);
+                RegisterRefStressEntry(theNew);
+                break;
+            default:
+                if (!sRefStressTable->TryUnRegister(&theOld->fRef))
+                    continue;
+                theOld->fIsAlive = false;
+                RegisterRefStressEntry(theNew);
+                break;
+        }
+        theCurrent[theKey] = 1 - theCurrent[theKey];
+        theNumOps++;
+    }
+    
+    Bool16 isOK = true;
+    UInt32 theNumResolved = 0;
+    for (UInt32 x = 0; x < kRefStressThreads; x++)
+    {
+        theThreads[x].StopAndWaitForThread();
+        theNumResolved += theThreads[x].fNumResolved;
+        if (theThreads[x].fNumDead > 0)
+        {
+            qtss_printf("OSRefTable: lookup thread %lu was handed a ref after it was unregistered, %lu times\n", x, theThreads[x].fNumDead);
+            isOK = false;
+        }
+    }
+    if (sRefStressTable->GetNumRefsInTable() != kRefStressKeys)
+    {
+        qtss_printf("OSRefTable: %lu refs left in the table, not %lu\n", sRefStressTable->GetNumRefsInTable(), kRefStressKeys);
+        isOK = false;
+    }
+    if ((theNumOps == 0) || (theNumResolved == 0))
+    {
+        qtss_printf("OSRefTable: %lu changes to the table and %lu lookups, nothing was tested\n", theNumOps, theNumResolved);
+        isOK = false;
+    }
+    
+    for (UInt32 x = 0; x < kRefStressKeys; x++)
+        sRefStressTable->UnRegister(&theEntries[(x * 2) + theCurrent[x]].fRef);
+    delete [] theThreads;
+    delete [] theEntries;
+    delete sRefStressTable;
+    sRefStressTable = NULL;
+    return isOK;
+}
+
+//
+// OSBufferPool: packet sized buffers, shared by every thread
+static OSBufferPool* sBufferPool = NULL;
+
+static Bool16 OSBufferPoolSetup(UInt32 /*inNumThreads*/) { if (sBufferPool == NULL) sBufferPool = NEW OSBufferPool(1500); return true; }
+
+static void OSBufferPoolGetPut(UInt32 /*inThreadIndex*/, UInt32 inIterations)
+{
+    for (UInt32 x = 0; x < inIterations; x++)
+        sBufferPool->Put(sBufferPool->Get());
+}
+
+//
+// OSMutex and the atomic routines, on one shared lock or counter
+static OSMutex sMutex;
+static unsigned int sCounter = 0;
+
+static void OSMutexLockUnlock(UInt32 /*inThreadIndex*/, UInt32 inIterations)
+{
+    for (UInt32 x = 0; x < inIterations; x++)
+    {
+        OSMutexLocker theLocker(&sMutex);
+        sCounter++;
+    }
+}
+
+static void AtomicAdd(UInt32 /*inThreadIndex*/, UInt32 inIterations)
+{
+    for (UInt32 x = 0; x < inIterations; x++)
+        (void)atomic_add(&sCounter, 1);
+}
+
+static void AtomicCompareAndStore(UInt32 /*inThreadIndex*/, UInt32 inIterations)
+{
+    for (UInt32 x = 0; x < inIterations; x++)
+    {
+        unsigned int theOldValue;
+        do
+        {
+            theOldValue = sCounter;
+        } while (!compare_and_store(theOldValue, theOldValue + 1, &sCounter));
+    }
+}
+
+//
+// base64: RTSP over HTTP tunnels base64 encode everything the player sends
+static const UInt32 kBase64PlainLen = 1024;
+static char sBase64Plain[kBase64PlainLen];
+static char sBase64Coded[((kBase64PlainLen + 2) / 3) * 4 + 1];
+
+static Bool16 Base64Setup(UInt32 /*inNumThreads*/)
+{
+    UInt32 theSeed = 4;
+    for (UInt32 x = 0; x < kBase64PlainLen; x++)
+        sBase64Plain[x] = (char)NextRandom(&theSeed);
+    (void)Base64encode(sBase64Coded, sBase64Plain, kBase64PlainLen);
+    return true;
+}
+
+static void Base64Encode(UInt32 /*inThreadIndex*/, UInt32 inIterations)
+{
+    char theCoded[sizeof(sBase64Coded)];
+    for (UInt32 x = 0; x < inIterations; x++)
+        sSink += Base64encode(theCoded, sBase64Plain, kBase64PlainLen);
+}
+
+static void Base64Decode(UInt32 /*inThreadIndex*/, UInt32 inIterations)
+{
+    char thePlain[kBase64PlainLen + 4];
+    for (UInt32 x = 0; x < inIterations; x++)
+        sSink += Base64decode(thePlain, sBase64Coded);
+}
+
+//
+// md5: digest authentication hashes a few short strings per request
+static const UInt32 kMD5ShortLen = 64;
+static const UInt32 kMD5LongLen = 1500;
+static unsigned char sMD5Data[kMD5LongLen];
+
+static void MD5(UInt32 inLen, UInt32 inIterations)
+{
+    MD5_CTX theContext;
+    unsigned char theDigest[16];
+    for (UInt32 x = 0; x < inIterations; x++)
+    {
+        MD5_Init(&theContext);
+        MD5_Update(&theContext, sMD5Data, inLen);
+        MD5_Final(theDigest, &theContext);
+        sSink += theDigest[0];
+    }
+}
+
+static void MD5Short(UInt32 /*inThreadIndex*/, UInt32 inIterations)    { MD5(kMD5ShortLen, inIterations); }
+static void MD5Long(UInt32 /*inThreadIndex*/, UInt32 inIterations)     { MD5(kMD5LongLen, inIterations); }
+
+//
+// StartCodeScanner: a megabyte of Annex B H.264, NAL units of a few bytes up to 30k,
+// with emulation prevention bytes in them the way an encoder puts them in. We build it
+// ourselves so we know where every start code is.
+static const UInt32 kAnnexBLen = 1024 * 1024;
+static const UInt32 kMaxStartCodes = kAnnexBLen / 4;
+static const UInt32 kMaxAlignment = 32;
+static UInt8*   sAnnexB = NULL;
+static UInt32*  sStartCodes = NULL;     // where Find should stop, the second zero of a 4 byte code
+static UInt32*  sNALUnitLens = NULL;
+static UInt32   sNumStartCodes = 0;
+static char*    sAnnexBPath = NULL;     // -s, checked against the scalar kernel as well
+
+static const UInt32 sKernels[] = { StartCodeScanner::kScalar, StartCodeScanner::kSSE2, StartCodeScanner::kAVX2 };
+static const char* sKernelNames[] = { "scalar", "SSE2", "AVX2" };
+static const UInt32 kNumKernels = sizeof(sKernels) / sizeof(UInt32);
+
+static void MakeAnnexB()
+{
+    if (sAnnexB != NULL)
+        return;
+        
+    sAnnexB = NEW UInt8[kAnnexBLen];
+    sStartCodes = NEW UInt32[kMaxStartCodes];
+    sNALUnitLens = NEW UInt32[kMaxStartCodes];
+    
+    UInt32 theSeed = 5;
+    UInt32 theOffset = 0;
+    while (theOffset + 16 < kAnnexBLen)
+    {
+        // Mostly 4 byte codes, as in front of an SPS, PPS or the first slice of a frame
+        if ((NextRandom(&theSeed) % 4) != 0)
+            sAnnexB[theOffset++] = 0;
+        sStartCodes[sNumStartCodes] = theOffset;
+        sAnnexB[theOffset++] = 0;
+        sAnnexB[theOffset++] = 0;
+        sAnnexB[theOffset++] = 1;
+        
+        UInt32 theNALUnitLen = 1 + (NextRandom(&theSeed) % ((NextRandom(&theSeed) % 8) == 0 ? 30000 : 1400));
+        if (theOffset + theNALUnitLen + 1 > kAnnexBLen)
+            theNALUnitLen = kAnnexBLen - theOffset - 1;
+        UInt32 theNALUnitStart = theOffset;
+        
+        // Plenty of zeros, so the kernels see 00 00 that isn't a start code. Two zeros in a
+        // row get an 03 after them, and the unit never ends in a zero.
+        UInt32 theZeros = 0;
+        while (theOffset - theNALUnitStart < theNALUnitLen)
+        {
+            UInt8 theByte = (UInt8)NextRandom(&theSeed);
+            if ((theByte & 0x07) == 0)
+                theByte = 0;
+            if ((theZeros == 2) && (theByte <= 3))
+                theByte = 3;
+            if ((theByte == 0) && (theOffset - theNALUnitStart + 1 == theNALUnitLen))
+                theByte = 0x80;
+            sAnnexB[theOffset++] = theByte;
+            theZeros = (theByte == 0) ? theZeros + 1 : 0;
+        }
+        sNALUnitLens[sNumStartCodes++] = theNALUnitLen;
+    }
+    
+    // Trailing bytes no start code can be made of. They're part of the last unit.
+    sNALUnitLens[sNumStartCodes - 1] += kAnnexBLen - theOffset;
+    while (theOffset < kAnnexBLen)
+        sAnnexB[theOffset++] = 0xFF;
+}
+
+static Bool16 CheckStartCodes(const char* inKernelName, const UInt8* inBuffer, UInt32 inAlignment)
+{
+    UInt32 theIndex = 0;
+    for (UInt32 x = StartCodeScanner::Find(inBuffer, kAnnexBLen); x < kAnnexBLen; x = StartCodeScanner::Find(inBuffer, kAnnexBLen, x + 1))
+    {
+        if ((theIndex == sNumStartCodes) || (x != sStartCodes[theIndex]))
+        {
+            qtss_printf("StartCodeScanner: %s found a start code at %lu, alignment %lu, that isn't there\n", inKernelName, x, inAlignment);
+            return false;
+        }
+        theIndex++;
+    }
+    if (theIndex != sNumStartCodes)
+    {
+        qtss_printf("StartCodeScanner: %s missed the start code at %lu, alignment %lu\n", inKernelName, sStartCodes[theIndex], inAlignment);
+        return false;
+    }
+    
+    // Every unit starts just past its start code and is exactly as long as we made it
+    theIndex = 0;
+    StrPtrLen theNALUnit;
+    for (UInt32 theOffset = 0; StartCodeScanner::GetNextNALUnit(inBuffer, kAnnexBLen, &theOffset, &theNALUnit); theIndex++)
+    {
+        if ((theIndex == sNumStartCodes) || ((UInt8*)theNALUnit.Ptr != inBuffer + sStartCodes[theIndex] + 3) || (theNALUnit.Len != sNALUnitLens[theIndex]))
+        {
+            qtss_printf("StartCodeScanner: %s got NAL unit %lu wrong, alignment %lu\n", inKernelName, theIndex, inAlignment);
+            return false;
+        }
+    }
+    if (theIndex != sNumStartCodes)
+    {
+        qtss_printf("StartCodeScanner: %s found %lu NAL units, not %lu\n", inKernelName, theIndex, sNumStartCodes);
+        return false;
+    }
+    return true;
+}
+
+// Counts the start codes in the -s file, and sums where they are, so a kernel that
+// finds the right number in the wrong places still fails
+static void CountStartCodes(const UInt8* inBuffer, UInt32 inLen, UInt32* outCount, UInt64* outPositionSum)
+{
+    *outCount = 0;
+    *outPositionSum = 0;
+    for (UInt32 x = StartCodeScanner::Find(inBuffer, inLen); x < inLen; x = StartCodeScanner::Find(inBuffer, inLen, x + 1))
+    {
+        (*outCount)++;
+        *outPositionSum += x;
+    }
+}
+
+static Bool16 CheckStartCodeFile()
+{
+    FILE* theFile = ::fopen(sAnnexBPath, "rb");
+    if (theFile == NULL)
+    {
+        qtss_printf("StartCodeScanner: couldn't open %s\n", sAnnexBPath);
+        return false;
+    }
+    (void)::fseek(theFile, 0, SEEK_END);
+    UInt32 theLen = (UInt32)::ftell(theFile);
+    (void)::fseek(theFile, 0, SEEK_SET);
+    
+    UInt8* theFileData = NEW UInt8[theLen];
+    Bool16 isOK = (::fread(theFileData, 1, theLen, theFile) == theLen);
+    ::fclose(theFile);
+    
+    UInt32 theNumCodes = 0;
+    UInt64 thePositionSum = 0;
+    (void)StartCodeScanner::SetKernel(StartCodeScanner::kScalar);
+    CountStartCodes(theFileData, theLen, &theNumCodes, &thePositionSum);
+    if (isOK && (theNumCodes == 0))
+    {
+        qtss_printf("StartCodeScanner: %s has no start codes in it\n", sAnnexBPath);
+        isOK = false;
+    }
+    
+    UInt8* theBuffer = NEW UInt8[theLen + kMaxAlignment];
+    for (UInt32 theKernel = 1; isOK && (theKernel < kNumKernels); theKernel++)
+    {
+        if (!StartCodeScanner::SetKernel(sKernels[theKernel]))
+            continue;
+        for (UInt32 theAlignment = 0; theAlignment < kMaxAlignment; theAlignment++)
+        {
+            UInt8* theData = theBuffer + theAlignment;
+            ::memcpy(theData, theFileData, theLen);
+            UInt32 theCount = 0;
+            UInt64 theSum = 0;
+            CountStartCodes(theData, theLen, &theCount, &theSum);
+            if ((theCount != theNumCodes) || (theSum != thePositionSum))
+            {
+                qtss_printf("StartCodeScanner: %s disagrees with scalar on %s at alignment %lu\n", sKernelNames[theKernel], sAnnexBPath, theAlignment);
+                isOK = false;
+                break;
+            }
+        }
+    }
+    
+    delete [] theBuffer;
+    delete [] theFileData;
+    return isOK;
+}
+
+static Bool16 CheckStartCodeScanner()
+{
+    MakeAnnexB();
+    UInt8* theBuffer = NEW UInt8[kAnnexBLen + kMaxAlignment];
+    
+    // Every kernel at every alignment, so the loads that straddle the end of a vector
+    // and the tail that's too short for one both get tried
+    Bool16 isOK = true;
+    for (UInt32 theKernel = 0; isOK && (theKernel < kNumKernels); theKernel++)
+    {
+        if (!StartCodeScanner::SetKernel(sKernels[theKernel]))
+        {
+            qtss_printf("StartCodeScanner: %s not available, not checked\n", sKernelNames[theKernel]);
+            continue;
+        }
+        for (UInt32 theAlignment = 0; isOK && (theAlignment < kMaxAlignment); theAlignment++)
+        {
+            ::memcpy(theBuffer + theAlignment, sAnnexB, kAnnexBLen);
+            isOK = CheckStartCodes(sKernelNames[theKernel], theBuffer + theAlignment, theAlignment);
+        }
+    }
+    delete [] theBuffer;
+    
+    if (isOK && (sAnnexBPath != NULL))
+        isOK = CheckStartCodeFile();
+    return isOK;
+}
+
+static Bool16 StartCodeScannerSetup(UInt32 inKernel)
+{
+    MakeAnnexB();
+    return StartCodeScanner::SetKernel(inKernel);
+}
+
+static Bool16 StartCodeScannerScalarSetup(UInt32 /*inNumThreads*/)  { return StartCodeScannerSetup(StartCodeScanner::kScalar); }
+static Bool16 StartCodeScannerSSE2Setup(UInt32 /*inNumThreads*/)    { return StartCodeScannerSetup(StartCodeScanner::kSSE2); }
+static Bool16 StartCodeScannerAVX2Setup(UInt32 /*inNumThreads*/)    { return StartCodeScannerSetup(StartCodeScanner::kAVX2); }
+
+static void StartCodeScannerFind(UInt32 /*inThreadIndex*/, UInt32 inIterations)
+{
+    UInt32 theFound = 0;
+    for (UInt32 theIteration = 0; theIteration < inIterations; theIteration++)
+    {
+        for (UInt32 x = StartCodeScanner::Find(sAnnexB, kAnnexBLen); x < kAnnexBLen; x = StartCodeScanner::Find(sAnnexB, kAnnexBLen, x + 1))
+            theFound++;
+    }
+    sSink += theFound;
+}
+
+//
+// UDPSocket multicast: a ReflectorMulticastOutput, over loopback. One socket bound to the
+// interface, with the TTL and outgoing interface set on it, sends stream x's RTP to
+// base + 2x and its RTCP to base + 2x + 1 on a group. A viewer on each port, joined on
+// loopback, has to get its own packet and nothing else, from that socket.
+static const UInt32 kMulticastGroup = 0xEFFF2A01;      // 239.255.42.1
+static const UInt16 kMulticastFirstPort = 22000;        // reflector_multicast_egress_port's default
+static const UInt32 kMulticastNumPorts = 4;             // 2 streams
+static const UInt16 kMulticastTTL = 3;
+static const UInt32 kMulticastWaitMsec = 2000;
+
+// The group's ports may be taken, so this moves along until every viewer binds.
+static UInt16 BindMulticastViewers(UDPSocket** outViewers)
+{
+    for (UInt32 thePort = kMulticastFirstPort; thePort < kMulticastFirstPort + 400; thePort += kMulticastNumPorts)
+    {
+        UInt32 theNumBound = 0;
+        for ( ; theNumBound < kMulticastNumPorts; theNumBound++)
+        {
+            outViewers[theNumBound] = NEW UDPSocket(NULL, Socket::kNonBlockingSocketType);
+            if ((outViewers[theNumBound]->Open() != OS_NoErr) ||
+                (outViewers[theNumBound]->Bind(INADDR_ANY, (UInt16)(thePort + theNumBound)) != OS_NoErr))
+            {
+                delete outViewers[theNumBound];
+                break;
+            }
+        }
+        if (theNumBound == kMulticastNumPorts)
+            return (UInt16)thePort;
+        for (UInt32 x = 0; x < theNumBound; x++)
+            delete outViewers[x];
+    }
+    return 0;
+}
+
+static Bool16 CheckUDPSocketMulticast()
+{
+    UDPSocket* theViewers[kMulticastNumPorts];
+    UInt16 theBasePort = BindMulticastViewers(theViewers);
+    if (theBasePort == 0)
+    {
+        qtss_printf("UDPSocket: no free ports for the multicast viewers\n");
+        return false;
+    }
+    
+    // UDPSocket::JoinMulticast joins on the interface the socket is bound to, and a viewer
+    // bound to 127.0.0.1 wouldn't get packets sent to the group, so the viewers join by hand.
+    Bool16 isOK = true;
+    for (UInt32 x = 0; isOK && (x < kMulticastNumPorts); x++)
+    {
+        struct ip_mreq theMulti;
+        theMulti.imr_multiaddr.s_addr = htonl(kMulticastGroup);
+        theMulti.imr_interface.s_addr = htonl(INADDR_LOOPBACK);
+        if (::setsockopt(theViewers[x]->GetSocketFD(), IPPROTO_IP, IP_ADD_MEMBERSHIP, (char*)&theMulti, sizeof(theMulti)) != 0)
+        {
+            qtss_printf("UDPSocket: couldn't join the group on loopback, error %d\n", OSThread::GetErrno());
+            isOK = false;
+        }
+    }
+    
+    // As ReflectorMulticastOutput::BindSocket sets its socket up
+    UDPSocket theOutput(NULL, Socket::kNonBlockingSocketType);
+    OS_Error theErr = isOK ? theOutput.Open() : OS_NoErr;
+    if (isOK && (theErr == OS_NoErr))
+        theErr = theOutput.Bind(INADDR_LOOPBACK, 0);
+    if (isOK && (theErr == OS_NoErr))
+        theErr = theOutput.SetTtl(kMulticastTTL);
+    if (isOK && (theErr == OS_NoErr))
+        theErr = theOutput.SetMulticastInterface(INADDR_LOOPBACK);
+    if (theErr != OS_NoErr)
+    {
+        qtss_printf("UDPSocket: couldn't set up the multicast output, error %ld\n", (SInt32)theErr);
+        isOK = false;
+    }
+    
+    if (isOK)
+    {
+        u_char theTTL = 0;
+#if __Win32__ || __osf__ || __sgi__ || __hpux__
+        int theOptLen = sizeof(theTTL);
+#else
+        socklen_t theOptLen = sizeof(theTTL);
+#endif
+        (void)::getsockopt(theOutput.GetSocketFD(), IPPROTO_IP, IP_MULTICAST_TTL, (char*)&theTTL, &theOptLen);
+        if (theTTL != kMulticastTTL)
+        {
+            qtss_printf("UDPSocket: multicast TTL is %u, not %u\n", theTTL, kMulticastTTL);
+            isOK = false;
+        }
+    }
+    
+    // Each packet says which port it went to
+    for (UInt32 x = 0; isOK && (x < kMulticastNumPorts); x++)
+    {
+        UInt32 thePacket = htonl(theBasePort + x);
+        theErr = theOutput.SendTo(kMulticastGroup, (UInt16)(theBasePort + x), &thePacket, sizeof(thePacket));
+        if (theErr != OS_NoErr)
+        {
+            qtss_printf("UDPSocket: couldn't send to the group on port %lu, error %ld\n", theBasePort + x, (SInt32)theErr);
+            isOK = false;
+        }
+    }
+    
+    UInt32 theNumReceived[kMulticastNumPorts];
+    ::memset(theNumReceived, 0, sizeof(theNumReceived));
+    SInt64 theDeadline = OS::Milliseconds() + kMulticastWaitMsec;
+    for (UInt32 theNumLeft = kMulticastNumPorts; isOK && (theNumLeft > 0) && (OS::Milliseconds() < theDeadline); )
+    {
+        for (UInt32 x = 0; x < kMulticastNumPorts; x++)
+        {
+            UInt32 thePacket = 0;
+            UInt32 theRemoteAddr = 0;
+            UInt16 theRemotePort = 0;
+            UInt32 theRecvLen = 0;
+            if (theViewers[x]->RecvFrom(&theRemoteAddr, &theRemotePort, &thePacket, sizeof(thePacket), &theRecvLen) != OS_NoErr)
+                continue;
+            
+            if ((theRecvLen != sizeof(thePacket)) || (ntohl(thePacket) != theBasePort + x) ||
+                (theRemoteAddr != INADDR_LOOPBACK) || (theRemotePort != theOutput.GetLocalPort()))
+            {
+                qtss_printf("UDPSocket: the viewer on port %lu got the wrong packet\n", theBasePort + x);
+                isOK = false;
+            }
+            if (theNumReceived[x]++ == 0)
+                theNumLeft--;
+        }
+        OSThread::Sleep(1);
+    }
+    
+    // Give strays to the wrong port a moment to turn up
+    OSThread::Sleep(50);
+    for (UInt32 x = 0; isOK && (x < kMulticastNumPorts); x++)
+    {
+        UInt32 thePacket = 0;
+        UInt32 theRemoteAddr = 0;
+        UInt16 theRemotePort = 0;
+        UInt32 theRecvLen = 0;
+        if (theViewers[x]->RecvFrom(&theRemoteAddr, &theRemotePort, &thePacket, sizeof(thePacket), &theRecvLen) == OS_NoErr)
+            theNumReceived[x]++;
+        if (theNumReceived[x] != 1)
+        {
+            qtss_printf("UDPSocket: the viewer on port %lu got %lu packets, not 1\n", theBasePort + x, theNumReceived[x]);
+            isOK = false;
+        }
+    }
+    
+    for (UInt32 x = 0; x < kMulticastNumPorts; x++)
+        delete theViewers[x];
+    return isOK;
+}
+
+static Check sChecks[] =
+{
+    { "OSRefTable",                             CheckOSRefTable },
+    { "StartCodeScanner",                       CheckStartCodeScanner },
+    { "UDPSocket/Multicast",                    CheckUDPSocketMulticast }
+};
+static const UInt32 kNumChecks = sizeof(sChecks) / sizeof(Check);
+
+static Benchmark sBenchmarks[] =
+{
+    { "StrPtrLen/EqualIgnoreCase",              false,  0,                  NULL,               StrPtrLenEqualIgnoreCase,       NULL },
+    { "StrPtrLen/FindStringIgnoreCase/request", false,  0,                  NULL,               StrPtrLenFindStringIgnoreCase,  NULL },
+    { "StringParser/RTSPRequest",               false,  0,                  NULL,               StringParserRTSPRequest,        NULL },
+    { "OSQueue/EnQueueDeQueue/64",              false,  0,                  OSQueueSetup,       OSQueueEnQueueDeQueue,          OSQueueTeardown },
+    { "OSHeap/ExtractMinInsert/100000",         false,  0,                  OSHeapSetup,        OSHeapExtractMinInsert,         OSHeapTeardown },
+    { "OSHeap/RemoveInsert/100000",             false,  0,                  OSHeapSetup,        OSHeapRemoveInsert,             OSHeapTeardown },
+    { "OSRefTable/ResolveRelease/10000",        true,   0,                  OSRefTableSetup,    OSRefTableResolveRelease,       OSRefTableTeardown },
+    { "OSRefTable/RegisterUnRegister/10000",    false,  0,                  OSRefTableSetup,    OSRefTableRegisterUnRegister,   OSRefTableTeardown },
+    { "OSBufferPool/GetPut",                    true,   0,                  OSBufferPoolSetup,  OSBufferPoolGetPut,             NULL },
+    { "OSMutex/LockUnlock",                     true,   0,                  NULL,               OSMutexLockUnlock,              NULL },
+    { "atomic/atomic_add",                      true,   0,                  NULL,               AtomicAdd,                      NULL },
+    { "atomic/compare_and_store",               true,   0,                  NULL,               AtomicCompareAndStore,          NULL },
+    { "base64/Encode/1024",                     false,  kBase64PlainLen,    Base64Setup,        Base64Encode,                   NULL },
+    { "base64/Decode/1024",                     false,  kBase64PlainLen,    Base64Setup,        Base64Decode,                   NULL },
+    { "md5/64",                                 false,  kMD5ShortLen,       NULL,               MD5Short,                       NULL },
+    { "md5/1500",                               false,  kMD5LongLen,        NULL,               MD5Long,                        NULL },
+    { "StartCodeScanner/Find/1MB/scalar",       false,  kAnnexBLen,         StartCodeScannerScalarSetup, StartCodeScannerFind,  NULL },
+    { "StartCodeScanner/Find/1MB/SSE2",         false,  kAnnexBLen,         StartCodeScannerSSE2Setup,   StartCodeScannerFind,  NULL },
+    { "StartCodeScanner/Find/1MB/AVX2",         false,  kAnnexBLen,         StartCodeScannerAVX2Setup,   StartCodeScannerFind,  NULL }
+};
+static const UInt32 kNumBenchmarks = sizeof(sBenchmarks) / sizeof(Benchmark);
+
+int main(int argc, char* argv[])
+{
+    extern char* optarg;
+    int ch;
+    
+    BenchmarkOptions theOptions;
+    while ((ch = getopt(argc, argv, kBenchmarkOptionLetters "s:h")) != EOF)
+    {
+        if (ParseBenchmarkOption(ch, optarg, &theOptions))
+            continue;
+        switch (ch)
+        {
+            case 's': sAnnexBPath = optarg; break;
+            default:
+                PrintUsage();
+                ::exit(0);
+        }
+    }
+        
+    OS::Initialize();
+    OSThread::Initialize();
+    
+    // For the multicast check
+#ifdef __Win32__
+    WORD wsVersion = MAKEWORD(2, 2);
+    WSADATA wsData;
+    (void)::WSAStartup(wsVersion, &wsData);
+#endif
+    
+    return RunChecksAndBenchmarks("CommonUtilitiesLib", sChecks, kNumChecks, sBenchmarks, kNumBenchmarks, &theOptions);
+}
+
+void PrintUsage()
+{
+    qtss_printf("usage: CommonUtilitiesBenchmark [-f filter] [-t msec] [-j threads] [-o results.json] [-s file.264] [-c]\n");
+    PrintBenchmarkOptions();
+    qtss_printf("  -s: also check every start code scanner kernel against the scalar one on this Annex B file\n");
+}
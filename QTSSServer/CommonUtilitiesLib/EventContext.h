@@ -89,6 +89,8 @@ class EventContext
             }
         }
         
+        Task*           GetTask()           { return fTask; }
+        
         // when the HTTP Proxy tunnels takes over a TCPSocket, we need to maintain this context too
         void            SnarfEventContext( EventContext &fromContext );
         
@@ -44,6 +44,7 @@
 
 #ifndef __Win32__
 #include <sys/time.h>
+#include <time.h>
 #endif
 
 #ifdef __sgi__ 
@@ -83,15 +84,14 @@ double  OS::sMicroDivisor = 0;
 SInt64  OS::sMsecSince1970 = 0;
 SInt64  OS::sMsecSince1900 = 0;
 SInt64  OS::sInitialMsec = 0;
-SInt64  OS::sWrapTime = 0;
-SInt64  OS::sCompareWrap = 0;
-SInt64  OS::sLastTimeMilli = 0;
+#if __Win32__
+SInt64  OS::sPerformanceFrequency = 1;
+#endif
 OSMutex OS::sStdLibOSMutex;
 
 #if DEBUG || __Win32__
 #include "OSMutex.h"
 #include "OSMemory.h"
-static OSMutex* sLastMillisMutex = NULL;
 #endif
 
 void OS::Initialize()
@@ -105,20 +105,17 @@ void OS::Initialize()
     SInt64 the1900Sec = (SInt64) (24 * 60 * 60) * (SInt64) ((70 * 365) + 17) ;
     sMsecSince1900 = the1900Sec * 1000;
     
-    sWrapTime = (SInt64) 0x00000001 << 32;
-    sCompareWrap = (SInt64) 0xffffffff << 32;
-    sLastTimeMilli = 0;
+#if __Win32__
+    LARGE_INTEGER theFrequency;
+    if(::QueryPerformanceFrequency(&theFrequency) && (theFrequency.QuadPart > 0))
+        sPerformanceFrequency = theFrequency.QuadPart;
+#endif
     
     sInitialMsec = OS::Milliseconds(); //Milliseconds uses sInitialMsec so this assignment is valid only once.
 
-    sMsecSince1970 = ::time(NULL);  // POSIX time always returns seconds since 1970
-    sMsecSince1970 *= 1000;         // Convert to msec
-    
-
-
-#if DEBUG || __Win32__ 
-    sLastMillisMutex = NEW OSMutex();
-#endif
+    // From here on Milliseconds reads as the wall clock did at startup, plus however
+    // long the monotonic clock says it has been
+    sMsecSince1970 = OS::WallClockMilliseconds();
 }
 
 //fym شJan 1, 1970 GMTڵĺ
@@ -146,18 +143,11 @@ SInt64 OS::Milliseconds()
     return scalarMicros;
 */
 #if __Win32__
-    OSMutexLocker locker(sLastMillisMutex);
-    // curTimeMilli = timeGetTime() + ((sLastTimeMilli/ 2^32) * 2^32)
-    // using binary & to reduce it to one operation from two
-    // sCompareWrap and sWrapTime are constants that are never changed
-    // sLastTimeMilli is updated with the curTimeMilli after each call to this function
-	//fym timeGetTimeصϵͳӿڵĺ 
-    SInt64 curTimeMilli = (UInt32) ::timeGetTime() + (sLastTimeMilli & sCompareWrap);
-    if((curTimeMilli - sLastTimeMilli) < 0)
-    {
-        curTimeMilli += sWrapTime;
-    }
-    sLastTimeMilli = curTimeMilli;
+    // The performance counter never wraps, so unlike timeGetTime there is no
+    // shared last value to keep, and no lock
+    LARGE_INTEGER theCount;
+    (void)::QueryPerformanceCounter(&theCount);
+    SInt64 curTimeMilli = ((theCount.QuadPart / sPerformanceFrequency) * 1000) + (((theCount.QuadPart % sPerformanceFrequency) * 1000) / sPerformanceFrequency);
     
     // For debugging purposes
     //SInt64 tempCurMsec = (curTimeMilli - sInitialMsec) + sMsecSince1970;
@@ -166,6 +156,17 @@ SInt64 OS::Milliseconds()
     //qtss_printf("OS::MilliSeconds current time = %s\n", qtss_ctime(&tempCurSec, buffer, sizeof(buffer)));
 
     return (curTimeMilli - sInitialMsec) + sMsecSince1970; // convert to application time
+#elif defined(CLOCK_MONOTONIC)
+    struct timespec t;
+    int theErr = ::clock_gettime(CLOCK_MONOTONIC, &t);
+    Assert(theErr == 0);
+
+    SInt64 curTime;
+    curTime = t.tv_sec;
+    curTime *= 1000;                // sec -> msec
+    curTime += t.tv_nsec / 1000000; // nsec -> msec
+
+    return (curTime - sInitialMsec) + sMsecSince1970;
 #else
     struct timeval t;
     struct timezone tz;
@@ -195,10 +196,21 @@ SInt64 OS::Microseconds()
     return theMillis;
 */
 #if __Win32__
-    SInt64 curTime = (SInt64) ::timeGetTime(); // unsigned long system time in milliseconds
-    curTime -= sInitialMsec; // convert to application time
-    curTime *= 1000; // convert to microseconds                   
-    return curTime;
+    LARGE_INTEGER theCount;
+    (void)::QueryPerformanceCounter(&theCount);
+    SInt64 curTime = ((theCount.QuadPart / sPerformanceFrequency) * 1000000) + (((theCount.QuadPart % sPerformanceFrequency) * 1000000) / sPerformanceFrequency);
+    return curTime - (sInitialMsec * 1000); // convert to application time
+#elif defined(CLOCK_MONOTONIC)
+    struct timespec t;
+    int theErr = ::clock_gettime(CLOCK_MONOTONIC, &t);
+    Assert(theErr == 0);
+
+    SInt64 curTime;
+    curTime = t.tv_sec;
+    curTime *= 1000000;             // sec -> usec
+    curTime += t.tv_nsec / 1000;    // nsec -> usec
+
+    return curTime - (sInitialMsec * 1000);
 #else
     struct timeval t;
     struct timezone tz;
@@ -214,6 +226,28 @@ SInt64 OS::Microseconds()
 #endif
 }
 
+SInt64 OS::WallClockMilliseconds()
+{
+#if __Win32__
+    // FILETIME counts 100ns intervals since Jan 1, 1601
+    FILETIME theFileTime;
+    ::GetSystemTimeAsFileTime(&theFileTime);
+    SInt64 curTime = ((SInt64)theFileTime.dwHighDateTime << 32) | theFileTime.dwLowDateTime;
+    return (curTime / 10000) - (SInt64)11644473600000LL;
+#else
+    struct timeval t;
+    struct timezone tz;
+    int theErr = ::gettimeofday(&t, &tz);
+    Assert(theErr == 0);
+
+    SInt64 curTime;
+    curTime = t.tv_sec;
+    curTime *= 1000;                // sec -> msec
+    curTime += t.tv_usec / 1000;    // usec -> msec
+    return curTime;
+#endif
+}
+
 SInt32 OS::GetGMTOffset()
 {
 #ifdef __Win32__
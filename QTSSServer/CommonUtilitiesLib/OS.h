@@ -49,13 +49,19 @@ class OS
         static SInt32 Min(SInt32 a, SInt32 b)   { if (a < b) return a; return b; }
         
         //
-        // Milliseconds always returns milliseconds since Jan 1, 1970 GMT.
-        // This basically makes it the same as a POSIX time_t value, except
-        // in msec, not seconds. To convert to a time_t, divide by 1000.
+        // Milliseconds returns milliseconds since Jan 1, 1970 GMT as of when the
+        // server started, and from then on counts on a monotonic clock, so it never
+        // goes backwards or jumps when the system clock is set. Use it for anything
+        // timed against other values of it. Convert with TimeMilli_To_UnixTimeMilli
+        // where the time has to agree with other machines (RTCP NTP, logs, SDP).
         static SInt64   Milliseconds();
 
+        // Microseconds since the server started, on the same clock
         static SInt64   Microseconds();
         
+        // The system clock, in milliseconds since Jan 1, 1970 GMT
+        static SInt64   WallClockMilliseconds();
+        
         // Some processors (MIPS, Sparc) cannot handle non word aligned memory
         // accesses. So, we need to provide functions to safely get at non-word
         // aligned memory.
@@ -69,10 +75,11 @@ class OS
         //disable: calculates integer value only                { return (SInt64) ( (Float64) inMilliseconds / 1000) * ((SInt64) 1 << 32 ) ; }
 		
 		static SInt64	TimeMilli_To_1900Fixed64Secs(SInt64 inMilliseconds)
-						{ return TimeMilli_To_Fixed64Secs(sMsecSince1900) + TimeMilli_To_Fixed64Secs(inMilliseconds); }
+						{ return TimeMilli_To_Fixed64Secs(sMsecSince1900) + TimeMilli_To_Fixed64Secs(TimeMilli_To_UnixTimeMilli(inMilliseconds)); }
 
+		// Moves a Milliseconds() value onto the system clock as it reads now
 		static SInt64	TimeMilli_To_UnixTimeMilli(SInt64 inMilliseconds)
-						{ return inMilliseconds; }
+						{ return inMilliseconds + (WallClockMilliseconds() - Milliseconds()); }
 
 		static time_t	TimeMilli_To_UnixTimeSecs(SInt64 inMilliseconds)
 						{ return (time_t)  ( (SInt64) TimeMilli_To_UnixTimeMilli(inMilliseconds) / (SInt64) 1000); }
@@ -84,7 +91,7 @@ class OS
                         { return (time_t)( (SInt64)  ((SInt64)  ( in1900Fixed64Secs - TimeMilli_To_Fixed64Secs(sMsecSince1900) ) /  ((SInt64) 1 << 32)  ) ); }
                             
         static SInt64   Time1900Fixed64Secs_To_TimeMilli(SInt64 in1900Fixed64Secs)
-                        { return   ( (SInt64) ( (Float64) ((SInt64) in1900Fixed64Secs - (SInt64) TimeMilli_To_Fixed64Secs(sMsecSince1900) ) / (Float64)  ((SInt64) 1 << 32) ) * 1000) ; }
+                        { return   ( (SInt64) ( (Float64) ((SInt64) in1900Fixed64Secs - (SInt64) TimeMilli_To_Fixed64Secs(sMsecSince1900) ) / (Float64)  ((SInt64) 1 << 32) ) * 1000) - (WallClockMilliseconds() - Milliseconds()) ; }
  
         // Returns the offset in hours between local time and GMT (or UTC) time.
         static SInt32   GetGMTOffset();
@@ -104,7 +111,7 @@ class OS
         // Mutex for StdLib calls
          static OSMutex* GetStdLibMutex()  { return &sStdLibOSMutex; }
 
-        static SInt64   InitialMSec()       { return sInitialMsec; }
+        static SInt64   InitialMSec()       { return sMsecSince1970; }
         static Float32  StartTimeMilli_Float() { return (Float32) ( (Float64) ( (SInt64) OS::Milliseconds() - (SInt64) OS::InitialMSec()) / (Float64) 1000.0 ); }
         static SInt64   StartTimeMilli_Int()      { return (OS::Milliseconds() - OS::InitialMSec()); }
 
@@ -119,9 +126,9 @@ class OS
         static SInt64 sInitialMsec;
         static SInt32 sMemoryErr;
         static void SetDivisor();
-        static SInt64 sWrapTime;
-        static SInt64 sCompareWrap;
-        static SInt64 sLastTimeMilli;
+#if __Win32__
+        static SInt64 sPerformanceFrequency;
+#endif
         static OSMutex sStdLibOSMutex;
 };
 
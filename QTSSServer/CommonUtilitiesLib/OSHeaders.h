@@ -67,7 +67,7 @@
     #define QT_PATH_SEPARATOR       '/'
 
     /* Typedefs */
-    typedef unsigned int        PointerSizedInt;
+    typedef unsigned long       PointerSizedInt;
     typedef unsigned char       UInt8;
     typedef signed char         SInt8;
     typedef unsigned short      UInt16;
@@ -187,7 +187,11 @@ Internet Explorer 6.0 						_WIN32_IE=0x0560 or _WIN32_IE=0x0600
     #define QT_PATH_SEPARATOR       '/'
 
     /* Typedefs */
+#ifdef _WIN64
+    typedef unsigned __int64    PointerSizedInt;
+#else
     typedef unsigned int        PointerSizedInt;
+#endif
     typedef unsigned char       UInt8;
     typedef signed char         SInt8;
     typedef unsigned short      UInt16;
@@ -26,7 +26,8 @@
     File:       OSMemory.h
 
     Contains:   Prototypes for overridden new & delete, definition of OSMemory
-                class which implements some memory leak debugging features.
+                class which implements some memory leak debugging features, and
+                optionally a slab allocator for small objects.
                     
     
 */
@@ -38,6 +39,12 @@
 #include "OSQueue.h"
 #include "OSMutex.h"
 
+// Memory debugging wraps every block itself, so it takes over from the slab allocator
+#if MEMORY_DEBUGGING || !defined(MEMORY_SLAB_ALLOCATOR)
+#undef MEMORY_SLAB_ALLOCATOR
+#define MEMORY_SLAB_ALLOCATOR 0
+#endif
+
 class OSMemory
 {
     public:
@@ -78,6 +85,36 @@ class OSMemory
         //the server exits with
         static void SetMemoryError(SInt32 inErr);
         
+#if MEMORY_SLAB_ALLOCATOR
+        //Blocks up to kMaxSlabBlockSize are rounded up to one of kNumSizeClasses sizes
+        //and carved out of slabs of that size. Each OSThread keeps a short free list per
+        //size class, so most allocations and frees touch no lock and no shared memory.
+        //A thread only locks its class to take or give back a batch of blocks.
+        //Threads other than OSThreads, or past the first kNumThreadCaches, always go
+        //to the class's shared list. Anything bigger comes from malloc, as does
+        //everything allocated before OSThread::Initialize.
+        enum
+        {
+            kNumSizeClasses     = 19,       //UInt32
+            kMaxSlabBlockSize   = 3072,     //UInt32 a ReflectorPacket fits
+            kSlabSize           = 65536,    //UInt32 bytes carved into blocks at a time
+            kNumThreadCaches    = 64        //UInt32
+        };
+        
+        struct SlabStats
+        {
+            UInt32  fBlockSize;
+            UInt64  fNumAllocs;
+            UInt64  fNumFrees;
+            UInt32  fNumCached;     //free blocks, in thread caches or the shared list
+            UInt32  fSlabBytes;     //slabs are never given back, so this only grows
+        };
+        
+        //Counters for size class inClassIndex (0 .. kNumSizeClasses - 1). Threads keep
+        //allocating while they are added up, so they are only roughly consistent.
+        static void     GetSlabStats(UInt32 inClassIndex, SlabStats* outStats);
+#endif
+
 #if MEMORY_DEBUGGING
     private:
             
@@ -31,6 +31,8 @@
 */
 
 #include "OSRef.h"
+#include "OSThread.h"
+#include "atomic.h"
 
 #include <errno.h>
 
@@ -44,12 +46,28 @@ UInt32  OSRefTableUtils::HashString(StrPtrLen* inString)
     //data in this string
     UInt8* theData = (UInt8*)inString->Ptr;
     
-    //divide by 4 and take the characters at quarter points in the string,
-    //use those as the basis for the hash value
-    UInt32 quarterLen = inString->Len >> 2;
-    return (inString->Len * (theData[0] + theData[quarterLen] +
-            theData[quarterLen * 2] + theData[quarterLen * 3] +
-            theData[inString->Len - 1]));
+    //hash every character. Keys like "\123.sdp" only differ in a few digits, and
+    //sampling the string at its quarter points put 10000 of them in 55 buckets.
+    UInt32 theHash = 2166136261U;
+    for (UInt32 x = 0; x < inString->Len; x++)
+    {
+        theHash ^= theData[x];
+        theHash *= 16777619U;
+    }
+    return theHash;
+}
+
+OSRefTable::OSRefTable(UInt32 tableSize)
+:   fTable(tableSize),
+    fMutex(),
+    fEpoch(0),
+    fResizeCount(0)
+{
+    for (UInt32 x = 0; x < kNumReaderSlots; x++)
+    {
+        fReaderSlots[x].fNumReaders[0] = 0;
+        fReaderSlots[x].fNumReaders[1] = 0;
+    }
 }
 
 OS_Error OSRefTable::Register(OSRef* inRef)
@@ -74,6 +92,7 @@ OS_Error OSRefTable::Register(OSRef* inRef)
     inRef->fInATable = true;
 #endif
     fTable.Add(inRef);
+    this->GrowIfNeeded();
     return OS_NoErr;
 }
 
@@ -98,6 +117,7 @@ OSRef* OSRefTable::RegisterOrResolve(OSRef* inRef)
     inRef->fInATable = true;
 #endif
     fTable.Add(inRef);
+    this->GrowIfNeeded();
     return NULL;
 }
 
@@ -107,8 +127,7 @@ void OSRefTable::UnRegister(OSRef* ref, UInt32 refCount)
     OSMutexLocker locker(&fMutex);
 
     //make sure that no one else is using the object
-    while (ref->fRefCount > refCount)
-        ref->fCond.Wait(&fMutex);
+    this->WaitForRefCount(ref, refCount);
     
 #if DEBUG
     OSRefKey key(&ref->fString);
@@ -118,8 +137,15 @@ void OSRefTable::UnRegister(OSRef* ref, UInt32 refCount)
 #endif
     
     //ok, we now definitely have no one else using this object, so
-    //remove it from the table
-    fTable.Remove(ref);
+    //remove it from the table. A lookup may have found it just before it went,
+    //so let those finish, and wait out any ref they took.
+    (void)fTable.Remove(ref, false);
+    this->WaitForReaders();
+    fTable.ClearLink(ref);
+    this->WaitForRefCount(ref, refCount);
+    
+    //the last Release may still be looking at the ref
+    this->WaitForReaders();
 }
 
 Bool16 OSRefTable::TryUnRegister(OSRef* ref, UInt32 refCount)
@@ -128,9 +154,22 @@ Bool16 OSRefTable::TryUnRegister(OSRef* ref, UInt32 refCount)
     if(ref->fRefCount > refCount)
         return false;
     
-    // At this point, this is guarenteed not to block, because
-    // we've already checked that the refCount is low.
-    this->UnRegister(ref, refCount);
+    // It's still possible a lookup found it just before we took it out. If so,
+    // that lookup won, so put the ref back.
+    Bool16 wasInTable = fTable.Remove(ref, false);
+    this->WaitForReaders();
+    fTable.ClearLink(ref);
+    if(ref->fRefCount > refCount)
+    {
+        if(wasInTable)
+            fTable.Add(ref);
+        return false;
+    }
+    
+#if DEBUG
+    ref->fInATable = false;
+#endif
+    this->WaitForReaders();
     return true;
 }
 
@@ -140,13 +179,29 @@ OSRef*  OSRefTable::Resolve(StrPtrLen* inUniqueID)
     Assert(inUniqueID != NULL);
     OSRefKey key(inUniqueID);
 
-    //this must be done atomically wrt the table
-    OSMutexLocker locker(&fMutex);
-    OSRef* ref = fTable.Map(&key);
-    if(ref != NULL)
+    //no lock here. Whatever we find can't be taken out of the table and freed
+    //until we've left, and we take our ref before we do.
+    UInt32 theToken = this->EnterReader(key.GetHashKey());
+    OSRef* ref = NULL;
+    Bool16 isResizing = (fResizeCount & 1) != 0;
+    if(!isResizing)
     {
-        ref->fRefCount++;
-        Assert(ref->fRefCount > 0);
+        ref = fTable.Map(&key);
+        if(ref != NULL)
+        {
+            UInt32 theRefCount = AtomicAdd(&ref->fRefCount, 1);
+            Assert(theRefCount > 0);
+        }
+    }
+    this->ExitReader(theToken);
+    
+    if(isResizing)
+    {
+        //the buckets are being moved around, so wait until they're done
+        OSMutexLocker locker(&fMutex);
+        ref = fTable.Map(&key);
+        if(ref != NULL)
+            (void)AtomicAdd(&ref->fRefCount, 1);
     }
     return ref;
 }
@@ -156,8 +211,15 @@ void  OSRefTable::Remove(OSRef* ref)
 {
 	Assert(ref != NULL);
 	OSMutexLocker locker(&fMutex);
-	ref->fRefCount = 0;
-	fTable.Remove(ref);
+
+	//only take it out of the table. Resolve and Release change fRefCount without
+	//the mutex, so leave it alone: UnRegister waits for it to drop.
+#if DEBUG
+	ref->fInATable = false;
+#endif
+	(void)fTable.Remove(ref, false);
+	this->WaitForReaders();
+	fTable.ClearLink(ref);
 
 	return;
 }
@@ -165,14 +227,24 @@ void  OSRefTable::Remove(OSRef* ref)
 void    OSRefTable::Release(OSRef* ref)
 {
     Assert(ref != NULL);
-    OSMutexLocker locker(&fMutex);
-    ref->fRefCount--;
+    
+    //UnRegister waits for our lookups to finish before it lets the ref go, so
+    //this counts as one until we're done looking at the ref
+    UInt32 theToken = this->EnterReader(ref->fHashValue);
+    UInt32 theRefCount = AtomicAdd(&ref->fRefCount, -1);
     // fRefCount is an unsigned long and QTSS should never run into
     // a ref greater than 16 * 64K, so this assert just checks to
     // be sure that we have not decremented the ref less than zero.
-    Assert( ref->fRefCount < 1048576L );
-    //make sure to wakeup anyone who may be waiting for this resource to be released
-    ref->fCond.Signal();
+    Assert( theRefCount < 1048576L );
+    Bool16 hasWaiters = (ref->fNumWaiters > 0);
+    this->ExitReader(theToken);
+    
+    //only take the mutex if someone is waiting for this resource to be released
+    if(hasWaiters)
+    {
+        OSMutexLocker locker(&fMutex);
+        fCond.Broadcast();
+    }
 }
 
 void    OSRefTable::Swap(OSRef* newRef)
@@ -184,8 +256,11 @@ void    OSRefTable::Swap(OSRef* newRef)
     OSRef* oldRef = fTable.Map(&key);
     if(oldRef != NULL)
     {
-        fTable.Remove(oldRef);
+        //add first, so a lookup always finds one of them
         fTable.Add(newRef);
+        (void)fTable.Remove(oldRef, false);
+        this->WaitForReaders();
+        fTable.ClearLink(oldRef);
 #if DEBUG
         newRef->fInATable = true;
         oldRef->fInATable = false;
@@ -196,3 +271,91 @@ void    OSRefTable::Swap(OSRef* newRef)
         Assert(0);
 }
 
+UInt32 OSRefTable::EnterReader(UInt32 inHashValue)
+{
+    UInt32 theSlot = inHashValue & (kNumReaderSlots - 1);
+    while (true)
+    {
+        // If the epoch moved before we were counted, the writer that moved it may
+        // already have looked at our slot, and the next one only looks at the other
+        // epoch's count. So we're only in once the epoch is still the one we counted
+        // ourselves in against. The whole value, as two moves leave the parity as it was.
+        UInt32 theEpochCount = fEpoch;
+        UInt32 theEpoch = theEpochCount & 1;
+        (void)AtomicAdd(&fReaderSlots[theSlot].fNumReaders[theEpoch], 1);
+        Fence();
+        if(fEpoch == theEpochCount)
+            return (theSlot << 1) | theEpoch;
+        (void)AtomicAdd(&fReaderSlots[theSlot].fNumReaders[theEpoch], -1);
+    }
+}
+
+void OSRefTable::ExitReader(UInt32 inToken)
+{
+    (void)AtomicAdd(&fReaderSlots[inToken >> 1].fNumReaders[inToken & 1], -1);
+}
+
+void OSRefTable::WaitForReaders()
+{
+    // A lookup that got in before the epoch moved may have seen the table as it was.
+    // One that counts itself in after we've looked at its slot sees it as it is now.
+    Fence();
+    UInt32 theOldEpoch = fEpoch & 1;
+    fEpoch++;
+    Fence();
+    for (UInt32 x = 0; x < kNumReaderSlots; x++)
+    {
+        //lookups are only a few loads long. One that is still going after
+        //that long has had its thread preempted, so get out of its way.
+        for (UInt32 theSpins = 0; fReaderSlots[x].fNumReaders[theOldEpoch] != 0; theSpins++)
+        {
+            if(theSpins >= kMaxReaderSpins)
+                OSThread::Sleep(1);
+        }
+    }
+}
+
+void OSRefTable::WaitForRefCount(OSRef* inRef, UInt32 inRefCount)
+{
+    // Release only takes the mutex to wake us if it sees we're waiting, so say
+    // so before looking at the ref count
+    inRef->fNumWaiters++;
+    Fence();
+    while (inRef->fRefCount > inRefCount)
+        fCond.Wait(&fMutex);
+    inRef->fNumWaiters--;
+}
+
+void OSRefTable::GrowIfNeeded()
+{
+    UInt32 theSize = fTable.GetTableSize();
+    if(fTable.GetNumEntries() <= (UInt64)theSize * 2)
+        return;
+        
+    // Send lookups to the mutex, which we hold, until the buckets have moved
+    fResizeCount++;
+    this->WaitForReaders();
+    fTable.Resize((theSize * 2) + 1);
+    Fence();
+    fResizeCount++;
+}
+
+UInt32 OSRefTable::AtomicAdd(volatile UInt32* ioValue, SInt32 inDelta)
+{
+#if __Win32__
+    return (UInt32)::InterlockedExchangeAdd((volatile LONG*)ioValue, inDelta) + inDelta;
+#elif defined(__GNUC__)
+    return __sync_add_and_fetch(ioValue, inDelta);
+#else
+    return atomic_add((unsigned int*)ioValue, inDelta);
+#endif
+}
+
+void OSRefTable::Fence()
+{
+#if __Win32__
+    ::MemoryBarrier();
+#elif defined(__GNUC__)
+    __sync_synchronize();
+#endif
+}
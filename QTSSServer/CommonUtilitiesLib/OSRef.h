@@ -32,6 +32,10 @@
                 Refs can only be removed from the table when no one is using the ref,
                 therefore allowing clients to arbitrate access to objects in a preemptive,
                 multithreaded environment. 
+                
+                Resolve and Release don't take the table mutex. Everything that changes
+                the table does, and before a removed ref is handed back it waits until
+                every lookup that might have been looking at it is done.
                     
     
     
@@ -62,7 +66,7 @@ class OSRef
 {
     public:
 
-        OSRef() :   fObjectP(NULL), fRefCount(0), fNextHashEntry(NULL)
+        OSRef() :   fObjectP(NULL), fRefCount(0), fNumWaiters(0), fNextHashEntry(NULL)
             {
 #if DEBUG
                 fInATable = false;
@@ -70,7 +74,7 @@ class OSRef
 #endif          
             }
         OSRef(const StrPtrLen &inString, void* inObjectP)
-                                : fRefCount(0), fNextHashEntry(NULL)
+                                : fRefCount(0), fNumWaiters(0), fNextHashEntry(NULL)
                                     {   Set(inString, inObjectP); }
         ~OSRef() {}
         
@@ -99,12 +103,12 @@ class OSRef
         StrPtrLen   fString;
         
         //refcounting
-        UInt32  fRefCount;
+        volatile UInt32 fRefCount;
+        UInt32  fNumWaiters;//threads in UnRegister waiting for this ref, changed under the table mutex
 #if DEBUG
         Bool16  fInATable;
         Bool16  fSwapCalled;
 #endif
-        OSCond  fCond;//to block threads waiting for this ref.
         
         UInt32              fHashValue;
         OSRef*              fNextHashEntry;
@@ -155,6 +159,7 @@ private:
     UInt32  fHashValue;
 
     friend class OSHashTable<OSRef, OSRefKey>;
+    friend class OSRefTable;
 };
 
 typedef OSHashTable<OSRef, OSRefKey> OSRefHashTable;
@@ -166,16 +171,20 @@ class OSRefTable
     
         enum
         {
-            kDefaultTableSize = 1193 //UInt32
+            kDefaultTableSize = 1193, //UInt32
+            kNumReaderSlots = 16,     //UInt32 must be a power of 2
+            kMaxReaderSpins = 1000    //UInt32
         };
     
         //tableSize doesn't indicate the max number of Refs that can be added
-        //(it's unlimited), but is rather just how big to make the hash table
-        OSRefTable(UInt32 tableSize = kDefaultTableSize) : fTable(tableSize), fMutex() {}
+        //(it's unlimited), but is rather just how big to make the hash table to
+        //start with. It grows once there are more than 2 refs per bucket.
+        OSRefTable(UInt32 tableSize = kDefaultTableSize);
         ~OSRefTable() {}
         
         //Allows access to the mutex in case you need to lock the table down
-        //between operations
+        //between operations. Holding it keeps the table from changing, and makes
+        //the hash table safe to iterate, but doesn't hold up Resolve or Release.
         OSMutex*    GetMutex()      { return &fMutex; }
         OSRefHashTable* GetHashTable() { return &fTable; }
         
@@ -214,6 +223,10 @@ class OSRefTable
         OSRef*      Resolve(StrPtrLen*  inString);
 
 		//fym
+		//Remove. Takes the Ref out of the table so no new Resolve can find it, but
+		//doesn't touch its refCount: threads that already have it still hold it.
+		//The table mutex doesn't keep out Resolve or Release, so the Ref must still
+		//be UnRegistered, which waits for them, before it is freed.
 		void      Remove(OSRef* ref);
         
         //Release. Release a Ref, and drops its refCount. After calling this, the
@@ -234,10 +247,36 @@ class OSRefTable
         
     private:
     
+        // Lookups count themselves in, in one of kNumReaderSlots slots so they don't all
+        // fight over one cache line, and against the epoch they started in. A writer
+        // moves the epoch on and waits for the old one to drain.
+        struct ReaderSlot
+        {
+            volatile UInt32 fNumReaders[2];
+            UInt32          fPad[14];
+        };
+        
+        UInt32          EnterReader(UInt32 inHashValue);
+        void            ExitReader(UInt32 inToken);
+        
+        // fMutex must be held. Returns once every lookup that started before it
+        // was called has finished.
+        void            WaitForReaders();
+        
+        // fMutex must be held
+        void            WaitForRefCount(OSRef* inRef, UInt32 inRefCount);
+        void            GrowIfNeeded();
+        
+        static UInt32   AtomicAdd(volatile UInt32* ioValue, SInt32 inDelta);
+        static void     Fence();
         
         //all this object needs to do its job is an atomic hashtable
         OSRefHashTable  fTable;
         OSMutex         fMutex;
+        OSCond          fCond;          //to block threads waiting for a ref to be released
+        volatile UInt32 fEpoch;
+        volatile UInt32 fResizeCount;   //odd while the table is being resized
+        ReaderSlot      fReaderSlots[kNumReaderSlots];
 };
 
 
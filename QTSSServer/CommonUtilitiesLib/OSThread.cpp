@@ -54,6 +54,7 @@
 
 #include "OSThread.h"
 #include "MyAssert.h"
+#include "atomic.h"
 
 #ifdef __sgi__ 
 #include <time.h>
@@ -64,6 +65,8 @@
 // OSThread.cp
 //
 void*   OSThread::sMainThreadData = NULL;
+unsigned int OSThread::sNumThreads = 0;
+Bool16  OSThread::sInitialized = false;
 
 #ifdef __Win32__
 DWORD   OSThread::sThreadStorageIndex = 0;
@@ -102,12 +105,15 @@ void OSThread::Initialize()
 #endif
 
 #endif
+    sInitialized = true;
 }
 
 OSThread::OSThread()
 :   fStopRequested(false),
     fJoined(false),
-    fThreadData(NULL)
+    fThreadData(NULL),
+    fThreadIndex(atomic_add(&sNumThreads, 1) - 1),
+    fRunStartMilliseconds(0)
 {
 }
 
@@ -305,6 +311,14 @@ OSThread*   OSThread::GetCurrent()
 #endif
 }
 
+SInt64  OSThread::GetRunStartMilliseconds()
+{
+    OSThread* theThread = OSThread::GetCurrent();
+    if ((theThread == NULL) || (theThread->fRunStartMilliseconds == 0))
+        return OS::Milliseconds();
+    return theThread->fRunStartMilliseconds;
+}
+
 #ifdef __Win32__
 int OSThread::GetErrno()
 {
@@ -60,6 +60,10 @@ public:
                 // Call before calling any other OSThread function
                 static void     Initialize();
                 
+                // Until Initialize has run, GetCurrent can't be called. Code that may run
+                // earlier than that, like operator new, checks this first.
+                static Bool16   IsInitialized()         { return sInitialized; }
+                
                                 OSThread();
     virtual                     ~OSThread();
     
@@ -82,6 +86,16 @@ public:
                 // As a convienence to higher levels, each thread has its own date buffer
                 DateBuffer*     GetDateBuffer()         { return &fDateBuffer; }
                 
+                // Each thread also gets an index, handed out in order of creation starting at 0,
+                // so higher levels can keep per thread data in a plain array.
+                UInt32          GetThreadIndex()        { return fThreadIndex; }
+                
+                // A task thread reads the clock once before each Task::Run and keeps it here,
+                // so the per packet paths a Run goes through don't each read it again.
+                // GetRunStartMilliseconds falls back to OS::Milliseconds on any other thread.
+                void            SetRunStartMilliseconds(SInt64 inMilliseconds) { fRunStartMilliseconds = inMilliseconds; }
+                static SInt64   GetRunStartMilliseconds();
+                
                 static void*    GetMainThreadData()     { return sMainThreadData; }
                 static void     SetMainThreadData(void* inData) { sMainThreadData = inData; }
                 static void     SetUser(char *user) {::strncpy(sUser,user, sizeof(sUser) -1); sUser[sizeof(sUser) -1]=0;} 
@@ -138,8 +152,12 @@ private:
 #endif
     void*           fThreadData;
     DateBuffer      fDateBuffer;
+    UInt32          fThreadIndex;
+    SInt64          fRunStartMilliseconds;
     
     static void*    sMainThreadData;
+    static unsigned int sNumThreads;
+    static Bool16   sInitialized;
 #ifdef __Win32__
     static unsigned int WINAPI _Entry(LPVOID inThread);
 #else
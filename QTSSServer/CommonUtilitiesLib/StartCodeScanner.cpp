@@ -0,0 +1,252 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1999-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ *
+ */
+/*
+    File:       StartCodeScanner.cpp
+
+    Contains:   Implementation of object described in .h file
+
+
+
+*/
+
+#include "StartCodeScanner.h"
+#include "SafeStdLib.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__i386__) || defined(__x86_64__))
+#include <immintrin.h>
+#define STARTCODE_X86 1
+#define STARTCODE_AVX2 1
+#define STARTCODE_SSE2_TARGET __attribute__((target("sse2")))
+#define STARTCODE_AVX2_TARGET __attribute__((target("avx2")))
+#elif defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#include <emmintrin.h>
+#define STARTCODE_X86 1
+#if _MSC_VER >= 1700
+#include <immintrin.h>
+#define STARTCODE_AVX2 1
+#else
+#define STARTCODE_AVX2 0
+#endif
+#define STARTCODE_SSE2_TARGET
+#define STARTCODE_AVX2_TARGET
+#else
+#define STARTCODE_X86 0
+#define STARTCODE_AVX2 0
+#endif
+
+StartCodeScanner::FindFunction StartCodeScanner::sFindFunction = StartCodeScanner::FindFirstTime;
+
+#if STARTCODE_X86
+static UInt32 LowestBit(UInt32 inMask)
+{
+#if defined(_MSC_VER)
+    unsigned long theIndex = 0;
+    _BitScanForward(&theIndex, inMask);
+    return (UInt32)theIndex;
+#else
+    return (UInt32)__builtin_ctz(inMask);
+#endif
+}
+
+static Bool16 CPUHasSSE2()
+{
+#if defined(_MSC_VER)
+    int theInfo[4];
+    __cpuid(theInfo, 1);
+    return (theInfo[3] & (1 << 26)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2") != 0;
+#endif
+}
+
+static Bool16 CPUHasAVX2()
+{
+#if defined(_MSC_VER) && STARTCODE_AVX2
+    int theInfo[4];
+    __cpuid(theInfo, 0);
+    if(theInfo[0] < 7)
+        return false;
+        
+    // The OS has to save the ymm registers too, or we can't touch them
+    __cpuid(theInfo, 1);
+    if((theInfo[2] & (1 << 27)) == 0 || (theInfo[2] & (1 << 28)) == 0)
+        return false;
+    if((_xgetbv(0) & 6) != 6)
+        return false;
+        
+    __cpuidex(theInfo, 7, 0);
+    return (theInfo[1] & (1 << 5)) != 0;
+#elif STARTCODE_AVX2
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+#else
+    return false;
+#endif
+}
+#endif
+
+UInt32 StartCodeScanner::FindScalar(const UInt8* inBuffer, UInt32 inLen, UInt32 inStart)
+{
+    // Look at the third byte of each candidate. Anything above 1 means none of the
+    // three positions ending there can start a code, so skip them all.
+    UInt32 x = inStart;
+    while ((x < inLen) && (inLen - x > 2))
+    {
+        UInt8 theByte = inBuffer[x + 2];
+        if(theByte > 1)
+            x += 3;
+        else if(theByte == 0)
+            x++;
+        else if((inBuffer[x] == 0) && (inBuffer[x + 1] == 0))
+            return x;
+        else
+            x += 3;
+    }
+    return inLen;
+}
+
+#if STARTCODE_X86
+STARTCODE_SSE2_TARGET UInt32 StartCodeScanner::FindSSE2(const UInt8* inBuffer, UInt32 inLen, UInt32 inStart)
+{
+    // Bit i of the mask is set where bytes i, i+1 and i+2 are 00 00 01
+    UInt32 x = inStart;
+    const __m128i theZeros = _mm_setzero_si128();
+    const __m128i theOnes = _mm_set1_epi8(1);
+    while ((x < inLen) && (inLen - x >= 18))
+    {
+        __m128i theFirst = _mm_loadu_si128((const __m128i*)(inBuffer + x));
+        __m128i theSecond = _mm_loadu_si128((const __m128i*)(inBuffer + x + 1));
+        __m128i theThird = _mm_loadu_si128((const __m128i*)(inBuffer + x + 2));
+        __m128i theMatches = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(theFirst, theZeros), _mm_cmpeq_epi8(theSecond, theZeros)),
+                                            _mm_cmpeq_epi8(theThird, theOnes));
+        UInt32 theMask = (UInt32)_mm_movemask_epi8(theMatches);
+        if(theMask != 0)
+            return x + LowestBit(theMask);
+        x += 16;
+    }
+    return FindScalar(inBuffer, inLen, x);
+}
+#else
+UInt32 StartCodeScanner::FindSSE2(const UInt8* inBuffer, UInt32 inLen, UInt32 inStart)
+{
+    return FindScalar(inBuffer, inLen, inStart);
+}
+#endif
+
+#if STARTCODE_X86 && STARTCODE_AVX2
+STARTCODE_AVX2_TARGET UInt32 StartCodeScanner::FindAVX2(const UInt8* inBuffer, UInt32 inLen, UInt32 inStart)
+{
+    UInt32 x = inStart;
+    const __m256i theZeros = _mm256_setzero_si256();
+    const __m256i theOnes = _mm256_set1_epi8(1);
+    while ((x < inLen) && (inLen - x >= 34))
+    {
+        __m256i theFirst = _mm256_loadu_si256((const __m256i*)(inBuffer + x));
+        __m256i theSecond = _mm256_loadu_si256((const __m256i*)(inBuffer + x + 1));
+        __m256i theThird = _mm256_loadu_si256((const __m256i*)(inBuffer + x + 2));
+        __m256i theMatches = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(theFirst, theZeros), _mm256_cmpeq_epi8(theSecond, theZeros)),
+                                               _mm256_cmpeq_epi8(theThird, theOnes));
+        UInt32 theMask = (UInt32)_mm256_movemask_epi8(theMatches);
+        if(theMask != 0)
+            return x + LowestBit(theMask);
+        x += 32;
+    }
+    return FindSSE2(inBuffer, inLen, x);
+}
+#else
+UInt32 StartCodeScanner::FindAVX2(const UInt8* inBuffer, UInt32 inLen, UInt32 inStart)
+{
+    return FindSSE2(inBuffer, inLen, inStart);
+}
+#endif
+
+UInt32 StartCodeScanner::FindFirstTime(const UInt8* inBuffer, UInt32 inLen, UInt32 inStart)
+{
+    // Every thread that gets here picks the same kernel, so there's no need to lock
+    if(!SetKernel(kAVX2) && !SetKernel(kSSE2))
+        (void)SetKernel(kScalar);
+    return (*sFindFunction)(inBuffer, inLen, inStart);
+}
+
+Bool16 StartCodeScanner::SetKernel(UInt32 inKernel)
+{
+    switch (inKernel)
+    {
+        case kScalar:
+            sFindFunction = FindScalar;
+            return true;
+#if STARTCODE_X86
+        case kSSE2:
+            if(!CPUHasSSE2())
+                return false;
+            sFindFunction = FindSSE2;
+            return true;
+#if STARTCODE_AVX2
+        case kAVX2:
+            if(!CPUHasAVX2())
+                return false;
+            sFindFunction = FindAVX2;
+            return true;
+#endif
+#endif
+        default:
+            return false;
+    }
+}
+
+UInt32 StartCodeScanner::GetKernel()
+{
+    if(sFindFunction == FindFirstTime)
+        (void)FindFirstTime(NULL, 0, 0);
+        
+    if(sFindFunction == FindAVX2)
+        return kAVX2;
+    if(sFindFunction == FindSSE2)
+        return kSSE2;
+    return kScalar;
+}
+
+Bool16 StartCodeScanner::GetNextNALUnit(const UInt8* inBuffer, UInt32 inLen, UInt32* ioOffset, StrPtrLen* outNALUnit)
+{
+    UInt32 theStart = Find(inBuffer, inLen, *ioOffset);
+    if(theStart >= inLen)
+    {
+        *ioOffset = inLen;
+        return false;
+    }
+    theStart += 3;
+    
+    // The unit runs to the next start code. A NAL unit never ends in a zero byte, so
+    // any zeros before that code are the first byte of a 4 byte code, or padding.
+    UInt32 theEnd = Find(inBuffer, inLen, theStart);
+    *ioOffset = theEnd;
+    while ((theEnd > theStart) && (inBuffer[theEnd - 1] == 0))
+        theEnd--;
+        
+    outNALUnit->Set((char*)inBuffer + theStart, theEnd - theStart);
+    return true;
+}
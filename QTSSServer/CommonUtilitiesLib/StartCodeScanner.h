@@ -0,0 +1,86 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1999-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ *
+ */
+/*
+    File:       StartCodeScanner.h
+
+    Contains:   Finds the 00 00 01 start codes that delimit NAL units in an Annex B
+                H.264 byte stream. The search runs 32 (AVX2) or 16 (SSE2) bytes at a
+                time where the processor can, which it checks once at run time, and
+                falls back to a byte scan that skips ahead on anything above 1.
+
+
+
+*/
+
+#ifndef __STARTCODESCANNER_H__
+#define __STARTCODESCANNER_H__
+
+#include "OSHeaders.h"
+#include "StrPtrLen.h"
+
+class StartCodeScanner
+{
+    public:
+
+        enum
+        {
+            kScalar = 0,    //UInt32
+            kSSE2   = 1,    //UInt32
+            kAVX2   = 2     //UInt32
+        };
+
+        // Returns the offset of the first 00 00 01 at or after inStart, or inLen if
+        // there isn't one. A 4 byte start code is found at its second zero.
+        static UInt32   Find(const UInt8* inBuffer, UInt32 inLen, UInt32 inStart = 0)
+                            { return (*sFindFunction)(inBuffer, inLen, inStart); }
+
+        // Steps through the NAL units of a buffer. Start with *ioOffset 0. Each call
+        // sets outNALUnit to the next unit, without its start code or the zeros that
+        // trail it, and returns false once there are none left.
+        static Bool16   GetNextNALUnit(const UInt8* inBuffer, UInt32 inLen, UInt32* ioOffset, StrPtrLen* outNALUnit);
+
+        // kScalar, kSSE2 or kAVX2, whichever Find is using
+        static UInt32   GetKernel();
+
+        // Forces a kernel, for comparing them. Returns false if this processor
+        // or compiler can't run it. CommonUtilitiesBenchmark checks every kernel, at
+        // every alignment, and times them.
+        static Bool16   SetKernel(UInt32 inKernel);
+
+    private:
+
+        typedef UInt32 (*FindFunction)(const UInt8* inBuffer, UInt32 inLen, UInt32 inStart);
+
+        static UInt32   FindScalar(const UInt8* inBuffer, UInt32 inLen, UInt32 inStart);
+        static UInt32   FindSSE2(const UInt8* inBuffer, UInt32 inLen, UInt32 inStart);
+        static UInt32   FindAVX2(const UInt8* inBuffer, UInt32 inLen, UInt32 inStart);
+
+        // Sits in sFindFunction until the first call, which picks the kernel
+        static UInt32   FindFirstTime(const UInt8* inBuffer, UInt32 inLen, UInt32 inStart);
+
+        static FindFunction sFindFunction;
+};
+
+#endif //__STARTCODESCANNER_H__
@@ -167,6 +167,7 @@ void TaskThread::Entry()
             theTask->fUseThisThread = NULL; // Each invocation of Run must independently
                                             // request a specific thread.
             SInt64 theTimeout = 0;
+            this->SetRunStartMilliseconds(OS::Milliseconds());
             
             if(theTask->fWriteLock)
             {   
@@ -133,6 +133,58 @@ OS_Error UDPSocket::RecvFrom(UInt32* outRemoteAddr, UInt16* outRemotePort,
     return OS_NoErr;        
 }
 
+OS_Error UDPSocket::RecvMultipleFrom(UInt32* outRemoteAddrs, UInt16* outRemotePorts,
+                            StrPtrLen* ioPackets, UInt32 inBufLen, UInt32 inNumPackets, UInt32* outNumPackets)
+{
+    Assert(outNumPackets != NULL);
+    *outNumPackets = 0;
+    
+    if(inNumPackets > kMaxRecvMultiplePackets)
+        inNumPackets = kMaxRecvMultiplePackets;
+
+#if __linux__ && defined(MSG_WAITFORONE)
+    struct mmsghdr      theMsgs[kMaxRecvMultiplePackets];
+    struct iovec        theIOVecs[kMaxRecvMultiplePackets];
+    struct sockaddr_in  theAddrs[kMaxRecvMultiplePackets];
+    
+    ::memset(theMsgs, 0, sizeof(struct mmsghdr) * inNumPackets);
+    for (UInt32 x = 0; x < inNumPackets; x++)
+    {
+        theIOVecs[x].iov_base = ioPackets[x].Ptr;
+        theIOVecs[x].iov_len = inBufLen;
+        theMsgs[x].msg_hdr.msg_name = &theAddrs[x];
+        theMsgs[x].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        theMsgs[x].msg_hdr.msg_iov = &theIOVecs[x];
+        theMsgs[x].msg_hdr.msg_iovlen = 1;
+    }
+    
+    int theNumRecvd = ::recvmmsg(fFileDesc, theMsgs, inNumPackets, MSG_DONTWAIT, NULL);
+    if(theNumRecvd == -1)
+        return (OS_Error)OSThread::GetErrno();
+        
+    for (int y = 0; y < theNumRecvd; y++)
+    {
+        outRemoteAddrs[y] = ntohl(theAddrs[y].sin_addr.s_addr);
+        outRemotePorts[y] = ntohs(theAddrs[y].sin_port);
+        ioPackets[y].Len = theMsgs[y].msg_len;
+    }
+    *outNumPackets = (UInt32)theNumRecvd;
+    return OS_NoErr;
+#else
+    for (UInt32 x = 0; x < inNumPackets; x++)
+    {
+        UInt32 theRecvLen = 0;
+        OS_Error theErr = this->RecvFrom(&outRemoteAddrs[x], &outRemotePorts[x], ioPackets[x].Ptr, inBufLen, &theRecvLen);
+        if(theErr != OS_NoErr)
+            return (x == 0) ? theErr : OS_NoErr;
+        
+        ioPackets[x].Len = theRecvLen;
+        *outNumPackets = x + 1;
+    }
+    return OS_NoErr;
+#endif
+}
+
 OS_Error UDPSocket::JoinMulticast(UInt32 inRemoteAddr)
 {
     struct ip_mreq  theMulti;
@@ -168,7 +220,7 @@ OS_Error UDPSocket::SetMulticastInterface(UInt32 inLocalAddr)
 {
     // set the outgoing interface for multicast datagrams on this socket
     in_addr theLocalAddr;
-    theLocalAddr.s_addr = inLocalAddr;
+    theLocalAddr.s_addr = htonl(inLocalAddr);
     int err = setsockopt(fFileDesc, IPPROTO_IP, IP_MULTICAST_IF, (char*)&theLocalAddr, sizeof(theLocalAddr));
     AssertV(err == 0, OSThread::GetErrno());
     if(err == -1)
@@ -181,7 +233,7 @@ OS_Error UDPSocket::LeaveMulticast(UInt32 inRemoteAddr)
 {
     struct ip_mreq  theMulti;
     theMulti.imr_multiaddr.s_addr = htonl(inRemoteAddr);
-    theMulti.imr_interface.s_addr = htonl(fLocalAddr.sin_addr.s_addr);
+    theMulti.imr_interface.s_addr = fLocalAddr.sin_addr.s_addr; // Already in network byte order
     int err = setsockopt(fFileDesc, IPPROTO_IP, IP_DROP_MEMBERSHIP, (char*)&theMulti, sizeof(theMulti));
     if(err == -1)
         return (OS_Error)OSThread::GetErrno();
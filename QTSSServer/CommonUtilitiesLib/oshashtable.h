@@ -74,10 +74,14 @@ public:
         K key( entry );
         UInt32 theIndex = ComputeIndex( key.GetHashKey() );
         entry->fNextHashEntry = fHashTable[ theIndex ];
+        Fence(); // so a reader without the lock never finds it half linked in
         fHashTable[ theIndex ] = entry;
         fNumEntries++;
     }
-    void Remove( T* entry )
+    // Returns false if entry wasn't in the table. With clearLink false the entry keeps
+    // pointing down its old chain, so a reader walking the table without the lock, who
+    // may be standing on it, can carry on. Call ClearLink once none can be.
+    Bool16 Remove( T* entry, Bool16 clearLink = true )
     {
         K key( entry );
         UInt32 theIndex = ComputeIndex( key.GetHashKey() );
@@ -95,9 +99,40 @@ public:
                 last->fNextHashEntry = elem->fNextHashEntry;
             else
                 fHashTable[ theIndex ] = elem->fNextHashEntry;
-            elem->fNextHashEntry = NULL;
+            if (clearLink)
+                elem->fNextHashEntry = NULL;
             fNumEntries--;
+            return true;
         }
+        return false;
+    }
+    void ClearLink( T* entry ) { entry->fNextHashEntry = NULL; }
+    
+    // Rehashes every entry into size buckets. Nobody may be reading the table meanwhile.
+    void Resize( UInt32 size )
+    {
+        T** theOldTable = fHashTable;
+        UInt32 theOldSize = fSize;
+        fHashTable = new T*[size];
+        Assert( fHashTable );
+        memset( fHashTable, 0, sizeof(T*) * size );
+        fSize = size;
+        fMask = fSize - 1;
+        if ((fMask & fSize) != 0)
+            fMask = 0;
+        
+        for (UInt32 x = 0; x < theOldSize; x++) {
+            T* elem = theOldTable[ x ];
+            while (elem) {
+                T* next = elem->fNextHashEntry;
+                K key( elem );
+                UInt32 theIndex = ComputeIndex( key.GetHashKey() );
+                elem->fNextHashEntry = fHashTable[ theIndex ];
+                fHashTable[ theIndex ] = elem;
+                elem = next;
+            }
+        }
+        delete [] theOldTable;
     }
     T* Map( K* key )
     {
@@ -129,6 +164,15 @@ private:
         else
             return( hashKey % fSize );
     }
+    
+    static void Fence()
+    {
+#if __Win32__
+        ::MemoryBarrier();
+#elif defined(__GNUC__)
+        __sync_synchronize();
+#endif
+    }
 };
 
 template<class T, class K>
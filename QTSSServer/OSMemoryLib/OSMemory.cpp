@@ -33,6 +33,7 @@
 
 #include <string.h>
 #include "OSMemory.h"
+#include "OSThread.h"
 
 #if MEMORY_DEBUGGING
 
@@ -45,6 +46,63 @@ OSMutex  OSMemory::sMutex;
 
 static SInt32   sMemoryErr = 0;
 
+#if MEMORY_SLAB_ALLOCATOR
+
+// Every block starts with its size class, so Delete knows where it goes back to.
+// The header is two pointers long so blocks keep the alignment malloc gives.
+static const UInt32 kBlockHeaderSize = 2 * sizeof(void*);
+static const UInt32 kLargeBlock = 0xFFFFFFFF;  // size class of a block straight from malloc
+static const UInt32 kMaxCachedBytes = 65536;    // a thread keeps about this much free per class
+static const UInt32 kMaxCachedBlocks = 256;
+
+static const UInt32 sBlockSizes[OSMemory::kNumSizeClasses] =
+    { 16, 32, 48, 64, 80, 96, 128, 160, 192, 256, 320, 384, 512, 640, 768, 1024, 1536, 2048, 3072 };
+
+// A thread's free blocks of one size class. Only that thread ever touches it.
+struct ClassCache
+{
+    char*   fFreeList;
+    UInt32  fNumFree;
+    UInt64  fNumAllocs;
+    UInt64  fNumFrees;
+};
+
+struct ThreadCache
+{
+    ClassCache  fClasses[OSMemory::kNumSizeClasses];
+};
+
+// The shared free list of a size class, and its counters for threads without a cache
+struct SizeClass
+{
+    OSMutex fMutex;
+    UInt32  fBlockSize;
+    UInt32  fMaxCached;     // a thread cache gives back half when it gets past this
+    char*   fFreeList;
+    UInt32  fNumFree;
+    UInt32  fSlabBytes;
+    UInt64  fNumAllocs;
+    UInt64  fNumFrees;
+};
+
+// Set up on the first allocation after OSThread::Initialize, and never torn down,
+// so blocks freed by static destructors at exit still have somewhere to go.
+static SizeClass*   sSizeClasses = NULL;
+static UInt8        sSizeToClass[(OSMemory::kMaxSlabBlockSize / 16) + 1];
+static ThreadCache  sThreadCaches[OSMemory::kNumThreadCaches];
+
+inline char*    GetNextBlock(char* inBlock)                 { return *(char**)(inBlock + kBlockHeaderSize); }
+inline void     SetNextBlock(char* inBlock, char* inNext)   { *(char**)(inBlock + kBlockHeaderSize) = inNext; }
+
+static void         SetupSizeClasses();
+static void         CarveSlab(SizeClass* inSizeClass, UInt32 inClassIndex);
+static ClassCache*  GetThreadCache(UInt32 inClassIndex);
+static void*        LargeNew(size_t inSize);
+static void*        SlabNew(size_t inSize);
+static void         SlabDelete(void* inMemory);
+
+#endif
+
 
 //
 // OPERATORS
@@ -94,6 +152,8 @@ void*   OSMemory::New(size_t inSize)
 {
 #if MEMORY_DEBUGGING
     return OSMemory::DebugNew(inSize, __FILE__, __LINE__, false);
+#elif MEMORY_SLAB_ALLOCATOR
+    return SlabNew(inSize);
 #else
     void *m = malloc(inSize);
     if(m == NULL)
@@ -108,11 +168,203 @@ void    OSMemory::Delete(void* inMemory)
         return;
 #if MEMORY_DEBUGGING
     OSMemory::DebugDelete(inMemory);
+#elif MEMORY_SLAB_ALLOCATOR
+    SlabDelete(inMemory);
 #else
     free(inMemory);
 #endif
 }
 
+#if MEMORY_SLAB_ALLOCATOR
+void SetupSizeClasses()
+{
+    // This happens on the first allocation after OSThread::Initialize, which is
+    // still in main before any other thread has been started.
+    SizeClass* theSizeClasses = (SizeClass*)malloc(OSMemory::kNumSizeClasses * sizeof(SizeClass));
+    if (theSizeClasses == NULL)
+        ::exit(sMemoryErr);
+        
+    UInt32 theClassIndex = 0;
+    for (UInt32 x = 0; x < OSMemory::kNumSizeClasses; x++)
+    {
+        SizeClass* theSizeClass = new (&theSizeClasses[x]) SizeClass;
+        theSizeClass->fBlockSize = sBlockSizes[x];
+        theSizeClass->fMaxCached = kMaxCachedBytes / sBlockSizes[x];
+        if (theSizeClass->fMaxCached > kMaxCachedBlocks)
+            theSizeClass->fMaxCached = kMaxCachedBlocks;
+        theSizeClass->fFreeList = NULL;
+        theSizeClass->fNumFree = 0;
+        theSizeClass->fSlabBytes = 0;
+        theSizeClass->fNumAllocs = 0;
+        theSizeClass->fNumFrees = 0;
+        
+        // every multiple of 16 up to this block size goes to this class
+        for ( ; (theClassIndex * 16) <= sBlockSizes[x]; theClassIndex++)
+            sSizeToClass[theClassIndex] = (UInt8)x;
+    }
+    Assert(theClassIndex == (OSMemory::kMaxSlabBlockSize / 16) + 1);
+    sSizeClasses = theSizeClasses;
+}
+
+void CarveSlab(SizeClass* inSizeClass, UInt32 inClassIndex)
+{
+    //Caller must hold inSizeClass->fMutex
+    UInt32 theStride = kBlockHeaderSize + inSizeClass->fBlockSize;
+    UInt32 theNumBlocks = OSMemory::kSlabSize / theStride;
+    char* theSlab = (char*)malloc(theNumBlocks * theStride);
+    if (theSlab == NULL)
+        ::exit(sMemoryErr);
+        
+    for (UInt32 x = 0; x < theNumBlocks; x++)
+    {
+        char* theBlock = theSlab + (x * theStride);
+        *(UInt32*)theBlock = inClassIndex;
+        SetNextBlock(theBlock, inSizeClass->fFreeList);
+        inSizeClass->fFreeList = theBlock;
+    }
+    inSizeClass->fNumFree += theNumBlocks;
+    inSizeClass->fSlabBytes += theNumBlocks * theStride;
+}
+
+ClassCache* GetThreadCache(UInt32 inClassIndex)
+{
+    OSThread* theThread = OSThread::GetCurrent();
+    if ((theThread == NULL) || (theThread->GetThreadIndex() >= OSMemory::kNumThreadCaches))
+        return NULL;
+    return &sThreadCaches[theThread->GetThreadIndex()].fClasses[inClassIndex];
+}
+
+void* LargeNew(size_t inSize)
+{
+    char* theBlock = (char*)malloc(kBlockHeaderSize + inSize);
+    if (theBlock == NULL)
+        ::exit(sMemoryErr);
+    *(UInt32*)theBlock = kLargeBlock;
+    return theBlock + kBlockHeaderSize;
+}
+
+void* SlabNew(size_t inSize)
+{
+    if ((inSize > OSMemory::kMaxSlabBlockSize) || !OSThread::IsInitialized())
+        return LargeNew(inSize);
+    if (sSizeClasses == NULL)
+        SetupSizeClasses();
+        
+    UInt32 theClassIndex = sSizeToClass[(inSize + 15) / 16];
+    SizeClass* theSizeClass = &sSizeClasses[theClassIndex];
+    ClassCache* theCache = GetThreadCache(theClassIndex);
+    char* theBlock = NULL;
+    
+    if (theCache == NULL)
+    {
+        OSMutexLocker locker(&theSizeClass->fMutex);
+        if (theSizeClass->fFreeList == NULL)
+            CarveSlab(theSizeClass, theClassIndex);
+        theBlock = theSizeClass->fFreeList;
+        theSizeClass->fFreeList = GetNextBlock(theBlock);
+        theSizeClass->fNumFree--;
+        theSizeClass->fNumAllocs++;
+        return theBlock + kBlockHeaderSize;
+    }
+    
+    if (theCache->fFreeList == NULL)
+    {
+        // Take half a cache's worth from the shared list
+        OSMutexLocker locker(&theSizeClass->fMutex);
+        for (UInt32 x = 0; x < theSizeClass->fMaxCached / 2; x++)
+        {
+            if (theSizeClass->fFreeList == NULL)
+                CarveSlab(theSizeClass, theClassIndex);
+            theBlock = theSizeClass->fFreeList;
+            theSizeClass->fFreeList = GetNextBlock(theBlock);
+            theSizeClass->fNumFree--;
+            SetNextBlock(theBlock, theCache->fFreeList);
+            theCache->fFreeList = theBlock;
+            theCache->fNumFree++;
+        }
+    }
+    
+    theBlock = theCache->fFreeList;
+    theCache->fFreeList = GetNextBlock(theBlock);
+    theCache->fNumFree--;
+    theCache->fNumAllocs++;
+    return theBlock + kBlockHeaderSize;
+}
+
+void SlabDelete(void* inMemory)
+{
+    char* theBlock = (char*)inMemory - kBlockHeaderSize;
+    UInt32 theClassIndex = *(UInt32*)theBlock;
+    if (theClassIndex == kLargeBlock)
+    {
+        free(theBlock);
+        return;
+    }
+    Assert(theClassIndex < OSMemory::kNumSizeClasses);
+    
+    SizeClass* theSizeClass = &sSizeClasses[theClassIndex];
+    ClassCache* theCache = GetThreadCache(theClassIndex);
+    if (theCache == NULL)
+    {
+        OSMutexLocker locker(&theSizeClass->fMutex);
+        SetNextBlock(theBlock, theSizeClass->fFreeList);
+        theSizeClass->fFreeList = theBlock;
+        theSizeClass->fNumFree++;
+        theSizeClass->fNumFrees++;
+        return;
+    }
+    
+    // Blocks go back to the cache of whichever thread frees them
+    SetNextBlock(theBlock, theCache->fFreeList);
+    theCache->fFreeList = theBlock;
+    theCache->fNumFree++;
+    theCache->fNumFrees++;
+    
+    if (theCache->fNumFree > theSizeClass->fMaxCached)
+    {
+        // Give half of them back, so a thread that mostly frees what others
+        // allocate doesn't sit on them
+        OSMutexLocker locker(&theSizeClass->fMutex);
+        for (UInt32 x = 0; x < theSizeClass->fMaxCached / 2; x++)
+        {
+            theBlock = theCache->fFreeList;
+            theCache->fFreeList = GetNextBlock(theBlock);
+            theCache->fNumFree--;
+            SetNextBlock(theBlock, theSizeClass->fFreeList);
+            theSizeClass->fFreeList = theBlock;
+            theSizeClass->fNumFree++;
+        }
+    }
+}
+
+void OSMemory::GetSlabStats(UInt32 inClassIndex, SlabStats* outStats)
+{
+    Assert(inClassIndex < kNumSizeClasses);
+    ::memset(outStats, 0, sizeof(SlabStats));
+    outStats->fBlockSize = sBlockSizes[inClassIndex];
+    if (sSizeClasses == NULL)
+        return;
+        
+    SizeClass* theSizeClass = &sSizeClasses[inClassIndex];
+    {
+        OSMutexLocker locker(&theSizeClass->fMutex);
+        outStats->fNumAllocs = theSizeClass->fNumAllocs;
+        outStats->fNumFrees = theSizeClass->fNumFrees;
+        outStats->fNumCached = theSizeClass->fNumFree;
+        outStats->fSlabBytes = theSizeClass->fSlabBytes;
+    }
+    
+    // No lock covers the thread caches, so this adds up whatever they hold right now
+    for (UInt32 x = 0; x < kNumThreadCaches; x++)
+    {
+        ClassCache* theCache = &sThreadCaches[x].fClasses[inClassIndex];
+        outStats->fNumAllocs += theCache->fNumAllocs;
+        outStats->fNumFrees += theCache->fNumFrees;
+        outStats->fNumCached += theCache->fNumFree;
+    }
+}
+#endif
+
 #if MEMORY_DEBUGGING
 void* OSMemory::DebugNew(size_t s, char* inFile, int inLine, Bool16 sizeCheck)
 {
@@ -28,6 +28,7 @@
 #define ASSERT 1
 #define MEMORY_DEBUGGING  0 //enable this to turn on really fancy debugging of memory leaks, etc...
 #define QTFILE_MEMORY_DEBUGGING 0
+#define MEMORY_SLAB_ALLOCATOR 0 //enable this to serve small objects from per thread caches of fixed size blocks instead of malloc
 
 #if __MacOSX__
     #define PLATFORM_SERVER_BIN_NAME "QuickTimeStreamingServer"
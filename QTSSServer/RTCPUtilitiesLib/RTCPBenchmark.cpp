@@ -0,0 +1,450 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1999-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ *
+ */
+/*
+    File:       RTCPBenchmark.cpp
+
+    Contains:   Checks RTCPCompoundPacket on the receiver reports players send, on
+                packets broken every way we could think of, and on fuzzed ones, then
+                times it against the RTCPPacket classes it replaced. Runs the way
+                CommonUtilitiesBenchmark does, with the same options.
+                
+                This is a program of its own, not part of the library.
+
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SafeStdLib.h"
+
+#ifdef __Win32__
+#include "getopt.h"
+#else
+#include <unistd.h>
+#endif
+
+#include "OS.h"
+#include "OSThread.h"
+#include "Benchmark.h"
+#include "RTCPCompoundPacket.h"
+#include "RTCPPacket.h"
+
+// Whatever a benchmark computes goes here, so the compiler can't throw the work away
+static volatile UInt32 sSink = 0;
+
+static void PrintUsage();
+
+static UInt16 GetUInt16(const UInt8* inBytes)  { return (UInt16)(((UInt16)inBytes[0] << 8) | inBytes[1]); }
+
+//
+// RTCP: the report a player sends every few seconds, an RR with one report block and
+// an SDES with its CNAME. RTCPCompoundPacket splits it in one pass; the old way, as
+// RTPStream did it, puts RTCPPacket and then RTCPReceiverPacket over each packet in turn.
+// The check builds compound packets it knows the layout of, then breaks them every way
+// it can, and makes sure Parse never hands out a view that reads past the datagram.
+static const UInt32 kRTCPReportLen = 64;        // RR, 32 bytes, and SDES with a 19 character CNAME, 32 bytes
+static const UInt32 kRTCPMaxLen = 1500;
+static const UInt32 kRTCPFuzzRounds = 200000;
+static const UInt32 kRTCPJunkRoom = 3 * 8;         // for the junk the fuzzer can add on the end
+static UInt32   sRTCPReport[kRTCPReportLen / 4];    // UInt32s, so the old classes' word reads are aligned
+static UInt32   sRTCPFuzz[kRTCPMaxLen / 4];
+
+static void PutUInt32(UInt8* ioBytes, UInt32 inValue)
+{
+    ioBytes[0] = (UInt8)(inValue >> 24);
+    ioBytes[1] = (UInt8)(inValue >> 16);
+    ioBytes[2] = (UInt8)(inValue >> 8);
+    ioBytes[3] = (UInt8)inValue;
+}
+
+static void PutRTCPHeader(UInt8* ioPacket, UInt32 inCount, UInt32 inType, UInt32 inLen)
+{
+    UInt32 theLenInWords = (inLen / 4) - 1;
+    ioPacket[0] = (UInt8)(0x80 | inCount);
+    ioPacket[1] = (UInt8)inType;
+    ioPacket[2] = (UInt8)(theLenInWords >> 8);
+    ioPacket[3] = (UInt8)theLenInWords;
+}
+
+static void MakeRTCPReport()
+{
+    UInt8* theReport = (UInt8*)sRTCPReport;
+    PutRTCPHeader(theReport, 1, RTCPPacketView::kRRPacketType, 32);
+    PutUInt32(theReport + 4, 0x1234ABCD);           // the player
+    PutUInt32(theReport + 8, 0x5EED5EED);           // the stream it's reporting on
+    PutUInt32(theReport + 12, (3 << 24) | 27);      // fraction lost, total lost
+    PutUInt32(theReport + 16, 0x00014F20);          // highest sequence number
+    PutUInt32(theReport + 20, 412);                 // jitter
+    PutUInt32(theReport + 24, 0x8B4E2000);          // last SR
+    PutUInt32(theReport + 28, 0x00004000);          // delay since
+    
+    UInt8* theSDES = theReport + 32;
+    const char* theCNAME = "player@192.168.1.20";
+    PutRTCPHeader(theSDES, 1, RTCPPacketView::kSDESPacketType, 32);
+    PutUInt32(theSDES + 4, 0x1234ABCD);
+    theSDES[8] = 1;                                 // CNAME
+    theSDES[9] = (UInt8)::strlen(theCNAME);
+    ::memcpy(theSDES + 10, theCNAME, theSDES[9]);
+    theSDES[29] = theSDES[30] = theSDES[31] = 0;    // end of the item list, and padding
+}
+
+// Writes one packet of a random legal type and size, or returns 0 if there isn't room
+static UInt32 MakeRTCPPacket(UInt8* ioPacket, UInt32 inRoom, UInt32* ioSeed)
+{
+    UInt32 theCount = NextRandom(ioSeed) % 4;
+    UInt32 theType = RTCPPacketView::kSRPacketType + (NextRandom(ioSeed) % 8);    // 207, XR, is one Parse passes along
+    UInt32 theLen = 0;
+    switch (theType)
+    {
+        case RTCPPacketView::kSRPacketType:     theLen = 28 + (theCount * RTCPPacketView::kReportBlockSizeInBytes); break;
+        case RTCPPacketView::kRRPacketType:     theLen = 8 + (theCount * RTCPPacketView::kReportBlockSizeInBytes); break;
+        case RTCPPacketView::kBYEPacketType:    theLen = 4 + (theCount * 4); break;
+        case RTCPPacketView::kAPPPacketType:
+        case RTCPPacketView::kRTPFBPacketType:
+        case RTCPPacketView::kPSFBPacketType:   theLen = 12 + (theCount * 4); break;
+        default:                                theLen = 8 + ((NextRandom(ioSeed) % 8) * 4); theCount = 1; break;
+    }
+    if (theLen > inRoom)
+        return 0;
+        
+    for (UInt32 x = 4; x < theLen; x++)
+        ioPacket[x] = (UInt8)NextRandom(ioSeed);
+    PutRTCPHeader(ioPacket, theCount, theType, theLen);
+    return theLen;
+}
+
+// What RFC 3550 says each packet must at least hold, written out plainly rather than
+// from a table, for Parse to agree with
+static Bool16 IsValidRTCP(const UInt8* inBuffer, UInt32 inLen)
+{
+    UInt32 theNumPackets = 0;
+    UInt32 theOffset = 0;
+    while ((theOffset < inLen) && (theNumPackets < RTCPCompoundPacket::kMaxPackets))
+    {
+        if (inLen - theOffset < 4)
+            return false;
+        const UInt8* thePacket = inBuffer + theOffset;
+        UInt32 theCount = thePacket[0] & 0x1F;
+        UInt32 theLen = (GetUInt16(thePacket + 2) + 1) * 4;
+        if (((thePacket[0] >> 6) != 2) || (theLen > inLen - theOffset))
+            return false;
+        switch (thePacket[1])
+        {
+            case RTCPPacketView::kSRPacketType:     if (theLen < 8 + 20 + (theCount * 24)) return false; break;
+            case RTCPPacketView::kRRPacketType:     if (theLen < 8 + (theCount * 24)) return false; break;
+            case RTCPPacketView::kBYEPacketType:    if (theLen < 4 + (theCount * 4)) return false; break;
+            case RTCPPacketView::kAPPPacketType:    if (theLen < 12) return false; break;
+            case RTCPPacketView::kRTPFBPacketType:  if (theLen < 12) return false; break;
+            case RTCPPacketView::kPSFBPacketType:   if (theLen < 12) return false; break;
+            default:                                break;
+        }
+        theOffset += theLen;
+        theNumPackets++;
+    }
+    return (theNumPackets > 0);
+}
+
+// Everything a view promises, checked against the datagram it came from. Reads every
+// report block too, so a view that promised too much shows up under a memory checker.
+static Bool16 CheckRTCPViews(const char* inCase, RTCPCompoundPacket* inPacket, UInt8* inBuffer, UInt32 inLen)
+{
+    UInt8* theNext = inBuffer;
+    for (UInt32 x = 0; x < inPacket->GetNumPackets(); x++)
+    {
+        RTCPPacketView* theView = inPacket->GetPacket(x);
+        UInt32 theLen = theView->GetLength();
+        UInt32 theCount = theView->GetCount();
+        UInt32 theNeeded = RTCPPacketView::kHeaderSizeInBytes;
+        Bool16 isFeedback = (theView->GetPacketType() == RTCPPacketView::kRTPFBPacketType) || (theView->GetPacketType() == RTCPPacketView::kPSFBPacketType);
+        if (isFeedback)
+            theNeeded = 12;
+        else if (theView->GetPacketType() == RTCPPacketView::kSRPacketType)
+            theNeeded = 8 + RTCPPacketView::kSenderInfoSizeInBytes + (theCount * RTCPPacketView::kReportBlockSizeInBytes);
+        else if (theView->GetPacketType() == RTCPPacketView::kRRPacketType)
+            theNeeded = 8 + (theCount * RTCPPacketView::kReportBlockSizeInBytes);
+            
+        if ((theView->GetBuffer() != theNext) || ((theLen % 4) != 0) || (theLen < theNeeded) ||
+            (theLen > (UInt32)(inBuffer + inLen - theNext)) || ((theNext[0] & 0xC0) != 0x80))
+        {
+            qtss_printf("RTCPCompoundPacket: %s: packet %lu is out of bounds\n", inCase, x);
+            return false;
+        }
+        
+        if (isFeedback)
+        {
+            for (UInt32 y = 0; y < theView->GetNumNACKFields(); y++)
+                sSink += theView->GetNACKPacketID(y) + theView->GetNACKBitmask(y);
+        }
+        else if (theNeeded > RTCPPacketView::kHeaderSizeInBytes)
+        {
+            UInt32 theSum = theView->GetCumulativeTotalLostPackets() + theView->GetCumulativeJitter();
+            for (UInt32 y = 0; y < theCount; y++)
+                theSum += theView->GetReportSourceID(y) + theView->GetLastSenderReportDelay(y);
+            sSink += theSum;
+        }
+        theNext += theLen;
+    }
+    
+    // A datagram it took can only stop short if it ran out of views
+    if ((inPacket->GetNumPackets() > 0) && (inPacket->GetNumPackets() < RTCPCompoundPacket::kMaxPackets) && (theNext != inBuffer + inLen))
+    {
+        qtss_printf("RTCPCompoundPacket: %s: %lu bytes at the end weren't parsed\n", inCase, (UInt32)(inBuffer + inLen - theNext));
+        return false;
+    }
+    return true;
+}
+
+static Bool16 ExpectRTCP(const char* inCase, UInt8* inBuffer, UInt32 inLen, UInt32 inNumPackets)
+{
+    RTCPCompoundPacket thePacket;
+    Bool16 isParsed = thePacket.Parse(inBuffer, inLen);
+    if ((isParsed != (inNumPackets > 0)) || (thePacket.GetNumPackets() != inNumPackets))
+    {
+        qtss_printf("RTCPCompoundPacket: %s: got %lu packets, not %lu\n", inCase, thePacket.GetNumPackets(), inNumPackets);
+        return false;
+    }
+    return CheckRTCPViews(inCase, &thePacket, inBuffer, inLen);
+}
+
+static Bool16 CheckRTCPReport()
+{
+    UInt8* theReport = (UInt8*)sRTCPReport;
+    if (!ExpectRTCP("RR+SDES", theReport, kRTCPReportLen, 2))
+        return false;
+        
+    // The view has to read what the old class does
+    RTCPCompoundPacket thePacket;
+    thePacket.Parse(theReport, kRTCPReportLen);
+    RTCPPacketView* theView = thePacket.GetPacket(0);
+    RTCPReceiverPacket theReceiverPacket;
+    if (!theReceiverPacket.ParseReceiverReport(theReport, kRTCPReportLen) || (theView->GetSSRC() != theReceiverPacket.GetPacketSSRC()) ||
+        (theView->GetReportSourceID(0) != theReceiverPacket.GetReportSourceID(0)) ||
+        (theView->GetFractionLostPackets(0) != theReceiverPacket.GetFractionLostPackets(0)) ||
+        (theView->GetTotalLostPackets(0) != theReceiverPacket.GetTotalLostPackets(0)) ||
+        (theView->GetHighestSeqNumReceived(0) != theReceiverPacket.GetHighestSeqNumReceived(0)) ||
+        (theView->GetJitter(0) != theReceiverPacket.GetJitter(0)) ||
+        (theView->GetLastSenderReportTime(0) != theReceiverPacket.GetLastSenderReportTime(0)) ||
+        (theView->GetLastSenderReportDelay(0) != theReceiverPacket.GetLastSenderReportDelay(0)) ||
+        (theView->GetCumulativeFractionLostPackets() != theReceiverPacket.GetCumulativeFractionLostPackets()) ||
+        (theView->GetCumulativeTotalLostPackets() != theReceiverPacket.GetCumulativeTotalLostPackets()) ||
+        (theView->GetCumulativeJitter() != theReceiverPacket.GetCumulativeJitter()))
+    {
+        qtss_printf("RTCPCompoundPacket: the RR doesn't read the way RTCPReceiverPacket reads it\n");
+        return false;
+    }
+    return true;
+}
+
+static Bool16 CheckRTCPBadPackets()
+{
+    UInt8* theBuffer = (UInt8*)sRTCPFuzz;
+    Bool16 isOK = ExpectRTCP("nothing", theBuffer, 0, 0);
+    
+    ::memcpy(theBuffer, sRTCPReport, kRTCPReportLen);
+    isOK = isOK && ExpectRTCP("cut short", theBuffer, kRTCPReportLen - 4, 0);
+    isOK = isOK && ExpectRTCP("2 bytes left over", theBuffer, kRTCPReportLen + 2, 0);
+    theBuffer[0] = 0x40 | 1;
+    isOK = isOK && ExpectRTCP("version 1", theBuffer, kRTCPReportLen, 0);
+    theBuffer[0] = 0x80 | 2;
+    isOK = isOK && ExpectRTCP("RR with 2 blocks in room for 1", theBuffer, kRTCPReportLen, 0);
+    theBuffer[0] = 0x80 | 1;
+    theBuffer[2] = 0xFF;
+    isOK = isOK && ExpectRTCP("length past the end", theBuffer, kRTCPReportLen, 0);
+    
+    // An SR without its sender info
+    PutRTCPHeader(theBuffer, 0, RTCPPacketView::kSRPacketType, 24);
+    isOK = isOK && ExpectRTCP("short SR", theBuffer, 24, 0);
+    PutRTCPHeader(theBuffer, 4, RTCPPacketView::kBYEPacketType, 12);
+    isOK = isOK && ExpectRTCP("BYE with 4 SSRCs in room for 2", theBuffer, 12, 0);
+    
+    // More packets than there are views for. The ones past the last view are left alone.
+    for (UInt32 x = 0; x < 20; x++)
+        PutRTCPHeader(theBuffer + (x * 8), 0, RTCPPacketView::kRRPacketType, 8);
+    isOK = isOK && ExpectRTCP("20 empty RRs", theBuffer, 20 * 8, RTCPCompoundPacket::kMaxPackets);
+    return isOK;
+}
+
+// Random compound packets, then bit flips, bad lengths, bad counts, truncation and junk on the end
+static Bool16 CheckRTCPFuzz()
+{
+    UInt8* theBuffer = (UInt8*)sRTCPFuzz;
+    UInt32 theSeed = 3550;
+    UInt32 theNumParsed = 0;
+    for (UInt32 theRound = 0; theRound < kRTCPFuzzRounds; theRound++)
+    {
+        UInt32 theOffsets[RTCPCompoundPacket::kMaxPackets + 4];
+        UInt32 theNumPackets = 0;
+        UInt32 theLen = 0;
+        UInt32 theNumWanted = 1 + (NextRandom(&theSeed) % (RTCPCompoundPacket::kMaxPackets + 4));
+        while (theNumPackets < theNumWanted)
+        {
+            UInt32 thePacketLen = MakeRTCPPacket(theBuffer + theLen, kRTCPMaxLen - kRTCPJunkRoom - theLen, &theSeed);
+            if (thePacketLen == 0)
+                break;
+            theOffsets[theNumPackets++] = theLen;
+            theLen += thePacketLen;
+        }
+        
+        // Every fourth one goes in as it is
+        UInt32 theNumMutations = NextRandom(&theSeed) % 4;
+        for (UInt32 x = 0; x < theNumMutations; x++)
+        {
+            UInt8* theHeader = theBuffer + theOffsets[NextRandom(&theSeed) % theNumPackets];
+            switch (NextRandom(&theSeed) % 6)
+            {
+                case 0: theHeader[NextRandom(&theSeed) % 4] ^= (UInt8)(1 << (NextRandom(&theSeed) % 8)); break;
+                case 1: theBuffer[NextRandom(&theSeed) % theLen] ^= (UInt8)(1 << (NextRandom(&theSeed) % 8)); break;
+                case 2: theHeader[2] = (UInt8)NextRandom(&theSeed); theHeader[3] = (UInt8)NextRandom(&theSeed); break;
+                case 3: theHeader[0] = (UInt8)((theHeader[0] & 0xE0) | (NextRandom(&theSeed) & 0x1F)); break;
+                case 4: theLen -= NextRandom(&theSeed) % (theLen + 1); break;
+                case 5:
+                {
+                    UInt32 theJunkLen = 1 + (NextRandom(&theSeed) % 8);
+                    for (UInt32 y = 0; y < theJunkLen; y++)
+                        theBuffer[theLen++] = (UInt8)NextRandom(&theSeed);
+                    break;
+                }
+            }
+            if (theLen == 0)
+                break;
+        }
+        
+        RTCPCompoundPacket thePacket;
+        Bool16 isParsed = thePacket.Parse(theBuffer, theLen);
+        if ((isParsed != IsValidRTCP(theBuffer, theLen)) || (isParsed != (thePacket.GetNumPackets() > 0)))
+        {
+            qtss_printf("RTCPCompoundPacket: fuzz round %lu was %s\n", theRound, isParsed ? "taken" : "refused");
+            return false;
+        }
+        if (!CheckRTCPViews("fuzz", &thePacket, theBuffer, theLen))
+            return false;
+        if (isParsed)
+            theNumParsed++;
+    }
+    
+    // Make sure the mutations weren't all caught at the first header, or none were
+    if ((theNumParsed < kRTCPFuzzRounds / 8) || (theNumParsed > kRTCPFuzzRounds / 2))
+    {
+        qtss_printf("RTCPCompoundPacket: %lu of %lu fuzzed packets parsed, the fuzzing is off\n", theNumParsed, kRTCPFuzzRounds);
+        return false;
+    }
+    return true;
+}
+
+static Bool16 CheckRTCPCompoundPacket()
+{
+    MakeRTCPReport();
+    return CheckRTCPReport() && CheckRTCPBadPackets() && CheckRTCPFuzz();
+}
+
+static Bool16 RTCPSetup(UInt32 /*inNumThreads*/) { MakeRTCPReport(); return true; }
+
+static void RTCPCompoundPacketParse(UInt32 /*inThreadIndex*/, UInt32 inIterations)
+{
+    UInt32 theSum = 0;
+    for (UInt32 x = 0; x < inIterations; x++)
+    {
+        RTCPCompoundPacket thePacket;
+        if (!thePacket.Parse((UInt8*)sRTCPReport, kRTCPReportLen))
+            continue;
+        for (UInt32 y = 0; y < thePacket.GetNumPackets(); y++)
+        {
+            RTCPPacketView* theView = thePacket.GetPacket(y);
+            if (theView->GetPacketType() == RTCPPacketView::kRRPacketType)
+                theSum += theView->GetSSRC() + theView->GetCumulativeFractionLostPackets() + theView->GetCumulativeJitter() + theView->GetCumulativeTotalLostPackets();
+        }
+    }
+    sSink += theSum;
+}
+
+// As RTPStream::ProcessRTCPPacket went about it before RTCPCompoundPacket
+static void RTCPPacketParse(UInt32 /*inThreadIndex*/, UInt32 inIterations)
+{
+    UInt32 theSum = 0;
+    for (UInt32 x = 0; x < inIterations; x++)
+    {
+        UInt8* thePtr = (UInt8*)sRTCPReport;
+        UInt32 theLen = kRTCPReportLen;
+        while (theLen > 0)
+        {
+            RTCPPacket theRTCPPacket;
+            if (!theRTCPPacket.ParsePacket(thePtr, theLen))
+                break;
+            if (theRTCPPacket.GetPacketType() == RTCPPacket::kReceiverPacketType)
+            {
+                RTCPReceiverPacket theReceiverPacket;
+                if (!theReceiverPacket.ParseReceiverReport(thePtr, theLen))
+                    break;
+                theSum += theRTCPPacket.GetPacketSSRC() + theReceiverPacket.GetCumulativeFractionLostPackets() +
+                          theReceiverPacket.GetCumulativeJitter() + theReceiverPacket.GetCumulativeTotalLostPackets();
+            }
+            UInt32 thePacketLen = (theRTCPPacket.GetPacketLength() * 4) + RTCPPacket::kRTCPHeaderSizeInBytes;
+            thePtr += thePacketLen;
+            theLen -= thePacketLen;
+        }
+    }
+    sSink += theSum;
+}
+
+static Check sChecks[] =
+{
+    { "RTCPCompoundPacket",                     CheckRTCPCompoundPacket }
+};
+static const UInt32 kNumChecks = sizeof(sChecks) / sizeof(Check);
+
+static Benchmark sBenchmarks[] =
+{
+    { "RTCP/Parse/RR+SDES/RTCPCompoundPacket",  false,  kRTCPReportLen,     RTCPSetup,          RTCPCompoundPacketParse,        NULL },
+    { "RTCP/Parse/RR+SDES/RTCPPacket",          false,  kRTCPReportLen,     RTCPSetup,          RTCPPacketParse,                NULL }
+};
+static const UInt32 kNumBenchmarks = sizeof(sBenchmarks) / sizeof(Benchmark);
+
+int main(int argc, char* argv[])
+{
+    extern char* optarg;
+    int ch;
+    
+    BenchmarkOptions theOptions;
+    while ((ch = getopt(argc, argv, kBenchmarkOptionLetters "h")) != EOF)
+    {
+        if (!ParseBenchmarkOption(ch, optarg, &theOptions))
+        {
+            PrintUsage();
+            ::exit(0);
+        }
+    }
+        
+    OS::Initialize();
+    OSThread::Initialize();
+    
+    return RunChecksAndBenchmarks("RTCPUtilitiesLib", sChecks, kNumChecks, sBenchmarks, kNumBenchmarks, &theOptions);
+}
+
+void PrintUsage()
+{
+    qtss_printf("usage: RTCPBenchmark [-f filter] [-t msec] [-j threads] [-o results.json] [-c]\n");
+    PrintBenchmarkOptions();
+}
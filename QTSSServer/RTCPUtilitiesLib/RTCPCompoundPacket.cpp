@@ -0,0 +1,124 @@
+ /*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1999-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ *
+ */
+/*
+    File:       RTCPCompoundPacket.cpp
+
+    Contains:   Implementation of the classes defined in RTCPCompoundPacket.h
+    
+*/
+
+
+#include "RTCPCompoundPacket.h"
+
+RTCPCompoundPacket::SizeRule RTCPCompoundPacket::sSizeRules[] =
+{
+    { 28, RTCPPacketView::kReportBlockSizeInBytes },   // SR: header, SSRC, sender info, report blocks
+    { 8,  RTCPPacketView::kReportBlockSizeInBytes },   // RR: header, SSRC, report blocks
+    { 4,  0 },                                          // SDES: chunks are variable length
+    { 4,  4 },                                          // BYE: header, one SSRC per count
+    { 12, 0 },                                          // APP: header, SSRC, name
+    { 12, 0 },                                          // RTPFB: header, sender SSRC, media SSRC, FCI
+    { 12, 0 }                                           // PSFB: same, the count field is the format
+};
+
+Bool16 RTCPCompoundPacket::Parse(UInt8* inBuffer, UInt32 inLength)
+{
+    fNumPackets = 0;
+    if(inBuffer == NULL)
+        return false;
+        
+    UInt32 theOffset = 0;
+    while ((inLength - theOffset >= RTCPPacketView::kHeaderSizeInBytes) && (fNumPackets < kMaxPackets))
+    {
+        UInt8* thePacket = inBuffer + theOffset;
+        
+        //version must be 2
+        if((thePacket[0] & 0xC0) != 0x80)
+            break;
+            
+        //the advertised length is in 32-bit words, not counting the header word
+        UInt32 thePacketLen = ((((UInt32)thePacket[2] << 8) | (UInt32)thePacket[3]) + 1) * 4;
+        if(thePacketLen > inLength - theOffset)
+            break;
+            
+        UInt8 theType = thePacket[1];
+        if((theType >= RTCPPacketView::kSRPacketType) && (theType <= RTCPPacketView::kPSFBPacketType))
+        {
+            SizeRule* theRule = &sSizeRules[theType - RTCPPacketView::kSRPacketType];
+            if(thePacketLen < theRule->fMinSize + (theRule->fSizePerCount * (thePacket[0] & 0x1F)))
+                break;
+        }
+        //other types are passed along, the caller can skip them
+        
+        fPackets[fNumPackets].fBuffer = thePacket;
+        fPackets[fNumPackets].fLength = thePacketLen;
+        fNumPackets++;
+        theOffset += thePacketLen;
+    }
+    
+    //anything left over that we didn't stop for on purpose means the datagram is bad
+    if((theOffset != inLength) && (fNumPackets < kMaxPackets))
+    {
+        fNumPackets = 0;
+        return false;
+    }
+    
+    return (fNumPackets > 0);
+}
+
+UInt32 RTCPPacketView::GetCumulativeFractionLostPackets()
+{
+    float avgFractionLost = 0;
+    for (UInt32 i = 0; i < this->GetCount(); i++)
+    {
+        avgFractionLost += this->GetFractionLostPackets(i);
+        avgFractionLost /= (i+1);
+    }
+    
+    return (UInt32)avgFractionLost;
+}
+
+UInt32 RTCPPacketView::GetCumulativeJitter()
+{
+    float avgJitter = 0;
+    for (UInt32 i = 0; i < this->GetCount(); i++)
+    {
+        avgJitter += this->GetJitter(i);
+        avgJitter /= (i + 1);
+    }
+    
+    return (UInt32)avgJitter;
+}
+
+UInt32 RTCPPacketView::GetCumulativeTotalLostPackets()
+{
+    UInt32 totalLostPackets = 0;
+    for (UInt32 i = 0; i < this->GetCount(); i++)
+    {
+        totalLostPackets += this->GetTotalLostPackets(i);
+    }
+    
+    return totalLostPackets;
+}
@@ -0,0 +1,160 @@
+ /*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1999-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ *
+ */
+/*
+    File:       RTCPCompoundPacket.h
+
+    Contains:   Walks a compound RTCP datagram once, producing a view of each
+                packet in it. Nothing is copied or allocated; the views point
+                into the caller's buffer and are only valid as long as it is.
+
+
+*/
+
+#ifndef _RTCPCOMPOUNDPACKET_H_
+#define _RTCPCOMPOUNDPACKET_H_
+
+#include <stdlib.h>
+#include "SafeStdLib.h"
+#ifndef __Win32__
+#include <sys/types.h>
+#include <netinet/in.h>
+#endif
+
+#include "OSHeaders.h"
+
+class RTCPPacketView
+{
+public:
+
+    // Packet types
+    enum
+    {
+        kSRPacketType           = 200,  //UInt32
+        kRRPacketType           = 201,  //UInt32
+        kSDESPacketType         = 202,  //UInt32
+        kBYEPacketType          = 203,  //UInt32
+        kAPPPacketType          = 204,  //UInt32
+        kRTPFBPacketType        = 205,  //UInt32 RFC 4585 transport layer feedback
+        kPSFBPacketType         = 206   //UInt32 RFC 4585 payload specific feedback
+    };
+    
+    // Feedback message types (FMT), carried where the count usually is
+    enum
+    {
+        kGenericNACKFormat      = 1,    //UInt32 in an RTPFB packet
+        kPLIFormat              = 1     //UInt32 in a PSFB packet
+    };
+    
+    enum
+    {
+        kHeaderSizeInBytes      = 4,    //UInt32
+        kReportBlockSizeInBytes = 24,   //UInt32
+        kSenderInfoSizeInBytes  = 20    //UInt32
+    };
+
+    UInt8*  GetBuffer()         { return fBuffer; }
+    UInt32  GetLength()         { return fLength; }     // in bytes, header included
+    UInt8   GetPacketType()     { return fBuffer[1]; }
+    UInt8   GetCount()          { return (UInt8)(fBuffer[0] & 0x1F); } // RC, SC, APP subtype or FB format
+    UInt32  GetSSRC()           { return ReadUInt32(4); }
+    
+    // APP packets only
+    UInt32  GetAppName()        { return ReadUInt32(8); }
+    
+    // RTPFB and PSFB packets only. A generic NACK is a list of 32-bit fields, each
+    // a lost packet ID plus a bitmask of lost packets among the 16 that follow it.
+    UInt32  GetMediaSSRC()                      { return ReadUInt32(8); }
+    UInt32  GetNumNACKFields()                  { return (fLength - 12) / 4; }
+    UInt16  GetNACKPacketID(UInt32 inFieldNum)  { return (UInt16)(ReadUInt32(12 + (inFieldNum * 4)) >> 16); }
+    UInt16  GetNACKBitmask(UInt32 inFieldNum)   { return (UInt16)(ReadUInt32(12 + (inFieldNum * 4)) & 0xFFFF); }
+    
+    // SR and RR packets only. Parse has already checked that GetCount() report
+    // blocks fit in the packet, so these don't need to.
+    UInt32  GetReportSourceID(UInt32 inReportNum)       { return ReadUInt32(ReportOffset(inReportNum)); }
+    UInt8   GetFractionLostPackets(UInt32 inReportNum)  { return fBuffer[ReportOffset(inReportNum) + 4]; }
+    UInt32  GetTotalLostPackets(UInt32 inReportNum)     { return ReadUInt32(ReportOffset(inReportNum) + 4) & 0x00FFFFFF; }
+    UInt32  GetHighestSeqNumReceived(UInt32 inReportNum){ return ReadUInt32(ReportOffset(inReportNum) + 8); }
+    UInt32  GetJitter(UInt32 inReportNum)               { return ReadUInt32(ReportOffset(inReportNum) + 12); }
+    UInt32  GetLastSenderReportTime(UInt32 inReportNum) { return ReadUInt32(ReportOffset(inReportNum) + 16); }
+    UInt32  GetLastSenderReportDelay(UInt32 inReportNum){ return ReadUInt32(ReportOffset(inReportNum) + 20); }
+    
+    // Same arithmetic as the RTCPReceiverPacket functions of the same names
+    UInt32  GetCumulativeFractionLostPackets();
+    UInt32  GetCumulativeTotalLostPackets();
+    UInt32  GetCumulativeJitter();
+    
+private:
+
+    // Reads byte by byte, so views don't have to be 32-bit aligned
+    UInt32  ReadUInt32(UInt32 inOffset)
+        {   return  ((UInt32)fBuffer[inOffset] << 24) | ((UInt32)fBuffer[inOffset + 1] << 16) |
+                    ((UInt32)fBuffer[inOffset + 2] << 8) | (UInt32)fBuffer[inOffset + 3]; }
+                    
+    UInt32  ReportOffset(UInt32 inReportNum)
+        {   return 8 + ((this->GetPacketType() == kSRPacketType) ? kSenderInfoSizeInBytes : 0) + (inReportNum * kReportBlockSizeInBytes); }
+
+    UInt8*  fBuffer;
+    UInt32  fLength;
+    
+    friend class RTCPCompoundPacket;
+};
+
+class RTCPCompoundPacket
+{
+public:
+
+    enum
+    {
+        kMaxPackets = 16    //UInt32
+    };
+    
+    RTCPCompoundPacket() : fNumPackets(0) {}
+    ~RTCPCompoundPacket() {}
+    
+    // Walks the datagram once, checking each packet's header against the bytes
+    // that are actually there and against the smallest size its type allows.
+    // Returns false, with no packets, if anything is malformed. Packets past
+    // kMaxPackets are ignored.
+    Bool16  Parse(UInt8* inBuffer, UInt32 inLength);
+    
+    UInt32          GetNumPackets()             { return fNumPackets; }
+    RTCPPacketView* GetPacket(UInt32 inIndex)   { return &fPackets[inIndex]; }
+    
+private:
+
+    // Smallest legal size of each packet type, in bytes, and how much each unit
+    // of the header's count field adds to that. Indexed by packet type - kSRPacketType.
+    struct SizeRule
+    {
+        UInt32  fMinSize;
+        UInt32  fSizePerCount;
+    };
+    static SizeRule sSizeRules[];
+    
+    RTCPPacketView  fPackets[kMaxPackets];
+    UInt32          fNumPackets;
+};
+
+#endif //_RTCPCOMPOUNDPACKET_H_
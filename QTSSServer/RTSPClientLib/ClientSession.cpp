@@ -40,6 +40,7 @@
 static const SInt64 kMaxWaitTimeInMsec = 5000;
 static const SInt64 kIdleTimeoutInMsec = 20000; // Time out in 20 seconds if nothing's doing
 static const SInt16 kSanitySeqNumDifference = 3000;
+static const SInt64 kMediaEventIdleMsec = 1000; // With no read interval, still run this often for RTCPs and the duration
 
 UInt32          ClientSession::sActiveConnections = 0;
 UInt32          ClientSession::sPlayingConnections = 0;
@@ -113,7 +114,9 @@ ClientSession::ClientSession(   UInt32 inAddr, UInt16 inPort, char* inURL,
     fStats(NULL),
     fOverbufferWindowSizeInK(inOverbufferWindowSizeInK),
     fCurRTCPTrack(0),
-    fNumPacketsReceived(0)
+    fNumPacketsReceived(0),
+    fPacketHandler(NULL),
+    fPacketHandlerCookie(NULL)
 {
     this->SetTaskName("RTSPClientLib:ClientSession");
     StrPtrLen theURL(inURL);
@@ -484,6 +487,11 @@ SInt64 ClientSession::Run()
                     if ((fCurRTCPTrack == fSDPParser.GetNumStreams()) && (fControlType == kRTSPHTTPDropPostControlType))
                         ((HTTPClientSocket*)fSocket)->ClosePost();
 
+                    if (fReadInterval == 0)
+                    {
+                        this->RequestMediaEvents();
+                        return kMediaEventIdleMsec;
+                    }
                     return fReadInterval;
                 }
                 break;
@@ -665,6 +673,22 @@ OS_Error    ClientSession::ReadMediaData()
     return theErr;
 }
 
+void    ClientSession::RequestMediaEvents()
+{
+    //
+    // ReadMediaData has drained every socket, so ask to be woken up by the next packet.
+    if (fTransportType == kTCPTransportType)
+    {
+        fSocket->GetSocket()->SetTask(this);
+        fSocket->GetSocket()->RequestEvent(EV_RE);
+    }
+    else
+    {
+        for (UInt32 x = 0; x < fSDPParser.GetNumStreams() * 2; x++)
+            fUDPSocketArray[x]->RequestEvent(EV_RE);
+    }
+}
+
 void    ClientSession::ProcessMediaPacket(  char* inPacket, UInt32 inLength,
                                             UInt32 inTrackID, Bool16 isRTCP)
 {
@@ -674,6 +698,9 @@ void    ClientSession::ProcessMediaPacket(  char* inPacket, UInt32 inLength,
     if (isRTCP)
         return;
     
+    if (fPacketHandler != NULL)
+        (*fPacketHandler)(fPacketHandlerCookie, inTrackID, inPacket, inLength);
+        
     UInt16* theSeqNumP = (UInt16*)inPacket;
     UInt16 theSeqNum = ntohs(theSeqNumP[1]);
     
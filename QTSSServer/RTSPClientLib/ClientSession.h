@@ -140,6 +140,15 @@ class ClientSession : public Task
                                     { return fStats[inTrackIndex].fNumAcks; }
                 
         UInt32   GetSessionPacketsReceived()  { UInt32 result = fNumPacketsReceived; fNumPacketsReceived = 0; return result; }
+
+        //
+        // Tools that need to look inside the media (to time it, say) can have every
+        // RTP packet handed to them as it arrives, before it is counted. The packet
+        // is only valid for the duration of the call, which is made from Run.
+        typedef void (*PacketHandler)(void* inCookie, UInt32 inTrackID, char* inPacket, UInt32 inLength);
+        void    SetPacketHandler(PacketHandler inHandler, void* inCookie)
+                    { fPacketHandler = inHandler; fPacketHandlerCookie = inCookie; }
+        
         //
         // Global stats
         static UInt32   GetActiveConnections()          { return sActiveConnections; }
@@ -195,7 +204,7 @@ class ClientSession : public Task
         
         Bool16          fTeardownImmediately;
         Bool16          fAppendJunk;
-        UInt32          fReadInterval;
+        UInt32          fReadInterval;  // 0 to read as packets arrive instead of polling
         UInt32          fSockRcvBufSize;
         
         Float32         fSpeed;
@@ -235,6 +244,9 @@ class ClientSession : public Task
         UInt32              fOverbufferWindowSizeInK;
         UInt32              fCurRTCPTrack;
         UInt32              fNumPacketsReceived;
+        
+        PacketHandler       fPacketHandler;
+        void*               fPacketHandlerCookie;
         //
         // Global stats
         static UInt32           sActiveConnections;
@@ -247,6 +259,7 @@ class ClientSession : public Task
         void    SetupUDPSockets();
         void    ProcessMediaPacket(char* inPacket, UInt32 inLength, UInt32 inTrackID, Bool16 isRTCP);
         OS_Error    ReadMediaData();
+        void    RequestMediaEvents();
         OS_Error    SendReceiverReport(UInt32 inTrackID);
         void    AckPackets(UInt32 inTrackIndex, UInt16 inCurSeqNum, Bool16 inCurSeqNumValid);
 };
@@ -44,12 +44,34 @@
 
 
 
-QTSSDictionary::QTSSDictionary(QTSSDictionaryMap* inMap, OSMutex* inMutex) 
+QTSSDictionary::QTSSDictionary(QTSSDictionaryMap* inMap, OSMutex* inMutex, char* inArena, UInt32 inArenaSize) 
 :   fAttributes(NULL), fInstanceAttrs(NULL), fInstanceArraySize(0),
-    fMap(inMap), fInstanceMap(NULL), fMutexP(inMutex), fMyMutex(false), fLocked(false)
+    fMap(inMap), fInstanceMap(NULL), fMutexP(inMutex), fMyMutex(false), fLocked(false),
+    fArena(inArena), fArenaSize(inArenaSize), fArenaUsed(0), fValueBytes(0),
+    fMyArena(false), fAttributesInArena(false)
 {
     if(fMap != NULL)
-        fAttributes = NEW DictValueElement[inMap->GetNumAttrs()];
+    {
+        UInt32 theArrayLen = inMap->GetNumAttrs() * sizeof(DictValueElement);
+        if(fArena == NULL)
+        {
+            // One allocation for the value array and the values that usually follow
+            fArenaSize = theArrayLen + inMap->GetArenaValueBytes();
+            fArena = NEW char[fArenaSize];
+            fMyArena = true;
+        }
+        
+        char* theArray = this->AllocateFromArena(theArrayLen);
+        if(theArray != NULL)
+        {
+            fAttributes = (DictValueElement*)theArray;
+            for (UInt32 x = 0; x < inMap->GetNumAttrs(); x++)
+                new (&fAttributes[x]) DictValueElement();
+            fAttributesInArena = true;
+        }
+        else
+            fAttributes = NEW DictValueElement[inMap->GetNumAttrs()];
+    }
 	if(fMutexP == NULL)
 	{
 		fMyMutex = true;
@@ -61,13 +83,33 @@ QTSSDictionary::~QTSSDictionary()
 {
     if(fMap != NULL)
         this->DeleteAttributeData(fAttributes, fMap->GetNumAttrs());
-    if(fAttributes != NULL)
+    if((fAttributes != NULL) && !fAttributesInArena)
         delete [] fAttributes;
     delete fInstanceMap;
     this->DeleteAttributeData(fInstanceAttrs, fInstanceArraySize);
     delete [] fInstanceAttrs;
 	if(fMyMutex)
 		delete fMutexP;
+    
+    // Let the next dictionary of this type start with enough room
+    if(fMap != NULL)
+        fMap->NoteArenaValueBytes(fValueBytes);
+    if(fMyArena)
+        delete [] fArena;
+}
+
+char* QTSSDictionary::AllocateFromArena(UInt32 inLen)
+{
+    if(fArena == NULL)
+        return NULL;
+        
+    UInt32 theStart = fArenaUsed;
+    theStart += (kArenaAlignment - ((size_t)(fArena + theStart) % kArenaAlignment)) % kArenaAlignment;
+    if((theStart > fArenaSize) || (inLen > fArenaSize - theStart))
+        return NULL;
+        
+    fArenaUsed = theStart + inLen;
+    return fArena + theStart;
 }
 
 QTSSDictionary* QTSSDictionary::CreateNewDictionary(QTSSDictionaryMap* inMap, OSMutex* inMutex)
@@ -331,16 +373,17 @@ QTSS_Error QTSSDictionary::SetValue(QTSS_AttributeID inAttrID, UInt32 inIndex,
                         char* temp = NEW char[tempStringLen + 1];
                         ::memcpy(temp, theAttrs[theMapIndex].fAttributeData.Ptr, tempStringLen);
                         temp[tempStringLen] = '\0';
-                        delete [] theAttrs[theMapIndex].fAttributeData.Ptr;
+                        if(theAttrs[theMapIndex].fAllocatedInternally) // arena and SetVal storage isn't ours to delete
+                            delete [] theAttrs[theMapIndex].fAttributeData.Ptr;
                         
             //char* temp = theAttrs[theMapIndex].fAttributeData.Ptr;
             
             theAttrs[theMapIndex].fAllocatedLen = 16 * sizeof(char*);
             theAttrs[theMapIndex].fAttributeData.Ptr = NEW char[theAttrs[theMapIndex].fAllocatedLen];
             theAttrs[theMapIndex].fAttributeData.Len = sizeof(char*);
+            theAttrs[theMapIndex].fAllocatedInternally = true;
             // store off original string as first value in array
             *(char**)theAttrs[theMapIndex].fAttributeData.Ptr = temp;
-                        // question: why isn't theAttrs[theMapIndex].fAllocatedInternally set to true?
         }
     }
     else
@@ -366,7 +409,13 @@ QTSS_Error QTSSDictionary::SetValue(QTSS_AttributeID inAttrID, UInt32 inIndex,
             theLen = attrLen;   // most attributes are single valued, so allocate just enough space
         else
             theLen = 2 * (attrLen * (inIndex + 1));// Allocate twice as much as we need
-        char* theNewBuffer = NEW char[theLen];
+        
+        // Take it from the arena if there's room left
+        fValueBytes += theLen;
+        char* theNewBuffer = this->AllocateFromArena(theLen);
+        Bool16 isInArena = (theNewBuffer != NULL);
+        if(!isInArena)
+            theNewBuffer = NEW char[theLen];
         if(inIndex > 0)
         {
             // Copy out the old attribute data
@@ -382,7 +431,7 @@ QTSS_Error QTSSDictionary::SetValue(QTSS_AttributeID inAttrID, UInt32 inIndex,
         // Finally, update this attribute structure with all the new values.
         theAttrs[theMapIndex].fAttributeData.Ptr = theNewBuffer;
         theAttrs[theMapIndex].fAllocatedLen = theLen;
-        theAttrs[theMapIndex].fAllocatedInternally = true;
+        theAttrs[theMapIndex].fAllocatedInternally = !isInArena;
     }
         
     // At this point, we should always have enough space to write what we want
@@ -543,10 +592,12 @@ QTSS_Error QTSSDictionary::RemoveValue(QTSS_AttributeID inAttrID, UInt32 inIndex
     {
         // we only have one string left, so we don't need the extra pointer
         char* str = *(char**)(theAttrs[theMapIndex].fAttributeData.Ptr);
-        delete theAttrs[theMapIndex].fAttributeData.Ptr;
+        if(theAttrs[theMapIndex].fAllocatedInternally)
+            delete theAttrs[theMapIndex].fAttributeData.Ptr;
         theAttrs[theMapIndex].fAttributeData.Ptr = str;
         theAttrs[theMapIndex].fAttributeData.Len = strlen(str);
         theAttrs[theMapIndex].fAllocatedLen = strlen(str);
+        theAttrs[theMapIndex].fAllocatedInternally = true;
     }
 
     //
@@ -859,7 +910,8 @@ void QTSSDictionaryMap::Initialize()
 }
 
 QTSSDictionaryMap::QTSSDictionaryMap(UInt32 inNumReservedAttrs, UInt32 inFlags)
-:   fNextAvailableID(inNumReservedAttrs), fNumValidAttrs(inNumReservedAttrs),fAttrArraySize(inNumReservedAttrs), fFlags(inFlags)
+:   fNextAvailableID(inNumReservedAttrs), fNumValidAttrs(inNumReservedAttrs),fAttrArraySize(inNumReservedAttrs), fFlags(inFlags),
+    fArenaValueBytes(kMinArenaValueBytes)
 {
     if(fAttrArraySize < kMinArraySize)
         fAttrArraySize = kMinArraySize;
@@ -64,7 +64,12 @@ class QTSSDictionary : public QTSSStream
         //
         // CONSTRUCTOR / DESTRUCTOR
         
-        QTSSDictionary(QTSSDictionaryMap* inMap, OSMutex* inMutex = NULL);
+        // Attribute storage (the value array and the values SetValue copies in) is carved
+        // out of one arena instead of being allocated attribute by attribute. Pass inArena
+        // to supply it, for instance from a buffer in the derived object, otherwise the
+        // dictionary allocates one sized from what dictionaries of this map have needed.
+        // Whatever doesn't fit is allocated separately, as before.
+        QTSSDictionary(QTSSDictionaryMap* inMap, OSMutex* inMutex = NULL, char* inArena = NULL, UInt32 inArenaSize = 0);
         virtual ~QTSSDictionary();
         
         //
@@ -215,6 +220,23 @@ class QTSSDictionary : public QTSSStream
 		Bool16				fMyMutex;
 		Bool16				fLocked;
         
+        enum
+        {
+            kArenaAlignment = 8 //UInt32 so 64 bit values can be read in place
+        };
+        
+        // A bump allocator. Nothing is given back until the arena goes away, so a value
+        // that outgrows its space leaves the old space behind.
+        char*               fArena;
+        UInt32              fArenaSize;
+        UInt32              fArenaUsed;
+        UInt32              fValueBytes;        // value storage asked for, arena or not, for the map's hint
+        Bool16              fMyArena;
+        Bool16              fAttributesInArena;
+        
+        // Returns NULL if inLen won't fit
+        char*   AllocateFromArena(UInt32 inLen);
+        
         void DeleteAttributeData(DictValueElement* inDictValues, UInt32 inNumValues);
 };
 
@@ -343,6 +365,13 @@ class QTSSDictionaryMap
         
         Bool16                  InstanceAttrsAllowed() { return (Bool16) (fFlags & kInstanceAttrsAllowed); }
         Bool16                  CompleteFunctionsAllowed() { return (Bool16) (fFlags & kCompleteFunctionsAllowed) ; }
+        
+        // How much value storage a dictionary of this type allocates for its arena. It
+        // follows the most any one of them has needed so far, up to kMaxArenaValueBytes.
+        UInt32                  GetArenaValueBytes() { return fArenaValueBytes; }
+        void                    NoteArenaValueBytes(UInt32 inBytes)
+            {   if (inBytes > kMaxArenaValueBytes) inBytes = kMaxArenaValueBytes;
+                if (inBytes > fArenaValueBytes) fArenaValueBytes = inBytes; }
 
         // MODIFIERS
         
@@ -406,7 +435,9 @@ class QTSSDictionaryMap
             
         enum
         {
-            kMinArraySize = 20
+            kMinArraySize = 20,
+            kMinArenaValueBytes = 64,   //UInt32
+            kMaxArenaValueBytes = 4096  //UInt32
         };
 
         UInt32                          fNextAvailableID;
@@ -414,6 +445,7 @@ class QTSSDictionaryMap
         UInt32                          fAttrArraySize;
         QTSSAttrInfoDict**              fAttrArray;
         UInt32                          fFlags;
+        UInt32                          fArenaValueBytes;
         
         friend class QTSSDictionary;
 };
@@ -284,7 +284,6 @@ void QTSServer::InitModules(QTSS_ServerState inEndState)
 
 void QTSServer::StartTasks()
 {
-    fRTCPTask = new RTCPTask();
     fStatsTask = new RTPStatsUpdaterTask();
 
     //
@@ -567,11 +566,7 @@ Bool16  QTSServer::SetupUDPSockets()
     {
         UDPSocketPair* thePair = fSocketPool->CreateUDPSocketPair(SocketUtils::GetIPAddr(theNumPairs), 0);
                 if(thePair != NULL)
-                {
-            theNumAllocatedPairs++;
-                        thePair->GetSocketA()->RequestEvent(EV_RE);
-                        thePair->GetSocketB()->RequestEvent(EV_RE);
-                }
+            theNumAllocatedPairs++; // the pool arms the RTCP socket itself
         }
     //only return an error if we couldn't allocate ANY pairs of sockets
     if(theNumAllocatedPairs == 0)
@@ -1046,6 +1041,7 @@ void QTSServer::SetupPublicHeader()
     {
         if(theUniqueMethods[z])
             this->SetValue(qtssSvrHandledMethods, uniqueMethodCount++, &z, sizeof(QTSS_RTSPMethod));
+        sHandledMethods[z] = theUniqueMethods[z];
     }
     this->SetNumValues(qtssSvrHandledMethods, uniqueMethodCount);
     
@@ -1109,35 +1105,28 @@ Bool16 RTSPListenerSocket::OverMaxConnections(UInt32 buffer)
 
 UDPSocketPair*  RTPSocketPool::ConstructUDPSocketPair()
 {
-    Task* theTask = ((QTSServer*)QTSServerInterface::GetServer())->fRTCPTask;
-    
     //construct a pair of UDP sockets, the lower one for RTP data (outgoing only, no demuxer
     //necessary), and one for RTCP data (incoming, so definitely need a demuxer).
-    //These are nonblocking sockets that DON'T receive events (we are going to poll for data)
-	// They do receive events - we don't poll from them anymore
-    return NEW
-        UDPSocketPair(  NEW UDPSocket(theTask, Socket::kNonBlockingSocketType),
-                        NEW UDPSocket(theTask, UDPSocket::kWantsDemuxer | Socket::kNonBlockingSocketType));
+    //Each pair gets its own RTCPTask, which is woken only when this pair's RTCP
+    //socket is readable, and which owns the sockets from here on.
+    RTCPTask* theTask = NEW RTCPTask();
+    UDPSocket* theRTPSocket = NEW UDPSocket(theTask, Socket::kNonBlockingSocketType);
+    UDPSocket* theRTCPSocket = NEW UDPSocket(theTask, UDPSocket::kWantsDemuxer | Socket::kNonBlockingSocketType);
+    theTask->SetSockets(theRTPSocket, theRTCPSocket);
+    
+    return NEW UDPSocketPair(theRTPSocket, theRTCPSocket);
 }
 
 void RTPSocketPool::DestructUDPSocketPair(UDPSocketPair* inPair)
 {
-#if 0//fym
-    delete inPair->GetSocketA();
-    delete inPair->GetSocketB();
+    //The sockets belong to the pair's RTCPTask, which deletes them from within its
+    //Run function so that they can't go away in the middle of a read.
+    Task* theTask = inPair->GetSocketB()->GetTask();
     delete inPair;
-#else//fym
-	UDPSocket* socket = inPair->GetSocketA();
-	delete socket;
-	socket = NULL;
-
-	socket = inPair->GetSocketB();
-	delete socket;
-	socket = NULL;
-
-	delete inPair;
-	inPair = NULL;
-#endif
+    inPair = NULL;
+    
+    if(theTask != NULL)
+        theTask->Signal(Task::kKillEvent);
 }
 
 void RTPSocketPool::SetUDPSocketOptions(UDPSocketPair* inPair)
@@ -1146,6 +1135,10 @@ void RTPSocketPool::SetUDPSocketOptions(UDPSocketPair* inPair)
     // used for sending... on UNIX typically the socket buffer size doesn't matter because the
     // packet goes right down to the driver. On Win32 and linux, unless this is really big, we get packet loss.
     inPair->GetSocketA()->SetSocketBufSize(256 * 1024);
+    
+    //
+    // Nothing else reads the RTCP socket, so arm it as soon as it's open
+    inPair->GetSocketB()->RequestEvent(EV_RE);
 
     //
     // Always set the Rcv buf size for the RTCP sockets. This is important because the
@@ -116,7 +116,6 @@ class QTSServer : public QTSServerInterface
     
         //
         // GLOBAL TASKS
-        RTCPTask*           fRTCPTask;
         RTPStatsUpdaterTask*fStatsTask;
         SessionTimeoutTask  *fSessionTimeoutTask;
         static char*        sPortPrefString;
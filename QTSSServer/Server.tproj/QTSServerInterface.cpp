@@ -43,6 +43,7 @@
 #include "UDPSocketPool.h"
 #include "RTSPProtocol.h"
 #include "RTPPacketResender.h"
+#include "OSMemory.h"
 #ifndef __MacOSX__
 #include "revision.h"
 #endif
@@ -69,6 +70,7 @@ StrPtrLen               QTSServerInterface::sServerHeaderPtr(sServerHeader, kMax
 
 ResizeableStringFormatter       QTSServerInterface::sPublicHeaderFormatter(NULL, 0);
 StrPtrLen                       QTSServerInterface::sPublicHeaderStr;
+Bool16                          QTSServerInterface::sHandledMethods[qtssNumMethods];
 
 QTSSModule**            QTSServerInterface::sModuleArray[QTSSModule::kNumRoles];
 UInt32                  QTSServerInterface::sNumModulesInRole[QTSSModule::kNumRoles];
@@ -140,7 +142,8 @@ QTSSAttrInfoDict::AttrInfo  QTSServerInterface::sAttributes[] =
     /* 38  */ { "qtssSvrServerBuild",           NULL,   qtssAttrDataTypeCharArray,  qtssAttrModeRead | qtssAttrModePreempSafe },
     /* 39  */ { "qtssSvrServerPlatform",        NULL,   qtssAttrDataTypeCharArray,  qtssAttrModeRead | qtssAttrModePreempSafe },
     /* 40  */ { "qtssSvrRTSPServerComment",     NULL,   qtssAttrDataTypeCharArray,  qtssAttrModeRead | qtssAttrModePreempSafe },
-    /* 41  */ { "qtssSvrNumThinned",            NULL,   qtssAttrDataTypeSInt32,     qtssAttrModeRead | qtssAttrModeWrite  }
+    /* 41  */ { "qtssSvrNumThinned",            NULL,   qtssAttrDataTypeSInt32,     qtssAttrModeRead | qtssAttrModeWrite  },
+    /* 42  */ { "qtssSvrMemorySlabStats",       GetMemorySlabStats, qtssAttrDataTypeCharArray,  qtssAttrModeRead }
 };
 
 void    QTSServerInterface::Initialize()
@@ -205,9 +208,9 @@ QTSServerInterface::QTSServerInterface()
     fTotalRTPBytes(0),
     fTotalRTPPackets(0),
     fTotalRTPPacketsLost(0),
-    fPeriodicRTPBytes(0),
     fPeriodicRTPPacketsLost(0),
-    fPeriodicRTPPackets(0),
+    fSendStatsShards(NULL),
+    fMaxLateEpoch(0),
     fCurrentRTPBandwidthInBits(0),
     fAvgRTPBandwidthInBits(0),
     fRTPPacketsPerSecond(0),
@@ -235,6 +238,12 @@ QTSServerInterface::QTSServerInterface()
         sModuleArray[y] = NULL;
         sNumModulesInRole[y] = 0;
     }
+    
+    // Start the shards on a cache line boundary so no two of them ever share one
+    char* theShardBuf = &fSendStatsShardBuf[0];
+    theShardBuf += (kCacheLineSize - ((PointerSizedInt)theShardBuf % kCacheLineSize)) % kCacheLineSize;
+    fSendStatsShards = (SendStatsShard*)theShardBuf;
+    ::memset(fSendStatsShards, 0, kNumSendStatsShards * sizeof(SendStatsShard));
 
     this->SetVal(qtssSvrState,              &fServerState,              sizeof(fServerState));
     this->SetVal(qtssServerAPIVersion,      &sServerAPIVersion,         sizeof(sServerAPIVersion));
@@ -397,18 +406,42 @@ SInt64 RTPStatsUpdaterTask::Run()
     //First update total bytes. This must be done because total bytes is a 64 bit number,
     //so no atomic functions can apply.
     //
-    // NOTE: The line below is not thread safe on non-PowerPC platforms. This is
-    // because the fPeriodicRTPBytes variable is being manipulated from within an
-    // atomic_add. On PowerPC, assignments are atomic, so the assignment below is ok.
-    // On a non-PowerPC platform, the following would be thread safe:
-    //unsigned int periodicBytes = atomic_add(&theServer->fPeriodicRTPBytes, 0);
-    unsigned int periodicBytes = theServer->fPeriodicRTPBytes;
-    (void)atomic_sub(&theServer->fPeriodicRTPBytes, periodicBytes);
+    //Each thread counts what it sends in its own shard. Only that thread writes the
+    //counters, and a 32 bit read is atomic, so all we have to do is see how far each one
+    //moved since last time. The counters wrap, which the unsigned subtraction takes care of.
+    unsigned int periodicBytes = 0;
+    unsigned int periodicPackets = 0;
+    for (UInt32 x = 0; x < QTSServerInterface::kNumSendStatsShards; x++)
+    {
+        QTSServerInterface::SendStatsShard* theShard = &theServer->fSendStatsShards[x];
+        
+        unsigned int theCount = theShard->fRTPBytes;
+        periodicBytes += theCount - theShard->fLastRTPBytes;
+        theShard->fLastRTPBytes = theCount;
+        
+        theCount = theShard->fRTPPackets;
+        periodicPackets += theCount - theShard->fLastRTPPackets;
+        theShard->fLastRTPPackets = theCount;
+        
+        theCount = theShard->fTotalLate;
+        theServer->fTotalLate += (int)(theCount - theShard->fLastTotalLate);
+        theShard->fLastTotalLate = theCount;
+        
+        theCount = theShard->fTotalQuality;
+        theServer->fTotalQuality += (int)(theCount - theShard->fLastTotalQuality);
+        theShard->fLastTotalQuality = theCount;
+        
+        // a shard that hasn't sent since the max was last cleared doesn't count
+        if (theShard->fMaxLateEpoch == theServer->fMaxLateEpoch)
+        {
+            SInt64 theMaxLate = theShard->fCurrentMaxLate;
+            if (theMaxLate > theServer->fCurrentMaxLate)
+                theServer->fCurrentMaxLate = theMaxLate;
+            if (theMaxLate > theServer->fMaxLate)
+                theServer->fMaxLate = theMaxLate;
+        }
+    }
     theServer->fTotalRTPBytes += periodicBytes;
-    
-    // Same deal for packet totals
-    unsigned int periodicPackets = theServer->fPeriodicRTPPackets;
-    (void)atomic_sub(&theServer->fPeriodicRTPPackets, periodicPackets);
     theServer->fTotalRTPPackets += periodicPackets;
     
     // ..and for lost packet totals
@@ -607,6 +640,31 @@ void* QTSServerInterface::GetNumWastedBytes(QTSSDictionary* inServer, UInt32* ou
     return &theServer->fUDPWastageInBytes;  
 }
 
+void* QTSServerInterface::GetMemorySlabStats(QTSSDictionary* inServer, UInt32* outLen)
+{
+    QTSServerInterface* theServer = (QTSServerInterface*)inServer;
+    UInt32 theLen = 0;
+    
+#if MEMORY_SLAB_ALLOCATOR
+    for (UInt32 x = 0; x < OSMemory::kNumSizeClasses; x++)
+    {
+        OSMemory::SlabStats theStats;
+        OSMemory::GetSlabStats(x, &theStats);
+        
+        int theLineLen = qtss_snprintf(&theServer->fMemorySlabStats[theLen], kMemorySlabStatsSize - theLen,
+                            "%lu: allocs=%"_64BITARG_"u frees=%"_64BITARG_"u cached=%lu slab_bytes=%lu\n",
+                            theStats.fBlockSize, theStats.fNumAllocs, theStats.fNumFrees, theStats.fNumCached, theStats.fSlabBytes);
+        if ((theLineLen < 0) || (theLen + theLineLen >= kMemorySlabStatsSize))
+            break;
+        theLen += theLineLen;
+    }
+#endif
+
+    // Return the result
+    *outLen = theLen;
+    return theServer->fMemorySlabStats;
+}
+
 void* QTSServerInterface::TimeConnected(QTSSDictionary* inConnection, UInt32* outLen)
 {
     SInt64 connectTime;
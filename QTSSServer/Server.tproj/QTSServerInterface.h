@@ -46,6 +46,7 @@
 #include "atomic.h"
 
 #include "OSMutex.h"
+#include "OSThread.h"
 #include "Task.h"
 #include "TCPListenerSocket.h"
 #include "ResizeableStringFormatter.h"
@@ -96,12 +97,10 @@ class QTSServerInterface : public QTSSDictionary
         void                SwapFromRTSPToHTTP()
             { OSMutexLocker locker(&fMutex); fNumRTSPSessions--; fNumRTSPHTTPSessions++; }
             
-        //total rtp bytes sent by the server
-        void            IncrementTotalRTPBytes(UInt32 bytes)
-                                        { (void)atomic_add(&fPeriodicRTPBytes, bytes); }
-        //total rtp packets sent by the server
-        void            IncrementTotalPackets()
-                                        { (void)atomic_add(&fPeriodicRTPPackets, 1); }
+        //one rtp packet of inBytes sent by the server, inLateMsec late, at stream quality inQuality.
+        //This touches nothing but the calling thread's own counters, RTPStatsUpdaterTask
+        //adds them all up.
+        inline void     IncrementSendStats(UInt32 inBytes, SInt64 inLateMsec, SInt32 inQuality);
         //total rtp bytes reported as lost by the clients
         void            IncrementTotalRTPPacketsLost(UInt32 packets)
                                         { (void)atomic_add(&fPeriodicRTPPacketsLost, packets); }
@@ -117,24 +116,13 @@ class QTSServerInterface : public QTSSDictionary
             { OSMutexLocker locker(&fMutex); fNumRTPPlayingSessions += inDifference; }
             
         
-        void            IncrementTotalLate(SInt64 milliseconds)
-           {    OSMutexLocker locker(&fMutex); 
-                fTotalLate += milliseconds;
-                if (milliseconds > fCurrentMaxLate) fCurrentMaxLate = milliseconds;
-                if (milliseconds > fMaxLate) fMaxLate = milliseconds;
-           }
-           
-        void            IncrementTotalQuality(SInt32 level)
-           { OSMutexLocker locker(&fMutex); fTotalQuality += level; }
-           
-           
         void            IncrementNumThinned(SInt32 inDifference)
            { OSMutexLocker locker(&fMutex); fNumThinned += inDifference; }
 
         void            ClearTotalLate()
            { OSMutexLocker locker(&fMutex); fTotalLate = 0;  }
         void            ClearCurrentMaxLate()
-           { OSMutexLocker locker(&fMutex); fCurrentMaxLate = 0;  }
+           { OSMutexLocker locker(&fMutex); fCurrentMaxLate = 0; fMaxLateEpoch++; }
         void            ClearTotalQuality()
            { OSMutexLocker locker(&fMutex); fTotalQuality = 0;  }
      
@@ -209,6 +197,10 @@ class QTSServerInterface : public QTSSDictionary
         // PUBLIC HEADER
         static StrPtrLen*   GetPublicHeader()           { return &sPublicHeaderStr; }
         
+        // Whether some module put inMethod in qtssSvrHandledMethods when it initialized
+        static Bool16       IsMethodHandled(QTSS_RTSPMethod inMethod)
+                                { return (inMethod < qtssNumMethods) ? sHandledMethods[inMethod] : false; }
+        
         //
         // KILL ALL
         void                KillAllRTPSessions();
@@ -287,6 +279,7 @@ class QTSServerInterface : public QTSSDictionary
 
         static ResizeableStringFormatter    sPublicHeaderFormatter;
         static StrPtrLen                    sPublicHeaderStr;
+        static Bool16                       sHandledMethods[qtssNumMethods];
 
         //
         // MODULE DATA
@@ -336,9 +329,40 @@ class QTSServerInterface : public QTSSDictionary
         //because there is no 64 bit atomic add (for obvious reasons), we efficiently
         //implement total byte counting by atomic adding to this variable, then every
         //once in awhile updating the sTotalBytes.
-        unsigned int        fPeriodicRTPBytes;
         unsigned int        fPeriodicRTPPacketsLost;
-        unsigned int        fPeriodicRTPPackets;
+        
+        //Send path statistics are kept per thread instead, so sending a packet never writes
+        //to memory another thread writes to. Each shard is a cache line of free running
+        //counters that only its own thread changes. RTPStatsUpdaterTask remembers where each
+        //one was last time and folds the differences into the totals. Threads that don't
+        //have a shard of their own share shard 0 under fMutex.
+        enum
+        {
+            kNumSendStatsShards = 64,   //UInt32
+            kCacheLineSize = 64         //UInt32
+        };
+        
+        struct SendStatsShard
+        {
+            unsigned int    fRTPBytes;
+            unsigned int    fRTPPackets;
+            unsigned int    fTotalLate;     // sum of SInt32 msec, wraps
+            unsigned int    fTotalQuality;  // sum of SInt32 levels, wraps
+            unsigned int    fMaxLateEpoch;  // fCurrentMaxLate is only good if this matches the server's
+            int             fCurrentMaxLate;
+            
+            // where RTPStatsUpdaterTask saw the counters last time
+            unsigned int    fLastRTPBytes;
+            unsigned int    fLastRTPPackets;
+            unsigned int    fLastTotalLate;
+            unsigned int    fLastTotalQuality;
+            
+            char            fPad[kCacheLineSize - (10 * sizeof(unsigned int))];
+        };
+        
+        SendStatsShard*     fSendStatsShards;   // kNumSendStatsShards of them, cache line aligned in fSendStatsShardBuf
+        char                fSendStatsShardBuf[(kNumSendStatsShards + 1) * sizeof(SendStatsShard)];
+        unsigned int        fMaxLateEpoch;
         
         //stores the current served bandwidth in BITS per second
         UInt32              fCurrentRTPBandwidthInBits;
@@ -362,6 +386,13 @@ class QTSServerInterface : public QTSSDictionary
         UInt32              fUDPWastageInBytes;
         UInt32              fNumUDPBuffers;
         
+        // Storage for the slab allocator stats attribute
+        enum
+        {
+            kMemorySlabStatsSize = 2048 //UInt32
+        };
+        char                fMemorySlabStats[kMemorySlabStatsSize];
+        
         // MP3 Client Session params
         UInt32              fNumMP3Sessions;
         UInt32              fTotalMP3Sessions;
@@ -388,6 +419,7 @@ class QTSServerInterface : public QTSSDictionary
         static void* IsOutOfDescriptors(QTSSDictionary* inServer, UInt32* outLen);
         static void* GetNumUDPBuffers(QTSSDictionary* inServer, UInt32* outLen);
         static void* GetNumWastedBytes(QTSSDictionary* inServer, UInt32* outLen);
+        static void* GetMemorySlabStats(QTSSDictionary* inServer, UInt32* outLen);
         
         static QTSServerInterface*  sServer;
         static QTSSAttrInfoDict::AttrInfo   sAttributes[];
@@ -397,6 +429,32 @@ class QTSServerInterface : public QTSSDictionary
         friend class SessionTimeoutTask;
 };
 
+void QTSServerInterface::IncrementSendStats(UInt32 inBytes, SInt64 inLateMsec, SInt32 inQuality)
+{
+    int theLate = (int)inLateMsec;  // never more than a few seconds either way
+    
+    OSThread* theThread = OSThread::GetCurrent();
+    UInt32 theShardIndex = (theThread == NULL) ? 0 : theThread->GetThreadIndex() + 1;
+    if (theShardIndex >= kNumSendStatsShards)
+        theShardIndex = 0;
+    
+    OSMutexLocker locker((theShardIndex == 0) ? &fMutex : NULL);
+    SendStatsShard* theShard = &fSendStatsShards[theShardIndex];
+    
+    theShard->fRTPBytes += inBytes;
+    theShard->fRTPPackets++;
+    theShard->fTotalLate += (unsigned int)theLate;
+    theShard->fTotalQuality += (unsigned int)inQuality;
+    
+    if (theShard->fMaxLateEpoch != fMaxLateEpoch)
+    {
+        theShard->fCurrentMaxLate = theLate;
+        theShard->fMaxLateEpoch = fMaxLateEpoch;
+    }
+    else if (theLate > theShard->fCurrentMaxLate)
+        theShard->fCurrentMaxLate = theLate;
+}
+
 
 class RTPStatsUpdaterTask : public Task
 {
@@ -192,6 +192,7 @@ class QTSServerPrefs : public QTSSPrefs
         UInt32  GetNumThreads()             { return fNumThreads; }
         
         Bool16  DisableThinning()           { return fDisableThinning; }
+        Bool16  RTCPRateControlEnabled()    { return fRTCPRateControlEnabled; }
     private:
 
         UInt32      fRTSPTimeoutInSecs;
@@ -264,6 +265,7 @@ class QTSServerPrefs : public QTSSPrefs
         Bool16  fCloseLogsOnWrite;
         
         Bool16 fDisableThinning;
+        Bool16 fRTCPRateControlEnabled;
         enum //fPacketHeaderPrintfOptions
         {
             kRTPALL = 1 << 0,
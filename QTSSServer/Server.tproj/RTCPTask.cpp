@@ -40,75 +40,64 @@
 
 SInt64 RTCPTask::Run()
 {
-    const UInt32 kMaxRTCPPacketSize = 2048;
-    char thePacketBuffer[kMaxRTCPPacketSize];
-    StrPtrLen thePacket(thePacketBuffer, 0);
-    QTSServerInterface* theServer = QTSServerInterface::GetServer();
-    
-    //This task goes through all the UDPSockets in the RTPSocketPool, checking to see
-    //if they have data. If they do, it demuxes the packets and sends the packet onto
-    //the proper RTP session.
     EventFlags events = this->GetEvents(); // get and clear events
     
+    if(events & Task::kKillEvent)
+    {
+        // The socket pool is done with this pair
+        delete fRTPSocket;
+        delete fRTCPSocket;
+        fRTPSocket = NULL;
+        fRTCPSocket = NULL;
+        return -1;
+    }
+    
     if( (events & Task::kReadEvent) || (events & Task::kIdleEvent) )
+        this->ReadRTCPSocket();
+     
+    return 0; /* Fix for 4004432 */   
+}
+
+void RTCPTask::ReadRTCPSocket()
+{
+    if(fRTCPSocket == NULL)
+        return;
+        
+    UDPDemuxer* theDemuxer = fRTCPSocket->GetDemuxer();
+    if(theDemuxer == NULL) 
+        return;
+        
+    char thePacketBuffers[kNumPacketsPerRead][kMaxRTCPPacketSize];
+    StrPtrLen thePackets[kNumPacketsPerRead];
+    UInt32 theRemoteAddrs[kNumPacketsPerRead];
+    UInt16 theRemotePorts[kNumPacketsPerRead];
+    
+    //This task only reads its own socket, so the only lock needed is the demuxer's,
+    //which keeps the target RTPStreams from going away while we hand them packets.
+    OSMutexLocker locker(theDemuxer->GetMutex());
+    while (true) //get all the outstanding packets for this socket
+    {
+        for (UInt32 x = 0; x < kNumPacketsPerRead; x++)
+            thePackets[x].Set(thePacketBuffers[x], 0);
+            
+        UInt32 theNumPackets = 0;
+        (void)fRTCPSocket->RecvMultipleFrom(theRemoteAddrs, theRemotePorts, thePackets,
+                                            kMaxRTCPPacketSize, kNumPacketsPerRead, &theNumPackets);
+        
+        //find the target RTPStream for each packet
+        for (UInt32 y = 0; y < theNumPackets; y++)
         {
-                //Must be done atomically wrt the socket pool.
+            if(thePackets[y].Len == 0)
+                continue;
                 
-                OSMutexLocker locker(theServer->GetSocketPool()->GetMutex());
-                for (OSQueueIter iter(theServer->GetSocketPool()->GetSocketQueue());
-                                !iter.IsDone(); iter.Next())
-                {
-                        UInt32 theRemoteAddr = 0;
-                        UInt16 theRemotePort = 0;
-        
-                        UDPSocketPair* thePair = (UDPSocketPair*)iter.GetCurrent()->GetEnclosingObject();
-                        Assert(thePair != NULL);
-                        
-                        for (UInt32 x = 0; x < 2; x++)
-                        {
-                                UDPSocket* theSocket = NULL;
-                                if(x == 0)
-                                        theSocket = thePair->GetSocketA();
-                                else
-                                        theSocket = thePair->GetSocketB();
-                                        
-                                UDPDemuxer* theDemuxer = theSocket->GetDemuxer();
-                        if(theDemuxer == NULL) 
-                            continue;
-                        else
-                        {
-                                        theDemuxer->GetMutex()->Lock();
-                            while (true) //get all the outstanding packets for this socket
-                                {
-                                        thePacket.Len = 0;
-                                        theSocket->RecvFrom(&theRemoteAddr, &theRemotePort, thePacket.Ptr,  
-                                                                        kMaxRTCPPacketSize, &thePacket.Len);
-                                        if(thePacket.Len == 0)
-                                        {
-                                                theSocket->RequestEvent(EV_RE);   
-                                                break;//no more packets on this socket!
-                                        }
-                                        
-                                        //if this socket has a demuxer, find the target RTPStream
-                                        if(theDemuxer != NULL)
-                                        {
-                                                RTPStream* theStream = (RTPStream*)theDemuxer->GetTask(theRemoteAddr, theRemotePort);
-                                                if(theStream != NULL)
-                                                        theStream->ProcessIncomingRTCPPacket(&thePacket);
-                                        }
-                                }
-                                        theDemuxer->GetMutex()->Unlock();
-                        }
-                }
+            RTPStream* theStream = (RTPStream*)theDemuxer->GetTask(theRemoteAddrs[y], theRemotePorts[y]);
+            if(theStream != NULL)
+                theStream->ProcessIncomingRTCPPacket(&thePackets[y]);
         }
+        
+        //a short read means the socket is drained
+        if(theNumPackets < kNumPacketsPerRead)
+            break;
     }
-     
-    return 0; /* Fix for 4004432 */   
-    /*
-    SInt64 result = 0;
-    if(theServer->GetNumRTPSessions() > 0)
-        result =  theServer->GetPrefs()->GetRTCPPollIntervalInMsec();
-    
-   return result;
-   */
+    fRTCPSocket->RequestEvent(EV_RE);
 }
@@ -25,9 +25,9 @@
 /*
     File:       RTCPTask.h
 
-    Contains:   A task object that processes all incoming RTCP packets
-                for the server, and passes each one onto the task for
-                which it belongs. 
+    Contains:   A task object that processes the incoming RTCP packets
+                on one RTP socket pair, and passes each one onto the task
+                for which it belongs. 
 
 */
 
@@ -35,17 +35,34 @@
 #define __RTCP_TASK_H__
 
 #include "Task.h"
+#include "UDPSocket.h"
 
 class RTCPTask : public Task
 {
     public:
-        //This task handles all incoming RTCP data. It just polls, so make sure
-        //to start the polling process by signalling a start event.
-        RTCPTask() : Task() {this->SetTaskName("RTCPTask"); this->Signal(Task::kStartEvent); }
+        //There is one of these per UDPSocketPair in the RTPSocketPool. It only wakes
+        //up when its RTCP socket is readable, and owns both sockets once SetSockets
+        //is called. To get rid of it, signal a kill event: the sockets get deleted from
+        //within Run, so they can't go away while a read is in progress.
+        RTCPTask() : Task(), fRTPSocket(NULL), fRTCPSocket(NULL) {this->SetTaskName("RTCPTask"); }
         virtual ~RTCPTask() {}
+        
+        void SetSockets(UDPSocket* inRTPSocket, UDPSocket* inRTCPSocket)
+            { fRTPSocket = inRTPSocket; fRTCPSocket = inRTCPSocket; }
     
     private:
+    
+        enum
+        {
+            kMaxRTCPPacketSize = 2048,  //UInt32
+            kNumPacketsPerRead = 16     //UInt32
+        };
+        
         virtual SInt64 Run();
+        void ReadRTCPSocket();
+        
+        UDPSocket*  fRTPSocket;
+        UDPSocket*  fRTCPSocket;
 };
 
 #endif //__RTCP_TASK_H__
@@ -0,0 +1,215 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1999-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ *
+ */
+/*
+    File:       RTPRateController.cpp
+
+    Contains:   Implementation of the class
+    
+*/
+
+#include "RTPRateController.h"
+#include "SafeStdLib.h"
+
+//Turns on printfs that are useful for debugging
+#define RATE_CONTROL_DEBUGGING 0
+
+RTPRateController::RTPRateController()
+:   fLastReportTime(0),
+    fLastByteCount(0),
+    fLastJitterMsec(0),
+    fMinRoundTripMsec(-1),
+    fState(kIncrease),
+    fSendBitRate(0),
+    fFullQualityBitRate(0),
+    fLossBasedBitRate(0),
+    fDelayBasedBitRate(0),
+    fTargetBitRate(0),
+    fLastLevelUpTime(0),
+    fLastLevelDownTime(0),
+    fLevelUpHoldMsec(kMinLevelUpHoldMsec)
+{}
+
+void RTPRateController::ProcessReceiverReport(  const SInt64& inCurTime, UInt32 inFractionLost, UInt32 inJitterMsec,
+                                                SInt64 inRoundTripMsec, UInt32 inByteCount, Bool16 inAtFullQuality)
+{
+    if((inRoundTripMsec >= 0) && ((fMinRoundTripMsec < 0) || (inRoundTripMsec < fMinRoundTripMsec)))
+        fMinRoundTripMsec = inRoundTripMsec;
+
+    if(fLastReportTime == 0)
+    {
+        // Nothing to measure a rate against yet
+        fLastReportTime = inCurTime;
+        fLastByteCount = inByteCount;
+        fLastJitterMsec = inJitterMsec;
+        return;
+    }
+    
+    SInt64 theElapsedMsec = inCurTime - fLastReportTime;
+    if(theElapsedMsec < kMinReportIntervalMsec)
+        return;
+        
+    //
+    // How fast have we actually been sending since the last report? Smooth it a
+    // little, a single report interval can be bursty.
+    UInt32 theBytesSent = (inByteCount - fLastByteCount) & 0xFFFFFFFF;
+    UInt32 theBitRate = (UInt32)(((SInt64)theBytesSent * 8 * 1000) / theElapsedMsec);
+    if(fSendBitRate == 0)
+        fSendBitRate = theBitRate;
+    else
+        fSendBitRate = ((fSendBitRate / 4) * 3) + (theBitRate / 4);
+        
+    if(inAtFullQuality)
+        fFullQualityBitRate = fSendBitRate;
+        
+    //
+    // Overuse detection. A round trip time above the smallest one we've seen on
+    // this path means packets are sitting in a queue somewhere, and jitter that
+    // keeps growing means that queue is getting longer.
+    SInt64 theQueuingDelayMsec = 0;
+    if((inRoundTripMsec >= 0) && (fMinRoundTripMsec >= 0))
+        theQueuingDelayMsec = inRoundTripMsec - fMinRoundTripMsec;
+    SInt32 theJitterGrowthMsec = (SInt32)inJitterMsec - (SInt32)fLastJitterMsec;
+    
+    if((theQueuingDelayMsec > kOveruseQueuingDelayMsec) || (theJitterGrowthMsec > kOveruseJitterGrowthMsec))
+        fState = kDecrease;
+    else if(((theQueuingDelayMsec * 2) > kOveruseQueuingDelayMsec) || (theJitterGrowthMsec > 0))
+        fState = kHold;
+    else
+        fState = kIncrease;
+        
+    //
+    // Never let a target run away from what we are actually able to send. While
+    // the stream is thinned the send rate says nothing about the path, so the full
+    // quality rate is always reachable, otherwise thinning could never be undone.
+    UInt32 theMaxBitRate = fSendBitRate + (fSendBitRate / 2);
+    if(theMaxBitRate < fFullQualityBitRate)
+        theMaxBitRate = fFullQualityBitRate;
+        
+    if(fDelayBasedBitRate == 0)
+        fDelayBasedBitRate = fSendBitRate;
+    if(fLossBasedBitRate == 0)
+        fLossBasedBitRate = fSendBitRate;
+        
+    //
+    // Back off from what actually got through, not from what we sent. When the link
+    // is overloaded the difference is what's piling up in its queue.
+    UInt32 theReceivedBitRate = theBitRate - (UInt32)(((UInt64)theBitRate * inFractionLost) / 256);
+    
+    switch (fState)
+    {
+        case kDecrease:
+            fDelayBasedBitRate = (UInt32)(theReceivedBitRate * 0.85);
+            break;
+        case kIncrease:
+            fDelayBasedBitRate = (UInt32)(fDelayBasedBitRate * 1.08);
+            break;
+        default:
+            break;
+    }
+    if(fDelayBasedBitRate > theMaxBitRate)
+        fDelayBasedBitRate = theMaxBitRate;
+    
+    //
+    // The fraction lost is out of 256. Above 10% loss, back off in proportion to
+    // the loss, below 2% probe upwards, in between hold.
+    if(inFractionLost > 26)
+        fLossBasedBitRate = (UInt32)(fSendBitRate * (1.0 - (inFractionLost / 512.0)));
+    else if(inFractionLost < 5)
+        fLossBasedBitRate = (UInt32)(fLossBasedBitRate * 1.05);
+    if(fLossBasedBitRate > theMaxBitRate)
+        fLossBasedBitRate = theMaxBitRate;
+        
+    fDelayBasedBitRate = this->ClampBitRate(fDelayBasedBitRate);
+    fLossBasedBitRate = this->ClampBitRate(fLossBasedBitRate);
+    fTargetBitRate = (fDelayBasedBitRate < fLossBasedBitRate) ? fDelayBasedBitRate : fLossBasedBitRate;
+    
+#if RATE_CONTROL_DEBUGGING
+    qtss_printf("RTPRateController: send=%lu full=%lu loss=%lu rtt=%ld qdelay=%ld jitter=%lu state=%lu -> delay=%lu loss=%lu target=%lu\n",
+                fSendBitRate, fFullQualityBitRate, inFractionLost, (SInt32)inRoundTripMsec, (SInt32)theQueuingDelayMsec,
+                inJitterMsec, fState, fDelayBasedBitRate, fLossBasedBitRate, fTargetBitRate);
+#endif
+
+    fLastReportTime = inCurTime;
+    fLastByteCount = inByteCount;
+    fLastJitterMsec = inJitterMsec;
+}
+
+UInt32 RTPRateController::ClampBitRate(UInt32 inBitRate)
+{
+    if(inBitRate < kMinBitRate)
+        return kMinBitRate;
+    return inBitRate;
+}
+
+SInt32 RTPRateController::GetRecommendedQualityLevel(SInt32 inCurLevel, UInt32 inNumLevels)
+{
+    if((fTargetBitRate == 0) || (fFullQualityBitRate == 0) || (inNumLevels == 0))
+        return inCurLevel;
+        
+    SInt32 theLevel = 0;
+    if(fTargetBitRate < fFullQualityBitRate / 2)
+        theLevel = inNumLevels;
+    else if(fTargetBitRate < (fFullQualityBitRate / 10) * 9)
+        theLevel = 1;
+    
+    //
+    // Steps up and down are in quality, so the level number goes the other way.
+    // A step up that has held for a while worked, so the next one needn't wait as long
+    if((fLastLevelUpTime != 0) && (fLastReportTime - fLastLevelUpTime >= kLevelUpProbeMsec))
+    {
+        fLastLevelUpTime = 0;
+        fLevelUpHoldMsec /= 2;
+        if(fLevelUpHoldMsec < kMinLevelUpHoldMsec)
+            fLevelUpHoldMsec = kMinLevelUpHoldMsec;
+    }
+    
+    // One step at a time, skipping the levels in between 1 and the last, like the flow control module
+    if(theLevel > inCurLevel)
+    {
+        // A step up that failed means the link can't take it yet, so wait longer next time
+        if(fLastLevelUpTime != 0)
+        {
+            fLevelUpHoldMsec *= 2;
+            if(fLevelUpHoldMsec > kMaxLevelUpHoldMsec)
+                fLevelUpHoldMsec = kMaxLevelUpHoldMsec;
+            fLastLevelUpTime = 0;
+        }
+        fLastLevelDownTime = fLastReportTime;
+        
+        inCurLevel++;
+        if(inCurLevel > 1)
+            inCurLevel = inNumLevels;
+    }
+    else if((theLevel < inCurLevel) && (fLastReportTime - fLastLevelDownTime >= (SInt64)fLevelUpHoldMsec))
+    {
+        fLastLevelUpTime = fLastReportTime;
+        
+        inCurLevel--;
+        if(inCurLevel > 1)
+            inCurLevel = 1;
+    }
+    
+    return inCurLevel;
+}
@@ -0,0 +1,124 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1999-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ *
+ */
+/*
+    File:       RTPRateController.h
+
+    Contains:   Per stream sender side rate controller. Each RTCP receiver report
+                is run through a delay based and a loss based estimator, and the
+                smaller of the two becomes the stream's target bitrate. The delay
+                estimator watches the round trip time (from LSR / DLSR) climb above
+                the smallest one seen on this path, and the interarrival jitter
+                grow between reports, so it usually backs off before the client
+                starts losing packets. The loss estimator is the usual one: hold
+                between 2% and 10% loss, back off above that, probe below it.
+                
+                Quality levels are coarse, so a link whose capacity falls between two
+                of them would have the stream going up and down every few reports.
+                A step up that has to be taken back within a few seconds doubles the
+                wait before the next one, as receiver driven layered multicast does
+                with its join experiments.
+    
+*/
+
+#ifndef __RTP_RATE_CONTROLLER_H__
+#define __RTP_RATE_CONTROLLER_H__
+
+#include "OSHeaders.h"
+
+class RTPRateController
+{
+    public:
+
+        RTPRateController();
+        ~RTPRateController() {}
+        
+        //
+        // Feed this every receiver report block describing this stream.
+        //
+        // inFractionLost:  the 8 bit fraction lost straight out of the report
+        // inJitterMsec:    the report's interarrival jitter, converted to msec
+        // inRoundTripMsec: computed from the report's LSR / DLSR, or -1 if it had none
+        // inByteCount:     total bytes sent on the stream so far. May wrap.
+        // inAtFullQuality: true if the stream isn't being thinned right now
+        void    ProcessReceiverReport(  const SInt64& inCurTime, UInt32 inFractionLost, UInt32 inJitterMsec,
+                                        SInt64 inRoundTripMsec, UInt32 inByteCount, Bool16 inAtFullQuality);
+        
+        //
+        // ACCESSORS
+        //
+        // All rates are in bits / sec. They are 0 until the second report arrives.
+        UInt32  GetTargetBitRate()      { return fTargetBitRate; }
+        UInt32  GetSendBitRate()        { return fSendBitRate; }
+        UInt32  GetFullQualityBitRate() { return fFullQualityBitRate; }
+        Bool16  IsOverusing()           { return fState == kDecrease; }
+        
+        //
+        // Which quality level the target bitrate calls for. Moves at most one step
+        // away from inCurLevel per call, using the same levels the flow control module
+        // does: 0 is the whole stream, 1 is thinned, inNumLevels is key frames only.
+        // Key frames only is reserved for a target below half of the full quality rate.
+        // Call it after each report, and do what it says.
+        SInt32  GetRecommendedQualityLevel(SInt32 inCurLevel, UInt32 inNumLevels);
+        
+    private:
+    
+        enum
+        {
+            kIncrease   = 0,
+            kHold       = 1,
+            kDecrease   = 2
+        };
+        
+        enum
+        {
+            kMinBitRate                 = 16000,    // never target less than this
+            kMinReportIntervalMsec      = 250,      // reports closer together than this are ignored
+            kOveruseQueuingDelayMsec    = 40,       // RTT above the path minimum that means a queue is building
+            kOveruseJitterGrowthMsec    = 10,       // jitter growth between reports that means the same
+            kLevelUpProbeMsec           = 5000,     // a step down this soon after a step up means it failed
+            kMinLevelUpHoldMsec         = 5000,     // wait at least this long after a step down to step up
+            kMaxLevelUpHoldMsec         = 64000     // and after enough failed steps up, no longer than this
+        };
+        
+        UInt32  ClampBitRate(UInt32 inBitRate);
+        
+        SInt64  fLastReportTime;
+        UInt32  fLastByteCount;
+        UInt32  fLastJitterMsec;
+        SInt64  fMinRoundTripMsec;
+        UInt32  fState;
+        
+        UInt32  fSendBitRate;
+        UInt32  fFullQualityBitRate;
+        UInt32  fLossBasedBitRate;
+        UInt32  fDelayBasedBitRate;
+        UInt32  fTargetBitRate;
+        
+        SInt64  fLastLevelUpTime;   // 0 once the step up has held for kLevelUpProbeMsec
+        SInt64  fLastLevelDownTime;
+        UInt32  fLevelUpHoldMsec;
+};
+
+#endif // __RTP_RATE_CONTROLLER_H__
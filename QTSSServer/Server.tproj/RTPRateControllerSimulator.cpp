@@ -0,0 +1,522 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1999-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ *
+ */
+/*
+    File:       RTPRateControllerSimulator.cpp
+
+    Contains:   Runs receiver reports through RTPRateController and through the loss
+                threshold algorithm of QTSSFlowControlModule side by side, and reports
+                how each one thinned the stream.
+                
+                Without -f it runs built in scenarios over a simulated bottleneck: a drop
+                tail queue drained at the link's capacity, with random loss in bursts on
+                top for a radio link. The reports each algorithm gets follow from what it
+                sent, so this shows how fast each backs off, how much it loses getting
+                there, and how often it changes its mind. -c runs them as a check, and
+                exits with 1 if the rate controller does worse than the old algorithm
+                where it is meant to do better.
+                
+                With -f the reports come from a trace instead, one per line:
+                
+                    <msec> <fraction lost, out of 256> <jitter msec> <round trip msec, or -1>
+                    
+                They are replayed as they are, whatever each algorithm sends, so they
+                show how the two react to the same client, not what that client would
+                have seen next.
+                
+                This is a program of its own, not part of the server.
+
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SafeStdLib.h"
+
+#include "getopt.h"
+#include "RTPRateController.h"
+
+static const UInt32 kNumQualityLevels = 2;      // as the reflector gives its streams: full, thinned, key frames only
+static const UInt32 kThinnedPercent = 60;       // of the full rate, about what thinning leaves of a reflected stream
+static const UInt32 kKeyFramesPercent = 15;
+static const UInt32 kPacketSize = 1400;
+static const UInt32 kTickMsec = 10;
+static const UInt32 kReportIntervalMsec = 1000; // randomized by half, as RFC 3550 has clients do
+static const UInt32 kBaseRoundTripMsec = 80;
+static const UInt32 kQueueMsec = 300;           // of the bottleneck's capacity, before it drops
+static const SInt64 kClockStart = 1000000;      // OS::Milliseconds is never 0, and the controller counts on it
+
+//
+// QTSSFlowControlModule::ProcessRTCPPacket at its default prefs, without the stream
+// dictionary. It gets the loss a QuickTime client puts in its APP packet. Getting better
+// and getting worse are never set, as they aren't by any other client.
+class LossThresholdFlowControl
+{
+    public:
+    
+        LossThresholdFlowControl() : fNumLossesAboveTol(0), fNumLossesBelowTol(0) {}
+        
+        SInt32  ProcessReceiverReport(UInt32 inFractionLost, SInt32 inCurLevel, UInt32 inNumLevels);
+        
+    private:
+    
+        enum
+        {
+            kLossThinTolerance  = 30,   // percent
+            kNumLossesToThin    = 3,
+            kLossThickTolerance = 5,    // percent
+            kLossesToThick      = 6
+        };
+        
+        UInt32  fNumLossesAboveTol;
+        UInt32  fNumLossesBelowTol;
+};
+
+//
+// What became of one algorithm over one run
+struct SimulationResult
+{
+    const char* fName;
+    UInt32      fNumLevelChanges;
+    UInt32      fMsecAtLevel[kNumQualityLevels + 1];
+    UInt64      fBytesSent;
+    UInt64      fBytesLost;
+    UInt64      fQueuingDelaySum;   // msec, summed over ticks
+    UInt32      fOverloadedMsec;    // sending faster than the link can carry
+    UInt32      fDurationMsec;
+};
+
+//
+// A bottleneck link. Its capacity changes with time, and past the queue, packets are
+// lost at random, at fLossPerMille, or at fBurstLossPerMille for a while once a burst
+// starts (a Gilbert-Elliott channel).
+struct Scenario
+{
+    const char* fName;
+    const char* fDescription;
+    UInt32      (*fCapacity)(UInt32 inMsec);    // bits/sec
+    UInt32      fLossPerMille;
+    UInt32      fBurstLossPerMille;
+    UInt32      fBurstStartsPerMillion;         // per packet
+    UInt32      fBurstEndsPerThousand;          // per packet
+    UInt32      fDurationSec;
+};
+
+static UInt32   sFullBitRate = 1000000;
+static Bool16   sVerbose = false;
+
+static UInt32   NextRandom(UInt32* ioSeed) { *ioSeed = (*ioSeed * 1103515245) + 12345; return *ioSeed >> 8; }
+static void     PrintUsage();
+
+SInt32 LossThresholdFlowControl::ProcessReceiverReport(UInt32 inFractionLost, SInt32 inCurLevel, UInt32 inNumLevels)
+{
+    // The module divides out the 256 it expects the client to multiply by
+    UInt32 thePercentLoss = (inFractionLost * 100) / 256;
+    Bool16 ratchetLess = false;
+    Bool16 ratchetMore = false;
+    
+    // Any report that doesn't add to a count clears it
+    if (thePercentLoss > kLossThinTolerance)
+    {
+        fNumLossesBelowTol = 0;
+        if (++fNumLossesAboveTol >= kNumLossesToThin)
+            ratchetLess = true;
+    }
+    else if (thePercentLoss < kLossThickTolerance)
+    {
+        fNumLossesAboveTol = 0;
+        if (++fNumLossesBelowTol >= kLossesToThick)
+            ratchetMore = true;
+    }
+    else
+    {
+        fNumLossesAboveTol = 0;
+        fNumLossesBelowTol = 0;
+    }
+    
+    if (!ratchetLess && !ratchetMore)
+        return inCurLevel;
+        
+    fNumLossesAboveTol = 0;
+    fNumLossesBelowTol = 0;
+    if (ratchetLess && (inCurLevel < (SInt32)inNumLevels))
+    {
+        inCurLevel++;
+        if (inCurLevel > 1)
+            inCurLevel = inNumLevels;
+    }
+    else if (ratchetMore && (inCurLevel > 0))
+    {
+        inCurLevel--;
+        if (inCurLevel > 1)
+            inCurLevel = 1;
+    }
+    return inCurLevel;
+}
+
+static UInt32 GetBitRate(SInt32 inLevel)
+{
+    if (inLevel == 0)
+        return sFullBitRate;
+    if (inLevel == 1)
+        return (sFullBitRate / 100) * kThinnedPercent;
+    return (sFullBitRate / 100) * kKeyFramesPercent;
+}
+
+//
+// Whichever algorithm is being run. Takes a report, returns the quality level to send at.
+static SInt32 ProcessReport(RTPRateController* inController, LossThresholdFlowControl* inFlowControl, SInt64 inMsec,
+                            UInt32 inFractionLost, UInt32 inJitterMsec, SInt64 inRoundTripMsec, UInt32 inByteCount, SInt32 inCurLevel)
+{
+    if (inFlowControl != NULL)
+        return inFlowControl->ProcessReceiverReport(inFractionLost, inCurLevel, kNumQualityLevels);
+        
+    inController->ProcessReceiverReport(kClockStart + inMsec, inFractionLost, inJitterMsec, inRoundTripMsec, inByteCount, inCurLevel == 0);
+    return inController->GetRecommendedQualityLevel(inCurLevel, kNumQualityLevels);
+}
+
+static void Simulate(Scenario* inScenario, Bool16 inUseFlowControl, SimulationResult* outResult)
+{
+    RTPRateController theController;
+    LossThresholdFlowControl theFlowControl;
+    LossThresholdFlowControl* theFlowControlPtr = inUseFlowControl ? &theFlowControl : NULL;
+    
+    ::memset(outResult, 0, sizeof(SimulationResult));
+    outResult->fName = inUseFlowControl ? "loss thresholds" : "rate controller";
+    outResult->fDurationMsec = inScenario->fDurationSec * 1000;
+    
+    // The same seed for both, so both get the same radio link
+    UInt32 theSeed = 4585;
+    SInt32 theLevel = 0;
+    Float64 theQueueBytes = 0;
+    Float64 theBytesToSend = 0;
+    Float64 theLastTransitMsec = -1;
+    Float64 theJitterMsec = 0;
+    Bool16 isInBurst = false;
+    UInt32 theNumExpected = 0;
+    UInt32 theNumLost = 0;
+    UInt32 theByteCount = 0;
+    UInt32 theNextReportMsec = kReportIntervalMsec;
+    
+    for (UInt32 theMsec = 0; theMsec < outResult->fDurationMsec; theMsec += kTickMsec)
+    {
+        UInt32 theCapacity = (*inScenario->fCapacity)(theMsec);
+        theQueueBytes -= ((Float64)theCapacity * kTickMsec) / 8000;
+        if (theQueueBytes < 0)
+            theQueueBytes = 0;
+            
+        UInt32 theBitRate = GetBitRate(theLevel);
+        if (theBitRate > theCapacity)
+            outResult->fOverloadedMsec += kTickMsec;
+        outResult->fMsecAtLevel[theLevel] += kTickMsec;
+        
+        theBytesToSend += ((Float64)theBitRate * kTickMsec) / 8000;
+        while (theBytesToSend >= kPacketSize)
+        {
+            theBytesToSend -= kPacketSize;
+            theByteCount += kPacketSize;
+            outResult->fBytesSent += kPacketSize;
+            theNumExpected++;
+            
+            // Drop tail at the bottleneck
+            if (theQueueBytes + kPacketSize > ((Float64)theCapacity * kQueueMsec) / 8000)
+            {
+                theNumLost++;
+                outResult->fBytesLost += kPacketSize;
+                continue;
+            }
+            theQueueBytes += kPacketSize;
+            Float64 theTransitMsec = (theQueueBytes * 8000) / theCapacity;
+            
+            // Then the radio
+            if (isInBurst)
+                isInBurst = (NextRandom(&theSeed) % 1000) >= inScenario->fBurstEndsPerThousand;
+            else
+                isInBurst = (NextRandom(&theSeed) % 1000000) < inScenario->fBurstStartsPerMillion;
+            UInt32 theLossPerMille = isInBurst ? inScenario->fBurstLossPerMille : inScenario->fLossPerMille;
+            if ((NextRandom(&theSeed) % 1000) < theLossPerMille)
+            {
+                theNumLost++;
+                outResult->fBytesLost += kPacketSize;
+                continue;
+            }
+            
+            // Interarrival jitter the way RFC 3550 has the client work it out
+            if (theLastTransitMsec >= 0)
+            {
+                Float64 theDifference = theTransitMsec - theLastTransitMsec;
+                if (theDifference < 0)
+                    theDifference = -theDifference;
+                theJitterMsec += (theDifference - theJitterMsec) / 16;
+            }
+            theLastTransitMsec = theTransitMsec;
+        }
+        outResult->fQueuingDelaySum += (UInt64)((theQueueBytes * 8000) / theCapacity);
+        
+        if (theMsec < theNextReportMsec)
+            continue;
+            
+        UInt32 theFractionLost = (theNumExpected > 0) ? (theNumLost * 256) / theNumExpected : 0;
+        if (theFractionLost > 255)
+            theFractionLost = 255;
+        SInt64 theRoundTripMsec = kBaseRoundTripMsec + (SInt64)((theQueueBytes * 8000) / theCapacity);
+        
+        SInt32 theNewLevel = ProcessReport(&theController, theFlowControlPtr, theMsec, theFractionLost, (UInt32)theJitterMsec,
+                                            theRoundTripMsec, theByteCount, theLevel);
+        if (sVerbose)
+            qtss_printf("  %-16s %7lu ms  capacity %5lu  loss %3lu/256  jitter %3lu  rtt %4ld  target %5lu  level %ld -> %ld\n", outResult->fName,
+                        theMsec, theCapacity / 1000, theFractionLost, (UInt32)theJitterMsec, (SInt32)theRoundTripMsec,
+                        inUseFlowControl ? 0 : theController.GetTargetBitRate() / 1000, theLevel, theNewLevel);
+        if (theNewLevel != theLevel)
+            outResult->fNumLevelChanges++;
+        theLevel = theNewLevel;
+        
+        theNumExpected = 0;
+        theNumLost = 0;
+        theNextReportMsec = theMsec + (kReportIntervalMsec / 2) + (NextRandom(&theSeed) % kReportIntervalMsec);
+    }
+}
+
+//
+// A trace says nothing about what the network did with what each algorithm sent, so
+// for one only the first columns mean anything
+static void PrintResultHeader(Bool16 inIsTrace)
+{
+    qtss_printf("  %-16s %8s %6s %8s %9s %10s", "", "changes", "full", "thinned", "keyframes", "sent kbps");
+    if (!inIsTrace)
+        qtss_printf(" %10s %7s %10s %11s", "recv kbps", "loss %", "queue ms", "overload s");
+    qtss_printf("\n");
+}
+
+static void PrintResult(SimulationResult* inResult, Bool16 inIsTrace)
+{
+    UInt32 theSec = inResult->fDurationMsec / 1000;
+    qtss_printf("  %-16s %8lu %5lus %7lus %8lus %10lu", inResult->fName, inResult->fNumLevelChanges,
+                inResult->fMsecAtLevel[0] / 1000, inResult->fMsecAtLevel[1] / 1000, inResult->fMsecAtLevel[kNumQualityLevels] / 1000,
+                (UInt32)((inResult->fBytesSent * 8) / theSec / 1000));
+    if (!inIsTrace)
+        qtss_printf(" %10lu %7.1f %10lu %11lu", (UInt32)(((inResult->fBytesSent - inResult->fBytesLost) * 8) / theSec / 1000),
+                    (inResult->fBytesSent > 0) ? ((Float64)inResult->fBytesLost * 100) / inResult->fBytesSent : 0.0,
+                    (UInt32)(inResult->fQueuingDelaySum / (inResult->fDurationMsec / kTickMsec)), inResult->fOverloadedMsec / 1000);
+    qtss_printf("\n");
+}
+
+//
+// The scenarios, all at the default 1 Mbit/s stream
+static UInt32 SteadyCapacity(UInt32 /*inMsec*/)   { return 3000000; }
+static UInt32 DropCapacity(UInt32 inMsec)         { return ((inMsec >= 60000) && (inMsec < 180000)) ? 500000 : 3000000; }
+
+// A phone moving about: the cell's capacity changes every few seconds, a third of the
+// time to less than the full rate
+static const UInt32 kMobileCapacityMsec = 7000;
+static UInt32 MobileCapacity(UInt32 inMsec)
+{
+    static const UInt32 sCapacities[] = { 2000, 1400, 800, 1100, 1800, 700, 1300, 2200, 900, 1600, 1200, 750 };
+    return sCapacities[(inMsec / kMobileCapacityMsec) % (sizeof(sCapacities) / sizeof(UInt32))] * 1000;
+}
+
+static Scenario sScenarios[] =
+{
+    { "steady",     "3 Mbit/s and no loss",                                 SteadyCapacity, 0,  0,   0,  0,  300 },
+    { "drop",       "3 Mbit/s, 500 kbit/s from 60 to 180 sec",              DropCapacity,   0,  0,   0,  0,  300 },
+    { "lossy",      "3 Mbit/s with 3% loss on the radio",                   SteadyCapacity, 30, 0,   0,  0,  300 },
+    { "mobile",     "0.7 to 2.2 Mbit/s, 1% loss, 30% in bursts of ~50",     MobileCapacity, 10, 300, 500, 20, 600 }
+};
+static const UInt32 kNumScenarios = sizeof(sScenarios) / sizeof(Scenario);
+
+//
+// What the rate controller is for. It must leave a clean link alone, get under a
+// capacity drop sooner and lose less doing it, not thin on loss that has nothing to do
+// with congestion, and follow a changing link without changing more often than it does.
+// The old algorithm barely reacts on the mobile link, so it isn't the bar for steadiness.
+static Bool16 CheckScenario(Scenario* inScenario, SimulationResult* inController, SimulationResult* inFlowControl)
+{
+    Bool16 isOK = true;
+    if (::strcmp(inScenario->fName, "steady") == 0)
+        isOK = (inController->fNumLevelChanges == 0);
+    else if (::strcmp(inScenario->fName, "drop") == 0)
+        isOK = (inController->fOverloadedMsec < inFlowControl->fOverloadedMsec) && (inController->fBytesLost < inFlowControl->fBytesLost);
+    else if (::strcmp(inScenario->fName, "lossy") == 0)
+        isOK = (inController->fMsecAtLevel[0] == inController->fDurationMsec);
+    else if (::strcmp(inScenario->fName, "mobile") == 0)
+        isOK = (inController->fBytesLost < inFlowControl->fBytesLost) && (inController->fOverloadedMsec < inFlowControl->fOverloadedMsec) &&
+                (inController->fNumLevelChanges <= inController->fDurationMsec / kMobileCapacityMsec);
+        
+    qtss_printf("%s: %s\n", inScenario->fName, isOK ? "ok" : "FAILED");
+    return isOK;
+}
+
+//
+// Replays a trace. The byte count the controller sees is what it would have sent.
+static Bool16 ReplayTrace(FILE* inTrace, Bool16 inUseFlowControl, SimulationResult* outResult)
+{
+    RTPRateController theController;
+    LossThresholdFlowControl theFlowControl;
+    LossThresholdFlowControl* theFlowControlPtr = inUseFlowControl ? &theFlowControl : NULL;
+    
+    ::memset(outResult, 0, sizeof(SimulationResult));
+    outResult->fName = inUseFlowControl ? "loss thresholds" : "rate controller";
+    
+    ::rewind(inTrace);
+    char theLine[256];
+    SInt32 theLevel = 0;
+    UInt32 theLastMsec = 0;
+    UInt32 theByteCount = 0;
+    UInt32 theLineNum = 0;
+    while (::fgets(theLine, sizeof(theLine), inTrace) != NULL)
+    {
+        theLineNum++;
+        if ((theLine[0] == '#') || (theLine[0] == '\n') || (theLine[0] == '\r'))
+            continue;
+            
+        unsigned long theMsec = 0;
+        unsigned long theFractionLost = 0;
+        unsigned long theJitterMsec = 0;
+        long theRoundTripMsec = -1;
+        if ((::sscanf(theLine, "%lu %lu %lu %ld", &theMsec, &theFractionLost, &theJitterMsec, &theRoundTripMsec) != 4) ||
+            (theMsec < theLastMsec) || (theFractionLost > 255))
+        {
+            qtss_printf("RTPRateControllerSimulator: line %lu of the trace isn't a report\n", theLineNum);
+            return false;
+        }
+        
+        UInt32 theElapsedMsec = theMsec - theLastMsec;
+        UInt32 theBytes = (UInt32)(((UInt64)GetBitRate(theLevel) * theElapsedMsec) / 8000);
+        theByteCount += theBytes;
+        outResult->fBytesSent += theBytes;
+        outResult->fMsecAtLevel[theLevel] += theElapsedMsec;
+        outResult->fDurationMsec += theElapsedMsec;
+        theLastMsec = theMsec;
+        
+        SInt32 theNewLevel = ProcessReport(&theController, theFlowControlPtr, theMsec, theFractionLost, theJitterMsec,
+                                            theRoundTripMsec, theByteCount, theLevel);
+        if (sVerbose)
+            qtss_printf("  %-16s %7lu ms  loss %3lu/256  jitter %3lu  rtt %4ld  target %5lu  level %ld -> %ld\n", outResult->fName,
+                        theMsec, theFractionLost, theJitterMsec, theRoundTripMsec,
+                        inUseFlowControl ? 0 : theController.GetTargetBitRate() / 1000, theLevel, theNewLevel);
+        if (theNewLevel != theLevel)
+            outResult->fNumLevelChanges++;
+        theLevel = theNewLevel;
+    }
+    
+    if (outResult->fDurationMsec < 1000)
+    {
+        qtss_printf("RTPRateControllerSimulator: the trace is less than a second long\n");
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    extern char* optarg;
+    int ch;
+    
+    char* theTracePath = NULL;
+    char* theScenarioName = NULL;
+    Bool16 isCheck = false;
+    
+    while ((ch = getopt(argc, argv, "f:s:r:cvh")) != EOF)
+    {
+        switch (ch)
+        {
+            case 'f': theTracePath = optarg; break;
+            case 's': theScenarioName = optarg; break;
+            case 'r': sFullBitRate = ::atoi(optarg) * 1000; break;
+            case 'c': isCheck = true; break;
+            case 'v': sVerbose = true; break;
+            default:
+                PrintUsage();
+                ::exit(0);
+        }
+    }
+    if ((sFullBitRate == 0) || (isCheck && ((theTracePath != NULL) || (sFullBitRate != 1000000))))
+    {
+        PrintUsage();
+        ::exit(-1);
+    }
+    
+    SimulationResult theFlowControlResult;
+    SimulationResult theControllerResult;
+    
+    if (theTracePath != NULL)
+    {
+        FILE* theTrace = ::fopen(theTracePath, "r");
+        if (theTrace == NULL)
+        {
+            qtss_printf("RTPRateControllerSimulator: couldn't open %s\n", theTracePath);
+            ::exit(-1);
+        }
+        Bool16 isReplayed = ReplayTrace(theTrace, true, &theFlowControlResult) && ReplayTrace(theTrace, false, &theControllerResult);
+        ::fclose(theTrace);
+        if (!isReplayed)
+            ::exit(-1);
+            
+        qtss_printf("%s, %lu sec\n", theTracePath, theControllerResult.fDurationMsec / 1000);
+        PrintResultHeader(true);
+        PrintResult(&theFlowControlResult, true);
+        PrintResult(&theControllerResult, true);
+        return 0;
+    }
+    
+    UInt32 theNumFailed = 0;
+    UInt32 theNumRun = 0;
+    for (UInt32 x = 0; x < kNumScenarios; x++)
+    {
+        if ((theScenarioName != NULL) && (::strcmp(sScenarios[x].fName, theScenarioName) != 0))
+            continue;
+            
+        Simulate(&sScenarios[x], true, &theFlowControlResult);
+        Simulate(&sScenarios[x], false, &theControllerResult);
+        theNumRun++;
+        if (isCheck)
+        {
+            if (!CheckScenario(&sScenarios[x], &theControllerResult, &theFlowControlResult))
+                theNumFailed++;
+            continue;
+        }
+        
+        qtss_printf("%s: %s, %lu sec\n", sScenarios[x].fName, sScenarios[x].fDescription, sScenarios[x].fDurationSec);
+        PrintResultHeader(false);
+        PrintResult(&theFlowControlResult, false);
+        PrintResult(&theControllerResult, false);
+    }
+    if (theNumRun == 0)
+    {
+        qtss_printf("RTPRateControllerSimulator: no scenario called %s\n", theScenarioName);
+        ::exit(-1);
+    }
+    return (theNumFailed > 0) ? 1 : 0;
+}
+
+void PrintUsage()
+{
+    qtss_printf("usage: RTPRateControllerSimulator [-s scenario] [-f trace] [-r kbit/s] [-c] [-v]\n");
+    qtss_printf("  -s: run just this scenario: steady, drop, lossy or mobile (default all of them)\n");
+    qtss_printf("  -f: replay the reports in this trace instead\n");
+    qtss_printf("  -r: the stream's full quality rate (default 1000)\n");
+    qtss_printf("  -c: check the rate controller against the old algorithm in every scenario\n");
+    qtss_printf("  -v: print every report and what each algorithm made of it\n");
+}
@@ -652,11 +652,19 @@ SInt64 RTPSession::Run()
     //RTSP requests coming in while it's sending packets
     {
         OSMutexLocker locker(&fSessionMutex);
+        
+        //
+        // Catch up on any RTCP that arrived while the mutex was busy
+        RTPStream** deferredStream = NULL;
+        UInt32 deferredStreamLen = 0;
+        for (int deferredIter = 0; this->GetValuePtr(qtssCliSesStreamObjects, deferredIter, (void**)&deferredStream, &deferredStreamLen) == QTSS_NoErr; deferredIter++)
+            if(deferredStream && *deferredStream)
+                (*deferredStream)->ProcessDeferredRTCPPackets();
 
         //just make sure we haven't been scheduled before our scheduled play
         //time. If so, reschedule ourselves for the proper time. (if client
         //sends a play while we are already playing, this may occur)
-        theParams.rtpSendPacketsParams.inCurrentTime = OS::Milliseconds();
+        theParams.rtpSendPacketsParams.inCurrentTime = OSThread::GetRunStartMilliseconds();
         if(fNextSendPacketsTime > theParams.rtpSendPacketsParams.inCurrentTime)
         {
             RTPStream** retransStream = NULL;
@@ -86,7 +86,8 @@ QTSSAttrInfoDict::AttrInfo  RTPSessionInterface::sAttributes[] =
 	/* 33 */ { "qtssCliSesOverBufferEnabled",       NULL, 	qtssAttrDataTypeBool16,		qtssAttrModeRead | qtssAttrModeWrite | qtssAttrModePreempSafe },
     /* 34 */ { "qtssCliSesRTCPPacketsRecv",         NULL,   qtssAttrDataTypeUInt32,         qtssAttrModeRead | qtssAttrModePreempSafe },
     /* 35 */ { "qtssCliSesRTCPBytesRecv",           NULL,   qtssAttrDataTypeUInt32,         qtssAttrModeRead | qtssAttrModePreempSafe },
-	/* 36 */ { "qtssCliSesStartedThinning",         NULL, 	qtssAttrDataTypeBool16,		qtssAttrModeRead | qtssAttrModeWrite  | qtssAttrModePreempSafe }
+	/* 36 */ { "qtssCliSesStartedThinning",         NULL, 	qtssAttrDataTypeBool16,		qtssAttrModeRead | qtssAttrModeWrite  | qtssAttrModePreempSafe },
+	/* 37 */ { "qtssCliSesInterleavedDataHandler",  NULL, 	qtssAttrDataTypeVoidPointer,	qtssAttrModeRead | qtssAttrModeWrite  | qtssAttrModePreempSafe }
     
 };
 
@@ -104,6 +105,7 @@ RTPSessionInterface::RTPSessionInterface()
     fLastQualityCheckTime(0),
 	fLastQualityCheckMediaTime(0),
 	fStartedThinning(false),    
+    fInterleavedDataHandler(NULL),
     fIsFirstPlay(true),
     fAllTracksInterleaved(true), // assume true until proven false!
     fFirstPlayTime(0),
@@ -195,6 +197,7 @@ QTSServerInterface::GetServer()->GetPrefs()->GetOverbufferRate()),
 	
 	this->SetVal(qtssCliSesOverBufferEnabled, this->GetOverbufferWindow()->OverbufferingEnabledPtr(), sizeof(Bool16));
 	this->SetVal(qtssCliSesStartedThinning, &fStartedThinning, sizeof(Bool16));
+	this->SetVal(qtssCliSesInterleavedDataHandler, &fInterleavedDataHandler, sizeof(fInterleavedDataHandler));
 	
 }
 
@@ -209,6 +212,11 @@ void RTPSessionInterface::SetValueComplete(UInt32 inAttrIndex, QTSSDictionaryMap
 		UInt32 newTimeOut = *((UInt32 *) inNewValue);
 		fTimeoutTask.SetTimeout((SInt64) newTimeOut);
 	}
+	else if(inAttrIndex == qtssCliSesInterleavedDataHandler)
+	{
+		// Wait for a call to the old handler to finish, so it may go away once this returns
+		OSMutexLocker locker(&fInterleavedDataMutex);
+	}
 }
 
 void RTPSessionInterface::UpdateRTSPSession(RTSPSessionInterface* inNewRTSPSession)
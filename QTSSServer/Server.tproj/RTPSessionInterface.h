@@ -98,6 +98,11 @@ class RTPSessionInterface : public QTSSDictionary, public Task
         UInt32          GetBytesSent()  { return fBytesSent; }
         OSRef*      GetRef()            { return &fRTPMapElem; }
         RTSPSessionInterface* GetRTSPSession() { return fRTSPSession; }
+        // Set by a module (qtssCliSesInterleavedDataHandler) that wants media pushed over RTSP.
+        // Only call the handler with GetInterleavedDataMutex held: setting the attribute
+        // takes it too, so once a module has cleared its handler no call is still running.
+        RTSPInterleavedDataHandler* GetInterleavedDataHandler() { return fInterleavedDataHandler; }
+        OSMutex*        GetInterleavedDataMutex()   { return &fInterleavedDataMutex; }
         UInt32      GetMovieAvgBitrate(){ return fMovieAverageBitRate; }
         QTSS_CliSesTeardownReason GetTeardownReason() { return fTeardownReason; }
         QTSS_RTPSessionState    GetSessionState() { return fState; }
@@ -183,6 +188,7 @@ class RTPSessionInterface : public QTSSDictionary, public Task
         SInt64          fLastQualityCheckTime;
 		SInt64			fLastQualityCheckMediaTime;
 		Bool16			fStartedThinning;
+        RTSPInterleavedDataHandler* fInterleavedDataHandler;
 		
         // Used by RTPStream to increment the RTCP packet and byte counts.
         void            IncrTotalRTCPPacketsRecv()         { fTotalRTCPPacketsRecv++; }
@@ -216,6 +222,10 @@ class RTPSessionInterface : public QTSSDictionary, public Task
         //responsible for managing this session. This allows the module to be
         //non-preemptive-safe with respect to a session
         OSMutex     fSessionMutex;
+        
+        //Held while the interleaved data handler is being called. Nothing else is taken
+        //under it, so unlike fSessionMutex it can be waited on from inside a module.
+        OSMutex     fInterleavedDataMutex;
 
         //Stores the session ID
         OSRef               fRTPMapElem;
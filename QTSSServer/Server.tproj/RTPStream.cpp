@@ -45,6 +45,7 @@
 #include "RTCPAPPPacket.h"
 #include "RTCPAckPacket.h"
 #include "RTCPSRPacket.h"
+#include "RTCPCompoundPacket.h"
 #include "SocketUtils.h"
 #include <errno.h>
 
@@ -95,7 +96,8 @@ QTSSAttrInfoDict::AttrInfo  RTPStream::sAttributes[] =
     /* 35 */ { "qtssRTPStrPacketCountInRTCPInterval",       NULL,   qtssAttrDataTypeUInt32, qtssAttrModeRead | qtssAttrModePreempSafe  },
     /* 36 */ { "qtssRTPStrSvrRTPPort",              NULL,   qtssAttrDataTypeUInt16, qtssAttrModeRead | qtssAttrModePreempSafe  },
     /* 37 */ { "qtssRTPStrClientRTPPort",           NULL,   qtssAttrDataTypeUInt16, qtssAttrModeRead | qtssAttrModePreempSafe  },
-    /* 38 */ { "qtssRTPStrNetworkMode",             NULL,   qtssAttrDataTypeUInt32, qtssAttrModeRead | qtssAttrModePreempSafe  }
+    /* 38 */ { "qtssRTPStrNetworkMode",             NULL,   qtssAttrDataTypeUInt32, qtssAttrModeRead | qtssAttrModePreempSafe  },
+    /* 39 */ { "qtssRTPStrRTPChannel",              NULL,   qtssAttrDataTypeUInt16, qtssAttrModeRead | qtssAttrModePreempSafe  }
 
 };
 
@@ -141,11 +143,15 @@ RTPStream::RTPStream(UInt32 inSSRC, RTPSessionInterface* inSession)
     fRemoteRTPPort(0),
     fRemoteRTCPPort(0),
     fLocalRTPPort(0),
+    fMulticastDestAddr(0),
+    fMulticastPort(0),
+    fMulticastTTL(0),
     fLastSenderReportTime(0),
     fPacketCount(0),
     fLastPacketCount(0),
     fPacketCountInRTCPInterval(0),
     fByteCount(0),
+    fClientOverbufferWindowSize(0),
     fTrackID(0),
     fSsrc(inSSRC),
     fSsrcStringPtr(fSsrcString, 0),
@@ -263,6 +269,7 @@ RTPStream::RTPStream(UInt32 inSSRC, RTPSessionInterface* inSession)
     this->SetVal(qtssRTPStrSvrRTPPort,          &fLocalRTPPort,         sizeof(fLocalRTPPort));
     this->SetVal(qtssRTPStrClientRTPPort,       &fRemoteRTPPort,        sizeof(fRemoteRTPPort));
     this->SetVal(qtssRTPStrNetworkMode,         &fNetworkMode,          sizeof(fNetworkMode));
+    this->SetVal(qtssRTPStrRTPChannel,          &fRTPChannel,           sizeof(fRTPChannel));
     
     
 }
@@ -275,7 +282,9 @@ RTPStream::~RTPStream()
         // If there is an UDP socket pair associated with this stream, make sure to free it up
         //fym Assert(fSockets->GetSocketB()->GetDemuxer() != NULL);
 		if(NULL == fSockets->GetSocketB()->GetDemuxer())//fym
+		{   this->DeleteDeferredRTCPPackets();
 			return;
+		}
 
         fSockets->GetSocketB()->GetDemuxer()->
             UnregisterTask(fRemoteAddr, fRemoteRTCPPort, this);
@@ -286,6 +295,9 @@ RTPStream::~RTPStream()
         QTSServerInterface::GetServer()->GetSocketPool()->ReleaseUDPSocketPair(fSockets);
     }
     
+    // Nothing can queue RTCP for us anymore
+    this->DeleteDeferredRTCPPackets();
+    
 #if RTP_PACKET_RESENDER_DEBUGGING
     //fResender.LogClose(fFlowControlDurationMsec);
     //qtss_printf("Flow control duration msec: %"_64BITARG_"d. Max outstanding packets: %d\n", fFlowControlDurationMsec, fResender.GetMaxPacketsInList());
@@ -423,7 +435,17 @@ QTSS_Error RTPStream::Setup(RTSPRequestInterface* request, QTSS_AddStreamFlags i
     //same as the RTSP client's IP address, unless an alternate was specified in the
     //transport header.
     fRemoteAddr = request->GetSession()->GetSocket()->GetRemoteAddr();
-    if(request->GetDestAddr() != INADDR_ANY)
+    
+    // A module may be sending this stream to a multicast group on its own. If so the
+    // client is told to join the group, and the unicast sockets set up below are only
+    // there to hear its RTCP. Any destination the client asked for doesn't matter then.
+    fMulticastDestAddr = request->GetMulticastDestAddr();
+    if(fMulticastDestAddr != 0)
+    {
+        fMulticastPort = request->GetMulticastPort();
+        fMulticastTTL = request->GetMulticastTTL();
+    }
+    else if(request->GetDestAddr() != INADDR_ANY)
     {
         // Sending data to other addresses could be used in malicious ways, therefore
         // it is up to the module as to whether this sort of request might be allowed
@@ -433,6 +455,13 @@ QTSS_Error RTPStream::Setup(RTSPRequestInterface* request, QTSS_AddStreamFlags i
     }
     fRemoteRTPPort = request->GetClientPortA();
     fRemoteRTCPPort = request->GetClientPortB();
+    
+    // A client asking for multicast sends port= rather than client_port=
+    if((fMulticastDestAddr != 0) && (fRemoteRTPPort == 0))
+    {
+        fRemoteRTPPort = fMulticastPort;
+        fRemoteRTCPPort = fMulticastPort + 1;
+    }
 
     if((fRemoteRTPPort == 0) || (fRemoteRTCPPort == 0))
         return QTSSModuleUtils::SendErrorResponse(request, qtssClientBadRequest, qtssMsgNoClientPortInTransport);       
@@ -600,7 +629,29 @@ void RTPStream::AppendTransport(RTSPRequestInterface* request)
             theSrcIPAddress = *fSockets->GetSocketA()->GetLocalAddrStr();
 
 
-        if(request->IsPushRequest())
+        if(fMulticastDestAddr != 0)
+        {
+            // Not an echo of what the client sent. We're telling it where to find the stream.
+            char theGroupBuf[20];
+            StrPtrLen theGroupStr(theGroupBuf, sizeof(theGroupBuf));
+            struct in_addr theGroupAddr;
+            theGroupAddr.s_addr = htonl(fMulticastDestAddr);
+            SocketUtils::ConvertAddrToString(theGroupAddr, &theGroupStr);
+            
+            char theSrcIPAddrBuf[20];
+            UInt32 theSrcIPAddrLen = (theSrcIPAddress.Len < sizeof(theSrcIPAddrBuf)) ? theSrcIPAddress.Len : sizeof(theSrcIPAddrBuf) - 1;
+            ::memcpy(theSrcIPAddrBuf, theSrcIPAddress.Ptr, theSrcIPAddrLen);
+            theSrcIPAddrBuf[theSrcIPAddrLen] = 0;
+            
+            char theTransportBuf[128];
+            qtss_snprintf(theTransportBuf, sizeof(theTransportBuf) - 1, "RTP/AVP;multicast;destination=%s;port=%u-%u;ttl=%u;source=%s",
+                            theGroupBuf, fMulticastPort, fMulticastPort + 1, fMulticastTTL, theSrcIPAddrBuf);
+            theTransportBuf[sizeof(theTransportBuf) - 1] = 0;
+            
+            StrPtrLen theTransportStr(theTransportBuf);
+            request->AppendHeader(qtssTransportHeader, &theTransportStr);
+        }
+        else if(request->IsPushRequest())
         {
             char rtpPortStr[10];
             char rtcpPortStr[10];
@@ -964,7 +1015,7 @@ QTSS_Error  RTPStream::Write(void* inBuffer, UInt32 inLen, UInt32* outLenWritten
 
 
     QTSS_Error err = QTSS_NoErr;
-    SInt64 theTime = OS::Milliseconds();
+    SInt64 theTime = OSThread::GetRunStartMilliseconds();
     
     //
     // Data passed into this version of write must be a QTSS_PacketStruct
@@ -1045,7 +1096,16 @@ QTSS_Error  RTPStream::Write(void* inBuffer, UInt32 inLen, UInt32* outLenWritten
 
 		//qtss_printf("*");//fym
 
-        if(this->UpdateQualityLevel(thePacket->packetTransmitTime, theCurrentPacketDelay, theTime, inLen))
+        Bool16 shouldSend = this->UpdateQualityLevel(thePacket->packetTransmitTime, theCurrentPacketDelay, theTime, inLen);
+        
+        //
+        // TCP and reliable UDP streams share one quality level for the session. Copy it
+        // into qtssRTPStrQualityLevel so modules that thin packets before writing them,
+        // like the reflector, see the level that is actually in effect.
+        if(fTransportType != qtssRTPTransportTypeUDP)
+            fQualityLevel = fSession->GetQualityLevel();
+            
+        if(shouldSend)
         {
             if( fTransportType == qtssRTPTransportTypeTCP )    // write out in interleave format on the RTSP TCP channel
                 err = this->InterleavedWrite( thePacket->packetData, inLen, outLenWritten, fRTPChannel );       
@@ -1113,11 +1173,7 @@ QTSS_Error  RTPStream::Write(void* inBuffer, UInt32 inLen, UInt32* outLenWritten
             fSession->GetOverbufferWindow()->AddPacketToWindow(inLen);
             fSession->UpdatePacketsSent(1);
             fSession->UpdateBytesSent(inLen);
-            QTSServerInterface::GetServer()->IncrementTotalRTPBytes(inLen);
-            QTSServerInterface::GetServer()->IncrementTotalPackets();
-            
-            QTSServerInterface::GetServer()->IncrementTotalLate(theCurrentPacketDelay);
-            QTSServerInterface::GetServer()->IncrementTotalQuality(this->GetQualityLevel());
+            QTSServerInterface::GetServer()->IncrementSendStats(inLen, theCurrentPacketDelay, this->GetQualityLevel());
 
             // Record the RTP timestamp for RTCPs
             UInt32* timeStampP = (UInt32*)(thePacket->packetData);
@@ -1216,60 +1272,97 @@ void RTPStream::ProcessIncomingInterleavedData(UInt8 inChannelNum, RTSPSessionIn
 
 void RTPStream::ProcessIncomingRTCPPacket(StrPtrLen* inPacket)
 {
-    StrPtrLen currentPtr(*inPacket);
-    SInt64 curTime = OS::Milliseconds();
-
-
     // Modules are guarenteed atomic access to the session. Also, the RTSP Session accessed
     // below could go away at any time. So we need to lock the RTP session mutex.
-    // *BUT*, when this function is called the caller already has the UDP socket pool &
-    // UDP Demuxer mutexes. Blocking on grabbing this mutex could cause a deadlock.
-    // So, dump this RTCP packet if we can't get the mutex.
+    // *BUT*, when this function is called the caller already has the UDP Demuxer mutex.
+    // Blocking on grabbing this mutex could cause a deadlock. So, if we can't get the
+    // mutex, queue a copy of the packet for whoever holds the mutex to process.
+    // Dropping it would lose the receiver report that flow control depends on.
     if(!fSession->GetSessionMutex()->TryLock())
+    {
+        OSMutexLocker locker(&fDeferredRTCPMutex);
+        if(fDeferredRTCPQueue.GetLength() < kMaxDeferredRTCPPackets)
+            fDeferredRTCPQueue.EnQueue(&(NEW DeferredRTCPPacket(inPacket))->fElem);
         return;
+    }
+    
+    // Anything that got queued while the mutex was busy came first
+    this->ProcessDeferredRTCPPackets();
+    this->ProcessRTCPPacket(inPacket);
     
+    fSession->GetSessionMutex()->Unlock();
+}
+
+void RTPStream::ProcessDeferredRTCPPackets()
+{
+    // Cheap check first, this gets called on every RTPSession::Run
+    if(fDeferredRTCPQueue.GetLength() == 0)
+        return;
+        
+    while (true)
+    {
+        OSQueueElem* theElem = NULL;
+        {
+            OSMutexLocker locker(&fDeferredRTCPMutex);
+            theElem = fDeferredRTCPQueue.DeQueue();
+        }
+        if(theElem == NULL)
+            break;
+            
+        DeferredRTCPPacket* thePacket = (DeferredRTCPPacket*)theElem->GetEnclosingObject();
+        this->ProcessRTCPPacket(&thePacket->fPacket);
+        delete thePacket;
+    }
+}
+
+void RTPStream::DeleteDeferredRTCPPackets()
+{
+    OSMutexLocker locker(&fDeferredRTCPMutex);
+    for (OSQueueElem* theElem = fDeferredRTCPQueue.DeQueue(); theElem != NULL; theElem = fDeferredRTCPQueue.DeQueue())
+        delete (DeferredRTCPPacket*)theElem->GetEnclosingObject();
+}
+
+void RTPStream::ProcessRTCPPacket(StrPtrLen* inPacket)
+{
+    SInt64 curTime = OS::Milliseconds();
+
     //no matter what happens (whether or not this is a valid packet) reset the timeouts
     fSession->RefreshTimeout();
     if(fSession->GetRTSPSession() != NULL)
         fSession->GetRTSPSession()->RefreshTimeout();
         
-    while ( currentPtr.Len > 0 )
+    //
+    // Split the compound packet up front. This checks every header in the datagram
+    // against the bytes that are actually there, so the cases below can read their
+    // packet without checking lengths again.
+    RTCPCompoundPacket compoundPacket;
+    if(!compoundPacket.Parse((UInt8*)inPacket->Ptr, inPacket->Len))
+        return;//abort if we discover a malformed RTCP packet
+        
+    for (UInt32 packetIndex = 0; packetIndex < compoundPacket.GetNumPackets(); packetIndex++)
     {
-        /*
-            Due to the variable-type nature of RTCP packets, this is a bit unusual...
-            We initially treat the packet as a generic RTCPPacket in order to determine its'
-            actual packet type.  Once that is figgered out, we treat it as its' actual packet type
-        */
-        RTCPPacket rtcpPacket;
-        if(!rtcpPacket.ParsePacket((UInt8*)currentPtr.Ptr, currentPtr.Len))
-        {   fSession->GetSessionMutex()->Unlock();
-            return;//abort if we discover a malformed RTCP packet
-        }
-        // Increment our RTCP Packet and byte counters for the session.
+        RTCPPacketView* rtcpPacket = compoundPacket.GetPacket(packetIndex);
+        UInt8* packetBuffer = rtcpPacket->GetBuffer();
+        UInt32 packetLen = rtcpPacket->GetLength();
         
+        // Increment our RTCP Packet and byte counters for the session.
         fSession->IncrTotalRTCPPacketsRecv();
-        fSession->IncrTotalRTCPBytesRecv( (SInt16) currentPtr.Len);
+        fSession->IncrTotalRTCPBytesRecv( (SInt16) packetLen);
 
-        switch (rtcpPacket.GetPacketType())
+        switch (rtcpPacket->GetPacketType())
         {
-            case RTCPPacket::kReceiverPacketType:
+            case RTCPPacketView::kRRPacketType:
             {
-                RTCPReceiverPacket receiverPacket;
-                if(!receiverPacket.ParseReceiverReport((UInt8*)currentPtr.Ptr, currentPtr.Len))
-                {   fSession->GetSessionMutex()->Unlock();
-                    return;//abort if we discover a malformed receiver report
-                }
-
-                this->PrintPacketPrefEnabled(currentPtr.Ptr,  currentPtr.Len, RTPStream::rtcpRR);
+                this->PrintPacketPrefEnabled((char*)packetBuffer, packetLen, RTPStream::rtcpRR);
 
                 //
                 // Set the Client SSRC based on latest RTCP
-                fClientSSRC = rtcpPacket.GetPacketSSRC();
+                fClientSSRC = rtcpPacket->GetSSRC();
 
-                fFractionLostPackets = receiverPacket.GetCumulativeFractionLostPackets();
-                fJitter = receiverPacket.GetCumulativeJitter();
+                fFractionLostPackets = rtcpPacket->GetCumulativeFractionLostPackets();
+                fJitter = rtcpPacket->GetCumulativeJitter();
                 
-                UInt32 curTotalLostPackets = receiverPacket.GetCumulativeTotalLostPackets();
+                UInt32 curTotalLostPackets = rtcpPacket->GetCumulativeTotalLostPackets();
                 
                 // Workaround for client problem.  Sometimes it appears to report a bogus lost packet count.
                 // Since we can't have lost more packets than we sent, ignore the packet if that seems to be the case.
@@ -1295,26 +1388,27 @@ void RTPStream::ProcessIncomingRTCPPacket(StrPtrLen* inPacket)
                     fPacketCountInRTCPInterval = fPacketCount - fLastPacketCount;
                     fLastPacketCount = fPacketCount;
                 }
+                
+                if((fTransportType != qtssRTPTransportTypeTCP) && (rtcpPacket->GetCount() > 0))
+                    this->ProcessReceiverReport(rtcpPacket, curTime);
 
 #ifdef DEBUG_RTCP_PACKETS
-                receiverPacket.Dump();
+                RTCPReceiverPacket receiverPacket;
+                if(receiverPacket.ParseReceiverReport(packetBuffer, packetLen))
+                    receiverPacket.Dump();
 #endif
             }
             break;
             
-            case RTCPPacket::kAPPPacketType:
+            case RTCPPacketView::kAPPPacketType:
             {   
                 //
                 // Check and see if this is an Ack packet. If it is, update the UDP Resender
                 RTCPAckPacket theAckPacket;
-                UInt8* packetBuffer = rtcpPacket.GetPacketBuffer();
-                UInt32 packetLen = (rtcpPacket.GetPacketLength() * 4) + RTCPPacket::kRTCPHeaderSizeInBytes;
-                
-                
                 if(theAckPacket.ParseAckPacket(packetBuffer, packetLen))
                 {
                     if(NULL != fTracker && false == fTracker->ReadyForAckProcessing()) // this stream must be ready to receive acks.  Between RTSP setup and sending of first packet on stream we must protect against a bad ack.
-                    {   fSession->GetSessionMutex()->Unlock();
+                    {
                         return;//abort if we receive an ack when we haven't sent anything.
                     }
                         
@@ -1343,8 +1437,8 @@ void RTPStream::ProcessIncomingRTCPPacket(StrPtrLen* inPacket)
                    //
                     // If it isn't an ACK, assume its the qtss APP packet
                     RTCPCompressedQTSSPacket compressedQTSSPacket;
-                    if(!compressedQTSSPacket.ParseCompressedQTSSPacket((UInt8*)currentPtr.Ptr, currentPtr.Len))
-                    {   fSession->GetSessionMutex()->Unlock();
+                    if(!compressedQTSSPacket.ParseCompressedQTSSPacket(packetBuffer, packetLen))
+                    {
                         return;//abort if we discover a malformed app packet
                     }
                     
@@ -1376,7 +1470,8 @@ void RTPStream::ProcessIncomingRTCPPacket(StrPtrLen* inPacket)
                     if(fTransportType != qtssRTPTransportTypeUDP)
                     {
 //                      qtss_printf("Setting over buffer to %d\n", compressedQTSSPacket.GetOverbufferWindowSize());
-                        fSession->GetOverbufferWindow()->SetWindowSize(compressedQTSSPacket.GetOverbufferWindowSize());
+                        fClientOverbufferWindowSize = compressedQTSSPacket.GetOverbufferWindowSize();
+                        this->UpdateOverbufferWindowSize();
                     }
                     
 #ifdef DEBUG_RTCP_PACKETS
@@ -1386,12 +1481,12 @@ void RTPStream::ProcessIncomingRTCPPacket(StrPtrLen* inPacket)
             }
             break;
             
-            case RTCPPacket::kSDESPacketType:
+            case RTCPPacketView::kSDESPacketType:
             {
 #ifdef DEBUG_RTCP_PACKETS
                 SourceDescriptionPacket sedsPacket;
-                if(!sedsPacket.ParsePacket((UInt8*)currentPtr.Ptr, currentPtr.Len))
-                {   fSession->GetSessionMutex()->Unlock();
+                if(!sedsPacket.ParsePacket(packetBuffer, packetLen))
+                {
                     return;//abort if we discover a malformed app packet
                 }
 
@@ -1405,10 +1500,6 @@ void RTPStream::ProcessIncomingRTCPPacket(StrPtrLen* inPacket)
             break;
         
         }
-        
-        
-        currentPtr.Ptr += (rtcpPacket.GetPacketLength() * 4 ) + 4;
-        currentPtr.Len -= (rtcpPacket.GetPacketLength() * 4 ) + 4;
     }
 
     // Invoke the RTCP modules, allowing them to process this packet
@@ -1424,8 +1515,74 @@ void RTPStream::ProcessIncomingRTCPPacket(StrPtrLen* inPacket)
     // Invoke RTCP processing modules
     for (UInt32 x = 0; x < QTSServerInterface::GetNumModulesInRole(QTSSModule::kRTCPProcessRole); x++)
         (void)QTSServerInterface::GetModule(QTSSModule::kRTCPProcessRole, x)->CallDispatch(QTSS_RTCPProcess_Role, &theParams);
+}
 
-    fSession->GetSessionMutex()->Unlock();
+void RTPStream::ProcessReceiverReport(RTCPPacketView* inReport, const SInt64& inCurTime)
+{
+    //
+    // Use the report block about this stream if there is one, otherwise the first
+    UInt32 theReportNum = 0;
+    for (UInt32 x = 0; x < inReport->GetCount(); x++)
+    {
+        if(inReport->GetReportSourceID(x) == fSsrc)
+        {
+            theReportNum = x;
+            break;
+        }
+    }
+    
+    //
+    // The round trip time is now, minus when we sent the SR the client is
+    // answering (LSR), minus how long the client held on to it (DLSR). All three
+    // are the middle 32 bits of an NTP timestamp, so in 1/65536 sec units.
+    SInt64 theRoundTripMsec = -1;
+    UInt32 theLastSRTime = inReport->GetLastSenderReportTime(theReportNum);
+    if(theLastSRTime != 0)
+    {
+        SInt64 theNTPTime = fSession->GetNTPPlayTime() + OS::TimeMilli_To_Fixed64Secs(inCurTime - fSession->GetPlayTime());
+        UInt32 theRoundTrip = ((UInt32)(theNTPTime >> 16) - theLastSRTime - inReport->GetLastSenderReportDelay(theReportNum)) & 0xFFFFFFFF;
+        if(theRoundTrip < 0x80000000) // otherwise the clocks don't make sense, so ignore it
+            theRoundTripMsec = ((SInt64)theRoundTrip * 1000) >> 16;
+    }
+    
+    UInt32 theJitterMsec = 0;
+    if(fTimescale > 0)
+        theJitterMsec = (UInt32)(((SInt64)inReport->GetJitter(theReportNum) * 1000) / fTimescale);
+        
+    fRateController.ProcessReceiverReport(inCurTime, inReport->GetFractionLostPackets(theReportNum), theJitterMsec,
+                                            theRoundTripMsec, fByteCount, this->GetQualityLevel() == 0);
+    
+    if(!QTSServerInterface::GetServer()->GetPrefs()->RTCPRateControlEnabled())
+        return;
+        
+    //
+    // On plain UDP the target picks the quality level. Reliable UDP streams are thinned
+    // by UpdateQualityLevel for the whole session, so there the target only limits how
+    // far ahead we send.
+    if(fTransportType == qtssRTPTransportTypeUDP)
+    {
+        SInt32 theLevel = fRateController.GetRecommendedQualityLevel(this->GetQualityLevel(), fNumQualityLevels);
+        if(theLevel != this->GetQualityLevel())
+            this->SetQualityLevel(theLevel);
+    }
+    else if(fTransportType == qtssRTPTransportTypeReliableUDP)
+        this->UpdateOverbufferWindowSize();
+}
+
+void RTPStream::UpdateOverbufferWindowSize()
+{
+    if(fClientOverbufferWindowSize == 0)
+        return;
+        
+    UInt32 theWindowSize = fClientOverbufferWindowSize;
+    UInt32 theTargetBitRate = fRateController.GetTargetBitRate();
+    if((fTransportType == qtssRTPTransportTypeReliableUDP) && (theTargetBitRate > 0) &&
+        QTSServerInterface::GetServer()->GetPrefs()->RTCPRateControlEnabled())
+    {
+        if(theWindowSize > theTargetBitRate / 8)
+            theWindowSize = theTargetBitRate / 8;
+    }
+    fSession->GetOverbufferWindow()->SetWindowSize(theWindowSize);
 }
 
 char* RTPStream::GetStreamTypeStr()
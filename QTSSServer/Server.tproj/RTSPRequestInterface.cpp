@@ -101,7 +101,10 @@ QTSSAttrInfoDict::AttrInfo  RTSPRequestInterface::sAttributes[] =
     /* 34 */ { "qtssRTSPReqAuthScheme",         NULL,                   qtssAttrDataTypeUInt32,     qtssAttrModeRead | qtssAttrModePreempSafe | qtssAttrModeWrite },
     /* 35 */ { "qtssRTSPReqSkipAuthorization",  NULL,                   qtssAttrDataTypeBool16,     qtssAttrModeRead | qtssAttrModePreempSafe | qtssAttrModeWrite },
     /* 36 */ { "qtssRTSPReqNetworkMode",		NULL,					qtssAttrDataTypeUInt32,		qtssAttrModeRead | qtssAttrModePreempSafe },
-    /* 37 */ { "qtssRTSPReqDynamicRateValue",	NULL,					qtssAttrDataTypeSInt32,		qtssAttrModeRead | qtssAttrModePreempSafe }
+    /* 37 */ { "qtssRTSPReqDynamicRateValue",	NULL,					qtssAttrDataTypeSInt32,		qtssAttrModeRead | qtssAttrModePreempSafe },
+    /* 38 */ { "qtssRTSPReqMulticastDestAddr",  NULL,                   qtssAttrDataTypeUInt32,     qtssAttrModeRead | qtssAttrModePreempSafe | qtssAttrModeWrite },
+    /* 39 */ { "qtssRTSPReqMulticastPort",      NULL,                   qtssAttrDataTypeUInt16,     qtssAttrModeRead | qtssAttrModePreempSafe | qtssAttrModeWrite },
+    /* 40 */ { "qtssRTSPReqMulticastTTL",       NULL,                   qtssAttrDataTypeUInt16,     qtssAttrModeRead | qtssAttrModePreempSafe | qtssAttrModeWrite }
  };
 
 
@@ -139,7 +142,7 @@ void  RTSPRequestInterface::Initialize()
 
 //CONSTRUCTOR / DESTRUCTOR: very simple stuff
 RTSPRequestInterface::RTSPRequestInterface(RTSPSessionInterface *session)
-:   QTSSDictionary(QTSSDictionaryMap::GetMap(QTSSDictionaryMap::kRTSPRequestDictIndex)),
+:   QTSSDictionary(QTSSDictionaryMap::GetMap(QTSSDictionaryMap::kRTSPRequestDictIndex), NULL, fRequestArena, kRequestArenaSizeInBytes),
 	fMethod(qtssIllegalMethod),
 	fStatus(qtssSuccessOK),
     fRealStatusCode(0),
@@ -162,7 +165,7 @@ RTSPRequestInterface::RTSPRequestInterface(RTSPSessionInterface *session)
     fPrebufferAmt(-1),
     fWindowSize(0),
     fMovieFolderPtr(&fMovieFolderPath[0]),
-    fHeaderDictionary(QTSSDictionaryMap::GetMap(QTSSDictionaryMap::kRTSPHeaderDictIndex)),
+    fHeaderDictionary(QTSSDictionaryMap::GetMap(QTSSDictionaryMap::kRTSPHeaderDictIndex), NULL, fHeaderArena, kHeaderArenaSizeInBytes),
     fAllowed(true),
     fTransportMode(qtssRTPTransportModePlay),
     fSetUpServerPort(0),
@@ -174,6 +177,9 @@ RTSPRequestInterface::RTSPRequestInterface(RTSPSessionInterface *session)
     fStale(false),
     fSkipAuthorization(false),
     fEnableDynamicRateState(-1),// -1 undefined, 0 disabled, 1 enabled
+    fMulticastDestAddr(0),
+    fMulticastPort(0),
+    fMulticastTTL(0),
 	// DJM PROTOTYPE
 	fRandomDataSize(0),
     fSession(session),
@@ -217,6 +223,9 @@ RTSPRequestInterface::RTSPRequestInterface(RTSPSessionInterface *session)
     this->SetVal(qtssRTSPReqSkipAuthorization, &fSkipAuthorization, sizeof(fSkipAuthorization));
 
     this->SetVal(qtssRTSPReqDynamicRateState, &fEnableDynamicRateState, sizeof(fEnableDynamicRateState));
+    this->SetVal(qtssRTSPReqMulticastDestAddr, &fMulticastDestAddr, sizeof(fMulticastDestAddr));
+    this->SetVal(qtssRTSPReqMulticastPort, &fMulticastPort, sizeof(fMulticastPort));
+    this->SetVal(qtssRTSPReqMulticastTTL, &fMulticastTTL, sizeof(fMulticastTTL));
  }
 
 void RTSPRequestInterface::AppendHeader(QTSS_RTSPHeader inHeader, StrPtrLen* inValue)
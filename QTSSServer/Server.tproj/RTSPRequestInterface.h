@@ -190,6 +190,11 @@ class RTSPRequestInterface : public QTSSDictionary
 
 		SInt32                      GetDynamicRateState()       { return fEnableDynamicRateState; }
         
+        // A module may have this SETUP answered with a multicast group instead of unicast
+        UInt32                      GetMulticastDestAddr()      { return fMulticastDestAddr; }
+        UInt16                      GetMulticastPort()          { return fMulticastPort; }
+        UInt16                      GetMulticastTTL()           { return fMulticastTTL; }
+        
 		// DJM PROTOTYPE
 		UInt32						GetRandomDataSize()			{ return fRandomDataSize; }
         
@@ -201,7 +206,13 @@ class RTSPRequestInterface : public QTSSDictionary
         enum
         {
             kMovieFolderBufSizeInBytes = 256,   //Uint32
-            kMaxFilePathSizeInBytes = 256       //Uint32
+            kMaxFilePathSizeInBytes = 256,      //Uint32
+            
+            // Attribute storage for this request and its headers. Both dictionaries
+            // carve their value arrays and any copied values out of these, so a
+            // request costs no heap allocations unless a value outgrows them.
+            kRequestArenaSizeInBytes = 2048,    //Uint32
+            kHeaderArenaSizeInBytes = 2560      //Uint32
         };
         
         QTSS_RTSPMethod             fMethod;            //Method of this request
@@ -244,6 +255,8 @@ class RTSPRequestInterface : public QTSSDictionary
         char                        fMovieFolderPath[kMovieFolderBufSizeInBytes];
         char*                       fMovieFolderPtr;
         
+        char                        fRequestArena[kRequestArenaSizeInBytes];
+        char                        fHeaderArena[kHeaderArenaSizeInBytes];
         QTSSDictionary              fHeaderDictionary;
         
         Bool16                      fAllowed;
@@ -270,6 +283,10 @@ class RTSPRequestInterface : public QTSSDictionary
 
 		SInt32                      fEnableDynamicRateState;
         
+        UInt32                      fMulticastDestAddr;
+        UInt16                      fMulticastPort;
+        UInt16                      fMulticastTTL;
+        
 		// DJM PROTOTYPE
 		UInt32						fRandomDataSize;
         
@@ -38,316 +38,375 @@
 #include "base64.h"
 #include "OSArrayObjectDeleter.h"
 #include "OS.h"
+#include "QTSServer.h"
 
 #include <errno.h>
 
 #define READ_DEBUGGING 0
 
-/*RTSPRequestStream::RTSPRequestStream(TCPSocket* sock)
+RTSPRequestStream::RTSPRequestStream(TCPSocket* sock)
 :   fSocket(sock),
-    fRetreatBytes(0), 
-    fRetreatBytesRead(0),
-    fCurOffset(0),
+    fBuffer(NEW char[kRequestBufferSizeInBytes + sizeof(fEncodedBytes)]),
+    fBufferSize(kRequestBufferSizeInBytes + sizeof(fEncodedBytes)),
+    fMsgStart(0),
+    fParsePos(0),
+    fEnd(0),
+    fMsgLen(0),
+    fSnarfedBytes(0),
+    fParseState(kParsingMessageStart),
+    fFirstLineHasSpace(false),
     fEncodedBytesRemaining(0),
-    fRequest(fRequestBuffer, 0),
+    fDataHandler(NULL),
+    fNumFrames(0),
     fRequestPtr(NULL),
     fDecode(false),
+    fIsDataPacket(false),
     fPrintRTSP(false)
-{}*/
+{}
 
 void RTSPRequestStream::SnarfRetreat( RTSPRequestStream &fromRequest )
 {
     // Simplest thing to do is to just completely blow away everything in this current
-    // stream, and replace it with the retreat bytes from the other stream.
+    // stream, and replace it with the unread bytes from the other stream. They are
+    // treated as if they had just come off the socket, so they get decoded if need be.
     fRequestPtr = NULL;
-    Assert(fRetreatBytes < kRequestBufferSizeInBytes);
-    fRetreatBytes = fromRequest.fRetreatBytes;
-    fEncodedBytesRemaining = fCurOffset = fRequest.Len = 0;
-    ::memcpy(&fRequestBuffer[0], fromRequest.fRequest.Ptr + fromRequest.fRequest.Len, fromRequest.fRetreatBytes);
+    fParseState = kParsingMessageStart;
+    fMsgStart = fParsePos = fEnd = fEncodedBytesRemaining = 0;
+    
+    fSnarfedBytes = 0;
+    
+    UInt32 theSnarfedLen = fromRequest.fEnd - fromRequest.fMsgStart;
+    this->MakeRoom(theSnarfedLen + 1);
+    ::memcpy(fBuffer, &fromRequest.fBuffer[fromRequest.fMsgStart], theSnarfedLen);
+    fSnarfedBytes = theSnarfedLen;
 }
 
-//ȡRTSP󼰷RTSP
-unsigned long timestamp = timeGetTime();
-QTSS_Error RTSPRequestStream::ReadRequest()
+void RTSPRequestStream::MakeRoom(UInt32 inMsgLen)
 {
-	//qtss_printf("\nRTSPRequestStream::ReadRequest 1");//fym
+    // Everything has been consumed, so just start over at the front of the buffer.
+    if (fMsgStart == fEnd)
+        fMsgStart = fParsePos = fEnd = 0;
+        
+    // Leave 1 byte for the terminator the base64 decoder needs
+    if (fMsgStart + inMsgLen < fBufferSize)
+        return;
+    
+    UInt32 thePendingLen = fEnd - fMsgStart + fSnarfedBytes;
+    if (inMsgLen < fBufferSize)
+    {
+        // The message fits, it just doesn't fit where it is. Wrap it to the front.
+        ::memmove(fBuffer, &fBuffer[fMsgStart], thePendingLen);
+    }
+    else
+    {
+        UInt32 theNewSize = fBufferSize;
+        while (theNewSize <= inMsgLen)
+            theNewSize *= 2;
+            
+        char* theNewBuffer = NEW char[theNewSize];
+        ::memcpy(theNewBuffer, &fBuffer[fMsgStart], thePendingLen);
+        delete [] fBuffer;
+        fBuffer = theNewBuffer;
+        fBufferSize = theNewSize;
+    }
+    
+    fParsePos -= fMsgStart;
+    fEnd -= fMsgStart;
+    fMsgStart = 0;
+}
 
-    while (true)
+QTSS_Error RTSPRequestStream::FillBuffer()
+{
+    // Figure out how much room the message we are in the middle of needs. For a '$' frame we
+    // know exactly; for anything else, make sure a whole RTSP header would fit. Once a
+    // client starts pushing interleaved data, read in big chunks so each read() picks up
+    // as many frames as the socket has. The buffer we start with already fits the biggest
+    // header, its terminator and any leftover base64, so a new connection never grows it.
+    UInt32 theMsgLen = kRequestBufferSizeInBytes - 1;
+    if (fParseState == kParsingInterleavedData)
+    {
+        if (fBufferSize < kInterleavedBufferSizeInBytes)
+            this->MakeRoom(kInterleavedBufferSizeInBytes - 1);
+        theMsgLen = fMsgLen + kInterleavedHeaderSizeInBytes;
+    }
+    
+    // Leftover base64 characters get put back in front of the new data
+    if (fDecode)
+        theMsgLen += sizeof(fEncodedBytes);
+    this->MakeRoom(theMsgLen);
+    
+    UInt32 theLenRead = 0;
+    if (fSnarfedBytes > 0)
     {
-		//qtss_printf("\nRTSPRequestStream::ReadRequest 2");//fym
-		//qtss_printf("\nRTSPRequestStream::ReadRequest %s", fRequest.Ptr);//fym
+        // This will be true if we've just snarfed another input stream, in which case the data
+        // is already sitting at fEnd. Just fall through and decode the data.
+        theLenRead = fSnarfedBytes;
+        fSnarfedBytes = 0;
+        Assert(fEncodedBytesRemaining == 0);
+    }
+    else
+    {
+        if (fDecode && (fEncodedBytesRemaining > 0))
+            ::memcpy(&fBuffer[fEnd], fEncodedBytes, fEncodedBytesRemaining);
+        
+        UInt32 theReadOffset = fEnd + fEncodedBytesRemaining;
+        QTSS_Error sockErr = fSocket->Read(&fBuffer[theReadOffset], (fBufferSize - theReadOffset) - 1, &theLenRead);
+        
+        //assume the client is dead if we get an error back
+        if (sockErr != QTSS_NoErr)
+            return sockErr;
+        if (theLenRead == 0)
+            return EAGAIN;
+#if READ_DEBUGGING
+        qtss_printf("In RTSPRequestStream::FillBuffer: Got %d bytes off Socket\n", theLenRead);
+#endif
+    }
+    
+    if (fDecode)
+    {
+        // If we need to decode this data, do it now.
+        // If the decode returns an error, it is because we've encountered some
+        // non-base64 data in the stream. We can process everything up until
+        // that point, but all data after this point will be ignored.
+        if (this->DecodeIncomingData(theLenRead + fEncodedBytesRemaining) == QTSS_NoErr)
+            Assert(fEncodedBytesRemaining < 4);
+    }
+    else
+        fEnd += theLenRead;
+    
+    Assert(fEnd < fBufferSize);
+    return QTSS_NoErr;
+}
 
-        UInt32 newOffset = 0;
+QTSS_Error RTSPRequestStream::ReadRequest()
+{
+    //If this is the case, we already HAVE a request on this session, and we now are done
+    //with the request and want to move onto the next one. Its bytes were consumed when
+    //it was returned, so anything after it in the buffer is the start of a new request.
+    fRequestPtr = NULL;
+    fIsDataPacket = false;
+    
+    while (true)
+    {
+        QTSS_Error theErr = this->ParseBuffer();
 
-		//fRequestPtrָһRTSPַ
+        // Whatever frames that pass completed go out together, while they are
+        // still sitting where the parser left them.
+        this->FlushInterleavedFrames();
+        if (theErr != QTSS_NoErr)
+            return theErr;
         
-        //If this is the case, we already HAVE a request on this session, and we now are done
-        //with the request and want to move onto the next one. The first thing we should do
-        //is check whether there is any lingering data in the stream. If there is, the parent
-        //session believes that is part of a new request
-		//fRequestPtrΪNULLỰȻַȴ
-		//ȣsocketǷв,ỰΪһһ
-        if(fRequestPtr != NULL)
+        // We don't have a full request, so try and get some more data
+        theErr = this->FillBuffer();
+        if (theErr == EAGAIN)
+            return QTSS_NoErr;
+        if (theErr != QTSS_NoErr)
         {
-            fRequestPtr = NULL;//flag that we no longer have a complete request
-            
-            // Take all the retreated leftover data and move it to the beginning of the buffer
-            if((fRetreatBytes > 0) && (fRequest.Len > 0))
-                ::memmove(fRequest.Ptr, fRequest.Ptr + fRequest.Len + fRetreatBytesRead, fRetreatBytes);
+            Assert(!fSocket->IsConnected());
+            return theErr;
+        }
+    }
+}
 
-            // if we are decoding, we need to also move over the remaining encoded bytes
-            // to the right position in the fRequestBuffer
-            if(fEncodedBytesRemaining > 0)
-            {
-                //Assert(fEncodedBytesRemaining < 4);
-                
-                // The right position is at fRetreatBytes offset in the request buffer. The reason for this is:
-                //  1) We need to find a place in the request buffer where we know we have enough space to store
-                //  fEncodedBytesRemaining. fRetreatBytes + fEncodedBytesRemaining will always be less than
-                //  kRequestBufferSize because all this data must have been in the same request buffer, together, at one point.
-                //
-                //  2) We need to make sure that there is always more data in the RequestBuffer than in the decoded
-                //  request buffer, otherwise we could overrun the decoded request buffer (we bounds check on the encoded
-                //  buffer, not the decoded buffer). Leaving fRetreatBytes as empty space in the request buffer ensures
-                //  that this principle is maintained. 
-                ::memmove(&fRequestBuffer[fRetreatBytes], &fRequestBuffer[fCurOffset - fEncodedBytesRemaining], fEncodedBytesRemaining);
-                fCurOffset = fRetreatBytes + fEncodedBytesRemaining;
-                Assert(fCurOffset < kRequestBufferSizeInBytes);
-            }
-            else
-                fCurOffset = fRetreatBytes;
-                
-            newOffset = fRequest.Len = fRetreatBytes;
-            fRetreatBytes = fRetreatBytesRead = 0;
+Bool16 RTSPRequestStream::IsRequestPending()
+{
+    // Between messages only. A '$' frame or bytes still to be decoded don't count.
+    if ((fParseState != kParsingMessageStart) || (fMsgStart >= fEnd) || (fSnarfedBytes > 0) || (fBuffer[fMsgStart] == '$'))
+        return false;
+        
+    // Look for the blank line ending the header: \n\n, \n\r\n (as in \r\n\r\n) or \r\r.
+    // ParseBuffer accepts a little more than this, which at worst means a false answer.
+    for (UInt32 x = fMsgStart + 1; x < fEnd; x++)
+    {
+        if (fBuffer[x] == '\n')
+        {
+            if ((fBuffer[x - 1] == '\n') || ((fBuffer[x - 1] == '\r') && (x - 1 > fMsgStart) && (fBuffer[x - 2] == '\n')))
+                return true;
         }
+        else if ((fBuffer[x] == '\r') && (fBuffer[x - 1] == '\r'))
+            return true;
+    }
+    return false;
+}
 
-        // We don't have any new data, so try and get some
-        if(newOffset == 0)
+QTSS_Error RTSPRequestStream::ParseBuffer()
+{
+    while (fParsePos < fEnd)
+    {
+        if (fParseState == kParsingMessageStart)
         {
-            if(fRetreatBytes > 0)
+            Assert(fParsePos == fMsgStart);
+            if (fBuffer[fMsgStart] == '$')
             {
-                // This will be true if we've just snarfed another input stream, in which case the encoded data
-                // is copied into our request buffer, and its length is tracked in fRetreatBytes.
-                // If this is true, just fall through and decode the data.
-                newOffset = fRetreatBytes;
-                fRetreatBytes = 0;
-                Assert(fEncodedBytesRemaining == 0);
+                // See if we have the whole interleaved header yet
+                if (fEnd - fMsgStart < kInterleavedHeaderSizeInBytes)
+                    return QTSS_NoErr;
+                    
+                fMsgLen = ((UInt8)fBuffer[fMsgStart + 2] << 8) | (UInt8)fBuffer[fMsgStart + 3];
+                fParseState = kParsingInterleavedData;
             }
             else
             {
-                // We don't have any new data, get some from the socket...
-                QTSS_Error sockErr = fSocket->Read(&fRequestBuffer[fCurOffset], (kRequestBufferSizeInBytes - fCurOffset) - 1, &newOffset);
-				
-				//qtss_printf("\n%d ====== %s", newOffset, &fRequestBuffer[fCurOffset]);
-				
-				if(newOffset)
-				{
-					//qtss_printf("<%d> ", newOffset);
-
-					bool is_rtsp_signal = false;//ǷΪRTSP
-
-					//ӿٶ
-#if 1
-					char* t = fRequestBuffer;
-					if(!fCurOffset)
-					{
-						char* t = &fRequestBuffer[fCurOffset];
-						if(('D' == t[0] && 'E' == t[1] && 'S' == t[2] && 'C' == t[3] && 'R' == t[4] && 'I' == t[5] && 'B' == t[6] && 'E' == t[7])//DESCRIBE
-						|| ('S' == t[0] && 'E' == t[1] && 'T' == t[2] && 'U' == t[3] && 'P' == t[4])//SETUP
-						|| ('P' == t[0] && 'L' == t[1] && 'A' == t[2] && 'Y' == t[3])//PLAY
-						|| ('T' == t[0] && 'E' == t[1] && 'A' == t[2] && 'R' == t[3] && 'D' == t[4] && 'O' == t[5] && 'W' == t[6] && 'N' == t[7])//TEARDOWN
-						|| ('P' == t[0] && 'A' == t[1] && 'U' == t[2] && 'S' == t[3] && 'E' == t[4])//PAUSE
-						|| ('O' == t[0] && 'P' == t[1] && 'T' == t[2] && 'I' == t[3] && 'O' == t[4] && 'N' == t[5] && 'S' == t[6]))//OPTIONS
-						//|| ('D' == t[0] && 'E' == t[1] && 'S' == t[2] && 'C' == t[3] && 'R' == t[4] && 'I' == t[5] && 'B' == t[6] && 'E' == t[7])//ANNOUNCE
-						//|| ('D' == t[0] && 'E' == t[1] && 'S' == t[2] && 'C' == t[3] && 'R' == t[4] && 'I' == t[5] && 'B' == t[6] && 'E' == t[7])//GET_PARAMETER
-						//|| ('D' == t[0] && 'E' == t[1] && 'S' == t[2] && 'C' == t[3] && 'R' == t[4] && 'I' == t[5] && 'B' == t[6] && 'E' == t[7])//SET_PARAMETER
-						//|| ('D' == t[0] && 'E' == t[1] && 'S' == t[2] && 'C' == t[3] && 'R' == t[4] && 'I' == t[5] && 'B' == t[6] && 'E' == t[7])//REDIRECT
-						//|| ('D' == t[0] && 'E' == t[1] && 'S' == t[2] && 'C' == t[3] && 'R' == t[4] && 'I' == t[5] && 'B' == t[6] && 'E' == t[7]))//RECORD
-						{
-							is_rtsp_signal = true;
-						}
-					}
-#else
-					char temp[16];
-					::memcpy(temp, &fRequestBuffer[fCurOffset], sizeof(temp));					
-					temp[15] = 0;
-
-					if(NULL != ::strstr(temp, "DESCRIBE")
-						|| NULL != ::strstr(temp, "SETUP")
-						|| NULL != ::strstr(temp, "PLAY")
-						|| NULL != ::strstr(temp, "TEARDOWN")
-						|| NULL != ::strstr(temp, "PAUSE")
-						|| NULL != ::strstr(temp, "OPTIONS"))
-						//|| NULL == ::strstr(temp, "ANNOUNCE")
-						//|| NULL == ::strstr(temp, "GET_PARAMETER")
-						//|| NULL == ::strstr(temp, "SET_PARAMETER")
-						//|| NULL == ::strstr(temp, "REDIRECT")
-						//|| NULL == ::strstr(temp, "RECORD"))
-					{
-						is_rtsp_signal = true;
-					}
-#endif
-					
-					//RTSP
-					if(false == is_rtsp_signal)
-					{
-						handle_media_data(&fRequestBuffer[fCurOffset], newOffset);
-
-						fIsDataPacket = true;
-						fRequestPtr = &fRequest;
-						return QTSS_RequestArrived;
-					}
-				}
-
-				//qtss_printf("\nReadRequest %s", &fRequestBuffer[fCurOffset]);//fym
-                //assume the client is dead if we get an error back
-                if(sockErr == EAGAIN)
-                    return QTSS_NoErr;
-                if(sockErr != QTSS_NoErr)
-                {
-                    Assert(!fSocket->IsConnected());
-                    return sockErr;
-                }
-            }   
-
-            if(fDecode)
-            {
-                // If we need to decode this data, do it now.
-                Assert(fCurOffset >= fEncodedBytesRemaining);
-                QTSS_Error decodeErr = this->DecodeIncomingData(&fRequestBuffer[fCurOffset - fEncodedBytesRemaining],
-                                                                    newOffset + fEncodedBytesRemaining);
-                // If the above function returns an error, it is because we've
-                // encountered some non-base64 data in the stream. We can process
-                // everything up until that point, but all data after this point will
-                // be ignored.
-                if(decodeErr == QTSS_NoErr)
-                    Assert(fEncodedBytesRemaining < 4);
+                fFirstLineHasSpace = false;
+                fParseState = kParsingHeaderLine;
             }
-            else
-                fRequest.Len += newOffset;
-            Assert(fRequest.Len < kRequestBufferSizeInBytes);
-            fCurOffset += newOffset;
         }
-        Assert(newOffset > 0);
-
-        // See if this is an interleaved data packet
-        if('$' == *(fRequest.Ptr))
-        {
-			if(fRequest.Len < 4)
-			{
-				//fym qtss_printf("!");//fym
-                continue;
-			}
-
-            UInt16* dataLenP = (UInt16*)fRequest.Ptr;
-            UInt32 interleavedPacketLen = ntohs(dataLenP[1]) + 4;
-
-            if(interleavedPacketLen > fRequest.Len)
-			{
-				//fym qtss_printf("?");//fym
-                continue;
-			}
-
-            //put back any data that is not part of the header
-            fRetreatBytes += fRequest.Len - interleavedPacketLen;
-            fRequest.Len = interleavedPacketLen;
         
-            fRequestPtr = &fRequest;
-            fIsDataPacket = true;
-            return QTSS_RequestArrived;
-        }
-        fIsDataPacket = false;
-
-        if(fPrintRTSP)
+        if (fParseState == kParsingInterleavedData)
         {
-            DateBuffer theDate;
-            DateTranslator::UpdateDateBuffer(&theDate, 0); // get the current GMT date and time
-			qtss_printf("\n\n#C->S:\n#time: ms=%lu date=%s\n", (UInt32) OS::StartTimeMilli_Int(), theDate.GetDateBuffer());
-
-            if(fSocket != NULL)    
+            UInt32 theFrameLen = fMsgLen + kInterleavedHeaderSizeInBytes;
+            if (fEnd - fMsgStart < theFrameLen)
             {
-                UInt16 serverPort = fSocket->GetLocalPort();
-                UInt16 clientPort = fSocket->GetRemotePort();    
-                StrPtrLen* theLocalAddrStr = fSocket->GetLocalAddrStr();
-                StrPtrLen* theRemoteAddrStr = fSocket->GetRemoteAddrStr();
-                if(theLocalAddrStr != NULL)
-                {	qtss_printf("#server: ip="); theLocalAddrStr->PrintStr(); qtss_printf(" port=%u\n" , serverPort );
-                }
-                else
-              	{	qtss_printf("#server: ip=NULL port=%u\n" , serverPort );
-              	}
-               	
-                if(theRemoteAddrStr != NULL)
-                {	qtss_printf("#client: ip="); theRemoteAddrStr->PrintStr(); qtss_printf(" port=%u\n" , clientPort );
-                }
-            	else
-            	{	qtss_printf("#client: ip=NULL port=%u\n" , clientPort );
-            	}
-
+                fParsePos = fEnd;
+                return QTSS_NoErr;
             }
-
-			StrPtrLen str(fRequest);
-			str.PrintStrEOL("\n\r\n", "\n");// print the request but stop on \n\r\n and add a \n afterwards.
+            
+            this->ProcessInterleavedFrame(&fBuffer[fMsgStart], theFrameLen);
+            fMsgStart = fParsePos = fMsgStart + theFrameLen;
+            fParseState = kParsingMessageStart;
+            continue;
         }
         
-        //use a StringParser object to search for a double EOL, which signifies the end of
-        //the header.
+        //Look for a double EOL, which signifies the end of the header.
+        //The legal end-of-header sequences are \r\r, \r\n\r\n, & \n\n. NOT \r\n\r!
+        //If the packets arrive just a certain way, we could get here with the latter
+        //combo, and not wait for a final \n.
         Bool16 weAreDone = false;
-        StringParser headerParser(&fRequest);
-        
-        UInt16 lcount = 0;
-        while (headerParser.GetThruEOL(NULL))
+        Bool16 endOfLine = false;
+        char theChar = fBuffer[fParsePos++];
+        switch (fParseState)
         {
-            lcount++;
-            if(headerParser.ExpectEOL())
-            {
-                //The legal end-of-header sequences are \r\r, \r\n\r\n, & \n\n. NOT \r\n\r!
-                //If the packets arrive just a certain way, we could get here with the latter
-                //combo, and not wait for a final \n.
-                if((headerParser.GetDataParsedLen() > 2) &&
-                    (memcmp(headerParser.GetCurrentPosition() - 3, "\r\n\r", 3) == 0))
-                    continue;
-                weAreDone = true;
-                break;
-            }
-            else if(lcount == 1) {
-                // if this request is actually a ShoutCast password it will be 
-                // in the form of "xxxxxx\r" where "xxxxx" is the password.
-                // If we get a 1st request line ending in \r with no blanks we will
-                // assume that this is the end of the request.
-                UInt16 flag = 0;
-                UInt16 i = 0;
-                for (i=0; i<fRequest.Len; i++)
+            case kParsingHeaderLine:
+                if (theChar == '\r')
+                    fParseState = kParsingHeaderCR;
+                else if (theChar == '\n')
                 {
-                    if(fRequest.Ptr[i] == ' ')
-                        flag++;
+                    fParseState = kParsingHeaderEOL;
+                    endOfLine = true;
                 }
-                if(flag == 0)
-                {
+                else if (theChar == ' ')
+                    fFirstLineHasSpace = true;
+                break;
+                
+            case kParsingHeaderCR:
+                if (theChar == '\n')
+                    fParseState = kParsingHeaderEOL;
+                else if (theChar == '\r')
                     weAreDone = true;
-                    break;
-                }
-            }
+                else
+                    fParseState = kParsingHeaderLine;
+                endOfLine = true;
+                break;
+                
+            case kParsingHeaderEOL:
+                if (theChar == '\n')
+                    weAreDone = true;
+                else if (theChar == '\r')
+                    fParseState = kParsingHeaderEOLCR;
+                else
+                    fParseState = kParsingHeaderLine;
+                break;
+                
+            case kParsingHeaderEOLCR:
+                if (theChar == '\n')
+                    weAreDone = true;
+                else
+                    fParseState = kParsingHeaderLine;
+                break;
         }
         
+        // if this request is actually a ShoutCast password it will be 
+        // in the form of "xxxxxx\r" where "xxxxx" is the password.
+        // If we get a 1st request line ending in \r with no blanks we will
+        // assume that this is the end of the request.
+        if (endOfLine && !fFirstLineHasSpace)
+            weAreDone = true;
+        if (endOfLine)
+            fFirstLineHasSpace = true;
+        
         //weAreDone means we have gotten a full request
-        if(weAreDone)
+        if (weAreDone)
         {
-            //put back any data that is not part of the header
-            fRequest.Len -= headerParser.GetDataRemaining();
-            fRetreatBytes += headerParser.GetDataRemaining();
-            
+            fRequest.Set(&fBuffer[fMsgStart], fParsePos - fMsgStart);
             fRequestPtr = &fRequest;
+            fMsgStart = fParsePos;
+            fParseState = kParsingMessageStart;
+            
+            if (fPrintRTSP)
+                this->PrintRequest();
             return QTSS_RequestArrived;
         }
+    }
+    
+    //check for a full buffer
+    if ((fParseState >= kParsingHeaderLine) && (fEnd - fMsgStart >= kRequestBufferSizeInBytes - 1))
+    {
+        // Hand back what we have so an error can be sent, and throw it away
+        fRequest.Set(&fBuffer[fMsgStart], fEnd - fMsgStart);
+        fRequestPtr = &fRequest;
+        fMsgStart = fParsePos = fEnd;
+        fParseState = kParsingMessageStart;
+        return E2BIG;
+    }
+    
+    return QTSS_NoErr;
+}
+
+void RTSPRequestStream::ProcessInterleavedFrame(char* inFrame, UInt32 inFrameLen)
+{
+    if (fNumFrames == RTSPInterleavedDataHandler::kMaxPacketsPerCall)
+        this->FlushInterleavedFrames();
+
+    // The frame is handed over straight out of the receive buffer
+    fFrameChannels[fNumFrames] = (UInt8)inFrame[1];
+    fFrames[fNumFrames].Set(inFrame + kInterleavedHeaderSizeInBytes, inFrameLen - kInterleavedHeaderSizeInBytes);
+    fNumFrames++;
+}
+
+void RTSPRequestStream::FlushInterleavedFrames()
+{
+    if (fNumFrames == 0)
+        return;
+
+    if (fDataHandler != NULL)
+        fDataHandler->ProcessInterleavedData(fFrameChannels, fFrames, fNumFrames);
+    else if (NULL != QTSServer::fDataCallBackFunc)
+    {
+        for (UInt32 x = 0; x < fNumFrames; x++)
+            (*QTSServer::fDataCallBackFunc)(fFrames[x].Ptr, fFrames[x].Len);
+    }
+    fNumFrames = 0;
+}
+
+void RTSPRequestStream::PrintRequest()
+{
+    DateBuffer theDate;
+    DateTranslator::UpdateDateBuffer(&theDate, 0); // get the current GMT date and time
+    qtss_printf("\n\n#C->S:\n#time: ms=%lu date=%s\n", (UInt32) OS::StartTimeMilli_Int(), theDate.GetDateBuffer());
+
+    if(fSocket != NULL)    
+    {
+        UInt16 serverPort = fSocket->GetLocalPort();
+        UInt16 clientPort = fSocket->GetRemotePort();    
+        StrPtrLen* theLocalAddrStr = fSocket->GetLocalAddrStr();
+        StrPtrLen* theRemoteAddrStr = fSocket->GetRemoteAddrStr();
+        if(theLocalAddrStr != NULL)
+        {   qtss_printf("#server: ip="); theLocalAddrStr->PrintStr(); qtss_printf(" port=%u\n" , serverPort );
+        }
+        else
+        {   qtss_printf("#server: ip=NULL port=%u\n" , serverPort );
+        }
         
-        //check for a full buffer
-        if(fCurOffset == kRequestBufferSizeInBytes - 1)
-        {
-            fRequestPtr = &fRequest;
-            return E2BIG;
+        if(theRemoteAddrStr != NULL)
+        {   qtss_printf("#client: ip="); theRemoteAddrStr->PrintStr(); qtss_printf(" port=%u\n" , clientPort );
+        }
+        else
+        {   qtss_printf("#client: ip=NULL port=%u\n" , clientPort );
         }
     }
+
+    StrPtrLen str(fRequest);
+    str.PrintStrEOL("\n\r\n", "\n");// print the request but stop on \n\r\n and add a \n afterwards.
 }
 
 QTSS_Error RTSPRequestStream::Read(void* ioBuffer, UInt32 inBufLen, UInt32* outLengthRead)
@@ -356,21 +415,19 @@ QTSS_Error RTSPRequestStream::Read(void* ioBuffer, UInt32 inBufLen, UInt32* outL
     UInt8* theIoBuffer = (UInt8*)ioBuffer;
     
     //
-    // If there are retreat bytes available, read them first.
-    if(fRetreatBytes > 0)
+    // If there are unparsed bytes following the request, read them first.
+    if((fParseState == kParsingMessageStart) && (fEnd > fMsgStart))
     {
-        theLengthRead = fRetreatBytes;
+        theLengthRead = fEnd - fMsgStart;
         if(inBufLen < theLengthRead)
             theLengthRead = inBufLen;
         
-        ::memcpy(theIoBuffer, fRequest.Ptr + fRequest.Len + fRetreatBytesRead, theLengthRead);
+        ::memcpy(theIoBuffer, &fBuffer[fMsgStart], theLengthRead);
         
         //
-        // We should not update fRequest.Len even though we've read some of the retreat bytes.
-        // fRequest.Len always refers to the length of the request header. Instead, we
-        // have a separate variable, fRetreatBytesRead
-        fRetreatBytes -= theLengthRead;
-        fRetreatBytesRead += theLengthRead;
+        // The request header itself stays where it is, we only move past the body.
+        fMsgStart += theLengthRead;
+        fParsePos = fMsgStart;
 #if READ_DEBUGGING
         qtss_printf("In RTSPRequestStream::Read: Got %d Retreat Bytes\n",theLengthRead);
 #endif  
@@ -394,31 +451,26 @@ QTSS_Error RTSPRequestStream::Read(void* ioBuffer, UInt32 inBufLen, UInt32* outL
 #endif  
     if(outLengthRead != NULL)
         *outLengthRead = theNewOffset + theLengthRead;
-
-	qtss_printf("\nRequest: %s", ioBuffer);
         
     return theErr;
 }
 
-QTSS_Error RTSPRequestStream::DecodeIncomingData(char* inSrcData, UInt32 inSrcDataLen)
+QTSS_Error RTSPRequestStream::DecodeIncomingData(UInt32 inSrcDataLen)
 {
-    Assert(fRetreatBytes == 0);
-    
-    if(fRequest.Ptr == &fRequestBuffer[0])
-    {
-        fRequest.Ptr = NEW char[kRequestBufferSizeInBytes];
-        fRequest.Len = 0;
-    }
+    // The encoded data sits at fEnd, and is decoded in place. Base64 always shrinks,
+    // so the decoder never writes over input it hasn't read yet.
+    char* inSrcData = &fBuffer[fEnd];
     
     // We always decode up through the last chunk of 4.
     fEncodedBytesRemaining = inSrcDataLen & 3;
     
     // Let our friendly Base64Decode function know this by NULL terminating at that point
     UInt32 bytesToDecode = inSrcDataLen - fEncodedBytesRemaining;
-    char endChar = inSrcData[bytesToDecode];
+    ::memcpy(fEncodedBytes, inSrcData + bytesToDecode, fEncodedBytesRemaining);
     inSrcData[bytesToDecode] = '\0';
     
     UInt32 encodedBytesConsumed = 0;
+    UInt32 bytesDecodedTotal = 0;
     
     // Loop until the whole load is decoded
     while (encodedBytesConsumed < bytesToDecode)
@@ -426,17 +478,18 @@ QTSS_Error RTSPRequestStream::DecodeIncomingData(char* inSrcData, UInt32 inSrcDa
         Assert((encodedBytesConsumed & 3) == 0);
         Assert((bytesToDecode & 3) == 0);
 
-        UInt32 bytesDecoded = Base64decode(fRequest.Ptr + fRequest.Len, inSrcData + encodedBytesConsumed);
+        UInt32 bytesDecoded = Base64decode(inSrcData + bytesDecodedTotal, inSrcData + encodedBytesConsumed);
 
         // If bytesDecoded is 0, we will end up being in an endless loop. The
         // base64 must be corrupt, so let's just return an error and abort
         if(bytesDecoded == 0)
         {
-            //Assert(0);
+            fEncodedBytesRemaining = 0;
+            fEnd += bytesDecodedTotal;
             return QTSS_BadArgument;
         }
         
-        fRequest.Len += bytesDecoded;
+        bytesDecodedTotal += bytesDecoded;
 
         // Assuming the stream is valid, the # of encoded bytes we just consumed is
         // 4/3rds of the number of decoded bytes returned by the decode function,
@@ -447,12 +500,10 @@ QTSS_Error RTSPRequestStream::DecodeIncomingData(char* inSrcData, UInt32 inSrcDa
         
     }
     
-    // Make sure to replace the sacred endChar
-    inSrcData[bytesToDecode] = endChar;
+    fEnd += bytesDecodedTotal;
 
-    Assert(fRequest.Len < kRequestBufferSizeInBytes);
+    Assert(fEnd < fBufferSize);
     Assert(encodedBytesConsumed == bytesToDecode);
     
     return QTSS_NoErr;
 }
-
@@ -29,7 +29,8 @@
                 can read in data until an entire RTSP request header is available.
                 (do this by calling ReadRequest). It handles RTSP pipelining (request
                 headers are produced serially even if multiple headers arrive simultaneously),
-                & RTSP request data.
+                & RTSP request data. Interleaved '$' data frames are demultiplexed out of the
+                same receive buffer as they complete, without being copied.
                     
 */
 
@@ -41,42 +42,39 @@
 #include "StrPtrLen.h"
 #include "TCPSocket.h"
 #include "QTSS.h"
-#include "QTSServer.h"//fym
+
+// Whoever consumes media pushed over the RTSP connection implements this. All the
+// interleaved frames that came out of a single read are handed over in one call,
+// so the consumer can pay for its lookups and locking once per read instead of once
+// per packet. inPackets[x] is the payload of a frame (the 4 byte '$' header is stripped)
+// received on channel inChannels[x]. The data is only valid for the duration of the call.
+class RTSPInterleavedDataHandler
+{
+public:
+
+    enum
+    {
+        kMaxPacketsPerCall = 64 //UInt32
+    };
+
+    virtual ~RTSPInterleavedDataHandler() {}
+    virtual void    ProcessInterleavedData(UInt8* inChannels, StrPtrLen* inPackets, UInt32 inNumPackets) = 0;
+};
 
 class RTSPRequestStream
 {
 public:
 
     //CONSTRUCTOR / DESTRUCTOR
-    RTSPRequestStream(TCPSocket* sock) :
-	fSocket(sock),
-	fRetreatBytes(0), 
-	fRetreatBytesRead(0),
-	fCurOffset(0),
-	fEncodedBytesRemaining(0),
-	fRequest(fRequestBuffer, 0),
-	fRequestPtr(NULL),
-	fDecode(false),
-	fPrintRTSP(false)
-	{
-		_track_id = -1;
-		_remain_packet_length = 0;
-		_new_packet = false;
-		::memset(_incomplete_rtsp_header, 0, sizeof(_incomplete_rtsp_header));
-		_incomplete_header_length = 0;//δTCPݰͷ
-
-		::memset(_recv_media_buf, 0, sizeof(_recv_media_buf));
-		::memset(_media_buf_pos, 0, sizeof(_media_buf_pos));
-		::memset(_latest_sequence, 0, sizeof(_latest_sequence));
-	}
+    RTSPRequestStream(TCPSocket* sock);
     
-    // We may have to delete this memory if it was allocated due to base64 decoding
-    ~RTSPRequestStream() { if (fRequest.Ptr != &fRequestBuffer[0]) delete [] fRequest.Ptr; }
+    ~RTSPRequestStream() { delete [] fBuffer; }
 
     //ReadRequest
     //This function will not block.
     //Attempts to read data into the stream, stopping when we hit the EOL - EOL that
-    //ends an RTSP header.
+    //ends an RTSP header. Interleaved data frames that complete along the way are
+    //handed off together before this returns, and never returned from here.
     //
     //Returns:          QTSS_NoErr:     Out of data, haven't hit EOL - EOL yet
     //                  QTSS_RequestArrived: full request has arrived
@@ -98,13 +96,22 @@ public:
     
     // Tell the request stream whether or not to decode from base64.
     void                IsBase64Encoded(Bool16 isDataEncoded) { fDecode = isDataEncoded; }
-    
+
+    // Where interleaved frames go. If there is no handler, each frame is passed
+    // to QTSServer::fDataCallBackFunc instead.
+    void                SetInterleavedDataHandler(RTSPInterleavedDataHandler* inHandler) { fDataHandler = inHandler; }
+
     //GetRequestBuffer
     //This returns a buffer containing the full client request. The length is set to
     //the exact length of the request headers. This will return NULL UNLESS this object
     //is in the proper state (has been initialized, ReadRequest has been called until it returns
-        //RequestArrived).
+        //RequestArrived). The buffer stays valid until the next call to ReadRequest.
     StrPtrLen*  GetRequestBuffer()  { return fRequestPtr; }
+
+    // Returns true if the whole header of the next request is already in the buffer,
+    // so the next call to ReadRequest will return it without touching the socket.
+    // Only meaningful once the current request's body has been read.
+    Bool16      IsRequestPending();
     Bool16      IsDataPacket()      { return fIsDataPacket; }
     void        ShowRTSP(Bool16 enable) {fPrintRTSP = enable; }     
     void SnarfRetreat( RTSPRequestStream &fromRequest );
@@ -113,191 +120,75 @@ private:
 
         
     //CONSTANTS:
-	//TCPݰΪ2048ֽ
     enum
     {
-        kRequestBufferSizeInBytes = 4096//2048        //UInt32
+        kRequestBufferSizeInBytes = 4096,       //UInt32 largest RTSP header we accept, terminator included
+        kInterleavedBufferSizeInBytes = 65536,  //UInt32 buffer size once a client starts sending '$' frames
+        kInterleavedHeaderSizeInBytes = 4       //UInt32 '$', channel, 16 bit length
     };
     
-    // Base64 decodes into fRequest.Ptr, updates fRequest.Len, and returns the amount
-    // of data left undecoded in inSrcData
-    QTSS_Error              DecodeIncomingData(char* inSrcData, UInt32 inSrcDataLen);
+    // Parser states. The parser may stop at any byte and pick up from here
+    // once more data arrives, so nothing already scanned is ever looked at twice.
+    enum
+    {
+        kParsingMessageStart    = 0,    // next byte starts a new message
+        kParsingInterleavedData = 1,    // inside a '$' frame, waiting for the rest of it
+        kParsingHeaderLine      = 2,    // inside a header line
+        kParsingHeaderCR        = 3,    // just saw a \r ending a line
+        kParsingHeaderEOL       = 4,    // just finished a line with \n (or \r\n)
+        kParsingHeaderEOLCR     = 5     // just saw a \r following a complete line
+    };
+    
+    // Runs the parser over [fParsePos, fEnd). Returns QTSS_RequestArrived or E2BIG if
+    // a request header is ready, QTSS_NoErr if all buffered data has been consumed.
+    QTSS_Error              ParseBuffer();
+    
+    // Appends new data from the socket (or data snarfed from another stream) at fEnd,
+    // base64 decoding it in place if necessary.
+    QTSS_Error              FillBuffer();
+    
+    // Makes sure the message starting at fMsgStart can grow to inMsgLen bytes without
+    // running off the end of fBuffer. Only the unparsed tail of one message is ever
+    // relocated, and only when the buffer wraps or grows.
+    void                    MakeRoom(UInt32 inMsgLen);
+    
+    // Base64 decodes inSrcDataLen bytes at fEnd in place, updates fEnd, and keeps the
+    // undecodable tail (less than 4 bytes) in fEncodedBytes for next time
+    QTSS_Error              DecodeIncomingData(UInt32 inSrcDataLen);
+    
+    // Queues one complete '$' frame, header included, for whoever consumes pushed data.
+    void                    ProcessInterleavedFrame(char* inFrame, UInt32 inFrameLen);
+
+    // Delivers the queued frames. This must happen before anything in fBuffer moves.
+    void                    FlushInterleavedFrames();
+
+    void                    PrintRequest();
 
     TCPSocket*              fSocket;
-    UInt32                  fRetreatBytes;
-	UInt32                  fRetreatBytesRead; // Used by Read() when it is reading RetreatBytes
     
-    char                    fRequestBuffer[kRequestBufferSizeInBytes];
-    UInt32                  fCurOffset; // tracks how much valid data is in the above buffer
-    UInt32                  fEncodedBytesRemaining; // If we are decoding, tracks how many encoded bytes are in the buffer
+    char*                   fBuffer;
+    UInt32                  fBufferSize;
+    UInt32                  fMsgStart;      // start of the message currently being parsed
+    UInt32                  fParsePos;      // first byte the parser hasn't looked at yet
+    UInt32                  fEnd;           // tracks how much valid data is in the above buffer
+    UInt32                  fMsgLen;        // total length of the current '$' frame, once known
+    UInt32                  fSnarfedBytes;  // data at fEnd taken over from another stream, not yet decoded
+    UInt32                  fParseState;
+    Bool16                  fFirstLineHasSpace;
     
+    char                    fEncodedBytes[4];
+    UInt32                  fEncodedBytesRemaining; // If we are decoding, tracks how many encoded bytes are in fEncodedBytes
+
+    RTSPInterleavedDataHandler* fDataHandler;
+    UInt8                   fFrameChannels[RTSPInterleavedDataHandler::kMaxPacketsPerCall];
+    StrPtrLen               fFrames[RTSPInterleavedDataHandler::kMaxPacketsPerCall]; // point into fBuffer
+    UInt32                  fNumFrames;
+
     StrPtrLen               fRequest;
     StrPtrLen*              fRequestPtr;    // pointer to a request header
     Bool16                  fDecode;        // should we base 64 decode?
-    Bool16                  fIsDataPacket;  // is this a data packet? Like for a record?//յǷRTSPݰ
+    Bool16                  fIsDataPacket;  // is this a data packet? Like for a record?
     Bool16                  fPrintRTSP;     // debugging printfs
-
-private://fym////////////////////////////////////////////////////////////////////////
-	//ݰṹ
-	//BYTE0: '$'
-	//BYTE1: track_id, 0-video, 2-audio, 4-whiteboard
-	//BYTE2: ɳֵĸ8λ
-	//BYTE3: ɳֵĵ8λ
-	//12 BYTEs: RTSP ServerӵRTPͷ
-	//12 BYTEs: RTSP ServerǰӵRTPͷ
-	int _track_id;// = -1;//յݰͷĹֵ
-	int _remain_packet_length;// = 0;//յݰʣδƵľɳ
-	bool _new_packet;// = false;
-	char _incomplete_rtsp_header[4];//ڴȡȱTCPݰͷ
-	int _incomplete_header_length;// = 0;//δTCPݰͷ
-
-	void handle_media_data(char* data, unsigned short data_length)
-	{
-		if(NULL == data || 1 > data_length)
-		{
-			qtss_printf("\nerror packet %d", data_length);
-			return;
-		}
-		
-		int pos = 0;
-
-		while(pos < data_length)
-		{
-			//Log.v("RTSP", "process packet 2 " + pos + " " + data_length);
-			if(0 == _remain_packet_length && '$' == data[pos])
-			{
-				if(4 <= data_length - pos)
-				{
-					//Log.v("RTSP", "process packet 3 " + pos + " " + data_length);
-					//յݰͷ
-					_track_id = *(unsigned char*)(data + pos + 1);
-					_remain_packet_length = 0x100 * (*(unsigned char*)(data + pos + 2)) + (*(unsigned char*)(data + pos + 3));
-					//Log.v("RTSP", "1 track " + _track_id + " length " + _remain_packet_length);
-
-					pos += 4;
-
-					_incomplete_header_length = 0;
-				}
-				else
-				{
-					//TCPͷȫ,ȸһ
-					::memcpy(_incomplete_rtsp_header, data + pos, data_length - pos);
-					_incomplete_header_length = 4 - (data_length - pos);
-					return;
-				}
-			}
-			else if(-1 == _track_id)
-			{
-				qtss_printf("\nerror data %d", data_length);
-				return;
-			}
-
-			//ȱTCPݰͷ
-			if(0 < _incomplete_header_length)
-			{
-				::memcpy(_incomplete_rtsp_header + 4 - _incomplete_header_length, data + pos, _incomplete_header_length);
-
-				_track_id = *(unsigned char*)(_incomplete_rtsp_header + 1);
-				_remain_packet_length = 0x100 * (*(unsigned char*)(_incomplete_rtsp_header + 2)) + (*(unsigned char*)(_incomplete_rtsp_header + 3));
-				//Log.v("RTSP", "2 track " + _track_id + " length " + _remain_packet_length);
-
-				pos += _incomplete_header_length;
-
-				_incomplete_header_length = 0;
-			}
-
-			//
-			//θƵĳ
-			int copy_length = (_remain_packet_length > data_length - pos) ? (data_length - pos) : _remain_packet_length;
-
-			if(false == handle_media_data(data, pos, copy_length, (_track_id / 2)))
-			{
-				_track_id = -1;
-				qtss_printf("\ndata copy fail");
-				return;
-			}
-
-			pos += copy_length;
-		}
-	}
-
-	//0-video, 1-audio, 2-whiteboard
-	char _recv_media_buf[3][2048];//ý建
-	int _media_buf_pos[3];// = {0, 0, 0};//ý建λ
-	unsigned short _latest_sequence[3];//յ
-
-	bool handle_media_data(char* data, int pos, int length, int type)
-	{
-		if(2 < type || 0 > type)//
-			return false;
-
-		if(length > sizeof(_recv_media_buf[type]) - _media_buf_pos[type])//ɲ
-		{
-			return false;
-		}
-
-		::memcpy(_recv_media_buf[type] + _media_buf_pos[type], data + pos, length);
-
-		_media_buf_pos[type] += length;    	
-		_remain_packet_length -= length;
-
-		if(0 >= _remain_packet_length)
-		{
-			if(0 == _media_buf_pos[type])
-				return false;
-
-			//ȡһݰ
-			//Ƶ뻺...
-			//qtss_printf("<data %d %d> ", type, _media_buf_pos[type]);
-
-			unsigned short sequence = 0x100 * (*(unsigned char*)(_recv_media_buf[type] + 2)) + (*(unsigned char*)(_recv_media_buf[type] + 3));
-			//Log.v("RTSP", "t " + type + " s " + sequence + " " + _media_buf_pos[type]);
-
-			{//޶
-				if(sequence != _latest_sequence[type] + 1)
-				{
-					if(!type)
-						qtss_printf("\n<VL %d, %d> ", _latest_sequence[type], sequence);
-					else
-						qtss_printf("\n<AL %d, %d> ", _latest_sequence[type], sequence);
-				}
-
-				_latest_sequence[type] = sequence;
-			}
-
-			if(0 == type)
-			{
-				//qtss_printf("<vs %d %d> ", sequence, _media_buf_pos[type]);
-				//MediaThreadManager.get_instance().add_video_packetx(_recv_media_buf[type],  _media_buf_pos[type]);
-				if(NULL != QTSServer::fDataCallBackFunc)
-				{
-					(*QTSServer::fDataCallBackFunc)(_recv_media_buf[type], _media_buf_pos[type]);
-				}
-			}
-			else if(1 == type)
-			{
-				//qtss_printf("<as %d %d> ", sequence, _media_buf_pos[type]);
-				//MediaThreadManager.get_instance().add_audio_packet_ex(_recv_media_buf[type],  _media_buf_pos[type]);
-				//MediaThreadManager.get_instance().decode_audio_packet(_recv_media_buf[type],  _media_buf_pos[type]);
-				if(NULL != QTSServer::fDataCallBackFunc)
-				{
-					(*QTSServer::fDataCallBackFunc)(_recv_media_buf[type], _media_buf_pos[type]);
-				}
-			}
-			else if(2 == type)
-			{
-				if(NULL != QTSServer::fDataCallBackFunc)
-				{
-					(*QTSServer::fDataCallBackFunc)(_recv_media_buf[type], _media_buf_pos[type]);
-				}
-			}
-
-			_media_buf_pos[type] = 0;
-		}
-
-		return true;
-	}
-    
 };
 
 #endif
@@ -150,6 +150,7 @@ void RTSPSession::Initialize()
 RTSPSession::RTSPSession( Bool16 doReportHTTPConnectionAddress )
 : RTSPSessionInterface(),
   fRequest(NULL),
+  fRequestStorage(NULL),
   fRTPSession(NULL),
   fReadMutex(),
   fHTTPMethod( kHTTPMethodInit ),
@@ -189,6 +190,7 @@ RTSPSession::RTSPSession( Bool16 doReportHTTPConnectionAddress )
                     
     (void)QTSS_IDForAttr(qtssClientSessionObjectType, sBroadcasterSessionName, &sClientBroadcastSessionAttr);
 
+    fInputStream.SetInterleavedDataHandler(this);
 }
 
 RTSPSession::~RTSPSession()
@@ -202,6 +204,7 @@ RTSPSession::~RTSPSession()
         (void)QTSServerInterface::GetModule(QTSSModule::kRTSPSessionClosingRole, x)->CallDispatch(QTSS_RTSPSessionClosing_Role, &theParams);
 
     this->CleanupRequest();// Make sure that all our objects are deleted
+    delete [] fRequestStorage;
     if(fSessionType == qtssRTSPSession)
         QTSServerInterface::GetServer()->AlterCurrentRTSPSessionCount(-1);
     else
@@ -360,6 +363,17 @@ SInt64 RTSPSession::Run()
                     //+rt use the socket that reads the data, may be different now.
 					//qtss_printf("B1 ");//fym
 
+                    // Responses held back for pipelined requests have to go out before we wait
+                    if(fOutputStream.GetBytesBuffered() > 0)
+                    {
+                        OSMutexLocker sessionLocker(&fSessionMutex);
+                        if(fOutputStream.Flush() == EAGAIN)
+                        {
+                            fSocket.RequestEvent(EV_WR);
+                            return 0;
+                        }
+                    }
+                    
                     fInputSocketP->RequestEvent(EV_RE);
 
 					//qtss_printf("E ");//fym
@@ -412,7 +426,9 @@ SInt64 RTSPSession::Run()
                 //fym Assert( fInputStream.GetRequestBuffer() );
                 
                 //fym Assert(fRequest == NULL);
-                fRequest = NEW RTSPRequest(this);
+                if(fRequestStorage == NULL)
+                    fRequestStorage = NEW char[sizeof(RTSPRequest)];
+                fRequest = new (fRequestStorage) RTSPRequest(this);
                 fRoleParams.rtspRequestParams.inRTSPRequest = fRequest;
                 fRoleParams.rtspRequestParams.inRTSPHeaders = fRequest->GetHeaderDictionary();
 
@@ -1024,6 +1040,16 @@ SInt64 RTSPSession::Run()
 					fSentOptionsRequest = false;
 				}
 				
+                // If the client has pipelined another request behind this one, it is already
+                // in the input buffer. Leave this response where it is so that it goes out in
+                // the same write as the next one, rather than in a send of its own.
+                if(fLiveSession && !fSentOptionsRequest && (this->GetRemainingReqBodyLen() <= 0)
+                    && (fOutputStream.GetBytesBuffered() < kMaxHeldResponseBytes) && fInputStream.IsRequestPending())
+                {
+                    fState = kCleaningUp;
+                    break;
+                }
+                
                 err = fOutputStream.Flush();
                 
                 if(err == EAGAIN)
@@ -1639,6 +1665,24 @@ void RTSPSession::SetupRequest()
         return;
     }
 
+    //
+    // A GET_PARAMETER without a body is a keep-alive. Unless a module has said it handles
+    // GET_PARAMETER, answer it here. The RTP session's timeout was refreshed above, and
+    // running it past the rest of the modules would get nothing but an error response.
+    if((fRequest->GetMethod() == qtssGetParameterMethod) && (this->GetRemainingReqBodyLen() <= 0)
+        && !QTSServerInterface::IsMethodHandled(qtssGetParameterMethod))
+    {
+        StrPtrLen* cSeqPtr = fRequest->GetHeaderDictionary()->GetValue(qtssCSeqHeader);
+        if(cSeqPtr == NULL || cSeqPtr->Len == 0)
+            statusCode = qtssClientBadRequest;
+        else if((fRTPSession == NULL) && (fRequest->GetHeaderDictionary()->GetValue(qtssSessionHeader)->Len > 0))
+            statusCode = qtssClientSessionNotFound;
+            
+        fRequest->SetValue(qtssRTSPReqStatusCode, 0, &statusCode, sizeof(statusCode));
+        fRequest->SendHeader();
+        return;
+    }
+
     //
 	// If this is a SET_PARAMETER request, don't let modules see it.
 	if(fRequest->GetMethod() == qtssSetParameterMethod)
@@ -1748,7 +1792,7 @@ void RTSPSession::CleanupRequest()
             delete [] fRequest->GetValue(qtssRTSPReqFullRequest)->Ptr;
             
         // NULL out any references to the current request
-        delete fRequest;
+        fRequest->~RTSPRequest();
         fRequest = NULL;
         fRoleParams.rtspRequestParams.inRTSPRequest = NULL;
         fRoleParams.rtspRequestParams.inRTSPHeaders = NULL;
@@ -2199,3 +2243,61 @@ void RTSPSession::HandleIncomingDataPacket()
 }
 #endif
 
+
+void RTSPSession::ProcessInterleavedData(UInt8* inChannels, StrPtrLen* inPackets, UInt32 inNumPackets)
+{
+    // We received something so auto refresh
+    fTimeoutTask.RefreshTimeout();
+
+    OSRefTable* theMap = QTSServerInterface::GetServer()->GetRTPSessionMap();
+    UInt32 theStart = 0;
+    while (theStart < inNumPackets)
+    {
+        // Everything a publisher pushes in one read normally belongs to a single RTP session,
+        // so look it up (using the channel map built at SETUP) once per run of packets.
+        StrPtrLen* theSessionID = this->GetSessionIDForChannelNum(inChannels[theStart]);
+        if (theSessionID == NULL)
+            theSessionID = &fLastRTPSessionIDPtr;
+        
+        UInt32 theEnd = theStart + 1;
+        while (theEnd < inNumPackets)
+        {
+            StrPtrLen* theNextID = this->GetSessionIDForChannelNum(inChannels[theEnd]);
+            if (theNextID == NULL)
+                theNextID = &fLastRTPSessionIDPtr;
+            if (!theNextID->Equal(*theSessionID))
+                break;
+            theEnd++;
+        }
+        
+        RTSPInterleavedDataHandler* theHandler = NULL;
+        OSRef* theRef = theMap->Resolve(theSessionID);
+        if (theRef != NULL)
+        {
+            RTPSession* theRTPSession = (RTPSession*)theRef->GetObject();
+            {
+                OSMutexLocker locker(theRTPSession->GetSessionMutex());
+                theRTPSession->RefreshTimeout();
+            }
+            
+            // Our ref only keeps the RTPSession around, not the handler it pushes to. The
+            // handler is cleared before it goes away, and clearing it waits for this mutex.
+            // Don't hold the session mutex here: the module may be holding its own locks
+            // while it waits for that one.
+            OSMutexLocker locker(theRTPSession->GetInterleavedDataMutex());
+            theHandler = theRTPSession->GetInterleavedDataHandler();
+            if (theHandler != NULL)
+                theHandler->ProcessInterleavedData(&inChannels[theStart], &inPackets[theStart], theEnd - theStart);
+        }
+        
+        if ((theHandler == NULL) && (NULL != QTSServer::fDataCallBackFunc))
+        {
+            for (UInt32 x = theStart; x < theEnd; x++)
+                (*QTSServer::fDataCallBackFunc)(inPackets[x].Ptr, inPackets[x].Len);
+        }
+        
+        if (theRef != NULL)
+            theMap->Release(theRef);
+        theStart = theEnd;
+    }
+}
@@ -0,0 +1,732 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * Copyright (c) 1999-2003 Apple Computer, Inc.  All Rights Reserved.
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ *
+ */
+/*
+    File:       ReflectorBenchmark.cpp
+
+    Contains:   End to end benchmark of the reflector. Starts the server in this process,
+                feeds an Annex B H.264 file (test.264) into it through
+                CRTSPServer::input_stream_data on any number of channels at a fixed
+                frame rate, and plays every channel back over loopback to RTSPClientLib
+                viewers using UDP or interleaved TCP. Once everyone is playing it measures
+                for a while, then writes packets/sec, CPU and memory per viewer and
+                ingest to receive latency to a JSON file, so builds can be compared.
+                
+                Latency is matched up through the SSRC. ReflectorStream::PushRelayPacket
+                gives every RTP packet cut from a frame that frame's number on its
+                stream, counting from 1, so we note the time each frame number went in.
+                
+                The viewers run in this process too, so the CPU and memory they use is
+                part of what gets reported.
+
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SafeStdLib.h"
+
+#if __Win32__
+#include <psapi.h>
+#else
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include "getopt.h"
+#include "OS.h"
+#include "OSThread.h"
+#include "OSMemory.h"
+#include "SocketUtils.h"
+#include "StartCodeScanner.h"
+#include "ClientSession.h"
+#include "revision.h"
+
+#include "RTSPServer.h"
+
+using namespace RTSPServerLib;
+
+static const UInt32 kMaxStartupSec = 60;        // to get everyone playing, before giving up on the stragglers
+static const UInt32 kMaxTeardownSec = 10;
+static const UInt32 kViewerSockRcvBufSize = 256 * 1024;
+
+//
+// Latencies in usec. Linear up to 64, then 32 buckets for each power of 2 above that,
+// so percentiles are within about 3%.
+class LatencyHistogram
+{
+    public:
+    
+        enum
+        {
+            kLinearBuckets  = 64,   //UInt32
+            kSubBuckets     = 32,   //UInt32
+            kNumBuckets     = kLinearBuckets + (32 - 6) * kSubBuckets   //UInt32 (msb 6 to 31)
+        };
+        
+        LatencyHistogram() { ::memset(fBuckets, 0, sizeof(fBuckets)); fCount = 0; fMax = 0; }
+        
+        void    Record(UInt32 inValue);
+        void    Merge(const LatencyHistogram& inHistogram);
+        
+        UInt32  GetCount()  { return fCount; }
+        UInt32  GetMax()    { return fMax; }
+        
+        // Smallest value that at least inPercent of the samples are at or below.
+        // 0 if nothing was recorded.
+        UInt32  GetPercentile(Float32 inPercent);
+        
+    private:
+    
+        static UInt32   GetBucket(UInt32 inValue);
+        static UInt32   GetBucketTop(UInt32 inBucket);
+        
+        UInt32  fBuckets[kNumBuckets];
+        UInt32  fCount;
+        UInt32  fMax;
+};
+
+//
+// One reflected stream, fed from the ingest thread, and the times its frames went in.
+// The ingest thread writes a slot's time before its frame number, so a viewer that
+// finds the number it is looking for also finds the right time.
+struct BenchmarkChannel
+{
+    enum
+    {
+        kNumFrameTimes = 1024   //UInt32 frames a packet can lag behind and still be timed
+    };
+    
+    UInt16          fUUID;
+    char            fURL[64];
+    UInt32          fNextFrame;         // number the reflector will give the next frame it takes
+    UInt32          fFramesIngested;
+    UInt64          fBytesIngested;
+    
+    volatile UInt32 fFrameNums[kNumFrameTimes];
+    volatile SInt64 fFrameTimes[kNumFrameTimes];    // OS::Microseconds()
+};
+
+//
+// A viewer is a ClientSession plus the numbers we keep on what it got. These are
+// only touched from the session's Run, through the packet handler.
+struct BenchmarkViewer
+{
+    static void PacketHandler(void* inCookie, UInt32 inTrackID, char* inPacket, UInt32 inLength);
+    
+    ClientSession*      fSession;
+    BenchmarkChannel*   fChannel;
+    Bool16              fIsTCP;
+    UInt64              fPacketsReceived;
+    UInt64              fBytesReceived;
+    UInt64              fUnmatchedPackets;  // frame had already left the ring, or never went through it
+    LatencyHistogram    fLatency;
+};
+
+struct TransportTotals
+{
+    TransportTotals() : fViewers(0), fPacketsReceived(0), fBytesReceived(0), fUnmatchedPackets(0) {}
+    
+    void    Add(BenchmarkViewer* inViewer);
+    
+    UInt32              fViewers;
+    UInt64              fPacketsReceived;
+    UInt64              fBytesReceived;
+    UInt64              fUnmatchedPackets;
+    LatencyHistogram    fLatency;
+};
+
+struct ProcessStats
+{
+    SInt64  fCPUUsec;       // user + system
+    UInt64  fResidentBytes;
+};
+
+//
+// Pushes one frame every 1/fFramesPerSec sec into every channel, looping over the file.
+class IngestThread : public OSThread
+{
+    public:
+    
+        IngestThread(CRTSPServer* inServer, BenchmarkChannel* inChannels, UInt32 inNumChannels,
+                        StrPtrLen* inFrames, UInt32 inNumFrames, UInt32 inFramesPerSec)
+        :   fServer(inServer), fChannels(inChannels), fNumChannels(inNumChannels),
+            fFrames(inFrames), fNumFrames(inNumFrames), fFramesPerSec(inFramesPerSec) {}
+        virtual ~IngestThread() {}
+        
+        virtual void Entry();
+        
+    private:
+    
+        CRTSPServer*        fServer;
+        BenchmarkChannel*   fChannels;
+        UInt32              fNumChannels;
+        StrPtrLen*          fFrames;
+        UInt32              fNumFrames;
+        UInt32              fFramesPerSec;
+};
+
+static volatile Bool16 sMeasuring = false;
+
+static UInt32   SplitFrames(UInt8* inData, UInt32 inLen, StrPtrLen** outFrames);
+static void     GetProcessStats(ProcessStats* outStats);
+static void     WriteJSONString(FILE* inFile, const char* inString);
+static void     WriteLatency(FILE* inFile, LatencyHistogram* inLatency);
+static void     WriteTransport(FILE* inFile, const char* inName, TransportTotals* inTotals, Float64 inSeconds);
+static void     PrintUsage();
+
+void LatencyHistogram::Record(UInt32 inValue)
+{
+    fBuckets[GetBucket(inValue)]++;
+    fCount++;
+    if (inValue > fMax)
+        fMax = inValue;
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& inHistogram)
+{
+    for (UInt32 x = 0; x < kNumBuckets; x++)
+        fBuckets[x] += inHistogram.fBuckets[x];
+    fCount += inHistogram.fCount;
+    if (inHistogram.fMax > fMax)
+        fMax = inHistogram.fMax;
+}
+
+UInt32 LatencyHistogram::GetPercentile(Float32 inPercent)
+{
+    if (fCount == 0)
+        return 0;
+        
+    UInt32 theTarget = (UInt32) (((Float64) fCount * inPercent) / 100);
+    if (theTarget == 0)
+        theTarget = 1;
+        
+    UInt32 theTotal = 0;
+    for (UInt32 x = 0; x < kNumBuckets; x++)
+    {
+        theTotal += fBuckets[x];
+        if (theTotal >= theTarget)
+        {
+            UInt32 theTop = GetBucketTop(x);
+            return (theTop < fMax) ? theTop : fMax;
+        }
+    }
+    return fMax;
+}
+
+UInt32 LatencyHistogram::GetBucket(UInt32 inValue)
+{
+    if (inValue < kLinearBuckets)
+        return inValue;
+        
+    UInt32 theMSB = 6;
+    while ((inValue >> theMSB) > 1)
+        theMSB++;
+    
+    // The 5 bits under the most significant one pick the sub bucket
+    UInt32 theSubBucket = (inValue >> (theMSB - 5)) - kSubBuckets;
+    return kLinearBuckets + ((theMSB - 6) * kSubBuckets) + theSubBucket;
+}
+
+UInt32 LatencyHistogram::GetBucketTop(UInt32 inBucket)
+{
+    if (inBucket < kLinearBuckets)
+        return inBucket;
+        
+    UInt32 theMSB = ((inBucket - kLinearBuckets) / kSubBuckets) + 6;
+    UInt32 theSubBucket = (inBucket - kLinearBuckets) % kSubBuckets;
+    
+    return ((kSubBuckets + theSubBucket + 1) << (theMSB - 5)) - 1;
+}
+
+void BenchmarkViewer::PacketHandler(void* inCookie, UInt32 /*inTrackID*/, char* inPacket, UInt32 inLength)
+{
+    BenchmarkViewer* theViewer = (BenchmarkViewer*)inCookie;
+    if ((!sMeasuring) || (inLength < 12))
+        return;
+        
+    SInt64 theNow = OS::Microseconds();
+    theViewer->fPacketsReceived++;
+    theViewer->fBytesReceived += inLength;
+    
+    UInt32 theFrame = 0;
+    ::memcpy(&theFrame, inPacket + 8, sizeof(theFrame));
+    theFrame = ntohl(theFrame);
+    
+    BenchmarkChannel* theChannel = theViewer->fChannel;
+    UInt32 theSlot = theFrame % BenchmarkChannel::kNumFrameTimes;
+    if (theChannel->fFrameNums[theSlot] != theFrame)
+    {
+        theViewer->fUnmatchedPackets++;
+        return;
+    }
+    
+    SInt64 theLatency = theNow - theChannel->fFrameTimes[theSlot];
+    if (theLatency < 0)
+        theLatency = 0;
+    else if (theLatency > (SInt64)kUInt32_Max)
+        theLatency = kUInt32_Max;
+    theViewer->fLatency.Record((UInt32)theLatency);
+}
+
+void TransportTotals::Add(BenchmarkViewer* inViewer)
+{
+    fViewers++;
+    fPacketsReceived += inViewer->fPacketsReceived;
+    fBytesReceived += inViewer->fBytesReceived;
+    fUnmatchedPackets += inViewer->fUnmatchedPackets;
+    fLatency.Merge(inViewer->fLatency);
+}
+
+void IngestThread::Entry()
+{
+    SInt64 theStartTime = OS::Microseconds();
+    UInt64 theNumTicks = 0;
+    UInt32 theFrameIndex = 0;
+    
+    while (!this->IsStopRequested())
+    {
+        SInt64 theDueTime = theStartTime + (SInt64)((theNumTicks * 1000000) / fFramesPerSec);
+        SInt64 theNow = OS::Microseconds();
+        if (theNow < theDueTime)
+        {
+            OSThread::Sleep((UInt32)((theDueTime - theNow + 999) / 1000));
+            continue;
+        }
+        
+        StrPtrLen* theFrame = &fFrames[theFrameIndex];
+        for (UInt32 x = 0; x < fNumChannels; x++)
+        {
+            BenchmarkChannel* theChannel = &fChannels[x];
+            UInt32 theSlot = theChannel->fNextFrame % BenchmarkChannel::kNumFrameTimes;
+            theChannel->fFrameTimes[theSlot] = OS::Microseconds();
+            theChannel->fFrameNums[theSlot] = theChannel->fNextFrame;
+            
+            // Until a viewer has set the channel up, the reflector drops the frame and
+            // doesn't number it, and returns 0.
+            if (fServer->input_stream_data(theChannel->fUUID, theFrame->Ptr, theFrame->Len, CRTSPServer::kVideoStream) > 0)
+            {
+                theChannel->fNextFrame++;
+                theChannel->fFramesIngested++;
+                theChannel->fBytesIngested += theFrame->Len;
+            }
+        }
+        
+        theNumTicks++;
+        theFrameIndex = (theFrameIndex + 1) % fNumFrames;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    extern char* optarg;
+    int ch;
+    
+    UInt16 thePort = 8554;
+    const char* theFilePath = "test.264";
+    const char* theOutputPath = "ReflectorBenchmark.json";
+    UInt32 theNumChannels = 1;
+    UInt32 theFirstUUID = 1;
+    UInt32 theFramesPerSec = 25;
+    UInt32 theNumUDPViewers = 100;
+    UInt32 theNumTCPViewers = 0;
+    UInt32 theViewerStartsPerSec = 200;
+    UInt32 theWarmupSec = 5;
+    UInt32 theDurationSec = 30;
+    UInt32 theMaxPacketSize = 1400;
+    
+    while ((ch = getopt(argc, argv, "p:f:o:c:b:r:u:t:s:w:d:m:h")) != EOF)
+    {
+        switch (ch)
+        {
+            case 'p': thePort = (UInt16)::atoi(optarg); break;
+            case 'f': theFilePath = optarg; break;
+            case 'o': theOutputPath = optarg; break;
+            case 'c': theNumChannels = ::atoi(optarg); break;
+            case 'b': theFirstUUID = ::atoi(optarg); break;
+            case 'r': theFramesPerSec = ::atoi(optarg); break;
+            case 'u': theNumUDPViewers = ::atoi(optarg); break;
+            case 't': theNumTCPViewers = ::atoi(optarg); break;
+            case 's': theViewerStartsPerSec = ::atoi(optarg); break;
+            case 'w': theWarmupSec = ::atoi(optarg); break;
+            case 'd': theDurationSec = ::atoi(optarg); break;
+            case 'm': theMaxPacketSize = ::atoi(optarg); break;
+            default:
+                PrintUsage();
+                ::exit(0);
+        }
+    }
+    
+    UInt32 theNumViewers = theNumUDPViewers + theNumTCPViewers;
+    if ((theNumChannels == 0) || (theFramesPerSec == 0) || (theNumViewers == 0) || (theDurationSec == 0) ||
+        (theViewerStartsPerSec == 0) || (theFirstUUID + theNumChannels > 65536))
+    {
+        PrintUsage();
+        ::exit(-1);
+    }
+    
+    //
+    // Read the whole file in and cut it into frames up front, so the ingest thread
+    // costs no more than the calls into the server.
+    FILE* theFile = ::fopen(theFilePath, "rb");
+    if (theFile == NULL)
+    {
+        qtss_printf("ReflectorBenchmark: couldn't open %s\n", theFilePath);
+        ::exit(-1);
+    }
+    (void)::fseek(theFile, 0, SEEK_END);
+    UInt32 theFileLen = (UInt32)::ftell(theFile);
+    (void)::fseek(theFile, 0, SEEK_SET);
+    
+    UInt8* theFileData = NEW UInt8[theFileLen];
+    Bool16 isRead = (::fread(theFileData, 1, theFileLen, theFile) == theFileLen);
+    ::fclose(theFile);
+    
+    StrPtrLen* theFrames = NULL;
+    UInt32 theNumFrames = isRead ? SplitFrames(theFileData, theFileLen, &theFrames) : 0;
+    if (theNumFrames == 0)
+    {
+        qtss_printf("ReflectorBenchmark: no H.264 frames in %s\n", theFilePath);
+        ::exit(-1);
+    }
+    
+    //
+    // The server starts its own task and event threads, which the viewers use as well.
+    CRTSPServer* theServer = NEW CRTSPServer(thePort);
+    theServer->set_max_packet_size((unsigned short)theMaxPacketSize);
+    
+    BenchmarkChannel* theChannels = NEW BenchmarkChannel[theNumChannels];
+    ::memset(theChannels, 0, sizeof(BenchmarkChannel) * theNumChannels);
+    for (UInt32 x = 0; x < theNumChannels; x++)
+    {
+        theChannels[x].fUUID = (UInt16)(theFirstUUID + x);
+        theChannels[x].fNextFrame = 1;
+        qtss_sprintf(theChannels[x].fURL, "rtsp://127.0.0.1:%u/%u.sdp", thePort, theChannels[x].fUUID);
+    }
+    
+    ProcessStats theIdleStats;
+    GetProcessStats(&theIdleStats);
+    
+    IngestThread* theIngestThread = NEW IngestThread(theServer, theChannels, theNumChannels, theFrames, theNumFrames, theFramesPerSec);
+    theIngestThread->Start();
+    
+    //
+    // Start the viewers, a tenth of a second's worth at a time. TCP viewers come
+    // after all the UDP ones, and each kind is dealt out over the channels in turn.
+    UInt32 theAddr = SocketUtils::ConvertStringToAddr("127.0.0.1");
+    UInt32 theSessionDurationSec = kMaxStartupSec + theWarmupSec + theDurationSec + kMaxTeardownSec;
+    UInt32 theStartsPerTick = (theViewerStartsPerSec + 9) / 10;
+    
+    BenchmarkViewer* theViewers = NEW BenchmarkViewer[theNumViewers];
+    for (UInt32 x = 0; x < theNumViewers; x++)
+    {
+        BenchmarkViewer* theViewer = &theViewers[x];
+        theViewer->fIsTCP = (x >= theNumUDPViewers);
+        theViewer->fChannel = &theChannels[(theViewer->fIsTCP ? x - theNumUDPViewers : x) % theNumChannels];
+        theViewer->fPacketsReceived = 0;
+        theViewer->fBytesReceived = 0;
+        theViewer->fUnmatchedPackets = 0;
+        
+        // A read interval of 0 has the session read as packets arrive, so the time a
+        // packet is handed to us is the time it got here.
+        theViewer->fSession = NEW ClientSession(theAddr, thePort, theViewer->fChannel->fURL,
+                                        theViewer->fIsTCP ? ClientSession::kRTSPTCPClientType : ClientSession::kRTSPUDPClientType,
+                                        theSessionDurationSec, 0, 5, 0, 0, false, 0,
+                                        kViewerSockRcvBufSize, 1.5, NULL,
+                                        1, false, NULL, 0,
+                                        false, false, 0);
+        theViewer->fSession->SetPacketHandler(BenchmarkViewer::PacketHandler, theViewer);
+        
+        if (((x + 1) % theStartsPerTick) == 0)
+            OSThread::Sleep(100);
+    }
+    
+    UInt32 theNumPlaying = 0;
+    UInt32 theNumFailed = 0;
+    SInt64 theStartupDeadline = OS::Milliseconds() + (kMaxStartupSec * 1000);
+    while (true)
+    {
+        theNumPlaying = 0;
+        theNumFailed = 0;
+        for (UInt32 x = 0; x < theNumViewers; x++)
+        {
+            if (theViewers[x].fSession->GetState() == ClientSession::kPlaying)
+                theNumPlaying++;
+            else if (theViewers[x].fSession->IsDone())
+                theNumFailed++;
+        }
+        if ((theNumPlaying + theNumFailed == theNumViewers) || (OS::Milliseconds() > theStartupDeadline))
+            break;
+        OSThread::Sleep(100);
+    }
+    qtss_printf("ReflectorBenchmark: %lu of %lu viewers playing, %lu failed\n", theNumPlaying, theNumViewers, theNumFailed);
+    
+    OSThread::Sleep(theWarmupSec * 1000);
+    
+    //
+    // Measure
+    UInt32 theStartFrames = 0;
+    UInt64 theStartBytes = 0;
+    for (UInt32 x = 0; x < theNumChannels; x++)
+    {
+        theStartFrames += theChannels[x].fFramesIngested;
+        theStartBytes += theChannels[x].fBytesIngested;
+    }
+    ProcessStats theStartStats;
+    GetProcessStats(&theStartStats);
+    SInt64 theStartTime = OS::Microseconds();
+    sMeasuring = true;
+    
+    OSThread::Sleep(theDurationSec * 1000);
+    
+    sMeasuring = false;
+    SInt64 theEndTime = OS::Microseconds();
+    ProcessStats theEndStats;
+    GetProcessStats(&theEndStats);
+    UInt32 theFramesIngested = 0;
+    UInt64 theBytesIngested = 0;
+    for (UInt32 x = 0; x < theNumChannels; x++)
+    {
+        theFramesIngested += theChannels[x].fFramesIngested;
+        theBytesIngested += theChannels[x].fBytesIngested;
+    }
+    theFramesIngested -= theStartFrames;
+    theBytesIngested -= theStartBytes;
+    
+    //
+    // Tear everyone down. A viewer that's still playing now was playing throughout.
+    TransportTotals theTotals[2];   // UDP, TCP
+    theNumPlaying = 0;
+    for (UInt32 x = 0; x < theNumViewers; x++)
+    {
+        if (theViewers[x].fSession->GetState() == ClientSession::kPlaying)
+        {
+            theNumPlaying++;
+            theTotals[theViewers[x].fIsTCP ? 1 : 0].Add(&theViewers[x]);
+        }
+        theViewers[x].fSession->Signal(ClientSession::kTeardownEvent);
+    }
+    
+    theIngestThread->StopAndWaitForThread();
+    delete theIngestThread;
+    
+    SInt64 theTeardownDeadline = OS::Milliseconds() + (kMaxTeardownSec * 1000);
+    for (UInt32 x = 0; x < theNumViewers; x++)
+    {
+        while ((!theViewers[x].fSession->IsDone()) && (OS::Milliseconds() < theTeardownDeadline))
+            OSThread::Sleep(10);
+    }
+    for (UInt32 x = 0; x < theNumViewers; x++)
+        theViewers[x].fSession->Signal(Task::kKillEvent);
+    
+    //
+    // Write the results
+    Float64 theSeconds = (Float64)(theEndTime - theStartTime) / 1000000;
+    TransportTotals theAllViewers;
+    theAllViewers.fViewers = theTotals[0].fViewers + theTotals[1].fViewers;
+    for (UInt32 x = 0; x < 2; x++)
+    {
+        theAllViewers.fPacketsReceived += theTotals[x].fPacketsReceived;
+        theAllViewers.fBytesReceived += theTotals[x].fBytesReceived;
+        theAllViewers.fUnmatchedPackets += theTotals[x].fUnmatchedPackets;
+        theAllViewers.fLatency.Merge(theTotals[x].fLatency);
+    }
+    
+    Float64 theCPUPercent = ((Float64)(theEndStats.fCPUUsec - theStartStats.fCPUUsec) * 100) / (Float64)(theEndTime - theStartTime);
+    SInt64 theViewerBytes = (SInt64)theEndStats.fResidentBytes - (SInt64)theIdleStats.fResidentBytes;
+    
+    FILE* theOutput = ::fopen(theOutputPath, "w");
+    if (theOutput == NULL)
+    {
+        qtss_printf("ReflectorBenchmark: couldn't write %s\n", theOutputPath);
+        ::exit(-1);
+    }
+    
+    qtss_fprintf(theOutput, "{\n");
+    qtss_fprintf(theOutput, "  \"benchmark\": \"reflector\",\n");
+    qtss_fprintf(theOutput, "  \"version\": \"%s\",\n", kVersionString);
+    qtss_fprintf(theOutput, "  \"build\": \"%s\",\n", kBuildString);
+    qtss_fprintf(theOutput, "  \"compiled\": \"%s %s\",\n", __DATE__, __TIME__);
+    qtss_fprintf(theOutput, "  \"config\": {\n");
+    qtss_fprintf(theOutput, "    \"file\": ");
+    WriteJSONString(theOutput, theFilePath);
+    qtss_fprintf(theOutput, ",\n");
+    qtss_fprintf(theOutput, "    \"file_frames\": %lu,\n", theNumFrames);
+    qtss_fprintf(theOutput, "    \"channels\": %lu,\n", theNumChannels);
+    qtss_fprintf(theOutput, "    \"frames_per_sec\": %lu,\n", theFramesPerSec);
+    qtss_fprintf(theOutput, "    \"udp_viewers\": %lu,\n", theNumUDPViewers);
+    qtss_fprintf(theOutput, "    \"tcp_viewers\": %lu,\n", theNumTCPViewers);
+    qtss_fprintf(theOutput, "    \"max_packet_size\": %lu,\n", theMaxPacketSize);
+    qtss_fprintf(theOutput, "    \"warmup_sec\": %lu,\n", theWarmupSec);
+    qtss_fprintf(theOutput, "    \"duration_sec\": %lu\n", theDurationSec);
+    qtss_fprintf(theOutput, "  },\n");
+    qtss_fprintf(theOutput, "  \"viewers_playing\": %lu,\n", theNumPlaying);
+    qtss_fprintf(theOutput, "  \"viewers_failed\": %lu,\n", theNumViewers - theNumPlaying);
+    qtss_fprintf(theOutput, "  \"seconds\": %.3f,\n", theSeconds);
+    qtss_fprintf(theOutput, "  \"ingest_frames_per_sec\": %.1f,\n", theFramesIngested / theSeconds);
+    qtss_fprintf(theOutput, "  \"ingest_kbps\": %.1f,\n", ((Float64)(SInt64)theBytesIngested * 8) / (theSeconds * 1000));
+    qtss_fprintf(theOutput, "  \"cpu_percent\": %.2f,\n", theCPUPercent);
+    qtss_fprintf(theOutput, "  \"cpu_percent_per_viewer\": %.4f,\n", (theNumPlaying > 0) ? theCPUPercent / theNumPlaying : 0.0);
+    qtss_fprintf(theOutput, "  \"cpu_usec_per_packet\": %.3f,\n", (theAllViewers.fPacketsReceived > 0) ?
+                        (Float64)(theEndStats.fCPUUsec - theStartStats.fCPUUsec) / (Float64)(SInt64)theAllViewers.fPacketsReceived : 0.0);
+    qtss_fprintf(theOutput, "  \"memory_idle_bytes\": %"_64BITARG_"u,\n", theIdleStats.fResidentBytes);
+    qtss_fprintf(theOutput, "  \"memory_bytes\": %"_64BITARG_"u,\n", theEndStats.fResidentBytes);
+    qtss_fprintf(theOutput, "  \"memory_per_viewer_bytes\": %"_64BITARG_"d,\n", (theNumPlaying > 0) ? theViewerBytes / (SInt64)theNumPlaying : 0);
+    WriteTransport(theOutput, "all", &theAllViewers, theSeconds);
+    qtss_fprintf(theOutput, ",\n");
+    WriteTransport(theOutput, "udp", &theTotals[0], theSeconds);
+    qtss_fprintf(theOutput, ",\n");
+    WriteTransport(theOutput, "tcp", &theTotals[1], theSeconds);
+    qtss_fprintf(theOutput, "\n}\n");
+    ::fclose(theOutput);
+    
+    qtss_printf("ReflectorBenchmark: %.0f packets/sec, %.2f%% CPU, latency p50 %lu usec p99 %lu usec. Results in %s\n",
+                (Float64)(SInt64)theAllViewers.fPacketsReceived / theSeconds, theCPUPercent,
+                theAllViewers.fLatency.GetPercentile(50), theAllViewers.fLatency.GetPercentile(99), theOutputPath);
+    
+    // The viewers are left for the process to clean up. A session may still be
+    // in its last Run, and that can call the packet handler.
+    delete theServer;
+    return 0;
+}
+
+//
+// Cuts an Annex B stream into frames, a frame being everything up to and including
+// the next slice. Each frame keeps its start codes, as a broadcaster would send it.
+UInt32 SplitFrames(UInt8* inData, UInt32 inLen, StrPtrLen** outFrames)
+{
+    UInt32 theNumFrames = 0;
+    UInt32 theOffset = 0;
+    StrPtrLen theNALUnit;
+    while (StartCodeScanner::GetNextNALUnit(inData, inLen, &theOffset, &theNALUnit))
+    {
+        UInt8 theNALType = (theNALUnit.Len > 0) ? (theNALUnit.Ptr[0] & 0x1F) : 0;
+        if ((theNALType >= 1) && (theNALType <= 5))
+            theNumFrames++;
+    }
+    if (theNumFrames == 0)
+        return 0;
+    
+    *outFrames = NEW StrPtrLen[theNumFrames];
+    UInt32 theFrameIndex = 0;
+    UInt32 theFrameStart = StartCodeScanner::Find(inData, inLen);  // skip anything ahead of the first start code
+    theOffset = 0;
+    while (StartCodeScanner::GetNextNALUnit(inData, inLen, &theOffset, &theNALUnit))
+    {
+        UInt8 theNALType = (theNALUnit.Len > 0) ? (theNALUnit.Ptr[0] & 0x1F) : 0;
+        if ((theNALType < 1) || (theNALType > 5))
+            continue;
+        
+        UInt32 theFrameEnd = (UInt32)((UInt8*)theNALUnit.Ptr - inData) + theNALUnit.Len;
+        (*outFrames)[theFrameIndex++].Set((char*)&inData[theFrameStart], theFrameEnd - theFrameStart);
+        theFrameStart = theFrameEnd;
+    }
+    return theNumFrames;
+}
+
+void GetProcessStats(ProcessStats* outStats)
+{
+#if __Win32__
+    FILETIME theCreationTime, theExitTime, theKernelTime, theUserTime;
+    (void)::GetProcessTimes(::GetCurrentProcess(), &theCreationTime, &theExitTime, &theKernelTime, &theUserTime);
+    
+    // 100 nsec units
+    UInt64 theKernel = ((UInt64)theKernelTime.dwHighDateTime << 32) | theKernelTime.dwLowDateTime;
+    UInt64 theUser = ((UInt64)theUserTime.dwHighDateTime << 32) | theUserTime.dwLowDateTime;
+    outStats->fCPUUsec = (SInt64)((theKernel + theUser) / 10);
+    
+    PROCESS_MEMORY_COUNTERS theCounters;
+    ::memset(&theCounters, 0, sizeof(theCounters));
+    (void)::GetProcessMemoryInfo(::GetCurrentProcess(), &theCounters, sizeof(theCounters));
+    outStats->fResidentBytes = theCounters.WorkingSetSize;
+#else
+    struct rusage theUsage;
+    (void)::getrusage(RUSAGE_SELF, &theUsage);
+    outStats->fCPUUsec = ((SInt64)theUsage.ru_utime.tv_sec * 1000000) + theUsage.ru_utime.tv_usec
+                        + ((SInt64)theUsage.ru_stime.tv_sec * 1000000) + theUsage.ru_stime.tv_usec;
+    
+    // The second field of statm is the resident set, in pages
+    outStats->fResidentBytes = 0;
+    FILE* theStatm = ::fopen("/proc/self/statm", "r");
+    if (theStatm != NULL)
+    {
+        unsigned long theSize = 0, theResident = 0;
+        if (::fscanf(theStatm, "%lu %lu", &theSize, &theResident) == 2)
+            outStats->fResidentBytes = (UInt64)theResident * ::sysconf(_SC_PAGESIZE);
+        ::fclose(theStatm);
+    }
+#endif
+}
+
+void WriteJSONString(FILE* inFile, const char* inString)
+{
+    qtss_fprintf(inFile, "\"");
+    for ( ; *inString != '\0'; inString++)
+    {
+        if ((*inString == '\\') || (*inString == '"'))
+            qtss_fprintf(inFile, "\\%c", *inString);
+        else if ((UInt8)*inString >= 0x20)
+            qtss_fprintf(inFile, "%c", *inString);
+    }
+    qtss_fprintf(inFile, "\"");
+}
+
+void WriteLatency(FILE* inFile, LatencyHistogram* inLatency)
+{
+    qtss_fprintf(inFile, "{ \"count\": %lu, \"p50\": %lu, \"p90\": %lu, \"p99\": %lu, \"max\": %lu }",
+                    inLatency->GetCount(), inLatency->GetPercentile(50), inLatency->GetPercentile(90),
+                    inLatency->GetPercentile(99), inLatency->GetMax());
+}
+
+void WriteTransport(FILE* inFile, const char* inName, TransportTotals* inTotals, Float64 inSeconds)
+{
+    qtss_fprintf(inFile, "  \"%s\": {\n", inName);
+    qtss_fprintf(inFile, "    \"viewers\": %lu,\n", inTotals->fViewers);
+    qtss_fprintf(inFile, "    \"packets\": %"_64BITARG_"u,\n", inTotals->fPacketsReceived);
+    qtss_fprintf(inFile, "    \"packets_per_sec\": %.1f,\n", (Float64)(SInt64)inTotals->fPacketsReceived / inSeconds);
+    qtss_fprintf(inFile, "    \"kbps\": %.1f,\n", ((Float64)(SInt64)inTotals->fBytesReceived * 8) / (inSeconds * 1000));
+    qtss_fprintf(inFile, "    \"unmatched_packets\": %"_64BITARG_"u,\n", inTotals->fUnmatchedPackets);
+    qtss_fprintf(inFile, "    \"latency_usec\": ");
+    WriteLatency(inFile, &inTotals->fLatency);
+    qtss_fprintf(inFile, "\n  }");
+}
+
+void PrintUsage()
+{
+    qtss_printf("usage: ReflectorBenchmark [-p port] [-f file.264] [-o results.json] [-c channels] [-b first uuid]\n");
+    qtss_printf("                          [-r frames/sec] [-u udp viewers] [-t tcp viewers] [-s viewer starts/sec]\n");
+    qtss_printf("                          [-w warmup sec] [-d duration sec] [-m max packet size]\n");
+    qtss_printf("  -p: RTSP port to run the server on (default 8554)\n");
+    qtss_printf("  -f: Annex B H.264 file fed to every channel, looped (default test.264)\n");
+    qtss_printf("  -o: where the JSON results go (default ReflectorBenchmark.json)\n");
+    qtss_printf("  -c: number of channels, uuids -b (default 1) and up (default 1)\n");
+    qtss_printf("  -r: frames/sec fed to each channel (default 25)\n");
+    qtss_printf("  -u, -t: viewers over UDP (default 100) and interleaved TCP (default 0), spread over the channels\n");
+    qtss_printf("  -s: how fast viewers are started (default 200/sec)\n");
+    qtss_printf("  -w: seconds to let things settle once viewers are playing (default 5)\n");
+    qtss_printf("  -d: seconds to measure for (default 30)\n");
+    qtss_printf("  -m: largest RTP payload the server cuts frames into (default 1400)\n");
+}
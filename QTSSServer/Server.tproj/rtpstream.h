@@ -51,7 +51,12 @@
 #include "RTPSessionInterface.h"
 
 #include "RTPPacketResender.h"
+#include "RTPRateController.h"
 #include "QTSServerInterface.h"
+#include "OSQueue.h"
+#include "OSMutex.h"
+
+class RTCPPacketView;
 
 class RTPStream : public QTSSDictionary, public UDPDemuxerTask
 {
@@ -70,8 +75,8 @@ class RTPStream : public QTSSDictionary, public UDPDemuxerTask
         //ACCESS FUNCTIONS
         
         UInt32      GetSSRC()                   { return fSsrc; }
-        UInt8       GetRTPChannelNum()          { return fRTPChannel; }
-        UInt8       GetRTCPChannelNum()         { return fRTCPChannel; }
+        UInt8       GetRTPChannelNum()          { return (UInt8)fRTPChannel; }
+        UInt8       GetRTCPChannelNum()         { return (UInt8)fRTCPChannel; }
         RTPPacketResender* GetResender()        { return &fResender; }
         QTSS_RTPTransportType GetTransportType() { return fTransportType; }
         UInt32      GetStalePacketsDropped()    { return fStalePacketsDropped; }
@@ -109,8 +114,13 @@ class RTPStream : public QTSSDictionary, public UDPDemuxerTask
         void ProcessIncomingInterleavedData(UInt8 inChannelNum, RTSPSessionInterface* inRTSPSession, StrPtrLen* inPacket);
 
         //When we get a new RTCP packet, we can directly invoke the RTP session and tell it
-        //to process the packet right now!
+        //to process the packet right now! If the session mutex is busy, the packet is
+        //queued instead, and processed by whoever next holds the session mutex.
         void ProcessIncomingRTCPPacket(StrPtrLen* inPacket);
+        
+        //Processes RTCP packets queued by ProcessIncomingRTCPPacket. Caller must hold
+        //the session mutex.
+        void ProcessDeferredRTCPPackets();
 
         // Send a RTCP SR on this stream. Pass in true if this SR should also have a BYE
         void SendRTCPSR(const SInt64& inTime, Bool16 inAppendBye = false);
@@ -145,7 +155,30 @@ class RTPStream : public QTSSDictionary, public UDPDemuxerTask
             kDefaultPayloadBufSize      = 32,
             kSenderReportIntervalInSecs = 7,
             kNumPrebuiltChNums          = 10,
+            kMaxDeferredRTCPPackets     = 16,
+        };
+        
+        // An RTCP packet that arrived while the session mutex was held by someone else
+        struct DeferredRTCPPacket
+        {
+            DeferredRTCPPacket(StrPtrLen* inPacket) : fElem(this) { fPacket.Set(inPacket->GetAsCString(), inPacket->Len); }
+            ~DeferredRTCPPacket() { delete [] fPacket.Ptr; }
+            
+            OSQueueElem fElem;
+            StrPtrLen   fPacket;
         };
+        
+        // Does the work of ProcessIncomingRTCPPacket. Caller must hold the session mutex.
+        void ProcessRTCPPacket(StrPtrLen* inPacket);
+        void DeleteDeferredRTCPPackets();
+        
+        // Runs a receiver report through fRateController, then applies the new
+        // target bitrate to the quality level (UDP) or overbuffer window (reliable UDP)
+        void ProcessReceiverReport(RTCPPacketView* inReport, const SInt64& inCurTime);
+        
+        // Sets the session's overbuffer window to what the client asked for, capped
+        // to one second at the target bitrate if rate control is on
+        void UpdateOverbufferWindowSize();
     
         SInt64 fLastQualityChange;
         SInt32 fQualityInterval;
@@ -172,12 +205,21 @@ class RTPStream : public QTSSDictionary, public UDPDemuxerTask
         UInt16      fRemoteRTCPPort;
         UInt16      fLocalRTPPort;
         
+        //if a module is sending this client's media to a multicast group, this is the group
+        UInt32      fMulticastDestAddr;
+        UInt16      fMulticastPort;
+        UInt16      fMulticastTTL;
+        
         //RTCP stuff 
+        OSMutex     fDeferredRTCPMutex; // protects fDeferredRTCPQueue
+        OSQueue     fDeferredRTCPQueue;
         SInt64      fLastSenderReportTime;
         UInt32      fPacketCount;
         UInt32      fLastPacketCount;
         UInt32      fPacketCountInRTCPInterval;
         UInt32      fByteCount;
+        RTPRateController   fRateController;
+        UInt32      fClientOverbufferWindowSize; // 0 until the client tells us
         
         // DICTIONARY ATTRIBUTES
         
@@ -278,9 +320,10 @@ class RTPStream : public QTSSDictionary, public UDPDemuxerTask
 #endif
         
         // If we are interleaving RTP data over the TCP connection,
-        // these are channel numbers to use for RTP & RTCP
-        UInt8   fRTPChannel;
-        UInt8   fRTCPChannel;
+        // these are channel numbers to use for RTP & RTCP. Channels are
+        // only 8 bits, these are wider so they can back qtssRTPStrRTPChannel.
+        UInt16  fRTPChannel;
+        UInt16  fRTCPChannel;
         
         QTSS_RTPNetworkMode     fNetworkMode;
         
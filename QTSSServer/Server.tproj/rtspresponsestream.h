@@ -84,6 +84,9 @@ class RTSPResponseStream : public ResizeableStringFormatter
         // this returns QTSS_NoErr, otherwise, it returns EWOULDBLOCK
         QTSS_Error Flush();
         
+        // How much has been written to this stream but not yet sent
+        UInt32      GetBytesBuffered()  { return this->GetCurrentOffset() - fBytesSentInBuffer; }
+        
         void        ShowRTSP(Bool16 enable) {fPrintRTSP = enable; }     
 
         
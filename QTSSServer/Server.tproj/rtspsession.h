@@ -42,7 +42,7 @@
 #include "RTPSession.h"
 #include "TimeoutTask.h"
 
-class RTSPSession : public RTSPSessionInterface
+class RTSPSession : public RTSPSessionInterface, public RTSPInterleavedDataHandler
 {
     public:
 
@@ -53,6 +53,10 @@ class RTSPSession : public RTSPSessionInterface
         static void Initialize();
 
         Bool16 IsPlaying() {if (fRTPSession == NULL) return false; if (fRTPSession->GetSessionState() == qtssPlayingState) return true; return false; }
+
+        // Media a client pushes over this connection. Each run of packets belonging to
+        // one RTP session goes to that session's qtssCliSesInterleavedDataHandler.
+        virtual void ProcessInterleavedData(UInt8* inChannels, StrPtrLen* inPackets, UInt32 inNumPackets);
         
     private:
 
@@ -86,6 +90,7 @@ class RTSPSession : public RTSPSessionInterface
         StrPtrLen           fLastRTPSessionIDPtr;
 
         RTSPRequest*        fRequest;
+        char*               fRequestStorage;    // fRequest is built here, so a keep-alive connection reuses one allocation
         RTPSession*         fRTPSession;
 
 		RTPSession*         fCurRTPSession;//fym fRTPSessionÿRun󶼱NULLԴԱRTPSessionַ
@@ -160,6 +165,11 @@ class RTSPSession : public RTSPSessionInterface
             kHaveNonTunnelMessage = 14                  // we've looked at the message, and its not an HTTP tunnle message
         };
         
+        enum
+        {
+            kMaxHeldResponseBytes = 4096    //UInt32 responses to pipelined requests wait in the output buffer up to this much
+        };
+        
         UInt32 fCurrentModule;
         UInt32 fState;
 